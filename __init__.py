@@ -59,7 +59,7 @@ def _import_pycsh(package_dir: str = None) -> _ModuleType:
 
     import os
     from _ctypes import PyObj_FromPtr
-    from ctypes import CDLL, RTLD_GLOBAL, c_void_p, cast, POINTER, py_object, PyDLL
+    from ctypes import CDLL, RTLD_GLOBAL, c_void_p, c_int, cast, POINTER, py_object, PyDLL
     from sysconfig import get_config_var
 
     # Get the suffix for the shared object file (e.g., .cpython-310-x86_64-linux-gnu.so)
@@ -88,6 +88,13 @@ def _import_pycsh(package_dir: str = None) -> _ModuleType:
 
     # Cast the returned integer to a Python object (Python module to be exact)
     pycsh_module: _ModuleType = PyObj_FromPtr(pycsh_module_ptr)
+
+    # Add the sniffer/telemetry functions implemented in this repository (src/python_sniffer.c)
+    pycsh.pycsh_sniffer_add_methods.argtypes = [py_object]
+    pycsh.pycsh_sniffer_add_methods.restype = c_int
+    if pycsh.pycsh_sniffer_add_methods(pycsh_module) != 0:
+        raise ImportError("Failed to add sniffer methods to pycsh")
+
     return pycsh_module
 
 
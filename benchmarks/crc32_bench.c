@@ -0,0 +1,192 @@
+/*
+ * crc32_bench.c
+ *
+ * Checks that sniffer_crc32c() matches the software CRC32C bit for bit, then times it
+ * against the slice-by-8 fallback and csp_crc32_memory().
+ *
+ * Run with `meson test` for the check only, `meson test --benchmark` for both, or directly:
+ *   crc32_bench [-c] [-n buffers] [-b buffer size]
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <csp/csp.h>
+#include <csp/csp_crc32.h>
+
+#include "sniffer_crc32.h"
+
+#define CHECK_MAX_LEN 4096
+#define CHECK_ROUNDS  20000
+
+typedef uint32_t (*bench_crc_fn)(const void * data, size_t len);
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t bench_rand(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Bitwise CRC32C, the definition the table and hardware versions must agree with */
+static uint32_t crc32c_bitwise(const void * data, size_t len) {
+    const uint8_t * p = data;
+    uint32_t crc = 0xFFFFFFFF;
+    while (len--) {
+        crc ^= *p++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+        }
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+static uint32_t bench_csp_crc32(const void * data, size_t len) {
+    return csp_crc32_memory(data, len);
+}
+
+static int check_value(const char * what, size_t offset, size_t len, uint32_t got, uint32_t expected) {
+    if (got != expected) {
+        fprintf(stderr, "%s mismatch at offset %zu, length %zu: 0x%08" PRIx32 " != 0x%08" PRIx32 "\n",
+                what, offset, len, got, expected);
+        return -1;
+    }
+    return 0;
+}
+
+/* Every length and alignment around the 8 byte stride, then random ones */
+static int check_equivalence(void) {
+
+    uint8_t * buf = malloc(CHECK_MAX_LEN + 16);
+    if (buf == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < CHECK_MAX_LEN + 16; i++) {
+        buf[i] = bench_rand();
+    }
+
+    /* Standard check value of CRC32C */
+    int err = check_value("check value", 0, 9, sniffer_crc32c("123456789", 9), 0xE3069283);
+
+    for (unsigned int round = 0; round < CHECK_ROUNDS + 16 * 64 && err == 0; round++) {
+        size_t offset, len;
+        if (round < 16 * 64) {
+            offset = round / 64;
+            len = round % 64;
+        } else {
+            offset = bench_rand() % 16;
+            len = bench_rand() % (CHECK_MAX_LEN + 1);
+        }
+        const uint8_t * p = buf + offset;
+        uint32_t expected = crc32c_bitwise(p, len);
+        err |= check_value(sniffer_crc32c_impl(), offset, len, sniffer_crc32c(p, len), expected);
+        err |= check_value("slice-by-8", offset, len, sniffer_crc32c_sw(p, len), expected);
+        err |= check_value("csp_crc32_memory", offset, len, csp_crc32_memory(p, len), expected);
+    }
+
+    /* Verification of packets, including a flipped bit in the data or the CRC */
+    csp_packet_t packet;
+    for (unsigned int round = 0; round < 1000 && err == 0; round++) {
+        size_t len = bench_rand() % (sizeof(packet.data) - 4 + 1);
+        for (size_t i = 0; i < len; i++) {
+            packet.data[i] = bench_rand();
+        }
+        packet.length = len;
+        csp_crc32_append(&packet);
+        size_t flip = (round % 2) ? bench_rand() % packet.length : packet.length;
+        if (flip < packet.length) {
+            packet.data[flip] ^= 1 << (bench_rand() % 8);
+        }
+
+        csp_packet_t copy = packet;
+        int expected = csp_crc32_verify(&copy) == 0 ? 0 : -1;
+        int got = sniffer_crc32_verify(&packet);
+        if (got != expected || (got == 0 && packet.length != copy.length)) {
+            fprintf(stderr, "Packet verification mismatch at length %zu, flipped byte %zu: %d != %d\n", len, flip, got, expected);
+            err = -1;
+        }
+    }
+
+    free(buf);
+    return err;
+}
+
+static void bench_crc(const char * name, bench_crc_fn fn, const uint8_t * buf, size_t size, unsigned int n) {
+
+    /* The result is folded into a volatile so the calls cannot be dropped */
+    volatile uint32_t sink = 0;
+    uint64_t start = bench_now_ns();
+    for (unsigned int i = 0; i < n; i++) {
+        sink ^= fn(buf, size);
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    (void) sink;
+
+    printf("%-18s %10zu %12.1f %12.1f\n", name, size,
+           (double) elapsed / n, (double) size * n * 1000.0 / (elapsed ? elapsed : 1));
+}
+
+int main(int argc, char * argv[]) {
+
+    unsigned int n = 1000000;
+    size_t size = 2048;
+    int check_only = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "cn:b:")) != -1) {
+        switch (opt) {
+            case 'c':
+                check_only = 1;
+                break;
+            case 'n':
+                n = strtoul(optarg, NULL, 0);
+                break;
+            case 'b':
+                size = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-c] [-n buffers] [-b buffer size]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (n == 0) {
+        n = 1;
+    }
+
+    if (check_equivalence() < 0) {
+        return EXIT_FAILURE;
+    }
+    printf("CRC32C implementation %s matches the software CRC\n", sniffer_crc32c_impl());
+    if (check_only) {
+        return EXIT_SUCCESS;
+    }
+
+    uint8_t * buf = malloc(size ? size : 1);
+    if (buf == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < size; i++) {
+        buf[i] = bench_rand();
+    }
+
+    printf("%-18s %10s %12s %12s\n", "crc32c", "bytes", "ns/buffer", "MB/s");
+    bench_crc(sniffer_crc32c_impl(), sniffer_crc32c, buf, size, n);
+    bench_crc("slice-by-8", sniffer_crc32c_sw, buf, size, n);
+    bench_crc("csp_crc32_memory", bench_csp_crc32, buf, size, n);
+
+    free(buf);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,432 @@
+/*
+ * sniffer_bench.c
+ *
+ * Throughput and latency benchmark of the sniffer ingest path, on synthetic traffic.
+ * Needs no CSP interface, decoded lines are collected with vm_ingest_start() and discarded.
+ *
+ * Run with `meson test --benchmark`, or directly:
+ *   sniffer_bench [-n packets per stage] [-l log file] [-s store file]
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <csp/csp.h>
+#include <mpack/mpack.h>
+#include <param/param.h>
+#include <param/param_list.h>
+#include <param/param_queue.h>
+#include <param/param_server.h>
+
+#include "param_sniffer.h"
+#include "hk_param_sniffer.h"
+#include "victoria_metrics.h"
+#include "sniffer_log.h"
+#include "sniffer_store.h"
+
+#define BENCH_NODE       100
+#define BENCH_HK_NODE    101
+#define BENCH_ARRAY_SIZE 8
+#define BENCH_MTU        200  // Payload of a typical pull response / HK packet
+#define BENCH_PACKETS    256  // Distinct packets generated per traffic class
+#define BENCH_HK_HEADER  5
+
+static const param_type_e bench_types[] = {
+    PARAM_TYPE_UINT8, PARAM_TYPE_UINT16, PARAM_TYPE_UINT32, PARAM_TYPE_UINT64,
+    PARAM_TYPE_INT8, PARAM_TYPE_INT16, PARAM_TYPE_INT32, PARAM_TYPE_INT64,
+    PARAM_TYPE_XINT8, PARAM_TYPE_XINT16, PARAM_TYPE_XINT32, PARAM_TYPE_XINT64,
+    PARAM_TYPE_FLOAT, PARAM_TYPE_DOUBLE, PARAM_TYPE_STRING, PARAM_TYPE_DATA,
+};
+#define BENCH_TYPES (sizeof(bench_types) / sizeof(bench_types[0]))
+
+/* Per node: a scalar and an array of every type. String and data params only have their length as array size */
+#define BENCH_PARAMS (2 * BENCH_TYPES)
+static param_t * params[2][BENCH_PARAMS];
+
+typedef struct {
+    const char * name;
+    csp_packet_t * packets;
+    unsigned int * samples;  // Numeric elements in each packet
+    unsigned int count;
+} bench_traffic_t;
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t bench_rand(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int bench_is_numeric(const param_t * param) {
+    return param->type != PARAM_TYPE_STRING && param->type != PARAM_TYPE_DATA;
+}
+
+static void bench_params_create(int slot, int node) {
+
+    for (unsigned int i = 0; i < BENCH_PARAMS; i++) {
+        param_type_e type = bench_types[i % BENCH_TYPES];
+        int array = (i >= BENCH_TYPES);
+        int array_size = 1;
+        if (type == PARAM_TYPE_STRING || type == PARAM_TYPE_DATA) {
+            array_size = 16;
+        } else if (array) {
+            array_size = BENCH_ARRAY_SIZE;
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "bench_%u%s", (unsigned int) type, array ? "_arr" : "");
+        param_t * param = param_list_create_remote(1000 + i, node, type, PM_TELEM, array_size, name, NULL, NULL, -1);
+        if (param == NULL || param_list_add(param) < 0) {
+            fprintf(stderr, "Failed to create param %s\n", name);
+            exit(EXIT_FAILURE);
+        }
+        params[slot][i] = param;
+    }
+}
+
+/* Give every element of param a new random value */
+static void bench_param_randomize(param_t * param) {
+
+    if (param->type == PARAM_TYPE_STRING) {
+        char str[16];
+        snprintf(str, sizeof(str), "bench%u", (unsigned int) (bench_rand() % 100000));
+        param_set(param, 0, str);
+        return;
+    }
+    if (param->type == PARAM_TYPE_DATA) {
+        uint8_t data[16];
+        for (unsigned int i = 0; i < sizeof(data); i++) {
+            data[i] = bench_rand();
+        }
+        param_set(param, 0, data);
+        return;
+    }
+
+    for (int i = 0; i < param->array_size; i++) {
+        uint64_t r = bench_rand();
+        union {
+            uint8_t u8; uint16_t u16; uint32_t u32; uint64_t u64;
+            int8_t i8; int16_t i16; int32_t i32; int64_t i64;
+            float f; double d;
+        } value;
+        switch (param->type) {
+            case PARAM_TYPE_UINT8: case PARAM_TYPE_XINT8: value.u8 = r; break;
+            case PARAM_TYPE_UINT16: case PARAM_TYPE_XINT16: value.u16 = r; break;
+            case PARAM_TYPE_UINT32: case PARAM_TYPE_XINT32: value.u32 = r; break;
+            case PARAM_TYPE_UINT64: case PARAM_TYPE_XINT64: value.u64 = r; break;
+            case PARAM_TYPE_INT8: value.i8 = r; break;
+            case PARAM_TYPE_INT16: value.i16 = r; break;
+            case PARAM_TYPE_INT32: value.i32 = r; break;
+            case PARAM_TYPE_INT64: value.i64 = r; break;
+            case PARAM_TYPE_FLOAT: value.f = (float) ((int64_t) r % 2000000) / 1000.0f; break;
+            case PARAM_TYPE_DOUBLE: value.d = (double) (int64_t) r / 3.0e12; break;
+            default: return;
+        }
+        param_set(param, i, &value);
+    }
+}
+
+/**
+ * Fill traffic with packets in the format of a pull response (version 1 or 2), or a HK packet if hk is set.
+ * timestamp_base 0 leaves params without timestamps, HK packets always carry one.
+ */
+static void bench_traffic_build(bench_traffic_t * traffic, const char * name, int version, int hk, uint32_t timestamp_base) {
+
+    traffic->name = name;
+    traffic->count = BENCH_PACKETS;
+    traffic->packets = calloc(BENCH_PACKETS, sizeof(csp_packet_t));
+    traffic->samples = calloc(BENCH_PACKETS, sizeof(unsigned int));
+    if (traffic->packets == NULL || traffic->samples == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int slot = hk ? 1 : 0;
+    int node = hk ? BENCH_HK_NODE : BENCH_NODE;
+    size_t header = hk ? BENCH_HK_HEADER : 2;
+    unsigned int next = 0;
+
+    for (unsigned int p = 0; p < BENCH_PACKETS; p++) {
+        csp_packet_t * packet = &traffic->packets[p];
+
+        param_queue_t queue;
+        param_queue_init(&queue, &packet->data[header], BENCH_MTU - header, 0, PARAM_QUEUE_TYPE_SET, version);
+        queue.last_node = node;
+
+        /* Add params round robin until the packet is full */
+        while (1) {
+            param_t * param = params[slot][next % BENCH_PARAMS];
+            bench_param_randomize(param);
+            if (timestamp_base) {
+                param->timestamp->tv_sec = timestamp_base + p;
+                param->timestamp->tv_nsec = (next % 1000) * 1000000;
+            } else {
+                param->timestamp->tv_sec = 0;
+                param->timestamp->tv_nsec = 0;
+            }
+            if (param_queue_add(&queue, param, -1, NULL) < 0) {
+                break;
+            }
+            if (bench_is_numeric(param)) {
+                traffic->samples[p] += param->array_size;
+            }
+            next++;
+        }
+
+        if (hk) {
+            memset(packet->data, 0, BENCH_HK_HEADER);
+            packet->id.sport = 13;
+        } else {
+            packet->data[0] = (version == 1) ? PARAM_PULL_RESPONSE : PARAM_PULL_RESPONSE_V2;
+            packet->data[1] = 0;
+            packet->id.sport = PARAM_PORT_SERVER;
+        }
+        packet->id.src = node;
+        packet->id.dst = 1;
+        packet->id.dport = 20;
+        packet->length = header + queue.used;
+    }
+}
+
+static int bench_cmp_u64(const void * a, const void * b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static void bench_header(void) {
+    printf("%-14s %12s %12s %9s %9s %8s %8s %8s %8s %8s\n",
+           "stage", "packets/s", "samples/s", "in MB/s", "out MB/s", "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "max ns");
+}
+
+/* Latency at per_mille of the sorted samples, indexed in 64 bits so large n does not overflow */
+static uint64_t bench_percentile(const uint64_t * sorted, unsigned int n, unsigned int per_mille) {
+    return sorted[(uint64_t) n * per_mille / 1000];
+}
+
+static void bench_report(const char * name, unsigned int n, uint64_t elapsed_ns, uint64_t samples,
+                         uint64_t in_bytes, uint64_t out_bytes, uint64_t * latency) {
+
+    qsort(latency, n, sizeof(uint64_t), bench_cmp_u64);
+    double seconds = elapsed_ns / 1e9;
+    printf("%-14s %12.0f %12.0f %9.2f %9.2f %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 "\n",
+           name, n / seconds, samples / seconds, in_bytes / seconds / 1e6, out_bytes / seconds / 1e6,
+           bench_percentile(latency, n, 500), bench_percentile(latency, n, 900), bench_percentile(latency, n, 990),
+           bench_percentile(latency, n, 999), latency[n - 1]);
+}
+
+/* Drive whole packets through the same decode path as the sniffer workers */
+static void bench_packets(const bench_traffic_t * traffic, unsigned int n, uint64_t * latency) {
+
+    uint64_t samples = 0, in_bytes = 0, out_bytes = 0;
+    vm_ingest_drain();
+
+    uint64_t start = bench_now_ns();
+    for (unsigned int i = 0; i < n; i++) {
+        unsigned int p = i % traffic->count;
+        csp_packet_t * packet = &traffic->packets[p];
+
+        uint64_t t0 = bench_now_ns();
+        param_sniffer_process(packet, NULL);
+        latency[i] = bench_now_ns() - t0;
+
+        samples += traffic->samples[p];
+        in_bytes += packet->length;
+        if (p == traffic->count - 1) {
+            out_bytes += vm_ingest_drain();
+        }
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    out_bytes += vm_ingest_drain();
+
+    bench_report(traffic->name, n, elapsed, samples, in_bytes, out_bytes, latency);
+}
+
+/* Drive param_sniffer_log() directly, with a single array param per call */
+static void bench_log(unsigned int n, uint64_t * latency) {
+
+    /* Pre-encode one array of every numeric type */
+    char encoded[BENCH_TYPES][BENCH_ARRAY_SIZE * 9 + 8];
+    size_t encoded_len[BENCH_TYPES];
+    param_t * encoded_param[BENCH_TYPES];
+    unsigned int encoded_count = 0;
+
+    for (unsigned int t = 0; t < BENCH_TYPES; t++) {
+        param_t * param = params[0][BENCH_TYPES + t];
+        if (!bench_is_numeric(param)) {
+            continue;
+        }
+        mpack_writer_t writer;
+        mpack_writer_init(&writer, encoded[encoded_count], sizeof(encoded[0]));
+        mpack_start_array(&writer, BENCH_ARRAY_SIZE);
+        for (int i = 0; i < BENCH_ARRAY_SIZE; i++) {
+            uint64_t r = bench_rand();
+            switch (param->type) {
+                case PARAM_TYPE_FLOAT: mpack_write_float(&writer, (float) (r % 2000000) / 1000.0f); break;
+                case PARAM_TYPE_DOUBLE: mpack_write_double(&writer, (double) (int64_t) r / 3.0e12); break;
+                case PARAM_TYPE_INT8: mpack_write_int(&writer, (int8_t) r); break;
+                case PARAM_TYPE_INT16: mpack_write_int(&writer, (int16_t) r); break;
+                case PARAM_TYPE_INT32: mpack_write_int(&writer, (int32_t) r); break;
+                case PARAM_TYPE_INT64: mpack_write_int(&writer, (int64_t) r); break;
+                case PARAM_TYPE_UINT8: case PARAM_TYPE_XINT8: mpack_write_uint(&writer, (uint8_t) r); break;
+                case PARAM_TYPE_UINT16: case PARAM_TYPE_XINT16: mpack_write_uint(&writer, (uint16_t) r); break;
+                case PARAM_TYPE_UINT32: case PARAM_TYPE_XINT32: mpack_write_uint(&writer, (uint32_t) r); break;
+                default: mpack_write_uint(&writer, r); break;
+            }
+        }
+        mpack_finish_array(&writer);
+        encoded_len[encoded_count] = mpack_writer_buffer_used(&writer);
+        if (mpack_writer_destroy(&writer) != mpack_ok) {
+            continue;
+        }
+        encoded_param[encoded_count++] = param;
+    }
+
+    param_queue_t queue;
+    param_queue_init(&queue, NULL, 0, 0, PARAM_QUEUE_TYPE_SET, 2);
+    csp_timestamp_t timestamp = { .tv_sec = time(NULL), .tv_nsec = 0 };
+    uint64_t samples = 0, in_bytes = 0, out_bytes = 0;
+    vm_ingest_drain();
+
+    uint64_t start = bench_now_ns();
+    for (unsigned int i = 0; i < n; i++) {
+        unsigned int e = i % encoded_count;
+        mpack_reader_t reader;
+        mpack_reader_init_data(&reader, encoded[e], encoded_len[e]);
+
+        uint64_t t0 = bench_now_ns();
+        param_sniffer_log(NULL, &queue, encoded_param[e], -1, &reader, &timestamp);
+        latency[i] = bench_now_ns() - t0;
+
+        samples += BENCH_ARRAY_SIZE;
+        in_bytes += encoded_len[e];
+        if ((i & 1023) == 1023) {
+            out_bytes += vm_ingest_drain();
+        }
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    out_bytes += vm_ingest_drain();
+
+    bench_report("param_log", n, elapsed, samples, in_bytes, out_bytes, latency);
+}
+
+/* Drive vm_add() directly with a typical rendered line */
+static void bench_vm_add(unsigned int n, uint64_t * latency) {
+
+    char line[128];
+    snprintf(line, sizeof(line), "bench_13_arr{node=\"%u\", idx=\"3\"} 1.234567890123e+02 %" PRIu64 "\n", BENCH_NODE, (uint64_t) time(NULL) * 1000);
+    size_t len = strlen(line);
+    uint64_t out_bytes = 0;
+    vm_ingest_drain();
+
+    uint64_t start = bench_now_ns();
+    for (unsigned int i = 0; i < n; i++) {
+        uint64_t t0 = bench_now_ns();
+        vm_add(line);
+        latency[i] = bench_now_ns() - t0;
+
+        if ((i & 4095) == 4095) {
+            out_bytes += vm_ingest_drain();
+        }
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    out_bytes += vm_ingest_drain();
+
+    bench_report("vm_add", n, elapsed, n, (uint64_t) n * len, out_bytes, latency);
+}
+
+int main(int argc, char * argv[]) {
+
+    unsigned int n = 200000;
+    const char * log_path = NULL;
+    const char * store_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:l:s:")) != -1) {
+        switch (opt) {
+            case 'n':
+                n = strtoul(optarg, NULL, 0);
+                break;
+            case 'l':
+                log_path = optarg;
+                break;
+            case 's':
+                store_path = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n packets per stage] [-l log file] [-s store file]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (n == 0) {
+        n = 1;
+    }
+
+    /* Also include these outputs in the measurements */
+    if (log_path && sniffer_log_open(log_path) < 0) {
+        fprintf(stderr, "Failed to open log %s\n", log_path);
+        return EXIT_FAILURE;
+    }
+    if (store_path && sniffer_store_open(store_path) < 0) {
+        fprintf(stderr, "Failed to open store %s\n", store_path);
+        return EXIT_FAILURE;
+    }
+
+    if (vm_ingest_start() < 0) {
+        fprintf(stderr, "Failed to allocate VictoriaMetrics buffers\n");
+        return EXIT_FAILURE;
+    }
+
+    bench_params_create(0, BENCH_NODE);
+    bench_params_create(1, BENCH_HK_NODE);
+
+    /* HK timestamps below Jan 1st 2020 are relative to the epoch of the HK node */
+    uint32_t now = time(NULL);
+    hk_set_epoch(now - 86400, BENCH_HK_NODE, false);
+
+    bench_traffic_t traffic[5];
+    bench_traffic_build(&traffic[0], "pull_v1", 1, 0, 0);
+    bench_traffic_build(&traffic[1], "pull_v2", 2, 0, 0);
+    bench_traffic_build(&traffic[2], "pull_v2_ts", 2, 0, now - 3600);
+    bench_traffic_build(&traffic[3], "hk_utc", 2, 1, now - 3600);
+    bench_traffic_build(&traffic[4], "hk_epoch", 2, 1, 3600);
+
+    uint64_t * latency = malloc(n * sizeof(uint64_t));
+    if (latency == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    bench_header();
+    for (unsigned int i = 0; i < sizeof(traffic) / sizeof(traffic[0]); i++) {
+        bench_packets(&traffic[i], n, latency);
+    }
+    bench_log(n, latency);
+    bench_vm_add(n, latency);
+
+    free(latency);
+    for (unsigned int i = 0; i < sizeof(traffic) / sizeof(traffic[0]); i++) {
+        free(traffic[i].packets);
+        free(traffic[i].samples);
+    }
+    vm_ingest_stop();
+    if (store_path) {
+        sniffer_store_close();
+    }
+    if (log_path) {
+        sniffer_log_flush();
+    }
+
+    return EXIT_SUCCESS;
+}
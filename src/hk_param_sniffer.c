@@ -6,6 +6,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 #include <pthread.h>
 #include <param/param_server.h>
@@ -21,25 +22,101 @@
 
 #include "param_sniffer.h"
 #include "hk_param_sniffer.h"
+#include "sniffer_filter.h"
+#include "sniffer_param_cache.h"
+#include "sniffer_unknown.h"
+#include "sniffer_stats.h"
 
 pthread_t hk_param_sniffer_thread;
-#define MAX_HKS 16
-
-typedef struct local_epoch_s {
-	int count;
-	time_t local_epoch[MAX_HKS];
-	uint16_t node[MAX_HKS];
-} local_epoch_t;
-static local_epoch_t hks = {0};
-
-typedef struct timesync_nodes_s {
-	int count;
-	uint16_t node[MAX_HKS];
-	uint16_t paramid[MAX_HKS];
-} timesync_nodes_t;
-static timesync_nodes_t timesync_nodes = {0};
 
-void hk_set_epoch(time_t epoch, uint16_t node, bool auto_sync) {
+/**
+ * Per node epoch and timesync registry.
+ * Open addressing hash tables, grown when 3/4 full, so any number of HK nodes is supported.
+ * Sniffer workers look up epochs for every HK parameter, while the CLI and timesync parameters update them,
+ * hence a read/write lock.
+ */
+#define HK_TABLE_SIZE_MIN 64
+
+typedef struct {
+	uint32_t key;  // 0 for empty
+	time_t epoch;
+} hk_entry_t;
+
+typedef struct {
+	hk_entry_t * entries;
+	unsigned int size;
+	unsigned int used;
+} hk_table_t;
+
+static hk_table_t hk_epochs = {0};     // key: node + 1
+static hk_table_t hk_timesyncs = {0};  // key: (node << 16 | param id) + 1, parameters carrying the remote time
+static pthread_rwlock_t hks_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static inline uint32_t hk_epoch_key(uint16_t node) {
+	return (uint32_t) node + 1;
+}
+
+static inline uint32_t hk_timesync_key(uint16_t node, uint16_t param_id) {
+	return (((uint32_t) node << 16) | param_id) + 1;
+}
+
+static hk_entry_t * hk_table_find(const hk_table_t * table, uint32_t key) {
+
+	if (table->size == 0) {
+		return NULL;
+	}
+
+	unsigned int slot = (key * 2654435761u) & (table->size - 1);
+	while (table->entries[slot].key != 0) {
+		if (table->entries[slot].key == key) {
+			return &table->entries[slot];
+		}
+		slot = (slot + 1) & (table->size - 1);
+	}
+	return NULL;
+}
+
+/* Returns the entry for key, inserting it with epoch 0 if it is new. NULL if out of memory */
+static hk_entry_t * hk_table_insert(hk_table_t * table, uint32_t key) {
+
+	hk_entry_t * entry = hk_table_find(table, key);
+	if (entry) {
+		return entry;
+	}
+
+	if (table->used + 1 > table->size / 4 * 3) {
+		unsigned int size = table->size ? table->size * 2 : HK_TABLE_SIZE_MIN;
+		hk_entry_t * entries = calloc(size, sizeof(hk_entry_t));
+		if (entries == NULL) {
+			return NULL;
+		}
+		for (unsigned int i = 0; i < table->size; i++) {
+			if (table->entries[i].key == 0) {
+				continue;
+			}
+			unsigned int slot = (table->entries[i].key * 2654435761u) & (size - 1);
+			while (entries[slot].key != 0) {
+				slot = (slot + 1) & (size - 1);
+			}
+			entries[slot] = table->entries[i];
+		}
+		free(table->entries);
+		table->entries = entries;
+		table->size = size;
+	}
+
+	unsigned int slot = (key * 2654435761u) & (table->size - 1);
+	while (table->entries[slot].key != 0) {
+		slot = (slot + 1) & (table->size - 1);
+	}
+	table->entries[slot].key = key;
+	table->entries[slot].epoch = 0;
+	table->used++;
+
+	return &table->entries[slot];
+}
+
+static void hk_set_epoch_locked(time_t epoch, uint16_t node, bool auto_sync) {
 
 	time_t current_epoch;
 	time(&current_epoch);
@@ -53,53 +130,77 @@ void hk_set_epoch(time_t epoch, uint16_t node, bool auto_sync) {
 	}
 
 	/* update existing */
-	for (int i = 0; i < hks.count; i++) {
-		if (hks.node[i] == node) {
-
-			if (auto_sync && hks.local_epoch[i] - epoch > 86400) {
-				char time[32];
-				strftime(time, sizeof(time), "%Y-%m-%d %H:%M:%S", gmtime(&epoch));
-				char time_current[32];
-				strftime(time_current, sizeof(time_current), "%Y-%m-%d %H:%M:%S", gmtime(&hks.local_epoch[i]));
-				printf("HK: Skipping possible invalid EPOCH %s, current EPOCH for HK node %u is %s (%ld)\n", time, node, time_current, hks.local_epoch[i]);
-				return;
-			}
-
-			if (labs(hks.local_epoch[i] - epoch) > 1 || !auto_sync) {
-				/* get unix time to string time */
-				char time[32];
-				strftime(time, sizeof(time), "%Y-%m-%d %H:%M:%S", gmtime(&epoch));
-				printf("HK: Updating HK node %u EPOCH by %ld sec to %s (%ld)\n", node, hks.local_epoch[i] - epoch, time, epoch);
-			}
+	hk_entry_t * entry = hk_table_find(&hk_epochs, hk_epoch_key(node));
+	if (entry) {
 
-			hks.local_epoch[i] = epoch;
+		if (auto_sync && entry->epoch - epoch > 86400) {
+			char time[32];
+			strftime(time, sizeof(time), "%Y-%m-%d %H:%M:%S", gmtime(&epoch));
+			char time_current[32];
+			strftime(time_current, sizeof(time_current), "%Y-%m-%d %H:%M:%S", gmtime(&entry->epoch));
+			printf("HK: Skipping possible invalid EPOCH %s, current EPOCH for HK node %u is %s (%ld)\n", time, node, time_current, entry->epoch);
 			return;
 		}
-	}
 
-	if (hks.count >= MAX_HKS) {
-		printf("HK: Error: Maximum number of HK nodes reached (%d). Cannot set new epoch for node %u\n", MAX_HKS, node);
+		if (labs(entry->epoch - epoch) > 1 || !auto_sync) {
+			/* get unix time to string time */
+			char time[32];
+			strftime(time, sizeof(time), "%Y-%m-%d %H:%M:%S", gmtime(&epoch));
+			printf("HK: Updating HK node %u EPOCH by %ld sec to %s (%ld)\n", node, entry->epoch - epoch, time, epoch);
+		}
+
+		entry->epoch = epoch;
 		return;
 	}
 
-	hks.node[hks.count] = node;
-	hks.local_epoch[hks.count++] = epoch;
+	entry = hk_table_insert(&hk_epochs, hk_epoch_key(node));
+	if (entry == NULL) {
+		printf("HK: Error: Out of memory. Cannot set new epoch for node %u\n", node);
+		return;
+	}
+	entry->epoch = epoch;
 
 	char new_epoch_str[32];
 	strftime(new_epoch_str, sizeof(new_epoch_str), "%Y-%m-%d %H:%M:%S", gmtime(&epoch));
 	printf("HK: Setting new hk node %u EPOCH to %s (%ld)\n", node, new_epoch_str, epoch);
 }
 
+void hk_set_epoch(time_t epoch, uint16_t node, bool auto_sync) {
+	pthread_rwlock_wrlock(&hks_lock);
+	hk_set_epoch_locked(epoch, node, auto_sync);
+	pthread_rwlock_unlock(&hks_lock);
+}
+
 bool hk_get_epoch(time_t * local_epoch, uint16_t node) {
 
-	for (int i = 0; i < hks.count; i++) {
-		if (node == hks.node[i]) {
-			*local_epoch = hks.local_epoch[i];
-			return true;
-		}
+	bool found = false;
+	pthread_rwlock_rdlock(&hks_lock);
+	hk_entry_t * entry = hk_table_find(&hk_epochs, hk_epoch_key(node));
+	if (entry) {
+		*local_epoch = entry->epoch;
+		found = true;
 	}
+	pthread_rwlock_unlock(&hks_lock);
 
-	return false;
+	return found;
+}
+
+int hk_timesync_add(uint16_t node, uint16_t param_id) {
+
+	pthread_rwlock_wrlock(&hks_lock);
+	hk_entry_t * entry = hk_table_insert(&hk_timesyncs, hk_timesync_key(node, param_id));
+	pthread_rwlock_unlock(&hks_lock);
+
+	return entry ? 0 : -1;
+}
+
+static bool hk_is_timesync(uint16_t node, uint16_t param_id) {
+
+	pthread_rwlock_rdlock(&hks_lock);
+	bool found = (hk_table_find(&hk_timesyncs, hk_timesync_key(node, param_id)) != NULL);
+	pthread_rwlock_unlock(&hks_lock);
+
+	return found;
 }
 
 bool hk_param_sniffer(csp_packet_t * packet) {
@@ -129,43 +230,59 @@ bool hk_param_sniffer(csp_packet_t * packet) {
 		if (node == 0) {
 			node = packet->id.src;
 		}
-		const param_t * param = param_list_find_id(node, id);
+		/* Filtered timesync parameters are still decoded for the epoch, just not logged */
+		int wanted = sniffer_filter_param(node, id);
+		if (!wanted && !hk_is_timesync(node, id)) {
+			SNIFFER_STATS_INC(params_filtered);
+			mpack_discard(&reader);
+			continue;
+		}
+		const param_t * param = sniffer_param_find(node, id);
 		if (param) {
-			*param->timestamp = timestamp;
-			if (param->timestamp->tv_sec == 0) {
+			/* Decoded into a local timestamp, param->timestamp is shared with the other workers */
+			if (timestamp.tv_sec == 0) {
 				printf("HK: Param timestamp is missing for %u:%s, logging is aborted\n", *(param->node), param->name);
 				break;
 			}
 
 			/* Only use local epoch if not receiving a UTC timestamp. 1577836800: Jan 1st 2020 */
-			if (param->timestamp->tv_sec < 1577836800) {
+			if (timestamp.tv_sec < 1577836800) {
 				time_t local_epoch = -1;
-				for (int i = 0; i < timesync_nodes.count; i++) {
-					if (timesync_nodes.node[i] == node && timesync_nodes.paramid[i] == param->id) {
-						mpack_tag_t tag = mpack_peek_tag(&reader);
-						local_epoch = tag.v.i - timestamp.tv_sec;
-						hk_set_epoch(local_epoch, packet->id.src, true);
-						break;
-					}
+				if (hk_is_timesync(node, param->id)) {
+					mpack_tag_t tag = mpack_peek_tag(&reader);
+					local_epoch = tag.v.i - timestamp.tv_sec;
+					hk_set_epoch(local_epoch, packet->id.src, true);
 				}
 
 				if (local_epoch == -1 && !hk_get_epoch(&local_epoch, packet->id.src)) {
 					if(!epoch_notfound_warning) {
-						printf("HK: No local epoch found for node %u, skipping %u %u %u\n", packet->id.src, *param->node, param->id, param->timestamp->tv_sec);
+						printf("HK: No local epoch found for node %u, skipping %u %u %u\n", packet->id.src, *param->node, param->id, timestamp.tv_sec);
 						epoch_notfound_warning = true;
 					}
 					mpack_discard(&reader);
 					continue;
 				}
 
-				param->timestamp->tv_sec += local_epoch;
+				timestamp.tv_sec += local_epoch;
+			}
+			if (wanted) {
+				param_sniffer_log(NULL, &queue, param, offset, &reader, &timestamp);
+			} else {
+				SNIFFER_STATS_INC(params_filtered);
+				mpack_discard(&reader);
 			}
-			param_sniffer_log(NULL, &queue, param, offset, &reader, param->timestamp);
 		} else {
-			printf("HK: Found unknown param node %d id %d\n", node, id);
+			unsigned int unreported = sniffer_unknown_seen(node, id);
+			if (unreported) {
+				printf("HK: Found unknown param node %d id %d (%u times)\n", node, id, unreported);
+			}
 			mpack_discard(&reader);
 			continue;
 		}
 	}
+
+	if (mpack_reader_error(&reader) != mpack_ok) {
+		SNIFFER_STATS_INC(decode_errors);
+	}
 	return true;
 }
@@ -13,6 +13,8 @@
 
 bool hk_get_epoch(time_t* epoch, uint16_t node);
 void hk_set_epoch(time_t epoch, uint16_t node, bool auto_sync);
+/* Register a parameter of node whose HK value is the remote UNIX time, used to track the epoch of node automatically */
+int hk_timesync_add(uint16_t node, uint16_t param_id);
 /* returns true if the packet was found to be for housekeeping */
 bool hk_param_sniffer(csp_packet_t * packet);
 
@@ -1,5 +1,6 @@
 /**
- * Naive, slow and simple storage of nodeid and hostname
+ * Storage of nodeid and hostname.
+ * Hosts live in a simple linked list, with hash indices on node and on name for fast lookups.
  */
 
  #include "known_hosts.h"
@@ -8,7 +9,6 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
-#include <limits.h>
 #include <sys/queue.h>
 
 #include <slash/slash.h>
@@ -26,6 +26,199 @@ struct host_s {
 static uint32_t known_host_storage_size = sizeof(host_t);
 SLIST_HEAD(known_host_s, host_s) known_hosts = {};
 
+/**
+ * Open addressing (linear probing) index of host pointers.
+ * The index is kept outside of struct host_s, so known_host_storage_size extensions are unaffected.
+ */
+typedef struct {
+    host_t ** slots;
+    size_t capacity;  // Power of 2, or 0 before first use
+    size_t count;
+    uint32_t (*host_hash)(const host_t * host);
+} host_index_t;
+
+#define HOST_INDEX_MIN_CAPACITY 64
+
+static uint32_t hash_node(int node) {
+    return (uint32_t) node * 0x9E3779B1u;
+}
+
+static uint32_t hash_name(const char * name) {
+    /* FNV-1a over the same characters that strncmp(..., HOSTNAME_MAXLEN) compares */
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < HOSTNAME_MAXLEN && name[i] != '\0'; i++) {
+        hash = (hash ^ (uint8_t) name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t host_hash_node(const host_t * host) {
+    return hash_node(host->node);
+}
+
+static uint32_t host_hash_name(const host_t * host) {
+    return hash_name(host->name);
+}
+
+static host_index_t hosts_by_node = { .host_hash = host_hash_node };
+static host_index_t hosts_by_name = { .host_hash = host_hash_name };
+
+static host_t * host_index_find_node(int node) {
+    if (hosts_by_node.count == 0) {
+        return NULL;
+    }
+    size_t mask = hosts_by_node.capacity - 1;
+    for (size_t i = hash_node(node) & mask; hosts_by_node.slots[i] != NULL; i = (i + 1) & mask) {
+        if (hosts_by_node.slots[i]->node == node) {
+            return hosts_by_node.slots[i];
+        }
+    }
+    return NULL;
+}
+
+static host_t * host_index_find_name(const char * name) {
+    if (hosts_by_name.count == 0) {
+        return NULL;
+    }
+    size_t mask = hosts_by_name.capacity - 1;
+    for (size_t i = hash_name(name) & mask; hosts_by_name.slots[i] != NULL; i = (i + 1) & mask) {
+        if (strncmp(name, hosts_by_name.slots[i]->name, HOSTNAME_MAXLEN) == 0) {
+            return hosts_by_name.slots[i];
+        }
+    }
+    return NULL;
+}
+
+/* Insert without checking for duplicates or capacity */
+static void host_index_insert_unchecked(host_index_t * index, host_t * host) {
+    size_t mask = index->capacity - 1;
+    size_t i = index->host_hash(host) & mask;
+    while (index->slots[i] != NULL) {
+        i = (i + 1) & mask;
+    }
+    index->slots[i] = host;
+    index->count++;
+}
+
+/**
+ * Ensure room for one more entry, keeping the load factor at or below 1/2.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int host_index_reserve(host_index_t * index) {
+
+    if ((index->count + 1) * 2 <= index->capacity) {
+        return 0;
+    }
+
+    size_t new_capacity = index->capacity ? index->capacity * 2 : HOST_INDEX_MIN_CAPACITY;
+    host_t ** new_slots = calloc(new_capacity, sizeof(host_t *));
+    if (new_slots == NULL) {
+        return -1;
+    }
+
+    host_t ** old_slots = index->slots;
+    size_t old_capacity = index->capacity;
+    index->slots = new_slots;
+    index->capacity = new_capacity;
+    index->count = 0;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_slots[i] != NULL) {
+            host_index_insert_unchecked(index, old_slots[i]);
+        }
+    }
+    free(old_slots);
+
+    return 0;
+}
+
+static void host_index_remove(host_index_t * index, const host_t * host) {
+
+    if (index->count == 0) {
+        return;
+    }
+
+    size_t mask = index->capacity - 1;
+    size_t i = index->host_hash(host) & mask;
+    while (index->slots[i] != host) {
+        if (index->slots[i] == NULL) {
+            return;  // Not indexed
+        }
+        i = (i + 1) & mask;
+    }
+    index->slots[i] = NULL;
+    index->count--;
+
+    /* Backward shift deletion: move later entries of the probe sequence into the hole, so lookups need no tombstones */
+    for (size_t j = (i + 1) & mask; index->slots[j] != NULL; j = (j + 1) & mask) {
+        size_t home = index->host_hash(index->slots[j]) & mask;
+        /* Entry at j may move to the hole at i, if its home slot is not cyclically within (i, j] */
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            index->slots[i] = index->slots[j];
+            index->slots[j] = NULL;
+            i = j;
+        }
+    }
+}
+
+/**
+ * Hosts sorted by name, so all names sharing a prefix are adjacent.
+ * Used by host_name_completer(), where the longest common prefix of a range is that of its first and last name.
+ */
+static host_t ** hosts_sorted = NULL;
+static size_t hosts_sorted_count = 0;
+static size_t hosts_sorted_capacity = 0;
+
+/* Index of the first host whose name is not ordered before prefix (compared over prefix_len characters) */
+static size_t hosts_sorted_lower_bound(const char * prefix, size_t prefix_len) {
+    size_t lo = 0, hi = hosts_sorted_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strncmp(hosts_sorted[mid]->name, prefix, prefix_len) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int hosts_sorted_reserve(void) {
+
+    if (hosts_sorted_count < hosts_sorted_capacity) {
+        return 0;
+    }
+
+    size_t new_capacity = hosts_sorted_capacity ? hosts_sorted_capacity * 2 : HOST_INDEX_MIN_CAPACITY;
+    host_t ** tmp = realloc(hosts_sorted, new_capacity * sizeof(host_t *));
+    if (tmp == NULL) {
+        return -1;
+    }
+    hosts_sorted = tmp;
+    hosts_sorted_capacity = new_capacity;
+
+    return 0;
+}
+
+static void hosts_sorted_insert(host_t * host) {
+    size_t pos = hosts_sorted_lower_bound(host->name, HOSTNAME_MAXLEN);
+    memmove(&hosts_sorted[pos + 1], &hosts_sorted[pos], (hosts_sorted_count - pos) * sizeof(host_t *));
+    hosts_sorted[pos] = host;
+    hosts_sorted_count++;
+}
+
+static void hosts_sorted_remove(const host_t * host) {
+    for (size_t pos = hosts_sorted_lower_bound(host->name, HOSTNAME_MAXLEN); pos < hosts_sorted_count; pos++) {
+        if (hosts_sorted[pos] == host) {
+            memmove(&hosts_sorted[pos], &hosts_sorted[pos + 1], (hosts_sorted_count - pos - 1) * sizeof(host_t *));
+            hosts_sorted_count--;
+            return;
+        }
+        if (strncmp(hosts_sorted[pos]->name, host->name, HOSTNAME_MAXLEN) != 0) {
+            return;  // Past all hosts of that name
+        }
+    }
+}
+
 /** Private (CSH-only API) */
 void node_save(const char * filename) {
     FILE * out = stdout;
@@ -62,7 +255,6 @@ uint32_t known_host_get_storage_size() {
 
 
 void host_name_completer(struct slash *slash, char * token) {
-    SLIST_HEAD(known_host_s, host_s) matching_hosts = {};
     char *part_to_complete = token + strnlen(token, slash->length);
     /* Rewind to a potential whitespace */
     while(part_to_complete > token) {
@@ -73,79 +265,74 @@ void host_name_completer(struct slash *slash, char * token) {
         part_to_complete--;
     }
     size_t token_l = strnlen(part_to_complete, HOSTNAME_MAXLEN - 1);
-    int cur_prefix;
-    struct host_s *completion = NULL;
     int len_to_compare_to = strlen(part_to_complete);
-    int matches = 0;
-    int res;
-    for (host_t* element = SLIST_FIRST(&known_hosts); element != NULL; element = SLIST_NEXT(element, next)) {
-        res = strncmp(element->name, part_to_complete, token_l);
-        if (0 == res) {
-            completion = malloc(sizeof(struct host_s));
-            if(completion) {
-                completion->node = element->node;
-                strncpy(completion->name, element->name, HOSTNAME_MAXLEN); 
-                SLIST_INSERT_HEAD(&matching_hosts, completion, next);
-                matches++;
-            }
-        }
-    }
-    if(matches > 1) {
-        /* We only print all commands over 1 match here */
-        slash_printf(slash, "\n");
-    }
-    struct host_s *prev_completion = NULL;
-    struct host_s *cur_completion = NULL;
-    int prefix_len = INT_MAX;
-
-    SLIST_FOREACH(cur_completion, &matching_hosts, next) {
-        /* Compute the length of prefix common to all completions */
-        if (prev_completion != 0) {
-            cur_prefix = slash_prefix_length(prev_completion->name, cur_completion->name);
-            if(cur_prefix < prefix_len) {
-                prefix_len = cur_prefix;
-                completion = cur_completion;
-            }
-        }
-        prev_completion = cur_completion;
-        if(matches > 1) {
-            slash_printf(slash, cur_completion->name);
-            slash_printf(slash, "\n");
-        }
+
+    /* Matching hosts are the contiguous range [first, end) of the sorted index */
+    size_t first = hosts_sorted_lower_bound(part_to_complete, token_l);
+    size_t end = first;
+    while (end < hosts_sorted_count && strncmp(hosts_sorted[end]->name, part_to_complete, token_l) == 0) {
+        end++;
     }
+    size_t matches = end - first;
+
     if (matches == 1) {
         *part_to_complete = '\0';
-        strcat(slash->buffer, completion->name);
+        strcat(slash->buffer, hosts_sorted[first]->name);
         slash->cursor = slash->length = strlen(slash->buffer);
     } else if(matches > 1) {
+        /* We only print all commands over 1 match here */
+        slash_printf(slash, "\n");
+        for (size_t i = first; i < end; i++) {
+            slash_printf(slash, hosts_sorted[i]->name);
+            slash_printf(slash, "\n");
+        }
+
+        /* In sorted order, the prefix common to all completions is the one common to the first and last */
+        const char * completion = hosts_sorted[first]->name;
+        int prefix_len = slash_prefix_length(completion, hosts_sorted[end - 1]->name);
+
         /* Fill the buffer with as much characters as possible:
         * if what the user typed in doesn't end with a space, we might
         * as well put all the common prefix in the buffer
         */
         if(slash->buffer[slash->length-1] != ' ' && len_to_compare_to < prefix_len) {
-            strncpy(&slash->buffer[slash->length] - len_to_compare_to, completion->name, prefix_len);
+            strncpy(&slash->buffer[slash->length] - len_to_compare_to, completion, prefix_len);
             slash->buffer[slash->length - len_to_compare_to + prefix_len] = '\0';
             slash->cursor = slash->length = strlen(slash->buffer);
         }
     }
-    /* Free up the completion list we built up earlier */
-    while (!SLIST_EMPTY(&matching_hosts))
-    {
-        completion = SLIST_FIRST(&matching_hosts);
-        SLIST_REMOVE(&matching_hosts, completion, host_s, next);
-        free(completion);
-    }
-
 }
 
 void known_hosts_del(int host) {
 
+    host_t * indexed = host_index_find_node(host);
+    if (indexed == NULL) {
+        return;  // Node is not in the list, so don't bother walking it
+    }
+
+    host_index_remove(&hosts_by_node, indexed);
+
+    bool name_removed = false;
     // SLIST_FOREACH(host_t host, &known_hosts, next) {
     for (host_t* element = SLIST_FIRST(&known_hosts); element != NULL; element = SLIST_NEXT(element, next)) {
         if (element->node == host) {
+            if (host_index_find_name(element->name) == element) {
+                host_index_remove(&hosts_by_name, element);
+                name_removed = true;
+            }
+            hosts_sorted_remove(element);
             SLIST_REMOVE(&known_hosts, element, host_s, next);  // Probably not the best time-complexity here, O(n)*2 perhaps?
         }
     }
+
+    if (name_removed) {
+        /* Another host may share the removed name, in which case the most recently added one should now be found by name */
+        for (host_t* element = SLIST_FIRST(&known_hosts); element != NULL; element = SLIST_NEXT(element, next)) {
+            if (host_index_find_name(element->name) == NULL && host_index_reserve(&hosts_by_name) == 0) {
+                host_index_insert_unchecked(&hosts_by_name, element);
+            }
+        }
+    }
 }
 
 host_t * known_hosts_add(int addr, const char * new_name, bool override_existing) {
@@ -157,15 +344,18 @@ host_t * known_hosts_add(int addr, const char * new_name, bool override_existing
     if (override_existing) {
         known_hosts_del(addr);  // Ensure 'addr' is not in the list
     } else {
-        
-        for (host_t* host = SLIST_FIRST(&known_hosts); host != NULL; host = SLIST_NEXT(host, next)) {
-            if (host->node == addr) {
-                return host;  // This node is already in the linked list, and we are not allowed to override it.
-            }
+        host_t * host = host_index_find_node(addr);
+        if (host != NULL) {
+            return host;  // This node is already in the linked list, and we are not allowed to override it.
         }
         // This node was not found in the list. Let's add it now.
     }
 
+    /* Make room in the indices first, so a host is never in the list without being indexed */
+    if (host_index_reserve(&hosts_by_node) < 0 || host_index_reserve(&hosts_by_name) < 0 || hosts_sorted_reserve() < 0) {
+        return NULL;  // No more memory
+    }
+
     // TODO Kevin: Do we want to break the API, and let the caller supply "host"?
     host_t * host = calloc(1, known_host_storage_size);
     if (host == NULL) {
@@ -173,20 +363,26 @@ host_t * known_hosts_add(int addr, const char * new_name, bool override_existing
     }
     host->node = addr;
     strncpy(host->name, new_name, HOSTNAME_MAXLEN-1);  // -1 to fit NULL byte
-    char address_str[64];
-    snprintf(address_str, sizeof(address_str) - 1, "%d", host->node);
     SLIST_INSERT_HEAD(&known_hosts, host, next);
 
+    host_index_insert_unchecked(&hosts_by_node, host);
+    /* Lookup by name finds the most recently added host, like the list walk did */
+    host_t * same_name = host_index_find_name(host->name);
+    if (same_name != NULL) {
+        host_index_remove(&hosts_by_name, same_name);
+    }
+    host_index_insert_unchecked(&hosts_by_name, host);
+    hosts_sorted_insert(host);
+
     return host;
 }
 
 int known_hosts_get_name(int find_host, char * name, int buflen) {
 
-    for (host_t* host = SLIST_FIRST(&known_hosts); host != NULL; host = SLIST_NEXT(host, next)) {
-        if (host->node == find_host) {
-            strncpy(name, host->name, buflen);
-            return 1;
-        }
+    host_t * host = host_index_find_node(find_host);
+    if (host != NULL) {
+        strncpy(name, host->name, buflen);
+        return 1;
     }
 
     return 0;
@@ -199,10 +395,9 @@ int known_hosts_get_node(const char * find_name) {
     if (find_name == NULL)
         return -1;
 
-    for (host_t* host = SLIST_FIRST(&known_hosts); host != NULL; host = SLIST_NEXT(host, next)) {
-        if (strncmp(find_name, host->name, HOSTNAME_MAXLEN) == 0) {
-            return host->node;
-        }
+    host_t * host = host_index_find_name(find_name);
+    if (host != NULL) {
+        return host->node;
     }
 
     return -1;
@@ -0,0 +1,201 @@
+/*
+ * metric_format.c
+ *
+ * Hand-rolled number formatting, which avoids the locale and format string parsing of sprintf().
+ */
+
+#include "metric_format.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const uint64_t pow10_u64[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+    1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+    1000000000000000000ULL, 10000000000000000000ULL,
+};
+
+/* Powers of ten that are exactly representable as double */
+static const double pow10_exact[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/* Write exactly ndigits digits of value, zero padded */
+static void format_digits(char * out, uint64_t value, int ndigits) {
+    char * p = out + ndigits;
+    while (p - out >= 2) {
+        p -= 2;
+        memcpy(p, &digit_pairs[(value % 100) * 2], 2);
+        value /= 100;
+    }
+    if (p > out) {
+        *--p = '0' + value % 10;
+    }
+}
+
+static int count_digits(uint64_t value) {
+    int n = 1;
+    while (n < 20 && value >= pow10_u64[n]) {
+        n++;
+    }
+    return n;
+}
+
+char * metric_format_u64(char * out, uint64_t value) {
+    int n = count_digits(value);
+    char * p = out + n;
+    while (value >= 100) {
+        p -= 2;
+        memcpy(p, &digit_pairs[(value % 100) * 2], 2);
+        value /= 100;
+    }
+    if (value >= 10) {
+        p -= 2;
+        memcpy(p, &digit_pairs[value * 2], 2);
+    } else {
+        *--p = '0' + value;
+    }
+    return out + n;
+}
+
+char * metric_format_i64(char * out, int64_t value) {
+    if (value < 0) {
+        *out++ = '-';
+        /* Negate as unsigned, so INT64_MIN does not overflow */
+        return metric_format_u64(out, 0 - (uint64_t) value);
+    }
+    return metric_format_u64(out, value);
+}
+
+/* value * 10^exp10, with only one rounding when the power is exact */
+static double scale10(double value, int exp10) {
+    while (exp10 > 22) {
+        value *= 1e22;
+        exp10 -= 22;
+    }
+    while (exp10 < -22) {
+        value /= 1e22;
+        exp10 += 22;
+    }
+    return (exp10 >= 0) ? value * pow10_exact[exp10] : value / pow10_exact[-exp10];
+}
+
+char * metric_format_double(char * out, double value, int precision) {
+
+    if (precision > 17) {
+        precision = 17;
+    } else if (precision < 0) {
+        precision = 0;
+    }
+
+    if (isnan(value)) {
+        memcpy(out, "NaN", 3);
+        return out + 3;
+    }
+    if (isinf(value)) {
+        memcpy(out, (value < 0) ? "-Inf" : "+Inf", 4);
+        return out + 4;
+    }
+    if (signbit(value)) {
+        *out++ = '-';
+        value = -value;
+    }
+
+    /* Significand as an integer of precision + 1 digits */
+    int exp10 = 0;
+    uint64_t mant = 0;
+    if (value != 0) {
+        exp10 = (int) floor(log10(value));
+        double scaled = scale10(value, precision - exp10);
+        /* log10() may be off by one decade */
+        if (scaled >= pow10_u64[precision + 1]) {
+            exp10++;
+            scaled = scale10(value, precision - exp10);
+        } else if (scaled < pow10_u64[precision]) {
+            exp10--;
+            scaled = scale10(value, precision - exp10);
+        }
+
+        /**
+         * scale10() is inexact by a few ulp, so when the digit after the last one printed is too close to 5,
+         * the rounding could differ from printf(). Those rare cases (and precisions where the significand
+         * no longer fits a double exactly) are handed to snprintf().
+         */
+        double frac = scaled - floor(scaled);
+        if (precision > 14 || fabs(frac - 0.5) < scaled * 4e-15) {
+            char tmp[METRIC_FORMAT_NUM_MAX];
+            int len = snprintf(tmp, sizeof(tmp), "%.*e", precision, value);
+            memcpy(out, tmp, len);
+            return out + len;
+        }
+
+        mant = (uint64_t) llround(scaled);
+        if (mant >= pow10_u64[precision + 1]) {
+            exp10++;
+            mant /= 10;
+        }
+    }
+
+    char digits[20];
+    format_digits(digits, mant, precision + 1);
+    *out++ = digits[0];
+    if (precision > 0) {
+        *out++ = '.';
+        memcpy(out, &digits[1], precision);
+        out += precision;
+    }
+
+    *out++ = 'e';
+    if (exp10 < 0) {
+        *out++ = '-';
+        exp10 = -exp10;
+    } else {
+        *out++ = '+';
+    }
+    if (exp10 < 10) {
+        *out++ = '0';
+    }
+    return metric_format_u64(out, exp10);
+}
+
+size_t metric_format_prefix(char * out, size_t size, const char * name, unsigned int node) {
+
+    static const char node_label[] = "{node=\"";
+    static const char idx_label[] = "\", idx=\"";
+    const size_t fixed_len = (sizeof(node_label) - 1) + (sizeof(idx_label) - 1) + METRIC_FORMAT_NUM_MAX;
+
+    if (size <= fixed_len) {
+        return 0;
+    }
+
+    size_t name_len = strlen(name);
+    if (name_len > size - fixed_len) {
+        name_len = size - fixed_len;
+    }
+
+    char * p = out;
+    memcpy(p, name, name_len);
+    p += name_len;
+    memcpy(p, node_label, sizeof(node_label) - 1);
+    p += sizeof(node_label) - 1;
+    p = metric_format_u64(p, node);
+    memcpy(p, idx_label, sizeof(idx_label) - 1);
+    p += sizeof(idx_label) - 1;
+
+    return p - out;
+}
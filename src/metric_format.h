@@ -0,0 +1,30 @@
+/*
+ * metric_format.h
+ *
+ * Allocation-free rendering of Prometheus text lines, used on the sniffer hot path.
+ * All functions write without NULL termination and return a pointer past the last character written.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Upper bound of characters written by metric_format_u64/i64/double */
+#define METRIC_FORMAT_NUM_MAX 32
+
+char * metric_format_u64(char * out, uint64_t value);
+char * metric_format_i64(char * out, int64_t value);
+
+/**
+ * @brief Render value in scientific notation, equivalent to printf("%.*e"), but with Prometheus spelling of NaN/+Inf/-Inf.
+ * @param precision Digits after the decimal point, at most 17.
+ */
+char * metric_format_double(char * out, double value, int precision);
+
+/**
+ * @brief Render the part of a line that is constant for a series: name{node="<node>", idx="
+ * @param size Available space in out. The name is truncated to fit.
+ * @return Number of characters written.
+ */
+size_t metric_format_prefix(char * out, size_t size, const char * name, unsigned int node);
@@ -6,7 +6,11 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <sys/time.h>
+#include <time.h>
 #include <pthread.h>
 #include <param/param_server.h>
 #include <param/param_queue.h>
@@ -14,23 +18,103 @@
 #include <mpack/mpack.h>
 #include <csp/csp.h>
 #include <csp/csp_hooks.h>
-#include <csp/csp_crc32.h>
+#include <slash/slash.h>
+#include <slash/optparse.h>
 
 #include "param_sniffer.h"
 #include "hk_param_sniffer.h"
 #include "victoria_metrics.h"
+#include "metric_format.h"
+#include "sniffer_log.h"
+#include "sniffer_store.h"
+#include "sniffer_capture.h"
+#include "sniffer_param_cache.h"
+#include "sniffer_unknown.h"
+#include "sniffer_stats.h"
+#include "sniffer_sink.h"
+#include "sniffer_filter.h"
+#include "sniffer_crc32.h"
+#include "sniffer_agg.h"
+#include "sniffer_dedup.h"
+#include "vm_change.h"
 #include "vts.h"
 
-extern int prometheus_started;
 extern int vm_running;
 
 int sniffer_running = 0;
 pthread_t param_sniffer_thread;
-FILE *logfile;
+
+/* Lines of one parameter are rendered into a local batch, and handed to the outputs in one go */
+#define SNIFFER_BATCH_SIZE 8192
+#define SNIFFER_LINE_MAX   1000
+
+/* With vm 0, the lines only go to the log, and param_sniffer_log() sends its selection of them to VictoriaMetrics */
+static void param_sniffer_output(const char * lines, size_t len, unsigned int count, int vm) {
+
+    if (len == 0) {
+        return;
+    }
+
+    SNIFFER_STATS_ADD(samples, count);
+
+    if(vm_running && vm){
+        vm_add_lines(lines, len, count);
+    }
+
+    if (sniffer_log_is_open()) {
+        sniffer_log_write(lines, len);
+    }
+}
+
+int param_sniffer_read_value(const param_t * param, void * reader, sniffer_value_t * value) {
+
+    switch (param->type) {
+        case PARAM_TYPE_UINT8:
+        case PARAM_TYPE_XINT8:
+        case PARAM_TYPE_UINT16:
+        case PARAM_TYPE_XINT16:
+        case PARAM_TYPE_UINT32:
+        case PARAM_TYPE_XINT32:
+            value->kind = SNIFFER_VALUE_UINT;
+            value->u = mpack_expect_uint(reader);
+            return 0;
+        case PARAM_TYPE_UINT64:
+        case PARAM_TYPE_XINT64:
+            value->kind = SNIFFER_VALUE_UINT;
+            value->u = mpack_expect_u64(reader);
+            return 0;
+        case PARAM_TYPE_INT8:
+        case PARAM_TYPE_INT16:
+        case PARAM_TYPE_INT32:
+            value->kind = SNIFFER_VALUE_INT;
+            value->i = mpack_expect_int(reader);
+            return 0;
+        case PARAM_TYPE_INT64:
+            value->kind = SNIFFER_VALUE_INT;
+            value->i = mpack_expect_i64(reader);
+            return 0;
+        case PARAM_TYPE_FLOAT:
+            value->kind = SNIFFER_VALUE_DOUBLE;
+            value->d = mpack_expect_float(reader);
+            return 0;
+        case PARAM_TYPE_DOUBLE:
+            value->kind = SNIFFER_VALUE_DOUBLE;
+            value->d = mpack_expect_double(reader);
+            return 0;
+
+        case PARAM_TYPE_STRING:
+        case PARAM_TYPE_DATA:
+        default:
+            mpack_discard(reader);
+            return -1;
+    }
+}
 
 int param_sniffer_log(void * ctx, param_queue_t *queue, const param_t *param, int offset, void *reader, csp_timestamp_t *timestamp) {
 
-    char tmp[1000] = {0};
+    char batch[SNIFFER_BATCH_SIZE];
+    size_t batch_len = 0;
+    unsigned int batch_lines = 0;
 
     if (offset < 0)
         offset = 0;
@@ -43,8 +127,24 @@ int param_sniffer_log(void * ctx, param_queue_t *queue, const param_t *param, in
         count = mpack_expect_array(reader);
     }
 
-    double vts_arr[4];
-    int vts = check_vts(*(param->node), param->id);
+    /* VTS takes whole vectors, so it gets nothing if any element was not read, or was suppressed as a duplicate */
+    double vts_arr[4] = {0};
+    int vts_filled = 0;
+    int vts = check_vts(*(param->node), param->id) && offset == 0 && param->type == PARAM_TYPE_DOUBLE;
+    int sinks = (sniffer_sink_count() > 0);
+    int log = sniffer_log_is_open();
+    int vm = vm_running;
+    int aggregated = vm && (sniffer_agg_match(param) >= 0);
+    int changes = vm && vm_change_is_enabled();
+    /* Samples stamped on reception cannot repeat */
+    int dedup = (timestamp->tv_sec > 0) && sniffer_dedup_is_enabled();
+    unsigned int skipped = 0;
+
+    /* Unless every line goes to both the log and VictoriaMetrics, lines for the latter are collected separately */
+    int selective = aggregated || changes;
+    char vm_batch[SNIFFER_BATCH_SIZE];
+    size_t vm_batch_len = 0;
+    unsigned int vm_batch_lines = 0;
 
     uint64_t time_ms;
     if (timestamp->tv_sec > 0) {
@@ -55,66 +155,110 @@ int param_sniffer_log(void * ctx, param_queue_t *queue, const param_t *param, in
         time_ms = ((uint64_t) tv.tv_sec * 1000000 + tv.tv_usec) / 1000;
     }
 
-    for (int i = offset; i < offset + count; i++) {
+    /* Everything but the index and value is the same for all elements, so render it once:
+     * name{node="<node>", idx="  and  " <time_ms>\n */
+    char prefix[SNIFFER_LINE_MAX - 3 * METRIC_FORMAT_NUM_MAX - 8];
+    size_t prefix_len = metric_format_prefix(prefix, sizeof(prefix), param->name, *(param->node));
+    char suffix[METRIC_FORMAT_NUM_MAX + 2] = " ";
+    char * suffix_end = metric_format_u64(suffix + 1, time_ms);
+    *suffix_end++ = '\n';
+    size_t suffix_len = suffix_end - suffix;
 
-        switch (param->type) {
-            case PARAM_TYPE_UINT8:
-            case PARAM_TYPE_XINT8:
-            case PARAM_TYPE_UINT16:
-            case PARAM_TYPE_XINT16:
-            case PARAM_TYPE_UINT32:
-            case PARAM_TYPE_XINT32:
-                sprintf(tmp, "%s{node=\"%u\", idx=\"%u\"} %u %"PRIu64"\n", param->name, *(param->node), i, mpack_expect_uint(reader), time_ms);
-                break;
-            case PARAM_TYPE_UINT64:
-            case PARAM_TYPE_XINT64:
-                sprintf(tmp, "%s{node=\"%u\", idx=\"%u\"} %"PRIu64" %"PRIu64"\n", param->name, *(param->node), i, mpack_expect_u64(reader), time_ms);
-                break;
-            case PARAM_TYPE_INT8:
-            case PARAM_TYPE_INT16:
-            case PARAM_TYPE_INT32:
-                sprintf(tmp, "%s{node=\"%u\", idx=\"%u\"} %d %"PRIu64"\n", param->name, *(param->node), i, mpack_expect_int(reader), time_ms);
-                break;
-            case PARAM_TYPE_INT64:
-                sprintf(tmp, "%s{node=\"%u\", idx=\"%u\"} %"PRIi64" %"PRIu64"\n", param->name, *(param->node), i, mpack_expect_i64(reader), time_ms);
-                break;
-            case PARAM_TYPE_FLOAT:
-                sprintf(tmp, "%s{node=\"%u\", idx=\"%u\"} %e %"PRIu64"\n", param->name, *(param->node), i, mpack_expect_float(reader), time_ms);
-                break;
-            case PARAM_TYPE_DOUBLE: {
-                double tmp_dbl = mpack_expect_double(reader);
-                sprintf(tmp, "%s{node=\"%u\", idx=\"%u\"} %.12e %"PRIu64"\n", param->name, *(param->node), i, tmp_dbl, time_ms);
-                if(vts){
-                    vts_arr[i] = tmp_dbl;
-                }
-                break;
-            }
-                
+    for (int i = offset; i < offset + count; i++) {
 
-            case PARAM_TYPE_STRING:
-            case PARAM_TYPE_DATA:
-            default:
-                mpack_discard(reader);
-                break;
-        }
+        sniffer_value_t value;
+        int valid = (param_sniffer_read_value(param, reader, &value) == 0);
 
         if (mpack_reader_error(reader) != mpack_ok) {
             break;
         }
 
-        if(vm_running){
-            vm_add(tmp);
+        if (!valid) {
+            continue;
+        }
+
+        if (dedup && sniffer_dedup_seen(*(param->node), param->id, i, time_ms, &value)) {
+            SNIFFER_STATS_INC(duplicates);
+            continue;
+        }
+
+        if(vts && i < 4){
+            vts_arr[i] = value.d;
+            vts_filled++;
+        }
+
+        if (sniffer_store_is_open()) {
+            sniffer_store_append(*(param->node), param->id, i, time_ms, &value);
+        }
+
+        if (sinks) {
+            sniffer_sink_sample(*(param->node), param->id, i, time_ms, &value);
+        }
+
+        /* Samples taken into a window, or unchanged, are only rendered for the log */
+        int to_vm = vm;
+        if (aggregated && sniffer_agg_sample(param, i, time_ms, &value) == 0) {
+            to_vm = 0;
+        }
+        if (to_vm && changes && !vm_change_check(*(param->node), param->id, i, time_ms, &value)) {
+            to_vm = 0;
+        }
+        if (!to_vm && !log) {
+            skipped++;
+            continue;
         }
 
-        if (logfile) {
-            fprintf(logfile, "%s", tmp);
-            fflush(logfile);
+        if (SNIFFER_BATCH_SIZE - batch_len < SNIFFER_LINE_MAX) {
+            param_sniffer_output(batch, batch_len, batch_lines, !selective);
+            batch_len = 0;
+            batch_lines = 0;
+        }
+
+        char * line = batch + batch_len;
+        char * p = line;
+        memcpy(p, prefix, prefix_len);
+        p += prefix_len;
+        p = metric_format_u64(p, i);
+        memcpy(p, "\"} ", 3);
+        p += 3;
+        switch (value.kind) {
+            case SNIFFER_VALUE_UINT:
+                p = metric_format_u64(p, value.u);
+                break;
+            case SNIFFER_VALUE_INT:
+                p = metric_format_i64(p, value.i);
+                break;
+            case SNIFFER_VALUE_DOUBLE:
+                p = metric_format_double(p, value.d, (param->type == PARAM_TYPE_FLOAT) ? 6 : 12);
+                break;
+        }
+        memcpy(p, suffix, suffix_len);
+        p += suffix_len;
+        size_t line_len = p - line;
+        batch_len += line_len;
+        batch_lines++;
+
+        if (selective && to_vm) {
+            if (SNIFFER_BATCH_SIZE - vm_batch_len < line_len) {
+                vm_add_lines(vm_batch, vm_batch_len, vm_batch_lines);
+                vm_batch_len = 0;
+                vm_batch_lines = 0;
+            }
+            memcpy(vm_batch + vm_batch_len, line, line_len);
+            vm_batch_len += line_len;
+            vm_batch_lines++;
         }
     }
 
-    if(vts){
+    param_sniffer_output(batch, batch_len, batch_lines, !selective);
+    if (vm_batch_len > 0) {
+        vm_add_lines(vm_batch, vm_batch_len, vm_batch_lines);
+    }
+    SNIFFER_STATS_ADD(samples, skipped);
+
+    if(vts && vts_filled == count){
         vts_add(vts_arr, param->id, count, time_ms);
-    } 
+    }
 
     return 0;
 }
@@ -124,12 +268,14 @@ int param_sniffer_crc(csp_packet_t * packet) {
     /* CRC32 verified packet */
     if (packet->id.flags & CSP_FCRC32) {
         if (packet->length < 4) {
+            SNIFFER_STATS_INC(crc_errors);
             printf("Too short packet for CRC32, %u\n", packet->length);
             return -1;
         }
         /* Verify CRC32 (does not include header for backwards compatability with csp1.x) */
-        if (csp_crc32_verify(packet) != 0) {
+        if (sniffer_crc32_verify(packet) != 0) {
             /* Checksum failed */
+            SNIFFER_STATS_INC(crc_errors);
             printf("CRC32 verification error in param sniffer! Discarding packet\n");
             return -1;
         }
@@ -137,71 +283,244 @@ int param_sniffer_crc(csp_packet_t * packet) {
     return 0;
 }
 
-static void * param_sniffer(void * arg) {
-    csp_promisc_enable(100);
-    while(1) {
-        csp_packet_t * packet = csp_promisc_read(CSP_MAX_DELAY);
+/* Decode a pull response and log its parameters */
+static void param_sniffer_packet(csp_packet_t * packet, const csp_timestamp_t * received) {
 
-        if(hk_param_sniffer(packet)){
-            csp_buffer_free(packet);
+    if (param_sniffer_crc(packet) < 0) {
+        return;
+    }
+
+    uint8_t type = packet->data[0];
+    if ((type != PARAM_PULL_RESPONSE) && (type != PARAM_PULL_RESPONSE_V2)) {
+        return;
+    }
+
+    int queue_version;
+    if (type == PARAM_PULL_RESPONSE) {
+        queue_version = 1;
+    } else {
+        queue_version = 2;
+    }
+
+    param_queue_t queue;
+    param_queue_init(&queue, &packet->data[2], packet->length - 2, packet->length - 2, PARAM_QUEUE_TYPE_SET, queue_version);
+    queue.last_node = packet->id.src;
+
+    csp_timestamp_t time_now;
+    csp_clock_get_time(&time_now);
+    queue.last_timestamp = time_now;
+
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, queue.buffer, queue.used);
+    while(reader.data < reader.end) {
+        int id, node, offset = -1;
+        csp_timestamp_t timestamp = { .tv_sec = 0, .tv_nsec = 0 };
+        param_deserialize_id(&reader, &id, &node, &timestamp, &offset, &queue);
+        if (node == 0) {
+            node = packet->id.src;
+        }
+        /* If parameter timestamp is not inside the header, and the lower layer found a timestamp*/
+        if ((timestamp.tv_sec == 0) && (packet->timestamp_rx != 0)) {
+            timestamp.tv_sec = packet->timestamp_rx;
+            timestamp.tv_nsec = 0;
+        } else if ((timestamp.tv_sec == 0) && received) {
+            timestamp = *received;
+        }
+        if (!sniffer_filter_param(node, id)) {
+            SNIFFER_STATS_INC(params_filtered);
+            mpack_discard(&reader);
             continue;
         }
-
-        if (packet->id.sport != PARAM_PORT_SERVER && packet->id.dport != PARAM_PORT_SERVER) {
-            csp_buffer_free(packet);
+        const param_t * param = sniffer_param_find(node, id);
+        if (param) {
+            param_sniffer_log(NULL, &queue, param, offset, &reader, &timestamp);
+        } else {
+            unsigned int unreported = sniffer_unknown_seen(node, id);
+            if (unreported) {
+                printf("Found unknown param node %d id %d (%u times)\n", node, id, unreported);
+            }
+            mpack_discard(&reader);
             continue;
         }
+    }
 
-        if (param_sniffer_crc(packet) < 0) {
-            csp_buffer_free(packet);
-            continue;
+    if (mpack_reader_error(&reader) != mpack_ok) {
+        SNIFFER_STATS_INC(decode_errors);
+    }
+}
+
+sniffer_packet_class_e param_sniffer_classify(const csp_packet_t * packet) {
+
+    if (packet->id.sport == 13) {
+        return SNIFFER_PACKET_HK;
+    }
+
+    if (packet->id.sport != PARAM_PORT_SERVER && packet->id.dport != PARAM_PORT_SERVER) {
+        return SNIFFER_PACKET_OTHER;
+    }
+
+    if (packet->length < 2) {
+        return SNIFFER_PACKET_OTHER;
+    }
+
+    uint8_t type = packet->data[0];
+    if ((type != PARAM_PULL_RESPONSE) && (type != PARAM_PULL_RESPONSE_V2)) {
+        return SNIFFER_PACKET_OTHER;
+    }
+
+    return SNIFFER_PACKET_PARAM;
+}
+
+void param_sniffer_process(csp_packet_t * packet, const csp_timestamp_t * received) {
+
+    /* Parameters found in the list stay valid until the packet is decoded */
+    sniffer_param_list_read_lock();
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (!hk_param_sniffer(packet) && param_sniffer_classify(packet) == SNIFFER_PACKET_PARAM) {
+        param_sniffer_packet(packet, received);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    sniffer_param_list_unlock();
+    uint64_t elapsed_us = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+    sniffer_stats_observe(sniffer_stats.decode_us_hist, &sniffer_stats.decode_us_sum, elapsed_us);
+
+    sniffer_sink_flush();
+}
+
+/**
+ * The reader thread only classifies packets, and hands them to a worker selected by source node.
+ * All packets from one node are therefore decoded in order, by the same worker,
+ * which keeps per-node state such as the HK epoch consistent.
+ */
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    csp_packet_t * packets[SNIFFER_QUEUE_LEN];
+    unsigned int head;
+    unsigned int count;
+} sniffer_worker_t;
+
+static sniffer_worker_t * workers = NULL;
+static unsigned int worker_count = 0;
+static unsigned int worker_count_setting = 0;  // 0: one per online CPU, up to SNIFFER_WORKERS_MAX
+
+int param_sniffer_set_workers(unsigned int count) {
+    if (sniffer_running) {
+        return -1;
+    }
+    worker_count_setting = count;
+    return 0;
+}
+
+unsigned int param_sniffer_get_workers(void) {
+    return worker_count;
+}
+
+static void * param_sniffer_worker(void * arg) {
+
+    sniffer_worker_t * worker = arg;
+
+    while (1) {
+        pthread_mutex_lock(&worker->lock);
+        while (worker->count == 0) {
+            pthread_cond_wait(&worker->cond, &worker->lock);
         }
+        csp_packet_t * packet = worker->packets[worker->head];
+        worker->head = (worker->head + 1) % SNIFFER_QUEUE_LEN;
+        worker->count--;
+        pthread_mutex_unlock(&worker->lock);
+
+        param_sniffer_process(packet, NULL);
+        csp_buffer_free(packet);
+    }
+
+    return NULL;
+}
+
+/* Returns -1 if the worker is behind, in which case the packet is left to the caller */
+static int param_sniffer_dispatch(csp_packet_t * packet) {
+
+    sniffer_worker_t * worker = &workers[packet->id.src % worker_count];
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->count >= SNIFFER_QUEUE_LEN) {
+        pthread_mutex_unlock(&worker->lock);
+        return -1;
+    }
+    worker->packets[(worker->head + worker->count) % SNIFFER_QUEUE_LEN] = packet;
+    worker->count++;
+    pthread_cond_signal(&worker->cond);
+    pthread_mutex_unlock(&worker->lock);
+
+    return 0;
+}
+
+static int param_sniffer_workers_start(void) {
+
+    unsigned int count = worker_count_setting;
+    if (count == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        count = (cpus > 1) ? cpus : 1;
+    }
+    if (count > SNIFFER_WORKERS_MAX) {
+        count = SNIFFER_WORKERS_MAX;
+    }
 
-        uint8_t type = packet->data[0];
-        if ((type != PARAM_PULL_RESPONSE) && (type != PARAM_PULL_RESPONSE_V2)) {
+    workers = calloc(count, sizeof(sniffer_worker_t));
+    if (workers == NULL) {
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        pthread_mutex_init(&workers[i].lock, NULL);
+        pthread_cond_init(&workers[i].cond, NULL);
+        if (pthread_create(&workers[i].thread, NULL, &param_sniffer_worker, &workers[i]) != 0) {
+            break;
+        }
+        worker_count++;
+    }
+
+    return (worker_count > 0) ? 0 : -1;
+}
+
+static void * param_sniffer(void * arg) {
+    csp_promisc_enable(100);
+    while(1) {
+        csp_packet_t * packet = csp_promisc_read(CSP_MAX_DELAY);
+        SNIFFER_STATS_INC(packets_read);
+
+        if (!sniffer_filter_packet(packet)) {
+            SNIFFER_STATS_INC(packets_filtered);
             csp_buffer_free(packet);
             continue;
         }
 
-        int queue_version;
-        if (type == PARAM_PULL_RESPONSE) {
-            queue_version = 1;
-        } else {
-            queue_version = 2;
+        if (sniffer_capture_is_open()) {
+            sniffer_capture_write(packet);
         }
 
-        param_queue_t queue;
-        param_queue_init(&queue, &packet->data[2], packet->length - 2, packet->length - 2, PARAM_QUEUE_TYPE_SET, queue_version);
-        queue.last_node = packet->id.src;
-
-        csp_timestamp_t time_now;
-        csp_clock_get_time(&time_now);
-        queue.last_timestamp = time_now;
-
-        mpack_reader_t reader;
-        mpack_reader_init_data(&reader, queue.buffer, queue.used);
-        while(reader.data < reader.end) {
-            int id, node, offset = -1;
-            csp_timestamp_t timestamp = { .tv_sec = 0, .tv_nsec = 0 };
-            param_deserialize_id(&reader, &id, &node, &timestamp, &offset, &queue);
-            if (node == 0) {
-                node = packet->id.src;
-            }
-            /* If parameter timestamp is not inside the header, and the lower layer found a timestamp*/
-            if ((timestamp.tv_sec == 0) && (packet->timestamp_rx != 0)) {
-                timestamp.tv_sec = packet->timestamp_rx;
-                timestamp.tv_nsec = 0;
-            }
-            const param_t * param = param_list_find_id(node, id);
-            if (param) {
-                param_sniffer_log(NULL, &queue, param, offset, &reader, &timestamp);
-            } else {
-                printf("Found unknown param node %d id %d\n", node, id);
-                mpack_discard(&reader);
+        switch (param_sniffer_classify(packet)) {
+            case SNIFFER_PACKET_HK:
+                SNIFFER_STATS_INC(packets_hk);
+                break;
+            case SNIFFER_PACKET_PARAM:
+                SNIFFER_STATS_INC(packets_param);
+                break;
+            case SNIFFER_PACKET_OTHER:
+                SNIFFER_STATS_INC(packets_other);
+                csp_buffer_free(packet);
                 continue;
-            }
         }
-        csp_buffer_free(packet);
+
+        if (param_sniffer_dispatch(packet) < 0) {
+            SNIFFER_STATS_INC(packets_dropped);
+            csp_buffer_free(packet);
+        }
     }
     return NULL;
 }
@@ -213,14 +532,53 @@ void param_sniffer_init(int add_logfile) {
     }
 
     if (add_logfile) {
-        logfile = fopen("param_sniffer.log", "a");
-        if (logfile) {
+        if (sniffer_log_open("param_sniffer.log") == 0) {
             printf("Logging parameters to param_sniffer.log\n");
         } else {
             printf("Couldn't open param_sniffer.log for append\n");
         }
     }	
 
+    if (param_sniffer_workers_start() < 0) {
+        printf("Failed to start param sniffer workers\n");
+        return;
+    }
+
     sniffer_running = 1;
     pthread_create(&param_sniffer_thread, NULL, &param_sniffer, NULL);
 }
+
+static int sniffer_workers_cmd(struct slash * slash) {
+
+    optparse_t * parser = optparse_new("sniffer_workers", "[count]");
+    optparse_add_help(parser);
+
+    int argi = optparse_parse(parser, slash->argc - 1, (const char **) slash->argv + 1);
+    optparse_del(parser);
+    if (argi < 0) {
+        return SLASH_EINVAL;
+    }
+
+    if (++argi < slash->argc) {
+        char * end;
+        unsigned long count = strtoul(slash->argv[argi], &end, 10);
+        if (*end != '\0' || end == slash->argv[argi] || count > SNIFFER_WORKERS_MAX) {
+            printf("Worker count must be 0 (one per CPU) to %u\n", SNIFFER_WORKERS_MAX);
+            return SLASH_EINVAL;
+        }
+        if (param_sniffer_set_workers(count) < 0) {
+            printf("Workers can only be set before the sniffer starts\n");
+            return SLASH_EINVAL;
+        }
+    }
+
+    if (sniffer_running) {
+        printf("%u decode workers running\n", worker_count);
+    } else if (worker_count_setting) {
+        printf("%u decode workers when the sniffer starts\n", worker_count_setting);
+    } else {
+        printf("One decode worker per CPU when the sniffer starts\n");
+    }
+    return SLASH_SUCCESS;
+}
+slash_command(sniffer_workers, sniffer_workers_cmd, "[count]", "Show or set the number of sniffer decode workers");
@@ -9,9 +9,61 @@
 #define SRC_PARAM_SNIFFER_H_
 
 #include <csp/csp.h>
+#include <param/param_queue.h>
+
+/* Length of each worker queue. Queued packets hold CSP buffers, so keep workers * length well below buffer_count */
+#define SNIFFER_QUEUE_LEN   64
+#define SNIFFER_WORKERS_MAX 8
+
+typedef enum {
+    SNIFFER_VALUE_UINT,
+    SNIFFER_VALUE_INT,
+    SNIFFER_VALUE_DOUBLE,
+} sniffer_value_kind_e;
+
+/* A decoded numeric sample. Integer types are widened to 64 bits, float to double */
+typedef struct {
+    sniffer_value_kind_e kind;
+    union {
+        uint64_t u;
+        int64_t i;
+        double d;
+    };
+} sniffer_value_t;
+
+typedef enum {
+    SNIFFER_PACKET_OTHER,
+    SNIFFER_PACKET_HK,
+    SNIFFER_PACKET_PARAM,
+} sniffer_packet_class_e;
 
 int param_sniffer_crc(csp_packet_t * packet);
 int param_sniffer_log(void * ctx, param_queue_t *queue, const param_t *param, int offset, void *reader, csp_timestamp_t *timestamp);
 void param_sniffer_init(int add_logfile);
 
+/**
+ * @brief Read the next element of param from reader.
+ * @return 0 for numeric types, -1 (with the element discarded) for string and data.
+ */
+int param_sniffer_read_value(const param_t * param, void * reader, sniffer_value_t * value);
+
+/* Cheap header-only classification, done by the reader thread before handing the packet to a worker */
+sniffer_packet_class_e param_sniffer_classify(const csp_packet_t * packet);
+
+/**
+ * @brief Verify, decode and log a single packet. Does not free it.
+ * @param received When the packet was read, for parameters with neither a timestamp nor timestamp_rx. NULL for now.
+ */
+void param_sniffer_process(csp_packet_t * packet, const csp_timestamp_t * received);
+
+/**
+ * @brief Set the number of decode workers, must be called before param_sniffer_init().
+ * @param count Number of workers, 0 for one per online CPU (the default). Capped at SNIFFER_WORKERS_MAX.
+ * @return 0 on success, -1 if the sniffer is already running.
+ */
+int param_sniffer_set_workers(unsigned int count);
+
+/* Number of decode workers running, 0 before param_sniffer_init() */
+unsigned int param_sniffer_get_workers(void);
+
 #endif /* SRC_PARAM_SNIFFER_H_ */
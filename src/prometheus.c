@@ -0,0 +1,686 @@
+/*
+ * prometheus.c
+ *
+ * See prometheus.h
+ *
+ * One thread polls the listening socket and all connections. Each connection has an output buffer,
+ * which is refilled from its snapshot when the client has read it, so a response never exists in full.
+ * Snapshots are sorted by metric name, as the exposition format wants all lines of a metric together.
+ */
+
+#include "prometheus.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <slash/slash.h>
+#include <slash/optparse.h>
+
+#include <param/param.h>
+
+#include "sniffer_cache.h"
+#include "sniffer_param_cache.h"
+#include "sniffer_stats.h"
+#include "metric_format.h"
+
+#define PROM_POLL_MS       200
+#define PROM_TIMEOUT_MS    10000
+#define PROM_REQUEST_MAX   4096
+#define PROM_BUFFER_SIZE   (64 * 1024)
+#define PROM_NAME_MAX      128
+#define PROM_LINE_MAX      512   // Room for a TYPE line and a sample line of a name of PROM_NAME_MAX
+
+int prometheus_started = 0;
+
+typedef struct {
+    uint64_t key;       // node << 48 | id << 32 | idx
+    uint64_t time_ms;
+    sniffer_value_t value;
+    uint32_t name;      // Offset of the metric name in the names of the snapshot
+    int precision;      // Digits of double values, as in the sniffer log
+} prom_entry_t;
+
+typedef struct {
+    int refs;           // The server and each connection rendering from it
+    uint64_t taken_ms;
+    prom_entry_t * entries;
+    size_t count;
+    size_t size;
+    char * names;
+    size_t names_len;
+    size_t names_size;
+    sniffer_stats_t stats;
+} prom_snapshot_t;
+
+typedef enum {
+    PROM_READ,          // Reading the request
+    PROM_STATS,         // Headers are buffered, the statistics are next
+    PROM_SERIES,        // Rendering series from the snapshot
+    PROM_DONE,          // Everything is buffered, close once sent
+} prom_state_e;
+
+typedef struct {
+    int fd;
+    prom_state_e state;
+    uint64_t active_ms; // Last time the client read or wrote anything
+    char request[PROM_REQUEST_MAX];
+    size_t request_len;
+    char out[PROM_BUFFER_SIZE];
+    size_t out_len;
+    size_t out_sent;
+    prom_snapshot_t * snapshot;
+    size_t next;        // Next entry of the snapshot to render
+} prom_client_t;
+
+typedef struct {
+    const char * name;
+    size_t offset;
+    const char * type;
+    const char * help;
+} prom_stat_t;
+
+#define PROM_STAT(field, suffix, type, help) { "pycsh_" #field suffix, offsetof(sniffer_stats_t, field), type, help }
+
+static const prom_stat_t prom_stats[] = {
+    PROM_STAT(packets_read, "_total", "counter", "Packets read from the promiscuous queue"),
+    PROM_STAT(packets_hk, "_total", "counter", "HK packets sniffed"),
+    PROM_STAT(packets_param, "_total", "counter", "Parameter packets sniffed"),
+    PROM_STAT(packets_other, "_total", "counter", "Other packets sniffed"),
+    PROM_STAT(packets_dropped, "_total", "counter", "Packets dropped because a worker was behind"),
+    PROM_STAT(packets_filtered, "_total", "counter", "Packets rejected by the sniffer filter"),
+    PROM_STAT(params_filtered, "_total", "counter", "Parameters skipped by the sniffer filter"),
+    PROM_STAT(crc_errors, "_total", "counter", "Packets with a wrong CRC"),
+    PROM_STAT(decode_errors, "_total", "counter", "Packets with malformed parameter data"),
+    PROM_STAT(samples, "_total", "counter", "Samples decoded"),
+    PROM_STAT(duplicates, "_total", "counter", "Samples dropped as seen before"),
+    PROM_STAT(agg_samples, "_total", "counter", "Samples taken into downsampling windows"),
+    PROM_STAT(agg_lines, "_total", "counter", "Lines sent for closed downsampling windows"),
+    PROM_STAT(agg_overflow, "_total", "counter", "Samples sent at full rate because the downsampling table was full"),
+    PROM_STAT(vm_dropped, "_total", "counter", "Lines dropped because the VictoriaMetrics buffer was full"),
+    PROM_STAT(vm_unchanged, "_total", "counter", "Samples not sent to VictoriaMetrics because their value did not change"),
+    PROM_STAT(vm_buffer_used, "_bytes", "gauge", "Bytes waiting in the active VictoriaMetrics buffer"),
+    PROM_STAT(vm_pushes, "_total", "counter", "Pushes to VictoriaMetrics"),
+    PROM_STAT(vm_push_errors, "_total", "counter", "Failed pushes to VictoriaMetrics"),
+    PROM_STAT(vm_push_ms, "", "gauge", "Duration of the last push to VictoriaMetrics, in milliseconds"),
+    PROM_STAT(vm_spooled, "_bytes_total", "counter", "Bytes written to the disk spool"),
+    PROM_STAT(vm_spool_dropped, "_bytes_total", "counter", "Spooled bytes deleted to keep the spool within its bound"),
+    PROM_STAT(vm_spool_pending, "_bytes", "gauge", "Bytes in the disk spool"),
+    PROM_STAT(vts_errors, "_total", "counter", "Failed sends to VTS"),
+};
+
+static const char prom_headers_ok[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+    "Connection: close\r\n\r\n";
+
+static pthread_mutex_t server_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t server_thread;
+static atomic_int server_running = 0;
+static int server_fd = -1;
+static int server_owns_cache = 0;
+
+/* Only touched by the server thread */
+static prom_client_t * clients[PROMETHEUS_CLIENTS_MAX];
+static prom_snapshot_t * current = NULL;
+static const char * sort_names = NULL;
+
+static uint64_t prom_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void prom_snapshot_release(prom_snapshot_t * snapshot) {
+    if (snapshot && --snapshot->refs == 0) {
+        free(snapshot->entries);
+        free(snapshot->names);
+        free(snapshot);
+    }
+}
+
+/* Called with a cache shard lock held, so only copies */
+static void prom_snapshot_add(void * ctx, uint16_t node, uint16_t id, uint32_t idx, uint64_t time_ms, const sniffer_value_t * value) {
+
+    prom_snapshot_t * snapshot = ctx;
+    if (snapshot->count == snapshot->size) {
+        size_t size = snapshot->size ? snapshot->size * 2 : 1024;
+        prom_entry_t * entries = realloc(snapshot->entries, size * sizeof(prom_entry_t));
+        if (entries == NULL) {
+            return;
+        }
+        snapshot->entries = entries;
+        snapshot->size = size;
+    }
+    snapshot->entries[snapshot->count++] = (prom_entry_t) {
+        .key = ((uint64_t) node << 48) | ((uint64_t) id << 32) | idx,
+        .time_ms = time_ms,
+        .value = *value,
+    };
+}
+
+/* Append name to the names of snapshot, with the characters not allowed in metric names replaced by '_' */
+static int prom_snapshot_name(prom_snapshot_t * snapshot, const char * name, uint32_t * offset) {
+
+    size_t len = strnlen(name, PROM_NAME_MAX - 1);
+    if (snapshot->names_len + len + 2 > snapshot->names_size) {
+        size_t size = snapshot->names_size ? snapshot->names_size * 2 : 16 * 1024;
+        char * names = realloc(snapshot->names, size);
+        if (names == NULL) {
+            return -1;
+        }
+        snapshot->names = names;
+        snapshot->names_size = size;
+    }
+
+    char * p = snapshot->names + snapshot->names_len;
+    *offset = snapshot->names_len;
+    if (len == 0 || (name[0] >= '0' && name[0] <= '9')) {
+        *p++ = '_';
+    }
+    for (size_t i = 0; i < len; i++) {
+        char c = name[i];
+        int valid = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == ':';
+        *p++ = valid ? c : '_';
+    }
+    *p++ = '\0';
+    snapshot->names_len = p - snapshot->names;
+    return 0;
+}
+
+static int prom_compare_key(const void * a, const void * b) {
+    uint64_t ka = ((const prom_entry_t *) a)->key;
+    uint64_t kb = ((const prom_entry_t *) b)->key;
+    return (ka > kb) - (ka < kb);
+}
+
+static int prom_compare_name(const void * a, const void * b) {
+    const prom_entry_t * ea = a;
+    const prom_entry_t * eb = b;
+    int res = strcmp(sort_names + ea->name, sort_names + eb->name);
+    return res ? res : prom_compare_key(a, b);
+}
+
+/* Copy the latest samples out of the cache, and name and sort them */
+static prom_snapshot_t * prom_snapshot_take(void) {
+
+    prom_snapshot_t * snapshot = calloc(1, sizeof(prom_snapshot_t));
+    if (snapshot == NULL) {
+        return NULL;
+    }
+    snapshot->refs = 1;
+    snapshot->taken_ms = prom_now_ms();
+    sniffer_stats_snapshot(&snapshot->stats);
+
+    /* Start at the size of the last snapshot, so the cache is rarely locked across a realloc() */
+    if (current && current->count > 0) {
+        snapshot->entries = malloc(current->count * sizeof(prom_entry_t));
+        snapshot->size = snapshot->entries ? current->count : 0;
+    }
+    sniffer_cache_foreach(prom_snapshot_add, snapshot);
+
+    /* Elements of an array are adjacent once sorted by key, and share one lookup and name */
+    qsort(snapshot->entries, snapshot->count, sizeof(prom_entry_t), prom_compare_key);
+
+    /* Parameters looked up stay valid while they are named, as for the decode workers */
+    sniffer_param_list_read_lock();
+    size_t count = 0;
+    uint64_t param_key = UINT64_MAX;
+    param_t * param = NULL;
+    uint32_t name = 0;
+    for (size_t i = 0; i < snapshot->count; i++) {
+        prom_entry_t * entry = &snapshot->entries[i];
+        if (entry->key >> 32 != param_key) {
+            param_key = entry->key >> 32;
+            param = sniffer_param_find(entry->key >> 48, (entry->key >> 32) & 0xFFFF);
+            if (param && prom_snapshot_name(snapshot, param->name, &name) < 0) {
+                param = NULL;
+            }
+        }
+        /* Parameters removed since they were sniffed are left out */
+        if (param == NULL) {
+            continue;
+        }
+        entry->name = name;
+        entry->precision = (param->type == PARAM_TYPE_FLOAT) ? 6 : 12;
+        snapshot->entries[count++] = *entry;
+    }
+    snapshot->count = count;
+    sniffer_param_list_unlock();
+
+    sort_names = snapshot->names;
+    qsort(snapshot->entries, snapshot->count, sizeof(prom_entry_t), prom_compare_name);
+    sort_names = NULL;
+
+    return snapshot;
+}
+
+/* Share the current snapshot if it is recent enough, or take a new one */
+static prom_snapshot_t * prom_snapshot_get(void) {
+
+    if (current == NULL || prom_now_ms() - current->taken_ms >= PROMETHEUS_SNAPSHOT_MS) {
+        prom_snapshot_t * snapshot = prom_snapshot_take();
+        if (snapshot == NULL) {
+            return NULL;
+        }
+        prom_snapshot_release(current);
+        current = snapshot;
+    }
+    current->refs++;
+    return current;
+}
+
+static char * prom_render_stats(char * p, const sniffer_stats_t * stats) {
+
+    for (size_t i = 0; i < sizeof(prom_stats) / sizeof(prom_stats[0]); i++) {
+        const prom_stat_t * stat = &prom_stats[i];
+        uint64_t value = *(const uint64_t *) ((const char *) stats + stat->offset);
+        p += sprintf(p, "# HELP %s %s\n# TYPE %s %s\n%s ", stat->name, stat->help, stat->name, stat->type, stat->name);
+        p = metric_format_u64(p, value);
+        *p++ = '\n';
+    }
+
+    const struct {
+        const char * name;
+        const char * help;
+        const uint64_t * hist;
+        uint64_t sum;
+    } hists[] = {
+        {"pycsh_decode_us", "Time to decode and log a packet, in microseconds", stats->decode_us_hist, stats->decode_us_sum},
+        {"pycsh_vm_push_duration_ms", "Duration of pushes to VictoriaMetrics, in milliseconds", stats->vm_push_ms_hist, stats->vm_push_ms_sum},
+    };
+    for (size_t i = 0; i < sizeof(hists) / sizeof(hists[0]); i++) {
+        p += sprintf(p, "# HELP %s %s\n# TYPE %s histogram\n", hists[i].name, hists[i].help, hists[i].name);
+        uint64_t total = 0;
+        for (int b = 0; b < SNIFFER_STATS_BUCKETS; b++) {
+            total += hists[i].hist[b];
+            if (b < SNIFFER_STATS_BUCKETS - 1) {
+                p += sprintf(p, "%s_bucket{le=\"%u\"} ", hists[i].name, sniffer_stats_bounds[b]);
+            } else {
+                p += sprintf(p, "%s_bucket{le=\"+Inf\"} ", hists[i].name);
+            }
+            p = metric_format_u64(p, total);
+            *p++ = '\n';
+        }
+        p += sprintf(p, "%s_sum ", hists[i].name);
+        p = metric_format_u64(p, hists[i].sum);
+        *p++ = '\n';
+        p += sprintf(p, "%s_count ", hists[i].name);
+        p = metric_format_u64(p, total);
+        *p++ = '\n';
+    }
+
+    return p;
+}
+
+static char * prom_render_entry(char * p, const prom_snapshot_t * snapshot, const prom_entry_t * entry, int first) {
+
+    const char * name = snapshot->names + entry->name;
+    size_t name_len = strlen(name);
+    if (first) {
+        memcpy(p, "# TYPE ", 7);
+        p += 7;
+        memcpy(p, name, name_len);
+        p += name_len;
+        memcpy(p, " gauge\n", 7);
+        p += 7;
+    }
+
+    memcpy(p, name, name_len);
+    p += name_len;
+    memcpy(p, "{node=\"", 7);
+    p = metric_format_u64(p + 7, entry->key >> 48);
+    memcpy(p, "\",idx=\"", 7);
+    p = metric_format_u64(p + 7, entry->key & 0xFFFFFFFF);
+    memcpy(p, "\"} ", 3);
+    p += 3;
+
+    switch (entry->value.kind) {
+        case SNIFFER_VALUE_UINT:
+            p = metric_format_u64(p, entry->value.u);
+            break;
+        case SNIFFER_VALUE_INT:
+            p = metric_format_i64(p, entry->value.i);
+            break;
+        case SNIFFER_VALUE_DOUBLE:
+        default:
+            p = metric_format_double(p, entry->value.d, entry->precision);
+            break;
+    }
+    *p++ = ' ';
+    p = metric_format_u64(p, entry->time_ms);
+    *p++ = '\n';
+
+    return p;
+}
+
+/* Refill the drained output buffer of client with the next part of the response */
+static void prom_render(prom_client_t * client) {
+
+    char * p = client->out;
+    char * end = client->out + PROM_BUFFER_SIZE;
+
+    if (client->state == PROM_STATS) {
+        p = prom_render_stats(p, &client->snapshot->stats);
+        client->state = PROM_SERIES;
+    }
+
+    const prom_snapshot_t * snapshot = client->snapshot;
+    while (client->state == PROM_SERIES && end - p >= PROM_LINE_MAX) {
+        if (client->next == snapshot->count) {
+            client->state = PROM_DONE;
+            break;
+        }
+        const prom_entry_t * entry = &snapshot->entries[client->next];
+        /* Parameters of the same name on several nodes share a TYPE line */
+        int first = client->next == 0
+            || strcmp(snapshot->names + entry->name, snapshot->names + snapshot->entries[client->next - 1].name) != 0;
+        p = prom_render_entry(p, snapshot, entry, first);
+        client->next++;
+    }
+
+    client->out_len = p - client->out;
+    client->out_sent = 0;
+}
+
+static void prom_respond_error(prom_client_t * client, const char * status) {
+    client->out_len = snprintf(client->out, PROM_BUFFER_SIZE,
+        "HTTP/1.1 %s\r\nContent-Type: text/plain\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n%s\n",
+        status, strlen(status) + 1, status);
+    client->out_sent = 0;
+    client->state = PROM_DONE;
+}
+
+/* Answer a complete request */
+static void prom_respond(prom_client_t * client) {
+
+    char method[8] = "";
+    char path[256] = "";
+    sscanf(client->request, "%7s %255s", method, path);
+    char * query = strchr(path, '?');
+    if (query) {
+        *query = '\0';
+    }
+
+    int head = strcmp(method, "HEAD") == 0;
+    if (strcmp(method, "GET") != 0 && !head) {
+        prom_respond_error(client, "405 Method Not Allowed");
+        return;
+    }
+    if (strcmp(path, "/metrics") != 0) {
+        prom_respond_error(client, "404 Not Found");
+        return;
+    }
+
+    memcpy(client->out, prom_headers_ok, sizeof(prom_headers_ok) - 1);
+    client->out_len = sizeof(prom_headers_ok) - 1;
+    client->out_sent = 0;
+    if (head) {
+        client->state = PROM_DONE;
+        return;
+    }
+
+    client->snapshot = prom_snapshot_get();
+    if (client->snapshot == NULL) {
+        prom_respond_error(client, "503 Service Unavailable");
+        return;
+    }
+    client->next = 0;
+    client->state = PROM_STATS;
+}
+
+static void prom_client_close(int i) {
+    close(clients[i]->fd);
+    prom_snapshot_release(clients[i]->snapshot);
+    free(clients[i]);
+    clients[i] = NULL;
+}
+
+static void prom_accept(uint64_t now) {
+
+    int fd = accept(server_fd, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    for (int i = 0; i < PROMETHEUS_CLIENTS_MAX; i++) {
+        if (clients[i] == NULL) {
+            clients[i] = malloc(sizeof(prom_client_t));
+            if (clients[i] == NULL) {
+                break;
+            }
+            clients[i]->fd = fd;
+            clients[i]->state = PROM_READ;
+            clients[i]->active_ms = now;
+            clients[i]->request_len = 0;
+            clients[i]->out_len = 0;
+            clients[i]->out_sent = 0;
+            clients[i]->snapshot = NULL;
+            return;
+        }
+    }
+    close(fd);
+}
+
+/* Read from or write to a ready client. @return -1 when the connection is finished */
+static int prom_client_serve(prom_client_t * client, uint64_t now) {
+
+    if (client->state == PROM_READ) {
+        ssize_t len = recv(client->fd, client->request + client->request_len, PROM_REQUEST_MAX - 1 - client->request_len, 0);
+        if (len <= 0) {
+            return (len < 0 && (errno == EAGAIN || errno == EINTR)) ? 0 : -1;
+        }
+        client->request_len += len;
+        client->request[client->request_len] = '\0';
+        client->active_ms = now;
+
+        if (strstr(client->request, "\r\n\r\n") || strstr(client->request, "\n\n")) {
+            prom_respond(client);
+        } else if (client->request_len == PROM_REQUEST_MAX - 1) {
+            prom_respond_error(client, "431 Request Header Fields Too Large");
+        }
+        return 0;
+    }
+
+    if (client->out_sent == client->out_len) {
+        if (client->state == PROM_DONE) {
+            return -1;
+        }
+        prom_render(client);
+    }
+
+    ssize_t len = send(client->fd, client->out + client->out_sent, client->out_len - client->out_sent, MSG_NOSIGNAL);
+    if (len < 0) {
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    }
+    client->out_sent += len;
+    client->active_ms = now;
+
+    return (client->out_sent == client->out_len && client->state == PROM_DONE) ? -1 : 0;
+}
+
+static void * prom_server(void * arg) {
+
+    struct pollfd fds[1 + PROMETHEUS_CLIENTS_MAX];
+    int slots[1 + PROMETHEUS_CLIENTS_MAX];
+
+    while (atomic_load(&server_running)) {
+
+        int nfds = 0;
+        fds[nfds++] = (struct pollfd) { .fd = server_fd, .events = POLLIN };
+        for (int i = 0; i < PROMETHEUS_CLIENTS_MAX; i++) {
+            if (clients[i]) {
+                slots[nfds] = i;
+                fds[nfds++] = (struct pollfd) { .fd = clients[i]->fd, .events = (clients[i]->state == PROM_READ) ? POLLIN : POLLOUT };
+            }
+        }
+
+        if (poll(fds, nfds, PROM_POLL_MS) < 0 && errno != EINTR) {
+            break;
+        }
+        uint64_t now = prom_now_ms();
+
+        for (int n = 1; n < nfds; n++) {
+            prom_client_t * client = clients[slots[n]];
+            if (fds[n].revents & (POLLERR | POLLNVAL)) {
+                prom_client_close(slots[n]);
+            } else if (fds[n].revents) {
+                if (prom_client_serve(client, now) < 0) {
+                    prom_client_close(slots[n]);
+                }
+            } else if (now - client->active_ms >= PROM_TIMEOUT_MS) {
+                prom_client_close(slots[n]);
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            prom_accept(now);
+        }
+    }
+
+    for (int i = 0; i < PROMETHEUS_CLIENTS_MAX; i++) {
+        if (clients[i]) {
+            prom_client_close(i);
+        }
+    }
+    prom_snapshot_release(current);
+    current = NULL;
+
+    return NULL;
+}
+
+int prometheus_start(const char * address, uint16_t port) {
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+    };
+    if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&server_lock);
+    if (prometheus_started) {
+        pthread_mutex_unlock(&server_lock);
+        return -1;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        pthread_mutex_unlock(&server_lock);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    socklen_t addr_len = sizeof(addr);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+            || listen(fd, PROMETHEUS_CLIENTS_MAX) < 0
+            || getsockname(fd, (struct sockaddr *) &addr, &addr_len) < 0) {
+        close(fd);
+        pthread_mutex_unlock(&server_lock);
+        return -1;
+    }
+
+    server_owns_cache = 0;
+    if (!sniffer_cache_is_enabled()) {
+        if (sniffer_cache_enable(1, SNIFFER_CACHE_SERIES_DEFAULT) < 0) {
+            close(fd);
+            pthread_mutex_unlock(&server_lock);
+            return -1;
+        }
+        server_owns_cache = 1;
+    }
+
+    server_fd = fd;
+    atomic_store(&server_running, 1);
+    if (pthread_create(&server_thread, NULL, &prom_server, NULL) != 0) {
+        atomic_store(&server_running, 0);
+        if (server_owns_cache) {
+            sniffer_cache_disable();
+        }
+        close(fd);
+        server_fd = -1;
+        pthread_mutex_unlock(&server_lock);
+        return -1;
+    }
+    prometheus_started = 1;
+    pthread_mutex_unlock(&server_lock);
+
+    return ntohs(addr.sin_port);
+}
+
+void prometheus_stop(void) {
+
+    pthread_mutex_lock(&server_lock);
+    if (!prometheus_started) {
+        pthread_mutex_unlock(&server_lock);
+        return;
+    }
+
+    /* The server thread notices within PROM_POLL_MS */
+    atomic_store(&server_running, 0);
+    pthread_join(server_thread, NULL);
+    close(server_fd);
+    server_fd = -1;
+
+    if (server_owns_cache) {
+        sniffer_cache_disable();
+        server_owns_cache = 0;
+    }
+    prometheus_started = 0;
+    pthread_mutex_unlock(&server_lock);
+}
+
+static int prometheus_start_cmd(struct slash * slash) {
+
+    char * address = PROMETHEUS_ADDRESS_DEFAULT;
+    unsigned int port = PROMETHEUS_PORT_DEFAULT;
+
+    optparse_t * parser = optparse_new("prometheus_start", "");
+    optparse_add_help(parser);
+    optparse_add_string(parser, 'a', "address", "ADDR", &address, "address to listen on (default 127.0.0.1, 0.0.0.0 for all)");
+    optparse_add_unsigned(parser, 'p', "port", "NUM", 0, &port, "port to listen on (default 9101)");
+
+    int argi = optparse_parse(parser, slash->argc - 1, (const char **) slash->argv + 1);
+    if (argi < 0) {
+        optparse_del(parser);
+        return SLASH_EINVAL;
+    }
+
+    if (port > UINT16_MAX) {
+        printf("Invalid port %u\n", port);
+        optparse_del(parser);
+        return SLASH_EINVAL;
+    }
+
+    int res = prometheus_start(address, port);
+    if (res < 0) {
+        printf("Failed to serve metrics on %s:%u\n", address, port);
+        optparse_del(parser);
+        return SLASH_EINVAL;
+    }
+    printf("Serving metrics on http://%s:%d/metrics\n", address, res);
+    optparse_del(parser);
+    return SLASH_SUCCESS;
+}
+slash_command(prometheus_start, prometheus_start_cmd, "[OPTIONS...]", "Serve sniffed telemetry to Prometheus");
+
+static int prometheus_stop_cmd(struct slash * slash) {
+    prometheus_stop();
+    return SLASH_SUCCESS;
+}
+slash_command(prometheus_stop, prometheus_stop_cmd, "", "Stop serving metrics to Prometheus");
@@ -0,0 +1,38 @@
+/*
+ * prometheus.h
+ *
+ * Embedded Prometheus pull endpoint. A single thread serves GET /metrics with the latest value of every
+ * sniffed series and the ingest statistics (sniffer_stats.h), in the Prometheus text exposition format.
+ *
+ * Values come from the telemetry cache (sniffer_cache.h). A scrape copies the latest samples out of it one shard
+ * at a time, and scrapes starting within PROMETHEUS_SNAPSHOT_MS share that copy. The response is then rendered
+ * from the copy a buffer at a time, as the client reads it, so the sniffer is never held up by a slow scraper.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define PROMETHEUS_PORT_DEFAULT    9101
+#define PROMETHEUS_ADDRESS_DEFAULT "127.0.0.1"
+
+/* Scrapes starting within this long of each other are served from the same snapshot */
+#define PROMETHEUS_SNAPSHOT_MS     1000
+
+/* Connections served at once, further ones are closed right away */
+#define PROMETHEUS_CLIENTS_MAX     8
+
+/* 1 while the server thread runs */
+extern int prometheus_started;
+
+/**
+ * @brief Listen on address and port, and start the server thread.
+ * Enables the telemetry cache with a history of one sample if it is not enabled, prometheus_stop() disables it again.
+ * @param address IPv4 address to listen on, "0.0.0.0" for all interfaces.
+ * @param port TCP port, 0 for any free port.
+ * @return The port listened on, or -1 if already started or the socket or thread could not be set up.
+ */
+int prometheus_start(const char * address, uint16_t port);
+
+/* Close all connections and stop the server thread */
+void prometheus_stop(void);
@@ -6,6 +6,7 @@
 #include <csp/csp_debug.h>
 
 #include "pycshconfig.h"
+#include "sniffer_stats.h"
 
 
 #define PARAMID_SERIAL0                     31
@@ -19,6 +20,34 @@
 #define PARAMID_CSP_DBG_RDP_PRINT           58
 #define PARAMID_CSP_DBG_PACKET_PRINT        59
 
+/* Telemetry ingest statistics, see sniffer_stats.h */
+#define PARAMID_SNIFF_PKTS                  70
+#define PARAMID_SNIFF_HK                    71
+#define PARAMID_SNIFF_PARAM                 72
+#define PARAMID_SNIFF_OTHER                 73
+#define PARAMID_SNIFF_DROPPED               74
+#define PARAMID_SNIFF_CRC_ERR               75
+#define PARAMID_SNIFF_DECODE_ERR            76
+#define PARAMID_SNIFF_SAMPLES               77
+#define PARAMID_SNIFF_DECODE_HIST           78
+#define PARAMID_VM_DROPPED                  79
+#define PARAMID_VM_BUF_USED                 80
+#define PARAMID_VM_PUSHES                   81
+#define PARAMID_VM_PUSH_ERR                 82
+#define PARAMID_VM_PUSH_MS                  83
+#define PARAMID_VM_PUSH_HIST                84
+#define PARAMID_VTS_ERR                     85
+#define PARAMID_VM_SPOOLED                  86
+#define PARAMID_VM_SPOOL_DROPPED            87
+#define PARAMID_VM_SPOOL_PENDING            88
+#define PARAMID_SNIFF_FILTERED              89
+#define PARAMID_SNIFF_PARAMS_FILTERED       90
+#define PARAMID_SNIFF_AGG_SAMPLES           91
+#define PARAMID_SNIFF_AGG_LINES             92
+#define PARAMID_SNIFF_AGG_OVERFLOW          93
+#define PARAMID_SNIFF_DUPLICATES            94
+#define PARAMID_VM_UNCHANGED                95
+
 static uint32_t _serial0;
 
 PARAM_DEFINE_STATIC_RAM(PARAMID_SERIAL0, serial0, PARAM_TYPE_XINT32, -1, 0, PM_HWREG, NULL, "", &_serial0, NULL);
@@ -32,6 +61,33 @@ PARAM_DEFINE_STATIC_RAM(PARAMID_CSP_DBG_CAN_ERRNO,    csp_can_errno,       PARAM
 PARAM_DEFINE_STATIC_RAM(PARAMID_CSP_DBG_RDP_PRINT,    csp_print_rdp,       PARAM_TYPE_UINT8,  0, 0, PM_DEBUG, NULL, "", &csp_dbg_rdp_print, "Turn on csp_print of rdp information");
 PARAM_DEFINE_STATIC_RAM(PARAMID_CSP_DBG_PACKET_PRINT, csp_print_packet,    PARAM_TYPE_UINT8,  0, 0, PM_DEBUG, NULL, "", &csp_dbg_packet_print, "Turn on csp_print of packet information");
 
+PARAM_DEFINE_STATIC_RAM(PARAMID_SNIFF_PKTS,           sniff_pkts,          PARAM_TYPE_UINT64, 0, 0, PM_DEBUG, NULL, "", &sniffer_stats.packets_read, "Packets read by the sniffer");
+PARAM_DEFINE_STATIC_RAM(PARAMID_SNIFF_HK,             sniff_hk,            PARAM_TYPE_UINT64, 0, 0, PM_DEBUG, NULL, "", &sniffer_stats.packets_hk, "Sniffed HK packets");
+PARAM_DEFINE_STATIC_RAM(PARAMID_SNIFF_PARAM,          sniff_param,         PARAM_TYPE_UINT64, 0, 0, PM_DEBUG, NULL, "", &sniffer_stats.packets_param, "Sniffed pull responses");
+PARAM_DEFINE_STATIC_RAM(PARAMID_SNIFF_OTHER,          sniff_other,         PARAM_TYPE_UINT64, 0, 0, PM_DEBUG, NULL, "", &sniffer_stats.packets_other, "Sniffed packets without parameters");
+PARAM_DEFINE_STATIC_RAM(PARAMID_SNIFF_DROPPED,        sniff_dropped,       PARAM_TYPE_UINT64, 0, 0, PM_DEBUG | PM_ERRCNT, NULL, "", &sniffer_stats.packets_dropped, "Sniffed packets dropped because a decode worker was behind");
+PARAM_DEFINE_STATIC_RAM(PARAMID_SNIFF_CRC_ERR,        sniff_crc_err,       PARAM_TYPE_UINT64, 0, 0, PM_DEBUG | PM_ERRCNT, NULL, "", &sniffer_stats.crc_errors, "Sniffed packets failing CRC32 verification");
+PARAM_DEFINE_STATIC_RAM(PARAMID_SNIFF_DECODE_ERR,     sniff_decode_err,    PARAM_TYPE_UINT64, 0, 0, PM_DEBUG | PM_ERRCNT, NULL, "", &sniffer_stats.decode_errors, "Sniffed packets with malformed parameter data");
+PARAM_DEFINE_STATIC_RAM(PARAMID_SNIFF_SAMPLES,        sniff_samples,       PARAM_TYPE_UINT64, 0, 0, PM_DEBUG, NULL, "", &sniffer_stats.samples, "Samples decoded by the sniffer");
+PARAM_DEFINE_STATIC_RAM(PARAMID_SNIFF_DECODE_HIST,    sniff_decode_hist,   PARAM_TYPE_UINT64, SNIFFER_STATS_BUCKETS, sizeof(uint64_t), PM_DEBUG, NULL, "us", sniffer_stats.decode_us_hist, "Histogram of packet decode time, buckets 1, 2, 5 .. 2000 us and above");
+PARAM_DEFINE_STATIC_RAM(PARAMID_VM_DROPPED,           vm_dropped,          PARAM_TYPE_UINT64, 0, 0, PM_DEBUG | PM_ERRCNT, NULL, "", &sniffer_stats.vm_dropped, "Lines dropped because the VictoriaMetrics buffer was full");
+PARAM_DEFINE_STATIC_RAM(PARAMID_VM_BUF_USED,          vm_buf_used,         PARAM_TYPE_UINT64, 0, 0, PM_DEBUG, NULL, "B", &sniffer_stats.vm_buffer_used, "Bytes waiting in the VictoriaMetrics buffer");
+PARAM_DEFINE_STATIC_RAM(PARAMID_VM_PUSHES,            vm_pushes,           PARAM_TYPE_UINT64, 0, 0, PM_DEBUG, NULL, "", &sniffer_stats.vm_pushes, "Successful pushes to VictoriaMetrics");
+PARAM_DEFINE_STATIC_RAM(PARAMID_VM_PUSH_ERR,          vm_push_err,         PARAM_TYPE_UINT64, 0, 0, PM_DEBUG | PM_ERRCNT, NULL, "", &sniffer_stats.vm_push_errors, "Failed pushes to VictoriaMetrics");
+PARAM_DEFINE_STATIC_RAM(PARAMID_VM_PUSH_MS,           vm_push_ms,          PARAM_TYPE_UINT64, 0, 0, PM_DEBUG, NULL, "ms", &sniffer_stats.vm_push_ms, "Duration of the last push to VictoriaMetrics");
+PARAM_DEFINE_STATIC_RAM(PARAMID_VM_PUSH_HIST,         vm_push_hist,        PARAM_TYPE_UINT64, SNIFFER_STATS_BUCKETS, sizeof(uint64_t), PM_DEBUG, NULL, "ms", sniffer_stats.vm_push_ms_hist, "Histogram of push duration, buckets 1, 2, 5 .. 2000 ms and above");
+PARAM_DEFINE_STATIC_RAM(PARAMID_VTS_ERR,              vts_err,             PARAM_TYPE_UINT64, 0, 0, PM_DEBUG | PM_ERRCNT, NULL, "", &sniffer_stats.vts_errors, "Failed sends to VTS");
+PARAM_DEFINE_STATIC_RAM(PARAMID_VM_SPOOLED,           vm_spooled,          PARAM_TYPE_UINT64, 0, 0, PM_DEBUG, NULL, "B", &sniffer_stats.vm_spooled, "Bytes written to the VictoriaMetrics disk spool");
+PARAM_DEFINE_STATIC_RAM(PARAMID_VM_SPOOL_DROPPED,     vm_spool_dropped,    PARAM_TYPE_UINT64, 0, 0, PM_DEBUG | PM_ERRCNT, NULL, "B", &sniffer_stats.vm_spool_dropped, "Spooled bytes deleted to keep the spool within its bound");
+PARAM_DEFINE_STATIC_RAM(PARAMID_VM_SPOOL_PENDING,     vm_spool_pending,    PARAM_TYPE_UINT64, 0, 0, PM_DEBUG, NULL, "B", &sniffer_stats.vm_spool_pending, "Bytes waiting in the VictoriaMetrics disk spool");
+PARAM_DEFINE_STATIC_RAM(PARAMID_SNIFF_FILTERED,       sniff_filtered,      PARAM_TYPE_UINT64, 0, 0, PM_DEBUG, NULL, "", &sniffer_stats.packets_filtered, "Sniffed packets rejected by the filter");
+PARAM_DEFINE_STATIC_RAM(PARAMID_SNIFF_PARAMS_FILTERED, sniff_par_filtered, PARAM_TYPE_UINT64, 0, 0, PM_DEBUG, NULL, "", &sniffer_stats.params_filtered, "Sniffed parameters skipped by the filter");
+PARAM_DEFINE_STATIC_RAM(PARAMID_SNIFF_AGG_SAMPLES,     sniff_agg_samples,   PARAM_TYPE_UINT64, 0, 0, PM_DEBUG, NULL, "", &sniffer_stats.agg_samples, "Sniffed samples taken into downsampling windows");
+PARAM_DEFINE_STATIC_RAM(PARAMID_SNIFF_AGG_LINES,       sniff_agg_lines,     PARAM_TYPE_UINT64, 0, 0, PM_DEBUG, NULL, "", &sniffer_stats.agg_lines, "Lines sent for closed downsampling windows");
+PARAM_DEFINE_STATIC_RAM(PARAMID_SNIFF_AGG_OVERFLOW,    sniff_agg_overflow,  PARAM_TYPE_UINT64, 0, 0, PM_DEBUG | PM_ERRCNT, NULL, "", &sniffer_stats.agg_overflow, "Samples sent at full rate because the downsampling table was full");
+PARAM_DEFINE_STATIC_RAM(PARAMID_SNIFF_DUPLICATES,      sniff_dups,          PARAM_TYPE_UINT64, 0, 0, PM_DEBUG, NULL, "", &sniffer_stats.duplicates, "Sniffed samples dropped as duplicates");
+PARAM_DEFINE_STATIC_RAM(PARAMID_VM_UNCHANGED,          vm_unchanged,        PARAM_TYPE_UINT64, 0, 0, PM_DEBUG, NULL, "", &sniffer_stats.vm_unchanged, "Samples not sent to VictoriaMetrics because they did not change");
+
 static char queue_buf[PARAM_SERVER_MTU];
 param_queue_t param_queue = { .buffer = queue_buf, .buffer_size = PARAM_SERVER_MTU, .type = PARAM_QUEUE_TYPE_EMPTY, .version = 2 };
 
@@ -0,0 +1,1633 @@
+/*
+ * python_sniffer.c
+ *
+ * Python functions for the sniffer and telemetry modules in this repository.
+ * They are added to the pycsh module by __init__.py, through pycsh_sniffer_add_methods().
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "param_sniffer.h"
+#include "sniffer_store.h"
+#include "sniffer_capture.h"
+#include "sniffer_param_cache.h"
+#include "hk_param_sniffer.h"
+#include "sniffer_unknown.h"
+#include "sniffer_stats.h"
+#include "sniffer_sink.h"
+#include "sniffer_ring.h"
+#include "sniffer_filter.h"
+#include "sniffer_agg.h"
+#include "sniffer_dedup.h"
+#include "vm_change.h"
+#include "sniffer_cache.h"
+#include "prometheus.h"
+#include "sniffer_log.h"
+#include "victoria_metrics.h"
+#include "vm_spool.h"
+
+/**
+ * Wrap bytes in a memoryview of the given struct format, without copying.
+ * Steals the reference to bytes.
+ */
+static PyObject * pycsh_sniffer_array(PyObject * bytes, const char * format) {
+
+    if (bytes == NULL) {
+        return NULL;
+    }
+
+    PyObject * view = PyMemoryView_FromObject(bytes);
+    Py_DECREF(bytes);
+    if (view == NULL) {
+        return NULL;
+    }
+
+    PyObject * cast = PyObject_CallMethod(view, "cast", "s", format);
+    Py_DECREF(view);
+    return cast;
+}
+
+static const char * pycsh_sniffer_value_format(sniffer_value_kind_e kind) {
+    switch (kind) {
+        case SNIFFER_VALUE_UINT:
+            return "Q";
+        case SNIFFER_VALUE_INT:
+            return "q";
+        case SNIFFER_VALUE_DOUBLE:
+        default:
+            return "d";
+    }
+}
+
+static PyObject * pycsh_sniffer_store_open(PyObject * self, PyObject * args, PyObject * kwds) {
+
+    char * path;
+    static char * kwlist[] = {"path", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &path)) {
+        return NULL;
+    }
+
+    if (sniffer_store_open(path) < 0) {
+        PyErr_Format(PyExc_OSError, "Failed to open sniffer store '%s'", path);
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject * pycsh_sniffer_store_close(PyObject * self, PyObject * args) {
+
+    Py_BEGIN_ALLOW_THREADS;
+    sniffer_store_close();
+    Py_END_ALLOW_THREADS;
+
+    Py_RETURN_NONE;
+}
+
+/* Open a store for reading, making sure samples still in partial chunks are included when it is being recorded */
+static sniffer_store_reader_t * pycsh_sniffer_reader_open(const char * path) {
+
+    sniffer_store_reader_t * reader;
+
+    Py_BEGIN_ALLOW_THREADS;
+    const char * recording = sniffer_store_path();
+    if (recording && strcmp(recording, path) == 0) {
+        sniffer_store_flush();
+    }
+    reader = sniffer_store_reader_open(path);
+    Py_END_ALLOW_THREADS;
+
+    if (reader == NULL) {
+        PyErr_Format(PyExc_OSError, "Failed to read sniffer store '%s'", path);
+    }
+    return reader;
+}
+
+static PyObject * pycsh_sniffer_store_series(PyObject * self, PyObject * args, PyObject * kwds) {
+
+    char * path;
+    static char * kwlist[] = {"path", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &path)) {
+        return NULL;
+    }
+
+    sniffer_store_reader_t * reader = pycsh_sniffer_reader_open(path);
+    if (reader == NULL) {
+        return NULL;
+    }
+
+    size_t count = sniffer_store_reader_series(reader, NULL, 0);
+    sniffer_series_key_t * keys = PyMem_Malloc(count * sizeof(sniffer_series_key_t) + 1);
+    if (keys == NULL) {
+        sniffer_store_reader_close(reader);
+        return PyErr_NoMemory();
+    }
+    count = sniffer_store_reader_series(reader, keys, count);
+    sniffer_store_reader_close(reader);
+
+    PyObject * list = PyList_New(count);
+    for (size_t i = 0; list && i < count; i++) {
+        PyObject * key = Py_BuildValue("(HHI)", keys[i].node, keys[i].id, keys[i].idx);
+        if (key == NULL) {
+            Py_CLEAR(list);
+            break;
+        }
+        PyList_SET_ITEM(list, i, key);
+    }
+    PyMem_Free(keys);
+
+    return list;
+}
+
+static PyObject * pycsh_sniffer_store_read(PyObject * self, PyObject * args, PyObject * kwds) {
+
+    char * path;
+    unsigned short node, id;
+    unsigned int idx = 0;
+    static char * kwlist[] = {"path", "node", "id", "idx", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "sHH|I", kwlist, &path, &node, &id, &idx)) {
+        return NULL;
+    }
+
+    sniffer_store_reader_t * reader = pycsh_sniffer_reader_open(path);
+    if (reader == NULL) {
+        return NULL;
+    }
+
+    sniffer_series_key_t key = { .node = node, .id = id, .idx = idx };
+    sniffer_value_kind_e kind = SNIFFER_VALUE_DOUBLE;
+    size_t count = sniffer_store_reader_count(reader, key, &kind);
+
+    PyObject * times = PyBytes_FromStringAndSize(NULL, count * sizeof(uint64_t));
+    PyObject * values = PyBytes_FromStringAndSize(NULL, count * sizeof(uint64_t));
+    if (times == NULL || values == NULL) {
+        Py_XDECREF(times);
+        Py_XDECREF(values);
+        sniffer_store_reader_close(reader);
+        return NULL;
+    }
+
+    char * times_buf = PyBytes_AS_STRING(times);
+    char * values_buf = PyBytes_AS_STRING(values);
+    size_t read;
+    Py_BEGIN_ALLOW_THREADS;
+    read = sniffer_store_reader_read(reader, key, kind, (uint64_t *) times_buf, values_buf, count);
+    sniffer_store_reader_close(reader);
+    Py_END_ALLOW_THREADS;
+
+    /* Samples that fail to decode are not read, so size the views to what was */
+    if (read < count && (_PyBytes_Resize(&times, read * sizeof(uint64_t)) < 0
+                         || _PyBytes_Resize(&values, read * sizeof(uint64_t)) < 0)) {
+        Py_XDECREF(times);
+        Py_XDECREF(values);
+        return NULL;
+    }
+
+    PyObject * times_view = pycsh_sniffer_array(times, "Q");
+    PyObject * values_view = pycsh_sniffer_array(values, pycsh_sniffer_value_format(kind));
+    if (times_view == NULL || values_view == NULL) {
+        Py_XDECREF(times_view);
+        Py_XDECREF(values_view);
+        return NULL;
+    }
+
+    return Py_BuildValue("(NN)", times_view, values_view);
+}
+
+static PyObject * pycsh_sniffer_capture_open(PyObject * self, PyObject * args, PyObject * kwds) {
+
+    char * path;
+    static char * kwlist[] = {"path", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &path)) {
+        return NULL;
+    }
+
+    if (sniffer_capture_open(path) < 0) {
+        PyErr_Format(PyExc_OSError, "Failed to open sniffer capture '%s'", path);
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject * pycsh_sniffer_capture_close(PyObject * self, PyObject * args) {
+
+    Py_BEGIN_ALLOW_THREADS;
+    sniffer_capture_close();
+    Py_END_ALLOW_THREADS;
+
+    Py_RETURN_NONE;
+}
+
+static PyObject * pycsh_sniffer_replay(PyObject * self, PyObject * args, PyObject * kwds) {
+
+    char * path;
+    static char * kwlist[] = {"path", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &path)) {
+        return NULL;
+    }
+
+    long count;
+    Py_BEGIN_ALLOW_THREADS;
+    count = sniffer_capture_replay(path);
+    Py_END_ALLOW_THREADS;
+
+    if (count < 0) {
+        PyErr_Format(PyExc_OSError, "Failed to replay sniffer capture '%s'", path);
+        return NULL;
+    }
+
+    return PyLong_FromLong(count);
+}
+
+static PyObject * pycsh_sniffer_param_cache_invalidate(PyObject * self, PyObject * args) {
+    sniffer_param_cache_invalidate();
+    Py_RETURN_NONE;
+}
+
+static PyObject * pycsh_hk_timesync_add(PyObject * self, PyObject * args, PyObject * kwds) {
+
+    unsigned int node;
+    unsigned int param_id;
+    static char * kwlist[] = {"node", "param_id", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "II", kwlist, &node, &param_id)) {
+        return NULL;
+    }
+
+    if (node > UINT16_MAX || param_id > UINT16_MAX) {
+        PyErr_SetString(PyExc_ValueError, "node and param_id must fit in 16 bits");
+        return NULL;
+    }
+
+    if (hk_timesync_add(node, param_id) < 0) {
+        return PyErr_NoMemory();
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject * pycsh_sniffer_unknown_params(PyObject * self, PyObject * args) {
+
+    sniffer_unknown_t * unknowns = NULL;
+    unsigned int count = sniffer_unknown_list(NULL, 0);
+    /* Entries may be added in between, in which case they are left out */
+    if (count > 0) {
+        unknowns = PyMem_Malloc(count * sizeof(sniffer_unknown_t));
+        if (unknowns == NULL) {
+            return PyErr_NoMemory();
+        }
+        unsigned int found = sniffer_unknown_list(unknowns, count);
+        if (found < count) {
+            count = found;
+        }
+    }
+
+    PyObject * list = PyList_New(count);
+    if (list == NULL) {
+        PyMem_Free(unknowns);
+        return NULL;
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        PyObject * item = Py_BuildValue("(IIK)", unknowns[i].node, unknowns[i].id, (unsigned long long) unknowns[i].count);
+        if (item == NULL) {
+            Py_DECREF(list);
+            PyMem_Free(unknowns);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, i, item);
+    }
+    PyMem_Free(unknowns);
+
+    return list;
+}
+
+static PyObject * pycsh_sniffer_unknown_clear(PyObject * self, PyObject * args) {
+    sniffer_unknown_clear();
+    Py_RETURN_NONE;
+}
+
+static PyObject * pycsh_sniffer_resolver(PyObject * self, PyObject * args, PyObject * kwds) {
+
+    int enable;
+    unsigned int timeout_ms = SNIFFER_RESOLVER_TIMEOUT_MS_DEFAULT;
+    int version = SNIFFER_RESOLVER_VERSION_DEFAULT;
+    static char * kwlist[] = {"enable", "timeout_ms", "version", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "p|Ii", kwlist, &enable, &timeout_ms, &version)) {
+        return NULL;
+    }
+
+    if (sniffer_resolver_enable(enable, timeout_ms, version) < 0) {
+        PyErr_SetString(PyExc_RuntimeError, "Failed to start the sniffer list resolver");
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+/* List of (upper bound, count) pairs, the last bound being infinity */
+static PyObject * pycsh_sniffer_histogram(const uint64_t hist[SNIFFER_STATS_BUCKETS]) {
+
+    PyObject * list = PyList_New(SNIFFER_STATS_BUCKETS);
+    if (list == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < SNIFFER_STATS_BUCKETS; i++) {
+        double bound = (i < SNIFFER_STATS_BUCKETS - 1) ? sniffer_stats_bounds[i] : Py_HUGE_VAL;
+        PyObject * item = Py_BuildValue("(dK)", bound, (unsigned long long) hist[i]);
+        if (item == NULL) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, i, item);
+    }
+    return list;
+}
+
+static PyObject * pycsh_sniffer_stats(PyObject * self, PyObject * args) {
+
+    sniffer_stats_t stats;
+    sniffer_stats_snapshot(&stats);
+
+    PyObject * decode_hist = pycsh_sniffer_histogram(stats.decode_us_hist);
+    PyObject * push_hist = pycsh_sniffer_histogram(stats.vm_push_ms_hist);
+    if (decode_hist == NULL || push_hist == NULL) {
+        Py_XDECREF(decode_hist);
+        Py_XDECREF(push_hist);
+        return NULL;
+    }
+
+    return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:N,s:N}",
+        "packets_read", (unsigned long long) stats.packets_read,
+        "packets_hk", (unsigned long long) stats.packets_hk,
+        "packets_param", (unsigned long long) stats.packets_param,
+        "packets_other", (unsigned long long) stats.packets_other,
+        "packets_dropped", (unsigned long long) stats.packets_dropped,
+        "packets_filtered", (unsigned long long) stats.packets_filtered,
+        "params_filtered", (unsigned long long) stats.params_filtered,
+        "crc_errors", (unsigned long long) stats.crc_errors,
+        "decode_errors", (unsigned long long) stats.decode_errors,
+        "samples", (unsigned long long) stats.samples,
+        "duplicates", (unsigned long long) stats.duplicates,
+        "agg_samples", (unsigned long long) stats.agg_samples,
+        "agg_lines", (unsigned long long) stats.agg_lines,
+        "agg_overflow", (unsigned long long) stats.agg_overflow,
+        "unknown_params", (unsigned long long) sniffer_unknown_total(),
+        "log_dropped_bytes", (unsigned long long) sniffer_log_dropped(),
+        "vm_dropped", (unsigned long long) stats.vm_dropped,
+        "vm_unchanged", (unsigned long long) stats.vm_unchanged,
+        "vm_buffer_used", (unsigned long long) stats.vm_buffer_used,
+        "vm_buffer_size", (unsigned long long) vm_get_buffer_size(),
+        "vm_pushes", (unsigned long long) stats.vm_pushes,
+        "vm_push_errors", (unsigned long long) stats.vm_push_errors,
+        "vm_push_ms", (unsigned long long) stats.vm_push_ms,
+        "vm_spooled", (unsigned long long) stats.vm_spooled,
+        "vm_spool_dropped", (unsigned long long) stats.vm_spool_dropped,
+        "vm_spool_pending", (unsigned long long) stats.vm_spool_pending,
+        "vts_errors", (unsigned long long) stats.vts_errors,
+        "decode_us_histogram", decode_hist,
+        "vm_push_ms_histogram", push_hist);
+}
+
+static PyObject * pycsh_sniffer_stats_reset(PyObject * self, PyObject * args) {
+    sniffer_stats_reset();
+    Py_RETURN_NONE;
+}
+
+/* PyArg "O&" converter for an optional non-negative size, leaving the target untouched for None */
+static int pycsh_optional_size(PyObject * obj, void * out) {
+
+    if (obj == Py_None) {
+        return 1;
+    }
+    Py_ssize_t value = PyLong_AsSsize_t(obj);
+    if (value == -1 && PyErr_Occurred()) {
+        return 0;
+    }
+    if (value < 0) {
+        PyErr_SetString(PyExc_ValueError, "sizes and times must not be negative");
+        return 0;
+    }
+    *(Py_ssize_t *) out = value;
+    return 1;
+}
+
+static PyObject * pycsh_sniffer_log_config(PyObject * self, PyObject * args, PyObject * kwds) {
+
+    Py_ssize_t commit_bytes = -1, commit_ms = -1, rotate_bytes = -1, rotate_seconds = -1, keep = -1, queue_bytes = -1;
+    static char * kwlist[] = {"commit_bytes", "commit_ms", "rotate_bytes", "rotate_seconds", "keep", "queue_bytes", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O&O&O&O&O&O&", kwlist,
+                                     pycsh_optional_size, &commit_bytes, pycsh_optional_size, &commit_ms,
+                                     pycsh_optional_size, &rotate_bytes, pycsh_optional_size, &rotate_seconds,
+                                     pycsh_optional_size, &keep, pycsh_optional_size, &queue_bytes)) {
+        return NULL;
+    }
+
+    if (queue_bytes == 0) {
+        PyErr_SetString(PyExc_ValueError, "queue_bytes must be above 0");
+        return NULL;
+    }
+    if (queue_bytes > 0 && sniffer_log_set_queue_size(queue_bytes) < 0) {
+        PyErr_SetString(PyExc_RuntimeError, "the queue size can only be changed before the log is opened");
+        return NULL;
+    }
+
+    size_t bytes;
+    unsigned int ms;
+    sniffer_log_get_commit(&bytes, &ms);
+    if (commit_bytes >= 0 || commit_ms >= 0) {
+        bytes = (commit_bytes >= 0) ? (size_t) commit_bytes : bytes;
+        ms = (commit_ms >= 0) ? (unsigned int) commit_ms : ms;
+        sniffer_log_set_commit(bytes, ms);
+    }
+
+    size_t max_bytes;
+    unsigned int max_seconds, max_keep;
+    sniffer_log_get_rotation(&max_bytes, &max_seconds, &max_keep);
+    if (rotate_bytes >= 0 || rotate_seconds >= 0 || keep >= 0) {
+        max_bytes = (rotate_bytes >= 0) ? (size_t) rotate_bytes : max_bytes;
+        max_seconds = (rotate_seconds >= 0) ? (unsigned int) rotate_seconds : max_seconds;
+        max_keep = (keep >= 0) ? (unsigned int) keep : max_keep;
+        sniffer_log_set_rotation(max_bytes, max_seconds, max_keep);
+    }
+
+    return Py_BuildValue("{s:n,s:n,s:I,s:n,s:I,s:I}",
+        "queue_bytes", (Py_ssize_t) sniffer_log_get_queue_size(),
+        "commit_bytes", (Py_ssize_t) bytes,
+        "commit_ms", ms,
+        "rotate_bytes", (Py_ssize_t) max_bytes,
+        "rotate_seconds", max_seconds,
+        "keep", max_keep);
+}
+
+static PyObject * pycsh_sniffer_workers(PyObject * self, PyObject * args, PyObject * kwds) {
+
+    PyObject * count_obj = Py_None;
+    static char * kwlist[] = {"count", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &count_obj)) {
+        return NULL;
+    }
+
+    if (count_obj != Py_None) {
+        long count = PyLong_AsLong(count_obj);
+        if (count == -1 && PyErr_Occurred()) {
+            return NULL;
+        }
+        if (count < 0 || count > SNIFFER_WORKERS_MAX) {
+            PyErr_Format(PyExc_ValueError, "count must be 0 (one per CPU) to %d", SNIFFER_WORKERS_MAX);
+            return NULL;
+        }
+        if (param_sniffer_set_workers(count) < 0) {
+            PyErr_SetString(PyExc_RuntimeError, "workers can only be set before the sniffer starts");
+            return NULL;
+        }
+    }
+
+    return PyLong_FromUnsignedLong(param_sniffer_get_workers());
+}
+
+static PyObject * pycsh_vm_spool_open(PyObject * self, PyObject * args, PyObject * kwds) {
+
+    char * path;
+    unsigned long long max_mb = VM_SPOOL_MAX_DEFAULT / (1024 * 1024);
+    static char * kwlist[] = {"path", "max_mb", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|K", kwlist, &path, &max_mb)) {
+        return NULL;
+    }
+
+    if (vm_spool_open(path, max_mb * 1024 * 1024) < 0) {
+        PyErr_Format(PyExc_OSError, "Failed to open VictoriaMetrics spool '%s'", path);
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject * pycsh_vm_spool_close(PyObject * self, PyObject * args) {
+
+    Py_BEGIN_ALLOW_THREADS;
+    vm_spool_close();
+    Py_END_ALLOW_THREADS;
+
+    Py_RETURN_NONE;
+}
+
+static PyObject * pycsh_vm_config(PyObject * self, PyObject * args, PyObject * kwds) {
+
+    Py_ssize_t buffer_size = 0;
+    Py_ssize_t flush_bytes = 0;
+    int flush_age_ms = 0;
+    int flush_lines = 0;
+    PyObject * gzip = Py_None;
+    int concurrency = 0;
+    static char * kwlist[] = {"buffer_size", "flush_bytes", "flush_age_ms", "flush_lines", "gzip", "concurrency", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|nniiOi", kwlist, &buffer_size, &flush_bytes, &flush_age_ms, &flush_lines, &gzip, &concurrency)) {
+        return NULL;
+    }
+
+    if (buffer_size < 0 || flush_bytes < 0 || flush_age_ms < 0 || flush_lines < 0) {
+        PyErr_SetString(PyExc_ValueError, "sizes, ages and line counts must be positive");
+        return NULL;
+    }
+    if (concurrency < 0 || concurrency > VM_CONCURRENCY_MAX) {
+        PyErr_Format(PyExc_ValueError, "concurrency must be 1 to %d", VM_CONCURRENCY_MAX);
+        return NULL;
+    }
+    int enable_gzip = (gzip == Py_None) ? -1 : PyObject_IsTrue(gzip);
+    if (gzip != Py_None && enable_gzip < 0) {
+        return NULL;
+    }
+    if (buffer_size > 0 && vm_set_buffer_size(buffer_size) < 0) {
+        PyErr_SetString(PyExc_RuntimeError, "buffer_size can only be changed while vm_push is stopped");
+        return NULL;
+    }
+
+    size_t max_bytes;
+    unsigned int max_age_ms, max_lines;
+    vm_get_flush_policy(&max_bytes, &max_age_ms, &max_lines);
+    if (flush_bytes || flush_age_ms || flush_lines) {
+        max_bytes = flush_bytes ? (size_t) flush_bytes : max_bytes;
+        max_age_ms = flush_age_ms ? (unsigned int) flush_age_ms : max_age_ms;
+        max_lines = flush_lines ? (unsigned int) flush_lines : max_lines;
+        vm_set_flush_policy(max_bytes, max_age_ms, max_lines);
+    }
+    if (enable_gzip >= 0) {
+        vm_set_compression(enable_gzip);
+    }
+    if (concurrency > 0) {
+        vm_set_concurrency(concurrency);
+    }
+
+    return Py_BuildValue("{s:n,s:n,s:I,s:I,s:O,s:I}",
+        "buffer_size", (Py_ssize_t) vm_get_buffer_size(),
+        "flush_bytes", (Py_ssize_t) max_bytes,
+        "flush_age_ms", max_age_ms,
+        "flush_lines", max_lines,
+        "gzip", vm_get_compression() ? Py_True : Py_False,
+        "concurrency", vm_get_concurrency());
+}
+
+/* Callables registered with sniffer_sink_add(), by name. The dict holds the references used by the decoding threads */
+static PyObject * python_sinks = NULL;
+
+/* Called from the decoding threads. The GIL is taken once per batch, and the samples passed as columns */
+static void pycsh_sniffer_sink_call(void * ctx, const sniffer_sample_t * samples, size_t count) {
+
+    PyGILState_STATE state = PyGILState_Ensure();
+
+    PyObject * nodes = PyBytes_FromStringAndSize(NULL, count * sizeof(uint16_t));
+    PyObject * ids = PyBytes_FromStringAndSize(NULL, count * sizeof(uint16_t));
+    PyObject * idxs = PyBytes_FromStringAndSize(NULL, count * sizeof(uint32_t));
+    PyObject * times = PyBytes_FromStringAndSize(NULL, count * sizeof(uint64_t));
+    PyObject * values = PyBytes_FromStringAndSize(NULL, count * sizeof(double));
+
+    if (nodes && ids && idxs && times && values) {
+        uint16_t * node_buf = (uint16_t *) PyBytes_AS_STRING(nodes);
+        uint16_t * id_buf = (uint16_t *) PyBytes_AS_STRING(ids);
+        uint32_t * idx_buf = (uint32_t *) PyBytes_AS_STRING(idxs);
+        uint64_t * time_buf = (uint64_t *) PyBytes_AS_STRING(times);
+        double * value_buf = (double *) PyBytes_AS_STRING(values);
+        for (size_t i = 0; i < count; i++) {
+            node_buf[i] = samples[i].node;
+            id_buf[i] = samples[i].id;
+            idx_buf[i] = samples[i].idx;
+            time_buf[i] = samples[i].time_ms;
+            value_buf[i] = sniffer_value_double(&samples[i].value);
+        }
+    }
+
+    PyObject * nodes_view = pycsh_sniffer_array(nodes, "H");
+    PyObject * ids_view = pycsh_sniffer_array(ids, "H");
+    PyObject * idxs_view = pycsh_sniffer_array(idxs, "I");
+    PyObject * times_view = pycsh_sniffer_array(times, "Q");
+    PyObject * values_view = pycsh_sniffer_array(values, "d");
+
+    PyObject * result = NULL;
+    if (nodes_view && ids_view && idxs_view && times_view && values_view) {
+        result = PyObject_CallFunctionObjArgs(ctx, nodes_view, ids_view, idxs_view, times_view, values_view, NULL);
+    }
+    if (result == NULL) {
+        PyErr_WriteUnraisable(ctx);
+    }
+
+    Py_XDECREF(result);
+    Py_XDECREF(nodes_view);
+    Py_XDECREF(ids_view);
+    Py_XDECREF(idxs_view);
+    Py_XDECREF(times_view);
+    Py_XDECREF(values_view);
+
+    PyGILState_Release(state);
+}
+
+/* Remove the sink without holding the GIL, since a decoding thread may be waiting for it inside the sink */
+static void pycsh_sniffer_sink_remove_name(const char * name) {
+    Py_BEGIN_ALLOW_THREADS;
+    sniffer_sink_remove(name, NULL);
+    Py_END_ALLOW_THREADS;
+}
+
+/* Registered with atexit, so the decoding threads stop calling into Python before the interpreter is finalized */
+static PyObject * pycsh_sniffer_sinks_release(PyObject * self, PyObject * args) {
+
+    if (python_sinks == NULL) {
+        Py_RETURN_NONE;
+    }
+
+    PyObject * names = PyDict_Keys(python_sinks);
+    if (names == NULL) {
+        return NULL;
+    }
+    for (Py_ssize_t i = 0; i < PyList_GET_SIZE(names); i++) {
+        const char * name = PyUnicode_AsUTF8(PyList_GET_ITEM(names, i));
+        if (name) {
+            pycsh_sniffer_sink_remove_name(name);
+        }
+    }
+    Py_DECREF(names);
+    PyDict_Clear(python_sinks);
+
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef pycsh_sniffer_sinks_release_def = {
+    "_sniffer_sinks_release", pycsh_sniffer_sinks_release, METH_NOARGS, NULL
+};
+
+static int pycsh_sniffer_sinks_init(void) {
+
+    if (python_sinks) {
+        return 0;
+    }
+
+    PyObject * atexit = PyImport_ImportModule("atexit");
+    if (atexit == NULL) {
+        return -1;
+    }
+    PyObject * release = PyCFunction_New(&pycsh_sniffer_sinks_release_def, NULL);
+    PyObject * res = release ? PyObject_CallMethod(atexit, "register", "O", release) : NULL;
+    Py_XDECREF(release);
+    Py_DECREF(atexit);
+    if (res == NULL) {
+        return -1;
+    }
+    Py_DECREF(res);
+
+    python_sinks = PyDict_New();
+    return python_sinks ? 0 : -1;
+}
+
+static PyObject * pycsh_sniffer_sink_add(PyObject * self, PyObject * args, PyObject * kwds) {
+
+    char * name;
+    PyObject * callback;
+    static char * kwlist[] = {"name", "callback", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "sO", kwlist, &name, &callback)) {
+        return NULL;
+    }
+
+    if (!PyCallable_Check(callback)) {
+        PyErr_SetString(PyExc_TypeError, "callback must be callable");
+        return NULL;
+    }
+
+    if (pycsh_sniffer_sinks_init() < 0) {
+        return NULL;
+    }
+
+    if (PyDict_GetItemString(python_sinks, name) != NULL) {
+        PyErr_Format(PyExc_ValueError, "Sniffer sink '%s' already exists", name);
+        return NULL;
+    }
+    if (PyDict_SetItemString(python_sinks, name, callback) < 0) {
+        return NULL;
+    }
+
+    int res;
+    Py_BEGIN_ALLOW_THREADS;
+    res = sniffer_sink_add(name, pycsh_sniffer_sink_call, callback);
+    Py_END_ALLOW_THREADS;
+
+    if (res < 0) {
+        PyDict_DelItemString(python_sinks, name);
+        PyErr_Format(PyExc_ValueError, "Failed to add sniffer sink '%s', the name is taken or too long, or there are %d sinks already",
+                     name, SNIFFER_SINKS_MAX);
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject * pycsh_sniffer_sink_remove(PyObject * self, PyObject * args, PyObject * kwds) {
+
+    char * name;
+    static char * kwlist[] = {"name", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &name)) {
+        return NULL;
+    }
+
+    if (python_sinks == NULL || PyDict_GetItemString(python_sinks, name) == NULL) {
+        PyErr_Format(PyExc_KeyError, "No sniffer sink '%s'", name);
+        return NULL;
+    }
+
+    pycsh_sniffer_sink_remove_name(name);
+
+    /* No decoding thread is using the callback anymore */
+    PyDict_DelItemString(python_sinks, name);
+
+    Py_RETURN_NONE;
+}
+
+/* Subscription to the sniffed samples, through a ring registered as a sink */
+typedef struct {
+    PyObject_HEAD
+    sniffer_ring_t * ring;
+    char sink[SNIFFER_SINK_NAME_MAX];
+    int subscribed;
+    PyObject * pending;     // Future of the __anext__() waiting for the ring, if any
+} pycsh_subscription_t;
+
+/**
+ * One column of a batch taken from a subscription. Exports the ring memory without copying,
+ * and releases it to the ring when the last view of it is gone.
+ */
+typedef struct {
+    PyObject_HEAD
+    pycsh_subscription_t * subscription;
+    uint64_t lease;
+    void * data;
+    Py_ssize_t count;
+    Py_ssize_t itemsize;
+    const char * format;
+} pycsh_column_t;
+
+/* Columns of a batch: timestamps, nodes, ids, idxs and values */
+#define PYCSH_BATCH_COLUMNS 5
+
+/* How often a blocked iterator checks for signals such as KeyboardInterrupt */
+#define PYCSH_SUBSCRIPTION_POLL_MS 100
+
+static int pycsh_column_getbuffer(PyObject * obj, Py_buffer * view, int flags) {
+
+    pycsh_column_t * self = (pycsh_column_t *) obj;
+
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "Sniffed samples are read-only");
+        view->obj = NULL;
+        return -1;
+    }
+
+    Py_INCREF(obj);
+    view->obj = obj;
+    view->buf = self->data;
+    view->len = self->count * self->itemsize;
+    view->readonly = 1;
+    view->itemsize = self->itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? (char *) self->format : NULL;
+    view->ndim = 1;
+    view->shape = (flags & PyBUF_ND) ? &self->count : NULL;
+    view->strides = (flags & PyBUF_STRIDES) ? &self->itemsize : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static void pycsh_column_dealloc(PyObject * obj) {
+    pycsh_column_t * self = (pycsh_column_t *) obj;
+    sniffer_ring_release(self->subscription->ring, self->lease);
+    Py_DECREF(self->subscription);
+    PyObject_Del(obj);
+}
+
+static PyBufferProcs pycsh_column_as_buffer = {
+    .bf_getbuffer = pycsh_column_getbuffer,
+};
+
+static PyTypeObject pycsh_column_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "pycsh.SnifferColumn",
+    .tp_basicsize = sizeof(pycsh_column_t),
+    .tp_dealloc = pycsh_column_dealloc,
+    .tp_as_buffer = &pycsh_column_as_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Read-only column of sniffed samples, backed by the ring of a subscription.",
+};
+
+/* Wrap one column of span in a memoryview. Releases one reference to the span on failure */
+static PyObject * pycsh_subscription_column(pycsh_subscription_t * self, const sniffer_ring_span_t * span,
+                                            const void * data, Py_ssize_t itemsize, const char * format) {
+
+    pycsh_column_t * column = PyObject_New(pycsh_column_t, &pycsh_column_type);
+    if (column == NULL) {
+        sniffer_ring_release(self->ring, span->lease);
+        return NULL;
+    }
+    Py_INCREF(self);
+    column->subscription = self;
+    column->lease = span->lease;
+    column->data = (void *) data;
+    column->count = span->count;
+    column->itemsize = itemsize;
+    column->format = format;
+
+    PyObject * view = PyMemoryView_FromObject((PyObject *) column);
+    Py_DECREF(column);
+    return view;
+}
+
+static PyObject * pycsh_subscription_batch(pycsh_subscription_t * self, const sniffer_ring_span_t * span) {
+
+    PyObject * times = pycsh_subscription_column(self, span, span->times, sizeof(uint64_t), "Q");
+    PyObject * nodes = pycsh_subscription_column(self, span, span->nodes, sizeof(uint16_t), "H");
+    PyObject * ids = pycsh_subscription_column(self, span, span->ids, sizeof(uint16_t), "H");
+    PyObject * idxs = pycsh_subscription_column(self, span, span->idxs, sizeof(uint32_t), "I");
+    PyObject * values = pycsh_subscription_column(self, span, span->values, sizeof(double), "d");
+
+    if (times == NULL || nodes == NULL || ids == NULL || idxs == NULL || values == NULL) {
+        Py_XDECREF(times);
+        Py_XDECREF(nodes);
+        Py_XDECREF(ids);
+        Py_XDECREF(idxs);
+        Py_XDECREF(values);
+        return NULL;
+    }
+
+    return Py_BuildValue("(NNNNN)", times, nodes, ids, idxs, values);
+}
+
+static void pycsh_subscription_unsubscribe(pycsh_subscription_t * self) {
+
+    if (!self->subscribed) {
+        return;
+    }
+
+    Py_BEGIN_ALLOW_THREADS;
+    sniffer_sink_remove(self->sink, NULL);
+    sniffer_ring_close(self->ring);
+    Py_END_ALLOW_THREADS;
+    self->subscribed = 0;
+}
+
+static void pycsh_subscription_dealloc(PyObject * obj) {
+    pycsh_subscription_t * self = (pycsh_subscription_t *) obj;
+    if (self->ring) {
+        pycsh_subscription_unsubscribe(self);
+        sniffer_ring_destroy(self->ring);
+    }
+    Py_XDECREF(self->pending);
+    PyObject_Del(obj);
+}
+
+static PyObject * pycsh_subscription_next(PyObject * obj) {
+
+    pycsh_subscription_t * self = (pycsh_subscription_t *) obj;
+
+    sniffer_ring_span_t span;
+    int res;
+    while (1) {
+        Py_BEGIN_ALLOW_THREADS;
+        res = sniffer_ring_take(self->ring, &span, PYCSH_BATCH_COLUMNS, PYCSH_SUBSCRIPTION_POLL_MS);
+        Py_END_ALLOW_THREADS;
+        if (res != 0) {
+            break;
+        }
+        if (PyErr_CheckSignals() < 0) {
+            return NULL;
+        }
+    }
+
+    /* Closed and drained, ends the iteration */
+    if (res < 0) {
+        return NULL;
+    }
+
+    return pycsh_subscription_batch(self, &span);
+}
+
+/**
+ * Complete future with the next batch if there is one, or end the iteration if the subscription is closed.
+ * @return 1 if future was completed, 0 if there was nothing yet, -1 on error.
+ */
+static int pycsh_subscription_poll(pycsh_subscription_t * self, PyObject * future) {
+
+    sniffer_ring_fd_clear(self->ring);
+
+    sniffer_ring_span_t span;
+    int res = sniffer_ring_take(self->ring, &span, PYCSH_BATCH_COLUMNS, 0);
+    if (res == 0) {
+        return 0;
+    }
+
+    PyObject * done;
+    if (res > 0) {
+        PyObject * batch = pycsh_subscription_batch(self, &span);
+        if (batch == NULL) {
+            return -1;
+        }
+        done = PyObject_CallMethod(future, "set_result", "(N)", batch);
+    } else {
+        done = PyObject_CallMethod(future, "set_exception", "(O)", PyExc_StopAsyncIteration);
+    }
+    Py_XDECREF(done);
+
+    return done ? 1 : -1;
+}
+
+/* Reader callback of the event loop, with (subscription, future, loop) as self */
+static PyObject * pycsh_subscription_ready(PyObject * args, PyObject * unused) {
+
+    pycsh_subscription_t * self = (pycsh_subscription_t *) PyTuple_GET_ITEM(args, 0);
+    PyObject * future = PyTuple_GET_ITEM(args, 1);
+    PyObject * loop = PyTuple_GET_ITEM(args, 2);
+
+    /* The future may have been cancelled in the meantime */
+    PyObject * done = PyObject_CallMethod(future, "done", NULL);
+    if (done == NULL) {
+        return NULL;
+    }
+    int res = PyObject_IsTrue(done) ? 1 : pycsh_subscription_poll(self, future);
+    Py_DECREF(done);
+
+    if (res != 0) {
+        PyObject * type, * value, * traceback;
+        PyErr_Fetch(&type, &value, &traceback);
+        PyObject * removed = PyObject_CallMethod(loop, "remove_reader", "i", sniffer_ring_fd(self->ring));
+        Py_XDECREF(removed);
+        if (type) {
+            PyErr_Restore(type, value, traceback);
+        }
+    }
+    if (res < 0 || PyErr_Occurred()) {
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef pycsh_subscription_ready_def = {
+    "_subscription_ready", pycsh_subscription_ready, METH_NOARGS, NULL
+};
+
+static PyObject * pycsh_subscription_anext(PyObject * obj) {
+
+    pycsh_subscription_t * self = (pycsh_subscription_t *) obj;
+
+    /* The ring has a single reader callback in the event loop, so only one __anext__() may wait at a time */
+    if (self->pending) {
+        PyObject * done = PyObject_CallMethod(self->pending, "done", NULL);
+        if (done == NULL) {
+            return NULL;
+        }
+        int waiting = !PyObject_IsTrue(done);
+        Py_DECREF(done);
+        if (waiting) {
+            PyErr_SetString(PyExc_RuntimeError, "anext() called while another anext() is already waiting for samples");
+            return NULL;
+        }
+        Py_CLEAR(self->pending);
+    }
+
+    PyObject * asyncio = PyImport_ImportModule("asyncio");
+    if (asyncio == NULL) {
+        return NULL;
+    }
+    PyObject * loop = PyObject_CallMethod(asyncio, "get_running_loop", NULL);
+    Py_DECREF(asyncio);
+    if (loop == NULL) {
+        return NULL;
+    }
+    PyObject * future = PyObject_CallMethod(loop, "create_future", NULL);
+    if (future == NULL) {
+        Py_DECREF(loop);
+        return NULL;
+    }
+
+    int res = pycsh_subscription_poll(self, future);
+    if (res == 0) {
+        /* Wait for the ring to signal new samples, without blocking the event loop */
+        PyObject * state = Py_BuildValue("(OOO)", self, future, loop);
+        PyObject * callback = state ? PyCFunction_New(&pycsh_subscription_ready_def, state) : NULL;
+        PyObject * added = callback ? PyObject_CallMethod(loop, "add_reader", "iO", sniffer_ring_fd(self->ring), callback) : NULL;
+        Py_XDECREF(state);
+        Py_XDECREF(callback);
+        res = added ? 1 : -1;
+        Py_XDECREF(added);
+        if (added) {
+            Py_INCREF(future);
+            self->pending = future;
+        }
+    }
+    Py_DECREF(loop);
+
+    if (res < 0) {
+        Py_DECREF(future);
+        return NULL;
+    }
+    return future;
+}
+
+static PyObject * pycsh_subscription_self(PyObject * self) {
+    Py_INCREF(self);
+    return self;
+}
+
+static PyObject * pycsh_subscription_close(PyObject * self, PyObject * args) {
+    pycsh_subscription_unsubscribe((pycsh_subscription_t *) self);
+    Py_RETURN_NONE;
+}
+
+static PyObject * pycsh_subscription_enter(PyObject * self, PyObject * args) {
+    return pycsh_subscription_self(self);
+}
+
+static PyObject * pycsh_subscription_exit(PyObject * self, PyObject * args) {
+    return pycsh_subscription_close(self, NULL);
+}
+
+static PyObject * pycsh_subscription_dropped(PyObject * self, void * closure) {
+    return PyLong_FromUnsignedLongLong(sniffer_ring_dropped(((pycsh_subscription_t *) self)->ring));
+}
+
+static PyMethodDef pycsh_subscription_methods[] = {
+    {"close", pycsh_subscription_close, METH_NOARGS,
+        "close() -> None\n\nStop receiving samples. Iteration ends once the samples already received are taken."},
+    {"__enter__", pycsh_subscription_enter, METH_NOARGS, NULL},
+    {"__exit__", pycsh_subscription_exit, METH_VARARGS, NULL},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef pycsh_subscription_getset[] = {
+    {"dropped", pycsh_subscription_dropped, NULL, "Samples dropped because the ring was full.", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyAsyncMethods pycsh_subscription_as_async = {
+    .am_aiter = pycsh_subscription_self,
+    .am_anext = pycsh_subscription_anext,
+};
+
+static PyTypeObject pycsh_subscription_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "pycsh.SnifferSubscription",
+    .tp_basicsize = sizeof(pycsh_subscription_t),
+    .tp_dealloc = pycsh_subscription_dealloc,
+    .tp_as_async = &pycsh_subscription_as_async,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Batches of sniffed samples, from sniffer_subscribe().",
+    .tp_iter = pycsh_subscription_self,
+    .tp_iternext = pycsh_subscription_next,
+    .tp_methods = pycsh_subscription_methods,
+    .tp_getset = pycsh_subscription_getset,
+};
+
+static PyObject * pycsh_sniffer_subscribe(PyObject * self, PyObject * args, PyObject * kwds) {
+
+    Py_ssize_t capacity = 65536;
+    static char * kwlist[] = {"capacity", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|n", kwlist, &capacity)) {
+        return NULL;
+    }
+
+    if (capacity <= 0) {
+        PyErr_SetString(PyExc_ValueError, "capacity must be positive");
+        return NULL;
+    }
+
+    pycsh_subscription_t * sub = PyObject_New(pycsh_subscription_t, &pycsh_subscription_type);
+    if (sub == NULL) {
+        return NULL;
+    }
+    sub->subscribed = 0;
+    sub->pending = NULL;
+    sub->ring = sniffer_ring_create(capacity);
+    if (sub->ring == NULL) {
+        Py_DECREF(sub);
+        return PyErr_NoMemory();
+    }
+
+    snprintf(sub->sink, sizeof(sub->sink), "subscription-%p", (void *) sub);
+    int res;
+    Py_BEGIN_ALLOW_THREADS;
+    res = sniffer_sink_add(sub->sink, sniffer_ring_push, sub->ring);
+    Py_END_ALLOW_THREADS;
+    if (res < 0) {
+        Py_DECREF(sub);
+        PyErr_Format(PyExc_RuntimeError, "Failed to subscribe, there are %d sniffer sinks already", SNIFFER_SINKS_MAX);
+        return NULL;
+    }
+    sub->subscribed = 1;
+
+    return (PyObject *) sub;
+}
+
+static PyObject * pycsh_sniffer_filter(PyObject * self, PyObject * args, PyObject * kwds) {
+
+    char * nodes = NULL;
+    char * ports = NULL;
+    char * allow = NULL;
+    char * deny = NULL;
+    static char * kwlist[] = {"nodes", "ports", "allow", "deny", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|zzzz", kwlist, &nodes, &ports, &allow, &deny)) {
+        return NULL;
+    }
+
+    if (sniffer_filter_set(nodes, ports, allow, deny) < 0) {
+        PyErr_SetString(PyExc_ValueError, "Malformed ranges, expected numbers and ranges like '1-10,20'");
+        return NULL;
+    }
+
+    sniffer_filter_settings_t * current = PyMem_Malloc(sizeof(sniffer_filter_settings_t));
+    if (current == NULL) {
+        return PyErr_NoMemory();
+    }
+    sniffer_filter_get(current);
+    PyObject * dict = Py_BuildValue("{s:s,s:s,s:s,s:s}",
+        "nodes", current->nodes, "ports", current->ports, "allow", current->allow, "deny", current->deny);
+    PyMem_Free(current);
+
+    return dict;
+}
+
+static PyObject * pycsh_sniffer_filter_clear(PyObject * self, PyObject * args) {
+    sniffer_filter_clear();
+    Py_RETURN_NONE;
+}
+
+static PyObject * pycsh_sniffer_agg(PyObject * self, PyObject * args, PyObject * kwds) {
+
+    char * pattern;
+    unsigned int window_ms;
+    char * stats_text = "all";
+    int node = -1;
+    static char * kwlist[] = {"pattern", "window_ms", "stats", "node", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "sI|si", kwlist, &pattern, &window_ms, &stats_text, &node)) {
+        return NULL;
+    }
+
+    unsigned int stats = sniffer_agg_parse_stats(stats_text);
+    if (stats == 0) {
+        PyErr_SetString(PyExc_ValueError, "Malformed stats, expected a list like 'min,max,mean,last,count' or 'all'");
+        return NULL;
+    }
+    if (sniffer_agg_rule_add(pattern, node, window_ms, stats) < 0) {
+        PyErr_Format(PyExc_ValueError, "Invalid rule, or more than %d rules", SNIFFER_AGG_RULES_MAX);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject * pycsh_sniffer_agg_remove(PyObject * self, PyObject * args, PyObject * kwds) {
+
+    char * pattern;
+    int node = -1;
+    static char * kwlist[] = {"pattern", "node", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|i", kwlist, &pattern, &node)) {
+        return NULL;
+    }
+
+    if (sniffer_agg_rule_remove(pattern, node) < 0) {
+        PyErr_Format(PyExc_KeyError, "No rule for %s", pattern);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject * pycsh_sniffer_agg_clear(PyObject * self, PyObject * args) {
+    sniffer_agg_clear();
+    Py_RETURN_NONE;
+}
+
+static PyObject * pycsh_sniffer_agg_flush(PyObject * self, PyObject * args) {
+    sniffer_agg_flush();
+    Py_RETURN_NONE;
+}
+
+static PyObject * pycsh_sniffer_agg_rules(PyObject * self, PyObject * args) {
+
+    sniffer_agg_rule_t rules[SNIFFER_AGG_RULES_MAX];
+    size_t count = sniffer_agg_rules(rules, SNIFFER_AGG_RULES_MAX);
+
+    PyObject * list = PyList_New(count);
+    if (list == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        char stats[64];
+        sniffer_agg_format_stats(rules[i].stats, stats, sizeof(stats));
+        PyObject * item = Py_BuildValue("(sIsi)", rules[i].pattern, (unsigned int) rules[i].window_ms, stats, rules[i].node);
+        if (item == NULL) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, i, item);
+    }
+    return list;
+}
+
+static PyObject * pycsh_sniffer_dedup(PyObject * self, PyObject * args, PyObject * kwds) {
+
+    int enable = 1;
+    unsigned int window_ms = SNIFFER_DEDUP_WINDOW_MS_DEFAULT;
+    Py_ssize_t capacity = SNIFFER_DEDUP_CAPACITY_DEFAULT;
+    static char * kwlist[] = {"enable", "window_ms", "capacity", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|pIn", kwlist, &enable, &window_ms, &capacity)) {
+        return NULL;
+    }
+
+    if (!enable) {
+        sniffer_dedup_disable();
+        Py_RETURN_NONE;
+    }
+    if (window_ms == 0 || capacity <= 0) {
+        PyErr_SetString(PyExc_ValueError, "window_ms and capacity must be positive");
+        return NULL;
+    }
+
+    int res;
+    Py_BEGIN_ALLOW_THREADS;
+    res = sniffer_dedup_enable(window_ms, capacity);
+    Py_END_ALLOW_THREADS;
+    if (res < 0) {
+        return PyErr_NoMemory();
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject * pycsh_vm_change_only(PyObject * self, PyObject * args, PyObject * kwds) {
+
+    int enable = 1;
+    unsigned int heartbeat_ms = VM_CHANGE_HEARTBEAT_MS_DEFAULT;
+    Py_ssize_t capacity = VM_CHANGE_CAPACITY_DEFAULT;
+    static char * kwlist[] = {"enable", "heartbeat_ms", "capacity", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|pIn", kwlist, &enable, &heartbeat_ms, &capacity)) {
+        return NULL;
+    }
+
+    if (!enable) {
+        vm_change_disable();
+        Py_RETURN_NONE;
+    }
+    if (heartbeat_ms == 0 || capacity <= 0) {
+        PyErr_SetString(PyExc_ValueError, "heartbeat_ms and capacity must be positive");
+        return NULL;
+    }
+
+    int res;
+    Py_BEGIN_ALLOW_THREADS;
+    res = vm_change_enable(heartbeat_ms, capacity);
+    Py_END_ALLOW_THREADS;
+    if (res < 0) {
+        return PyErr_NoMemory();
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject * pycsh_sniffer_cache(PyObject * self, PyObject * args, PyObject * kwds) {
+
+    int enable = 1;
+    Py_ssize_t history = SNIFFER_CACHE_HISTORY_DEFAULT;
+    Py_ssize_t max_series = SNIFFER_CACHE_SERIES_DEFAULT;
+    static char * kwlist[] = {"enable", "history", "max_series", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|pnn", kwlist, &enable, &history, &max_series)) {
+        return NULL;
+    }
+
+    if (!enable) {
+        Py_BEGIN_ALLOW_THREADS;
+        sniffer_cache_disable();
+        Py_END_ALLOW_THREADS;
+        Py_RETURN_NONE;
+    }
+    if (history <= 0 || max_series <= 0) {
+        PyErr_SetString(PyExc_ValueError, "history and max_series must be positive");
+        return NULL;
+    }
+
+    int res;
+    Py_BEGIN_ALLOW_THREADS;
+    res = sniffer_cache_enable(history, max_series);
+    Py_END_ALLOW_THREADS;
+    if (res < 0) {
+        PyErr_SetString(PyExc_RuntimeError, "Failed to add the cache sink");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject * pycsh_sniffer_value_object(const sniffer_value_t * value) {
+    switch (value->kind) {
+        case SNIFFER_VALUE_UINT:
+            return PyLong_FromUnsignedLongLong(value->u);
+        case SNIFFER_VALUE_INT:
+            return PyLong_FromLongLong(value->i);
+        case SNIFFER_VALUE_DOUBLE:
+        default:
+            return PyFloat_FromDouble(value->d);
+    }
+}
+
+static PyObject * pycsh_sniffer_latest(PyObject * self, PyObject * args, PyObject * kwds) {
+
+    unsigned short node, id;
+    unsigned int idx = 0;
+    static char * kwlist[] = {"node", "id", "idx", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "HH|I", kwlist, &node, &id, &idx)) {
+        return NULL;
+    }
+
+    uint64_t time_ms;
+    sniffer_value_t value;
+    if (sniffer_cache_latest(node, id, idx, &time_ms, &value) < 0) {
+        Py_RETURN_NONE;
+    }
+    return Py_BuildValue("(KN)", (unsigned long long) time_ms, pycsh_sniffer_value_object(&value));
+}
+
+static PyObject * pycsh_sniffer_history(PyObject * self, PyObject * args, PyObject * kwds) {
+
+    unsigned short node, id;
+    unsigned int idx = 0;
+    PyObject * count_obj = Py_None;
+    static char * kwlist[] = {"node", "id", "idx", "count", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "HH|IO", kwlist, &node, &id, &idx, &count_obj)) {
+        return NULL;
+    }
+
+    size_t max = sniffer_cache_history_size();
+    if (count_obj != Py_None) {
+        Py_ssize_t count = PyNumber_AsSsize_t(count_obj, PyExc_OverflowError);
+        if (count == -1 && PyErr_Occurred()) {
+            return NULL;
+        }
+        if (count < 0) {
+            PyErr_SetString(PyExc_ValueError, "count must not be negative");
+            return NULL;
+        }
+        if ((size_t) count < max) {
+            max = count;
+        }
+    }
+
+    PyObject * times = PyBytes_FromStringAndSize(NULL, max * sizeof(uint64_t));
+    sniffer_value_t * samples = PyMem_Malloc((max ? max : 1) * sizeof(sniffer_value_t));
+    if (times == NULL || samples == NULL) {
+        Py_XDECREF(times);
+        PyMem_Free(samples);
+        return PyErr_NoMemory();
+    }
+
+    uint64_t * times_buf = (uint64_t *) PyBytes_AS_STRING(times);
+    size_t found;
+    Py_BEGIN_ALLOW_THREADS;
+    found = sniffer_cache_history(node, id, idx, times_buf, samples, max);
+    Py_END_ALLOW_THREADS;
+
+    /* The history may have been shortened by re-enabling the cache in between */
+    if (found < max && _PyBytes_Resize(&times, found * sizeof(uint64_t)) < 0) {
+        PyMem_Free(samples);
+        return NULL;
+    }
+
+    sniffer_value_kind_e kind = found ? samples[0].kind : SNIFFER_VALUE_DOUBLE;
+    PyObject * values = PyBytes_FromStringAndSize(NULL, found * sizeof(uint64_t));
+    if (values == NULL) {
+        Py_DECREF(times);
+        PyMem_Free(samples);
+        return NULL;
+    }
+    uint64_t * values_buf = (uint64_t *) PyBytes_AS_STRING(values);
+    for (size_t i = 0; i < found; i++) {
+        values_buf[i] = samples[i].u;
+    }
+    PyMem_Free(samples);
+
+    PyObject * times_view = pycsh_sniffer_array(times, "Q");
+    PyObject * values_view = pycsh_sniffer_array(values, pycsh_sniffer_value_format(kind));
+    if (times_view == NULL || values_view == NULL) {
+        Py_XDECREF(times_view);
+        Py_XDECREF(values_view);
+        return NULL;
+    }
+
+    return Py_BuildValue("(NN)", times_view, values_view);
+}
+
+typedef struct {
+    uint64_t * keys;
+    size_t count;
+    size_t size;
+} pycsh_cache_keys_t;
+
+static void pycsh_cache_key_add(void * ctx, uint16_t node, uint16_t id, uint32_t idx, uint64_t time_ms, const sniffer_value_t * value) {
+    pycsh_cache_keys_t * keys = ctx;
+    if (keys->count == keys->size) {
+        size_t size = keys->size ? keys->size * 2 : 256;
+        uint64_t * grown = realloc(keys->keys, size * sizeof(uint64_t));
+        if (grown == NULL) {
+            return;
+        }
+        keys->keys = grown;
+        keys->size = size;
+    }
+    keys->keys[keys->count++] = ((uint64_t) node << 48) | ((uint64_t) id << 32) | idx;
+}
+
+static PyObject * pycsh_sniffer_cache_series(PyObject * self, PyObject * args) {
+
+    /* Collected without the GIL, as the shard locks are held meanwhile */
+    pycsh_cache_keys_t keys = {0};
+    Py_BEGIN_ALLOW_THREADS;
+    sniffer_cache_foreach(pycsh_cache_key_add, &keys);
+    Py_END_ALLOW_THREADS;
+
+    PyObject * list = PyList_New(keys.count);
+    if (list == NULL) {
+        free(keys.keys);
+        return NULL;
+    }
+    for (size_t i = 0; i < keys.count; i++) {
+        uint64_t key = keys.keys[i];
+        PyObject * item = Py_BuildValue("(III)", (unsigned int) (key >> 48), (unsigned int) ((key >> 32) & 0xFFFF), (unsigned int) (key & 0xFFFFFFFF));
+        if (item == NULL) {
+            Py_DECREF(list);
+            free(keys.keys);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, i, item);
+    }
+    free(keys.keys);
+
+    return list;
+}
+
+static PyObject * pycsh_prometheus_start(PyObject * self, PyObject * args, PyObject * kwds) {
+
+    unsigned short port = PROMETHEUS_PORT_DEFAULT;
+    char * address = PROMETHEUS_ADDRESS_DEFAULT;
+    static char * kwlist[] = {"port", "address", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Hs", kwlist, &port, &address)) {
+        return NULL;
+    }
+
+    int res;
+    Py_BEGIN_ALLOW_THREADS;
+    res = prometheus_start(address, port);
+    Py_END_ALLOW_THREADS;
+    if (res < 0) {
+        if (prometheus_started) {
+            PyErr_SetString(PyExc_RuntimeError, "The Prometheus endpoint is already started");
+        } else {
+            PyErr_Format(PyExc_OSError, "Failed to listen on %s:%u", address, port);
+        }
+        return NULL;
+    }
+    return PyLong_FromLong(res);
+}
+
+static PyObject * pycsh_prometheus_stop(PyObject * self, PyObject * args) {
+    Py_BEGIN_ALLOW_THREADS;
+    prometheus_stop();
+    Py_END_ALLOW_THREADS;
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef sniffer_methods[] = {
+    {"sniffer_store_open", (PyCFunction) pycsh_sniffer_store_open, METH_VARARGS | METH_KEYWORDS,
+        "sniffer_store_open(path: str) -> None\n\nStart recording sniffed samples to a compressed columnar store at path."},
+    {"sniffer_store_close", pycsh_sniffer_store_close, METH_NOARGS,
+        "sniffer_store_close() -> None\n\nWrite pending chunks and stop recording sniffed samples."},
+    {"sniffer_store_series", (PyCFunction) pycsh_sniffer_store_series, METH_VARARGS | METH_KEYWORDS,
+        "sniffer_store_series(path: str) -> list[tuple[int, int, int]]\n\nList the (node, id, idx) series in a store."},
+    {"sniffer_store_read", (PyCFunction) pycsh_sniffer_store_read, METH_VARARGS | METH_KEYWORDS,
+        "sniffer_store_read(path: str, node: int, id: int, idx: int = 0) -> tuple[memoryview, memoryview]\n\n"
+        "Read a series from a store. Returns timestamps in milliseconds (format 'Q'),\n"
+        "and values (format 'Q', 'q' or 'd' depending on the parameter type)."},
+    {"sniffer_capture_open", (PyCFunction) pycsh_sniffer_capture_open, METH_VARARGS | METH_KEYWORDS,
+        "sniffer_capture_open(path: str) -> None\n\nStart recording raw packets read by the sniffer to path."},
+    {"sniffer_capture_close", pycsh_sniffer_capture_close, METH_NOARGS,
+        "sniffer_capture_close() -> None\n\nStop recording raw packets."},
+    {"sniffer_replay", (PyCFunction) pycsh_sniffer_replay, METH_VARARGS | METH_KEYWORDS,
+        "sniffer_replay(path: str) -> int\n\n"
+        "Feed a capture through the sniffer as fast as possible, without a CSP interface.\n"
+        "Samples go to the same outputs as live ones (VictoriaMetrics, log file, store). Returns the number of packets replayed."},
+    {"sniffer_param_cache_invalidate", pycsh_sniffer_param_cache_invalidate, METH_NOARGS,
+        "sniffer_param_cache_invalidate() -> None\n\n"
+        "Make the sniffer look up parameters in the list again.\n"
+        "Done automatically whenever parameters are added to or removed from the list, by any means."},
+    {"hk_timesync_add", (PyCFunction) pycsh_hk_timesync_add, METH_VARARGS | METH_KEYWORDS,
+        "hk_timesync_add(node: int, param_id: int) -> None\n\n"
+        "Register a HK parameter of node holding its UNIX time, so the HK epoch of node is tracked automatically."},
+    {"sniffer_unknown_params", pycsh_sniffer_unknown_params, METH_NOARGS,
+        "sniffer_unknown_params() -> list[tuple[int, int, int]]\n\n"
+        "List the (node, id, count) of sniffed parameters not found in the parameter list."},
+    {"sniffer_unknown_clear", pycsh_sniffer_unknown_clear, METH_NOARGS,
+        "sniffer_unknown_clear() -> None\n\nForget the sniffed parameters not found in the parameter list."},
+    {"sniffer_resolver", (PyCFunction) pycsh_sniffer_resolver, METH_VARARGS | METH_KEYWORDS,
+        "sniffer_resolver(enable: bool, timeout_ms: int = 1000, version: int = 2) -> None\n\n"
+        "Download the parameter lists of nodes sending unknown parameters, from a background thread."},
+    {"sniffer_stats", pycsh_sniffer_stats, METH_NOARGS,
+        "sniffer_stats() -> dict\n\n"
+        "Snapshot of the telemetry ingest counters. Histograms are lists of (upper bound, count),\n"
+        "the last bound being infinity."},
+    {"sniffer_stats_reset", pycsh_sniffer_stats_reset, METH_NOARGS,
+        "sniffer_stats_reset() -> None\n\nZero the telemetry ingest counters."},
+    {"sniffer_log_config", (PyCFunction) pycsh_sniffer_log_config, METH_VARARGS | METH_KEYWORDS,
+        "sniffer_log_config(commit_bytes: int | None = None, commit_ms: int | None = None, rotate_bytes: int | None = None,\n"
+        "                   rotate_seconds: int | None = None, keep: int | None = None, queue_bytes: int | None = None) -> dict\n\n"
+        "Set when param_sniffer.log is written and rotated, and return the current settings. None leaves a setting unchanged.\n"
+        "Lines are queued in memory, up to queue_bytes which can only be changed before the log is opened.\n"
+        "Queued lines are written once commit_bytes are queued or the oldest is commit_ms old. The file is rotated to\n"
+        "<path>.1 .. <path>.<keep> when it exceeds rotate_bytes or has been written for rotate_seconds, 0 disables either."},
+    {"sniffer_workers", (PyCFunction) pycsh_sniffer_workers, METH_VARARGS | METH_KEYWORDS,
+        "sniffer_workers(count: int | None = None) -> int\n\n"
+        "Set the number of threads decoding sniffed packets, 0 for one per CPU (the default), up to 8.\n"
+        "Only possible before the sniffer starts. Returns the number of workers running."},
+    {"vm_spool_open", (PyCFunction) pycsh_vm_spool_open, METH_VARARGS | METH_KEYWORDS,
+        "vm_spool_open(path: str, max_mb: int = 1024) -> None\n\n"
+        "Spool VictoriaMetrics lines to the directory path while the buffer is full or the server unreachable.\n"
+        "Spooled lines are pushed alongside live data once the server is back. Beyond max_mb, the oldest are deleted."},
+    {"vm_spool_close", pycsh_vm_spool_close, METH_NOARGS,
+        "vm_spool_close() -> None\n\nStop spooling. Lines already spooled are kept for the next vm_spool_open()."},
+    {"vm_config", (PyCFunction) pycsh_vm_config, METH_VARARGS | METH_KEYWORDS,
+        "vm_config(buffer_size: int = 0, flush_bytes: int = 0, flush_age_ms: int = 0, flush_lines: int = 0, gzip: bool | None = None,\n"
+        "          concurrency: int = 0) -> dict\n\n"
+        "Set how lines are sent to VictoriaMetrics, and return the current settings. Arguments left at 0 or None are unchanged.\n"
+        "buffer_size is the capacity in bytes of each of the two ingest buffers, and can only be changed while vm_push is stopped.\n"
+        "A batch is pushed once it holds flush_bytes or flush_lines, or its oldest line is flush_age_ms old.\n"
+        "gzip compresses pushed batches (Content-Encoding: gzip).\n"
+        "concurrency is the number of push requests in flight at once, up to 32, and applies from the next start of vm_push."},
+    {"sniffer_sink_add", (PyCFunction) pycsh_sniffer_sink_add, METH_VARARGS | METH_KEYWORDS,
+        "sniffer_sink_add(name: str, callback: Callable[[memoryview, memoryview, memoryview, memoryview, memoryview], None]) -> None\n\n"
+        "Call callback with each batch of decoded samples, as columns: nodes ('H'), ids ('H'), idxs ('I'),\n"
+        "timestamps in milliseconds ('Q') and values converted to double ('d').\n"
+        "The callback runs in the decoding threads, and takes the GIL once per batch."},
+    {"sniffer_sink_remove", (PyCFunction) pycsh_sniffer_sink_remove, METH_VARARGS | METH_KEYWORDS,
+        "sniffer_sink_remove(name: str) -> None\n\nStop calling the sink added under name."},
+    {"sniffer_subscribe", (PyCFunction) pycsh_sniffer_subscribe, METH_VARARGS | METH_KEYWORDS,
+        "sniffer_subscribe(capacity: int = 65536) -> SnifferSubscription\n\n"
+        "Subscribe to sniffed samples, buffered in a ring of capacity samples. The subscription is an iterator\n"
+        "and an async iterator, yielding batches as (timestamps, nodes, ids, idxs, values) memoryviews\n"
+        "of formats 'Q', 'H', 'H', 'I' and 'd'. They refer directly to the ring, which reuses the memory\n"
+        "once they are released. Samples arriving while the ring is full are dropped, and counted in .dropped.\n"
+        "Only one anext() may wait at a time, another raises RuntimeError."},
+    {"sniffer_filter", (PyCFunction) pycsh_sniffer_filter, METH_VARARGS | METH_KEYWORDS,
+        "sniffer_filter(nodes: str = None, ports: str = None, allow: str = None, deny: str = None) -> dict\n\n"
+        "Drop sniffed traffic before it is decoded. Each argument is a list of numbers and ranges like '1-10,20',\n"
+        "and '' removes that part of the filter. nodes and ports select packets (and nodes also parameters of other nodes),\n"
+        "allow and deny select parameter ids. Arguments left out are unchanged. Returns the current settings."},
+    {"sniffer_filter_clear", pycsh_sniffer_filter_clear, METH_NOARGS,
+        "sniffer_filter_clear() -> None\n\nAccept all sniffed traffic again."},
+    {"sniffer_agg", (PyCFunction) pycsh_sniffer_agg, METH_VARARGS | METH_KEYWORDS,
+        "sniffer_agg(pattern: str, window_ms: int, stats: str = 'all', node: int = -1) -> None\n\n"
+        "Downsample the parameters whose name matches the glob pattern before they are sent to VictoriaMetrics.\n"
+        "Each series is reduced to the stats 'last' (under its own name), 'min', 'max', 'mean' and 'count'\n"
+        "(as name_min etc.) per tumbling window of window_ms. The log, store and sinks still get every sample.\n"
+        "Replaces the rule with the same pattern and node. The first matching rule applies."},
+    {"sniffer_agg_remove", (PyCFunction) pycsh_sniffer_agg_remove, METH_VARARGS | METH_KEYWORDS,
+        "sniffer_agg_remove(pattern: str, node: int = -1) -> None\n\nRemove a downsampling rule."},
+    {"sniffer_agg_clear", pycsh_sniffer_agg_clear, METH_NOARGS,
+        "sniffer_agg_clear() -> None\n\nRemove all downsampling rules, sending every sample to VictoriaMetrics again."},
+    {"sniffer_agg_flush", pycsh_sniffer_agg_flush, METH_NOARGS,
+        "sniffer_agg_flush() -> None\n\nClose all open downsampling windows now."},
+    {"sniffer_agg_rules", pycsh_sniffer_agg_rules, METH_NOARGS,
+        "sniffer_agg_rules() -> list[tuple[str, int, str, int]]\n\nList the downsampling rules as (pattern, window_ms, stats, node)."},
+    {"sniffer_dedup", (PyCFunction) pycsh_sniffer_dedup, METH_VARARGS | METH_KEYWORDS,
+        "sniffer_dedup(enable: bool = True, window_ms: int = 600000, capacity: int = 262144) -> None\n\n"
+        "Drop sniffed samples whose node, id, index, timestamp and value were seen within window_ms,\n"
+        "as with relayed copies, retransmits and repeated HK downloads. Up to capacity samples are remembered\n"
+        "per generation, using 48 bytes each. Enabling again forgets the samples seen so far."},
+    {"vm_change_only", (PyCFunction) pycsh_vm_change_only, METH_VARARGS | METH_KEYWORDS,
+        "vm_change_only(enable: bool = True, heartbeat_ms: int = 60000, capacity: int = 262144) -> None\n\n"
+        "Only send samples to VictoriaMetrics when their value changed, or the last one sent is heartbeat_ms old.\n"
+        "Applies to sniffed samples and vm_add_param(). Keep heartbeat_ms below the staleness interval of\n"
+        "VictoriaMetrics (5 minutes). Up to capacity series are tracked, others are always sent."},
+    {"sniffer_cache", (PyCFunction) pycsh_sniffer_cache, METH_VARARGS | METH_KEYWORDS,
+        "sniffer_cache(enable: bool = True, history: int = 1024, max_series: int = 65536) -> None\n\n"
+        "Keep the latest value and the last history samples of every sniffed series in memory, for sniffer_latest()\n"
+        "and sniffer_history(). Up to max_series series are cached. Enabling again empties the cache."},
+    {"sniffer_latest", (PyCFunction) pycsh_sniffer_latest, METH_VARARGS | METH_KEYWORDS,
+        "sniffer_latest(node: int, id: int, idx: int = 0) -> tuple[int, int | float] | None\n\n"
+        "Latest cached sample of a series as (time in milliseconds, value), or None if it has not been seen."},
+    {"sniffer_history", (PyCFunction) pycsh_sniffer_history, METH_VARARGS | METH_KEYWORDS,
+        "sniffer_history(node: int, id: int, idx: int = 0, count: int | None = None) -> tuple[memoryview, memoryview]\n\n"
+        "Up to count of the newest cached samples of a series, oldest first. Returns timestamps in milliseconds\n"
+        "(format 'Q'), and values (format 'Q', 'q' or 'd' depending on the parameter type)."},
+    {"sniffer_cache_series", pycsh_sniffer_cache_series, METH_NOARGS,
+        "sniffer_cache_series() -> list[tuple[int, int, int]]\n\nList the (node, id, idx) series in the cache."},
+    {"prometheus_start", (PyCFunction) pycsh_prometheus_start, METH_VARARGS | METH_KEYWORDS,
+        "prometheus_start(port: int = 9101, address: str = '127.0.0.1') -> int\n\n"
+        "Serve the latest value of every sniffed series, and the ingest statistics, at http://address:port/metrics\n"
+        "for Prometheus to scrape. Enables sniffer_cache() with a history of 1 if it is not enabled.\n"
+        "Port 0 picks a free port. Returns the port listened on."},
+    {"prometheus_stop", pycsh_prometheus_stop, METH_NOARGS,
+        "prometheus_stop() -> None\n\nStop serving metrics to Prometheus."},
+    {NULL, NULL, 0, NULL}
+};
+
+int pycsh_sniffer_add_methods(PyObject * module) {
+    if (PyType_Ready(&pycsh_column_type) < 0 || PyType_Ready(&pycsh_subscription_type) < 0) {
+        return -1;
+    }
+    return PyModule_AddFunctions(module, sniffer_methods);
+}
@@ -0,0 +1,565 @@
+/*
+ * sniffer_agg.c
+ *
+ * See sniffer_agg.h
+ *
+ * Rules are matched by name, so the match of each (node, id) is cached per thread and revalidated when the rules
+ * or the parameter list change.
+ * Series live in one open addressing table under agg_lock, and are kept until the rules change.
+ */
+
+#include "sniffer_agg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <fnmatch.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <slash/slash.h>
+#include <slash/optparse.h>
+
+#include "metric_format.h"
+#include "sniffer_stats.h"
+#include "sniffer_sink.h"
+#include "sniffer_param_cache.h"
+#include "victoria_metrics.h"
+
+extern int vm_running;
+
+#define AGG_TABLE_INITIAL  1024
+#define AGG_MATCH_CACHE    1024  // Entries of the per thread match cache, a power of two
+#define AGG_OUT_SIZE       (64 * 1024)
+#define AGG_LINE_MAX       512
+
+typedef struct {
+    uint64_t key;           // node << 48 | id << 32 | idx
+    char * name;            // NULL if the slot is free
+    uint16_t node;
+    uint8_t precision;      // Digits of doubles, as the sniffer renders them
+    uint8_t stats;
+    uint32_t window_ms;
+    uint64_t window_start;  // Sample time of the open window
+    uint64_t touched_ms;    // Monotonic time of the last sample
+    uint32_t count;         // Samples in the open window, 0 if none is open
+    double min, max, sum;
+    sniffer_value_t last;
+} agg_series_t;
+
+static pthread_mutex_t agg_lock = PTHREAD_MUTEX_INITIALIZER;
+static sniffer_agg_rule_t rules[SNIFFER_AGG_RULES_MAX];
+static size_t rule_count = 0;
+static atomic_uint agg_generation = 1;
+static atomic_int agg_active = 0;
+
+static agg_series_t * table = NULL;
+static size_t table_size = 0;
+static size_t table_used = 0;
+static char agg_out[AGG_OUT_SIZE];
+static size_t agg_out_len = 0;
+static unsigned int agg_out_lines = 0;
+
+typedef struct {
+    uint32_t key;                    // Node and id, 0 for an empty entry
+    unsigned int generation;         // Of the rules
+    unsigned int list_generation;    // Of the parameter list, a (node, id) may be renamed by a new list
+    int rule;
+} agg_match_t;
+
+static __thread agg_match_t * match_cache = NULL;
+static pthread_key_t match_key;
+static pthread_once_t match_key_once = PTHREAD_ONCE_INIT;
+
+static void agg_key_init(void) {
+    pthread_key_create(&match_key, free);
+}
+
+static uint64_t agg_clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* First rule matching param. Called with agg_lock held */
+static int agg_find_rule(const param_t * param) {
+    for (size_t i = 0; i < rule_count; i++) {
+        if (rules[i].node >= 0 && rules[i].node != *(param->node)) {
+            continue;
+        }
+        if (fnmatch(rules[i].pattern, param->name, 0) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void agg_out_flush(void) {
+    if (agg_out_len > 0 && vm_running) {
+        vm_add_lines(agg_out, agg_out_len, agg_out_lines);
+        SNIFFER_STATS_ADD(agg_lines, agg_out_lines);
+    }
+    agg_out_len = 0;
+    agg_out_lines = 0;
+}
+
+static void agg_out_line(const agg_series_t * s, const char * suffix, const sniffer_value_t * value) {
+
+    if (AGG_OUT_SIZE - agg_out_len < AGG_LINE_MAX) {
+        agg_out_flush();
+    }
+
+    char name[AGG_LINE_MAX / 2];
+    snprintf(name, sizeof(name), "%s%s", s->name, suffix);
+
+    char * line = agg_out + agg_out_len;
+    char * p = line;
+    p += metric_format_prefix(p, AGG_LINE_MAX - 3 * METRIC_FORMAT_NUM_MAX - 8, name, s->node);
+    p = metric_format_u64(p, s->key & 0xFFFFFFFF);
+    memcpy(p, "\"} ", 3);
+    p += 3;
+    switch (value->kind) {
+        case SNIFFER_VALUE_UINT:
+            p = metric_format_u64(p, value->u);
+            break;
+        case SNIFFER_VALUE_INT:
+            p = metric_format_i64(p, value->i);
+            break;
+        case SNIFFER_VALUE_DOUBLE:
+            p = metric_format_double(p, value->d, s->precision);
+            break;
+    }
+    *p++ = ' ';
+    p = metric_format_u64(p, s->window_start);
+    *p++ = '\n';
+
+    agg_out_len += p - line;
+    agg_out_lines++;
+}
+
+/* Send the statistics of the open window and close it. Called with agg_lock held */
+static void agg_emit(agg_series_t * s) {
+
+    if (s->count == 0) {
+        return;
+    }
+
+    if (s->stats & SNIFFER_AGG_LAST) {
+        agg_out_line(s, "", &s->last);
+    }
+    if (s->stats & SNIFFER_AGG_MIN) {
+        agg_out_line(s, "_min", &(sniffer_value_t) { .kind = SNIFFER_VALUE_DOUBLE, .d = s->min });
+    }
+    if (s->stats & SNIFFER_AGG_MAX) {
+        agg_out_line(s, "_max", &(sniffer_value_t) { .kind = SNIFFER_VALUE_DOUBLE, .d = s->max });
+    }
+    if (s->stats & SNIFFER_AGG_MEAN) {
+        agg_out_line(s, "_mean", &(sniffer_value_t) { .kind = SNIFFER_VALUE_DOUBLE, .d = s->sum / s->count });
+    }
+    if (s->stats & SNIFFER_AGG_COUNT) {
+        agg_out_line(s, "_count", &(sniffer_value_t) { .kind = SNIFFER_VALUE_UINT, .u = s->count });
+    }
+
+    s->count = 0;
+}
+
+/* Emit every open window and forget all series. Called with agg_lock held */
+static void agg_reset(void) {
+    for (size_t i = 0; i < table_size; i++) {
+        if (table[i].name) {
+            agg_emit(&table[i]);
+            free(table[i].name);
+        }
+    }
+    agg_out_flush();
+    free(table);
+    table = NULL;
+    table_size = 0;
+    table_used = 0;
+}
+
+static size_t agg_slot(uint64_t key, size_t size) {
+    return (key * 0x9E3779B97F4A7C15ULL) >> 32 & (size - 1);
+}
+
+/* Called with agg_lock held. @return 0 on success, -1 if the table cannot grow */
+static int agg_grow(void) {
+
+    size_t size = table_size ? table_size * 2 : AGG_TABLE_INITIAL;
+    if (size > 2 * SNIFFER_AGG_SERIES_MAX) {
+        return -1;
+    }
+    agg_series_t * grown = calloc(size, sizeof(agg_series_t));
+    if (grown == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < table_size; i++) {
+        if (table[i].name == NULL) {
+            continue;
+        }
+        size_t slot = agg_slot(table[i].key, size);
+        while (grown[slot].name) {
+            slot = (slot + 1) & (size - 1);
+        }
+        grown[slot] = table[i];
+    }
+    free(table);
+    table = grown;
+    table_size = size;
+    return 0;
+}
+
+static agg_series_t * agg_series_find(uint64_t key) {
+    if (table_size == 0) {
+        return NULL;
+    }
+    size_t slot = agg_slot(key, table_size);
+    while (table[slot].name) {
+        if (table[slot].key == key) {
+            return &table[slot];
+        }
+        slot = (slot + 1) & (table_size - 1);
+    }
+    return NULL;
+}
+
+/* Called with agg_lock held. @return NULL if the table is full */
+static agg_series_t * agg_series_add(uint64_t key, const param_t * param, const sniffer_agg_rule_t * rule) {
+
+    if (table_used >= SNIFFER_AGG_SERIES_MAX) {
+        return NULL;
+    }
+    if ((table_used + 1) * 4 > table_size * 3 && agg_grow() < 0) {
+        return NULL;
+    }
+
+    char * name = strdup(param->name);
+    if (name == NULL) {
+        return NULL;
+    }
+
+    size_t slot = agg_slot(key, table_size);
+    while (table[slot].name) {
+        slot = (slot + 1) & (table_size - 1);
+    }
+    agg_series_t * s = &table[slot];
+    memset(s, 0, sizeof(*s));
+    s->key = key;
+    s->name = name;
+    s->node = *(param->node);
+    s->precision = (param->type == PARAM_TYPE_FLOAT) ? 6 : 12;
+    s->stats = rule->stats;
+    s->window_ms = rule->window_ms;
+    table_used++;
+
+    return s;
+}
+
+int sniffer_agg_match(const param_t * param) {
+
+    if (!atomic_load_explicit(&agg_active, memory_order_relaxed)) {
+        return -1;
+    }
+
+    if (match_cache == NULL) {
+        pthread_once(&match_key_once, agg_key_init);
+        match_cache = calloc(AGG_MATCH_CACHE, sizeof(agg_match_t));
+        if (match_cache == NULL) {
+            return -1;
+        }
+        pthread_setspecific(match_key, match_cache);
+    }
+
+    /* Node and id are both 16 bit. Offset by one, so node 0 id 0 does not look empty */
+    uint32_t key = (((uint32_t) *(param->node) << 16) | (uint16_t) param->id) + 1;
+    unsigned int generation = atomic_load_explicit(&agg_generation, memory_order_acquire);
+    unsigned int list_generation = sniffer_param_cache_generation();
+    agg_match_t * entry = &match_cache[((key * 2654435761u) >> 22) & (AGG_MATCH_CACHE - 1)];
+    if (entry->key != key || entry->generation != generation || entry->list_generation != list_generation) {
+        pthread_mutex_lock(&agg_lock);
+        entry->key = key;
+        entry->generation = atomic_load_explicit(&agg_generation, memory_order_relaxed);
+        entry->list_generation = list_generation;
+        entry->rule = agg_find_rule(param);
+        pthread_mutex_unlock(&agg_lock);
+    }
+
+    return entry->rule;
+}
+
+int sniffer_agg_sample(const param_t * param, unsigned int idx, uint64_t time_ms, const sniffer_value_t * value) {
+
+    uint64_t key = ((uint64_t) (*(param->node) & 0xFFFF) << 48) | ((uint64_t) (param->id & 0xFFFF) << 32) | idx;
+
+    pthread_mutex_lock(&agg_lock);
+    agg_series_t * s = agg_series_find(key);
+    if (s == NULL) {
+        /* Series take the rule current when they are created, the match may be from before a change */
+        int rule = agg_find_rule(param);
+        if (rule < 0) {
+            pthread_mutex_unlock(&agg_lock);
+            return -1;
+        }
+        s = agg_series_add(key, param, &rules[rule]);
+        if (s == NULL) {
+            pthread_mutex_unlock(&agg_lock);
+            SNIFFER_STATS_INC(agg_overflow);
+            return -1;
+        }
+    }
+
+    uint64_t window_start = time_ms - time_ms % s->window_ms;
+    if (s->count > 0 && window_start != s->window_start) {
+        agg_emit(s);
+        agg_out_flush();
+    }
+
+    double d = sniffer_value_double(value);
+    if (s->count == 0) {
+        s->window_start = window_start;
+        s->min = d;
+        s->max = d;
+        s->sum = 0;
+    }
+    if (d < s->min) {
+        s->min = d;
+    }
+    if (d > s->max) {
+        s->max = d;
+    }
+    s->sum += d;
+    s->last = *value;
+    s->count++;
+    s->touched_ms = agg_clock_ms();
+
+    pthread_mutex_unlock(&agg_lock);
+
+    SNIFFER_STATS_INC(agg_samples);
+    return 0;
+}
+
+void sniffer_agg_sweep(void) {
+
+    if (!atomic_load_explicit(&agg_active, memory_order_relaxed)) {
+        return;
+    }
+
+    uint64_t now = agg_clock_ms();
+    pthread_mutex_lock(&agg_lock);
+    for (size_t i = 0; i < table_size; i++) {
+        agg_series_t * s = &table[i];
+        if (s->name && s->count > 0 && now - s->touched_ms >= s->window_ms) {
+            agg_emit(s);
+        }
+    }
+    agg_out_flush();
+    pthread_mutex_unlock(&agg_lock);
+}
+
+void sniffer_agg_flush(void) {
+    pthread_mutex_lock(&agg_lock);
+    for (size_t i = 0; i < table_size; i++) {
+        if (table[i].name) {
+            agg_emit(&table[i]);
+        }
+    }
+    agg_out_flush();
+    pthread_mutex_unlock(&agg_lock);
+}
+
+/* Called with agg_lock held, after changing the rules */
+static void agg_rules_changed(void) {
+    agg_reset();
+    atomic_store(&agg_active, rule_count > 0);
+    atomic_fetch_add_explicit(&agg_generation, 1, memory_order_release);
+}
+
+int sniffer_agg_rule_add(const char * pattern, int node, uint32_t window_ms, unsigned int stats) {
+
+    if (pattern == NULL || pattern[0] == '\0' || strlen(pattern) >= SNIFFER_AGG_PATTERN_MAX) {
+        return -1;
+    }
+    if (window_ms == 0 || stats == 0 || (stats & ~SNIFFER_AGG_ALL) || node > 0xFFFF) {
+        return -1;
+    }
+    if (node < 0) {
+        node = -1;
+    }
+
+    pthread_mutex_lock(&agg_lock);
+    size_t i;
+    for (i = 0; i < rule_count; i++) {
+        if (rules[i].node == node && strcmp(rules[i].pattern, pattern) == 0) {
+            break;
+        }
+    }
+    if (i == SNIFFER_AGG_RULES_MAX) {
+        pthread_mutex_unlock(&agg_lock);
+        return -1;
+    }
+    strcpy(rules[i].pattern, pattern);
+    rules[i].node = node;
+    rules[i].window_ms = window_ms;
+    rules[i].stats = stats;
+    if (i == rule_count) {
+        rule_count++;
+    }
+    agg_rules_changed();
+    pthread_mutex_unlock(&agg_lock);
+
+    return 0;
+}
+
+int sniffer_agg_rule_remove(const char * pattern, int node) {
+
+    if (node < 0) {
+        node = -1;
+    }
+
+    pthread_mutex_lock(&agg_lock);
+    for (size_t i = 0; i < rule_count; i++) {
+        if (rules[i].node == node && strcmp(rules[i].pattern, pattern) == 0) {
+            memmove(&rules[i], &rules[i + 1], (rule_count - i - 1) * sizeof(rules[0]));
+            rule_count--;
+            agg_rules_changed();
+            pthread_mutex_unlock(&agg_lock);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&agg_lock);
+
+    return -1;
+}
+
+void sniffer_agg_clear(void) {
+    pthread_mutex_lock(&agg_lock);
+    rule_count = 0;
+    agg_rules_changed();
+    pthread_mutex_unlock(&agg_lock);
+}
+
+size_t sniffer_agg_rules(sniffer_agg_rule_t * out, size_t max) {
+    pthread_mutex_lock(&agg_lock);
+    size_t count = rule_count;
+    memcpy(out, rules, ((count < max) ? count : max) * sizeof(rules[0]));
+    pthread_mutex_unlock(&agg_lock);
+    return count;
+}
+
+static const struct {
+    const char * name;
+    unsigned int flag;
+} agg_stat_names[] = {
+    { "last", SNIFFER_AGG_LAST },
+    { "min", SNIFFER_AGG_MIN },
+    { "max", SNIFFER_AGG_MAX },
+    { "mean", SNIFFER_AGG_MEAN },
+    { "count", SNIFFER_AGG_COUNT },
+    { "all", SNIFFER_AGG_ALL },
+};
+
+unsigned int sniffer_agg_parse_stats(const char * text) {
+
+    unsigned int stats = 0;
+    const char * p = text;
+    while (*p) {
+        while (isspace((unsigned char) *p)) {
+            p++;
+        }
+        size_t len = strcspn(p, ", \t");
+        unsigned int flag = 0;
+        for (size_t i = 0; i < sizeof(agg_stat_names) / sizeof(agg_stat_names[0]); i++) {
+            if (strlen(agg_stat_names[i].name) == len && strncasecmp(p, agg_stat_names[i].name, len) == 0) {
+                flag = agg_stat_names[i].flag;
+            }
+        }
+        if (flag == 0) {
+            return 0;
+        }
+        stats |= flag;
+        p += len;
+        while (isspace((unsigned char) *p)) {
+            p++;
+        }
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0') {
+            return 0;
+        }
+    }
+    return stats;
+}
+
+void sniffer_agg_format_stats(unsigned int stats, char * out, size_t size) {
+    out[0] = '\0';
+    for (size_t i = 0; i < sizeof(agg_stat_names) / sizeof(agg_stat_names[0]) - 1; i++) {
+        if (stats & agg_stat_names[i].flag) {
+            snprintf(out + strlen(out), size - strlen(out), "%s%s", out[0] ? "," : "", agg_stat_names[i].name);
+        }
+    }
+}
+
+static int sniffer_agg_cmd(struct slash * slash) {
+
+    int window_ms = 0;
+    int node = -1;
+    char * stats_text = "all";
+    int remove = 0;
+    int clear = 0;
+
+    optparse_t * parser = optparse_new("sniffer_agg", "[pattern]");
+    optparse_add_help(parser);
+    optparse_add_int(parser, 'w', "window", "NUM", 0, &window_ms, "window length in ms, adds or replaces the rule for pattern");
+    optparse_add_int(parser, 'n', "node", "NUM", 0, &node, "only apply to this node (default any)");
+    optparse_add_string(parser, 's', "stats", "LIST", &stats_text, "statistics sent, of last,min,max,mean,count (default all)");
+    optparse_add_set(parser, 'r', "remove", 1, &remove, "remove the rule for pattern");
+    optparse_add_set(parser, 'c', "clear", 1, &clear, "remove all rules");
+
+    int argi = optparse_parse(parser, slash->argc - 1, (const char **) slash->argv + 1);
+    if (argi < 0) {
+        optparse_del(parser);
+        return SLASH_EINVAL;
+    }
+    const char * pattern = (++argi < slash->argc) ? slash->argv[argi] : NULL;
+
+    int result = SLASH_SUCCESS;
+    if (clear) {
+        sniffer_agg_clear();
+    } else if (remove) {
+        if (pattern == NULL || sniffer_agg_rule_remove(pattern, node) < 0) {
+            printf("No such rule\n");
+            result = SLASH_EINVAL;
+        }
+    } else if (pattern) {
+        unsigned int stats = sniffer_agg_parse_stats(stats_text);
+        if (window_ms <= 0 || stats == 0 || sniffer_agg_rule_add(pattern, node, window_ms, stats) < 0) {
+            printf("Invalid rule, a window length and valid statistics are required\n");
+            result = SLASH_EINVAL;
+        }
+    }
+
+    if (result == SLASH_SUCCESS) {
+        sniffer_agg_rule_t list[SNIFFER_AGG_RULES_MAX];
+        size_t count = sniffer_agg_rules(list, SNIFFER_AGG_RULES_MAX);
+        for (size_t i = 0; i < count; i++) {
+            char stats[64];
+            sniffer_agg_format_stats(list[i].stats, stats, sizeof(stats));
+            if (list[i].node >= 0) {
+                printf("%-32s node %-5d %8" PRIu32 " ms  %s\n", list[i].pattern, list[i].node, list[i].window_ms, stats);
+            } else {
+                printf("%-32s node any   %8" PRIu32 " ms  %s\n", list[i].pattern, list[i].window_ms, stats);
+            }
+        }
+        if (count == 0) {
+            printf("No aggregation, all series are sent at full rate\n");
+        }
+    }
+
+    optparse_del(parser);
+    return result;
+}
+slash_command(sniffer_agg, sniffer_agg_cmd, "[pattern]", "Downsample sniffed series sent to VictoriaMetrics");
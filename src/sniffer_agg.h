@@ -0,0 +1,87 @@
+/*
+ * sniffer_agg.h
+ *
+ * Downsampling of sniffed series before they are sent to VictoriaMetrics.
+ * Parameters matching a rule are not sent at full rate. Instead, each (node, id, idx) series collects
+ * its samples over tumbling windows aligned to the window length, and at the end of each window
+ * the selected statistics are sent, stamped with the window start:
+ *
+ *   name{node="N", idx="I"}        last value
+ *   name_min / _max / _mean{...}   over the window
+ *   name_count{...}                samples in the window
+ *
+ * A window ends when a sample of a later window arrives, or when no sample has arrived for a window length.
+ * The local log, the store and the sinks still receive every sample.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <param/param.h>
+
+#include "param_sniffer.h"
+
+#define SNIFFER_AGG_RULES_MAX   32
+#define SNIFFER_AGG_PATTERN_MAX 64
+
+/* Series tracked at once. Samples of series beyond this are sent at full rate */
+#define SNIFFER_AGG_SERIES_MAX  (256 * 1024)
+
+/* Statistics sent per window, or'ed together */
+#define SNIFFER_AGG_LAST  0x01
+#define SNIFFER_AGG_MIN   0x02
+#define SNIFFER_AGG_MAX   0x04
+#define SNIFFER_AGG_MEAN  0x08
+#define SNIFFER_AGG_COUNT 0x10
+#define SNIFFER_AGG_ALL   0x1F
+
+typedef struct {
+    char pattern[SNIFFER_AGG_PATTERN_MAX];  // Glob (fnmatch) on the parameter name
+    int node;                               // -1 for any node
+    uint32_t window_ms;
+    unsigned int stats;
+} sniffer_agg_rule_t;
+
+/**
+ * @brief Add a rule, or replace the rule with the same pattern and node. Rules are tried in the order added, the first match applies.
+ * Changing the rules ends all open windows.
+ * @return 0 on success, -1 if an argument is invalid or SNIFFER_AGG_RULES_MAX rules exist.
+ */
+int sniffer_agg_rule_add(const char * pattern, int node, uint32_t window_ms, unsigned int stats);
+
+/* @return 0 on success, -1 if there is no rule with this pattern and node */
+int sniffer_agg_rule_remove(const char * pattern, int node);
+
+/* Remove all rules, sending all series at full rate again */
+void sniffer_agg_clear(void);
+
+/* Copy up to max rules to out. @return Number of rules */
+size_t sniffer_agg_rules(sniffer_agg_rule_t * out, size_t max);
+
+/**
+ * @brief Parse a comma separated list of "last", "min", "max", "mean", "count" or "all".
+ * @return The SNIFFER_AGG_ flags, 0 if text is malformed.
+ */
+unsigned int sniffer_agg_parse_stats(const char * text);
+
+/* Render stats as sniffer_agg_parse_stats() reads them */
+void sniffer_agg_format_stats(unsigned int stats, char * out, size_t size);
+
+/**
+ * @brief Find the rule applying to param, cached per thread.
+ * @return Index of the rule, -1 if param is sent at full rate.
+ */
+int sniffer_agg_match(const param_t * param);
+
+/**
+ * @brief Add a sample of a parameter matched by sniffer_agg_match().
+ * @return 0 if the sample was taken, -1 if it must be sent at full rate, when the series table is full or the rules have changed.
+ */
+int sniffer_agg_sample(const param_t * param, unsigned int idx, uint64_t time_ms, const sniffer_value_t * value);
+
+/* End the windows that have not received a sample for their length. Called periodically by vm_push() */
+void sniffer_agg_sweep(void);
+
+/* End all open windows */
+void sniffer_agg_flush(void);
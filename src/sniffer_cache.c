@@ -0,0 +1,364 @@
+/*
+ * sniffer_cache.c
+ *
+ * See sniffer_cache.h
+ *
+ * Series are split into shards by key hash. Each shard is an open addressing table of pointers
+ * to series, under its own lock, which the sink takes once per run of samples of the same shard.
+ */
+
+#include "sniffer_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <slash/slash.h>
+#include <slash/optparse.h>
+
+#include "sniffer_sink.h"
+
+#define CACHE_SINK_NAME    "cache"
+#define CACHE_SHARDS       16
+#define CACHE_RING_INITIAL 8
+
+typedef struct {
+    uint64_t time_ms;
+    uint64_t value;    // Bits of the value, of the kind of the series
+} cache_sample_t;
+
+typedef struct {
+    uint64_t key;      // node << 48 | id << 32 | idx
+    sniffer_value_kind_e kind;
+    uint64_t latest_ms;
+    sniffer_value_t latest;
+    size_t head;       // Next slot written in ring
+    size_t count;      // Samples in ring
+    size_t size;       // Slots allocated in ring, grows up to the history setting
+    cache_sample_t * ring;
+} cache_series_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    cache_series_t ** table;
+    size_t size;       // A power of two
+    size_t used;
+} cache_shard_t;
+
+static cache_shard_t shards[CACHE_SHARDS] = {
+    [0 ... CACHE_SHARDS - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER },
+};
+static pthread_mutex_t config_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t cache_history = SNIFFER_CACHE_HISTORY_DEFAULT;
+static size_t cache_series_max = SNIFFER_CACHE_SERIES_DEFAULT;
+static atomic_size_t cache_series_count = 0;
+static atomic_int cache_enabled = 0;
+
+static inline uint64_t cache_key(uint16_t node, uint16_t id, uint32_t idx) {
+    return ((uint64_t) node << 48) | ((uint64_t) id << 32) | idx;
+}
+
+static inline uint64_t cache_hash(uint64_t key) {
+    uint64_t h = key * 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 29);
+}
+
+/* Slot of key in shard, holding it or empty. Called with the shard lock held, on a table with free slots */
+static cache_series_t ** cache_slot(cache_shard_t * shard, uint64_t key, uint64_t hash) {
+    size_t slot = (hash >> 4) & (shard->size - 1);
+    while (shard->table[slot] && shard->table[slot]->key != key) {
+        slot = (slot + 1) & (shard->size - 1);
+    }
+    return &shard->table[slot];
+}
+
+static cache_series_t * cache_find(cache_shard_t * shard, uint64_t key, uint64_t hash) {
+    if (shard->table == NULL) {
+        return NULL;
+    }
+    return *cache_slot(shard, key, hash);
+}
+
+/* Called with the shard lock held. @return 0 on success, -1 if out of memory */
+static int cache_grow(cache_shard_t * shard) {
+
+    size_t size = shard->size ? shard->size * 2 : 64;
+    cache_series_t ** table = calloc(size, sizeof(cache_series_t *));
+    if (table == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < shard->size; i++) {
+        cache_series_t * series = shard->table[i];
+        if (series == NULL) {
+            continue;
+        }
+        size_t slot = (cache_hash(series->key) >> 4) & (size - 1);
+        while (table[slot]) {
+            slot = (slot + 1) & (size - 1);
+        }
+        table[slot] = series;
+    }
+    free(shard->table);
+    shard->table = table;
+    shard->size = size;
+    return 0;
+}
+
+/* Called with the shard lock held. @return NULL if the cache is full or out of memory */
+static cache_series_t * cache_add(cache_shard_t * shard, uint64_t key, uint64_t hash, sniffer_value_kind_e kind) {
+
+    if (atomic_load_explicit(&cache_series_count, memory_order_relaxed) >= cache_series_max) {
+        return NULL;
+    }
+    if ((shard->used + 1) * 4 > shard->size * 3 && cache_grow(shard) < 0) {
+        return NULL;
+    }
+
+    cache_series_t * series = calloc(1, sizeof(cache_series_t));
+    if (series == NULL) {
+        return NULL;
+    }
+    series->key = key;
+    series->kind = kind;
+
+    *cache_slot(shard, key, hash) = series;
+    shard->used++;
+    atomic_fetch_add_explicit(&cache_series_count, 1, memory_order_relaxed);
+
+    return series;
+}
+
+/* Called with the shard lock held */
+static void cache_append(cache_series_t * series, const sniffer_sample_t * sample) {
+
+    /* A parameter redefined with another type starts a new history */
+    if (sample->value.kind != series->kind) {
+        series->kind = sample->value.kind;
+        series->head = 0;
+        series->count = 0;
+    }
+
+    if (sample->time_ms >= series->latest_ms || series->count == 0) {
+        series->latest_ms = sample->time_ms;
+        series->latest = sample->value;
+    }
+
+    /* Grow the ring while it is full and below the history setting, keeping the samples in order */
+    if (series->count == series->size && series->size < cache_history) {
+        size_t size = series->size ? series->size * 2 : CACHE_RING_INITIAL;
+        if (size > cache_history) {
+            size = cache_history;
+        }
+        cache_sample_t * ring = malloc(size * sizeof(cache_sample_t));
+        if (ring) {
+            for (size_t i = 0; i < series->count; i++) {
+                ring[i] = series->ring[(series->head + series->size - series->count + i) % series->size];
+            }
+            free(series->ring);
+            series->ring = ring;
+            series->size = size;
+            series->head = series->count;
+        }
+    }
+    if (series->size == 0) {
+        return;
+    }
+
+    series->ring[series->head] = (cache_sample_t) { .time_ms = sample->time_ms, .value = sample->value.u };
+    series->head = (series->head + 1) % series->size;
+    if (series->count < series->size) {
+        series->count++;
+    }
+}
+
+static void cache_sink(void * ctx, const sniffer_sample_t * samples, size_t count) {
+
+    cache_shard_t * locked = NULL;
+    for (size_t i = 0; i < count; i++) {
+        const sniffer_sample_t * sample = &samples[i];
+        uint64_t key = cache_key(sample->node, sample->id, sample->idx);
+        uint64_t hash = cache_hash(key);
+        cache_shard_t * shard = &shards[hash & (CACHE_SHARDS - 1)];
+
+        /* Elements of an array often follow each other, keep the lock while they share a shard */
+        if (shard != locked) {
+            if (locked) {
+                pthread_mutex_unlock(&locked->lock);
+            }
+            pthread_mutex_lock(&shard->lock);
+            locked = shard;
+        }
+
+        cache_series_t * series = cache_find(shard, key, hash);
+        if (series == NULL) {
+            series = cache_add(shard, key, hash, sample->value.kind);
+            if (series == NULL) {
+                continue;
+            }
+        }
+        cache_append(series, sample);
+    }
+    if (locked) {
+        pthread_mutex_unlock(&locked->lock);
+    }
+}
+
+/* Free all series. Called with config_lock held, once the sink is removed */
+static void cache_free(void) {
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        cache_shard_t * shard = &shards[i];
+        pthread_mutex_lock(&shard->lock);
+        for (size_t j = 0; j < shard->size; j++) {
+            if (shard->table[j]) {
+                free(shard->table[j]->ring);
+                free(shard->table[j]);
+            }
+        }
+        free(shard->table);
+        shard->table = NULL;
+        shard->size = 0;
+        shard->used = 0;
+        pthread_mutex_unlock(&shard->lock);
+    }
+    atomic_store(&cache_series_count, 0);
+}
+
+int sniffer_cache_enable(size_t history, size_t max_series) {
+
+    if (history == 0 || max_series == 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&config_lock);
+    if (atomic_load(&cache_enabled)) {
+        sniffer_sink_remove(CACHE_SINK_NAME, NULL);
+        atomic_store(&cache_enabled, 0);
+    }
+    cache_free();
+    cache_history = history;
+    cache_series_max = max_series;
+
+    int res = sniffer_sink_add(CACHE_SINK_NAME, cache_sink, NULL);
+    if (res == 0) {
+        atomic_store(&cache_enabled, 1);
+    }
+    pthread_mutex_unlock(&config_lock);
+
+    return res;
+}
+
+void sniffer_cache_disable(void) {
+    pthread_mutex_lock(&config_lock);
+    if (atomic_load(&cache_enabled)) {
+        /* Returns once no thread is in cache_sink() */
+        sniffer_sink_remove(CACHE_SINK_NAME, NULL);
+        atomic_store(&cache_enabled, 0);
+    }
+    cache_free();
+    pthread_mutex_unlock(&config_lock);
+}
+
+int sniffer_cache_is_enabled(void) {
+    return atomic_load_explicit(&cache_enabled, memory_order_relaxed);
+}
+
+size_t sniffer_cache_history_size(void) {
+    pthread_mutex_lock(&config_lock);
+    size_t history = cache_history;
+    pthread_mutex_unlock(&config_lock);
+    return history;
+}
+
+int sniffer_cache_latest(uint16_t node, uint16_t id, uint32_t idx, uint64_t * time_ms, sniffer_value_t * value) {
+
+    uint64_t key = cache_key(node, id, idx);
+    uint64_t hash = cache_hash(key);
+    cache_shard_t * shard = &shards[hash & (CACHE_SHARDS - 1)];
+
+    pthread_mutex_lock(&shard->lock);
+    cache_series_t * series = cache_find(shard, key, hash);
+    if (series) {
+        *time_ms = series->latest_ms;
+        *value = series->latest;
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    return series ? 0 : -1;
+}
+
+size_t sniffer_cache_history(uint16_t node, uint16_t id, uint32_t idx, uint64_t * times, sniffer_value_t * values, size_t max) {
+
+    uint64_t key = cache_key(node, id, idx);
+    uint64_t hash = cache_hash(key);
+    cache_shard_t * shard = &shards[hash & (CACHE_SHARDS - 1)];
+
+    pthread_mutex_lock(&shard->lock);
+    cache_series_t * series = cache_find(shard, key, hash);
+    size_t count = 0;
+    if (series && series->size > 0) {
+        count = (series->count < max) ? series->count : max;
+        size_t first = (series->head + series->size - count) % series->size;
+        for (size_t i = 0; i < count; i++) {
+            const cache_sample_t * sample = &series->ring[(first + i) % series->size];
+            times[i] = sample->time_ms;
+            values[i].kind = series->kind;
+            values[i].u = sample->value;
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    return count;
+}
+
+size_t sniffer_cache_foreach(void (*fn)(void * ctx, uint16_t node, uint16_t id, uint32_t idx, uint64_t time_ms, const sniffer_value_t * value), void * ctx) {
+
+    size_t count = 0;
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        cache_shard_t * shard = &shards[i];
+        pthread_mutex_lock(&shard->lock);
+        for (size_t j = 0; j < shard->size; j++) {
+            cache_series_t * series = shard->table[j];
+            if (series) {
+                fn(ctx, series->key >> 48, (series->key >> 32) & 0xFFFF, series->key & 0xFFFFFFFF, series->latest_ms, &series->latest);
+                count++;
+            }
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+    return count;
+}
+
+static int sniffer_cache_cmd(struct slash * slash) {
+
+    unsigned int history = SNIFFER_CACHE_HISTORY_DEFAULT;
+    unsigned int max_series = SNIFFER_CACHE_SERIES_DEFAULT;
+    int disable = 0;
+
+    optparse_t * parser = optparse_new("sniffer_cache", "");
+    optparse_add_help(parser);
+    optparse_add_unsigned(parser, 'n', "history", "NUM", 0, &history, "samples kept per series (default 1024)");
+    optparse_add_unsigned(parser, 's', "series", "NUM", 0, &max_series, "series cached (default 65536)");
+    optparse_add_set(parser, 'd', "disable", 1, &disable, "stop caching and free the cache");
+
+    int argi = optparse_parse(parser, slash->argc - 1, (const char **) slash->argv + 1);
+    optparse_del(parser);
+    if (argi < 0) {
+        return SLASH_EINVAL;
+    }
+
+    if (disable) {
+        sniffer_cache_disable();
+        printf("Telemetry cache disabled\n");
+        return SLASH_SUCCESS;
+    }
+
+    if (sniffer_cache_enable(history, max_series) < 0) {
+        printf("Failed to enable the telemetry cache\n");
+        return SLASH_EINVAL;
+    }
+    printf("Caching the latest %u samples of up to %u series\n", history, max_series);
+    return SLASH_SUCCESS;
+}
+slash_command(sniffer_cache, sniffer_cache_cmd, "", "Keep the latest sniffed samples in memory");
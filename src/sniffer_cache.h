@@ -0,0 +1,57 @@
+/*
+ * sniffer_cache.h
+ *
+ * In-memory cache of sniffed telemetry: the latest sample of every (node, id, idx) series,
+ * and a ring of its most recent samples. Fed as a sink (sniffer_sink.h), so it sees every decoded sample
+ * that was not dropped as a duplicate. Lookups hash the series, and take a lock shared with a fraction of them.
+ *
+ * History rings start small and grow as samples arrive, so series that rarely change take little memory.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "param_sniffer.h"
+
+#define SNIFFER_CACHE_HISTORY_DEFAULT 1024
+#define SNIFFER_CACHE_SERIES_DEFAULT  (64 * 1024)
+
+/**
+ * @brief Start caching sniffed samples, or change the settings, which empties the cache.
+ * @param history Samples kept per series, at least 1.
+ * @param max_series Series cached. Samples of further series are not cached.
+ * @return 0 on success, -1 if an argument is 0 or the cache sink could not be added.
+ */
+int sniffer_cache_enable(size_t history, size_t max_series);
+
+/* Stop caching, and free the cache */
+void sniffer_cache_disable(void);
+
+int sniffer_cache_is_enabled(void);
+
+/**
+ * @brief Latest sample of a series.
+ * @return 0 on success, -1 if the series has not been seen.
+ */
+int sniffer_cache_latest(uint16_t node, uint16_t id, uint32_t idx, uint64_t * time_ms, sniffer_value_t * value);
+
+/**
+ * @brief Copy the newest samples of a series, oldest first.
+ * @param times Receives timestamps in milliseconds.
+ * @param values Receives the values.
+ * @param max Room in times and values.
+ * @return Number of samples copied, 0 if the series has not been seen.
+ */
+size_t sniffer_cache_history(uint16_t node, uint16_t id, uint32_t idx, uint64_t * times, sniffer_value_t * values, size_t max);
+
+/* Number of samples kept per series, as set by sniffer_cache_enable() */
+size_t sniffer_cache_history_size(void);
+
+/**
+ * @brief Call fn with the latest sample of every cached series, in no particular order.
+ * fn is called with a shard lock held, so it should be quick and must not call back into the cache.
+ * @return Number of series.
+ */
+size_t sniffer_cache_foreach(void (*fn)(void * ctx, uint16_t node, uint16_t id, uint32_t idx, uint64_t time_ms, const sniffer_value_t * value), void * ctx);
@@ -0,0 +1,199 @@
+/*
+ * sniffer_capture.c
+ *
+ * Raw CSP packet capture and replay, see sniffer_capture.h
+ *
+ * File layout (little endian): "PYCSHCAP", then per packet a capture_record_t followed by length bytes of data.
+ */
+
+#include "sniffer_capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "param_sniffer.h"
+#include "sniffer_filter.h"
+
+#define CAPTURE_MAGIC "PYCSHCAP"
+#define CAPTURE_BUFFER_SIZE (1024 * 1024)
+
+typedef struct __attribute__((packed)) {
+    uint64_t capture_us;  // Wall clock time the packet was read
+    uint32_t timestamp_rx;
+    uint16_t length;
+    uint8_t pri;
+    uint8_t flags;
+    uint16_t src;
+    uint16_t dst;
+    uint8_t dport;
+    uint8_t sport;
+} capture_record_t;
+
+static FILE * capture_file = NULL;
+static char * capture_buffer = NULL;
+static pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int sniffer_capture_is_open(void) {
+    return capture_file != NULL;
+}
+
+void sniffer_capture_write(const csp_packet_t * packet) {
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    capture_record_t record = {
+        .capture_us = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec,
+        .timestamp_rx = packet->timestamp_rx,
+        .length = packet->length,
+        .pri = packet->id.pri,
+        .flags = packet->id.flags,
+        .src = packet->id.src,
+        .dst = packet->id.dst,
+        .dport = packet->id.dport,
+        .sport = packet->id.sport,
+    };
+
+    /* Written through a large stdio buffer, so the reader thread rarely enters a write syscall */
+    pthread_mutex_lock(&capture_lock);
+    if (capture_file) {
+        fwrite(&record, sizeof(record), 1, capture_file);
+        fwrite(packet->data, 1, packet->length, capture_file);
+    }
+    pthread_mutex_unlock(&capture_lock);
+}
+
+void sniffer_capture_close(void) {
+
+    pthread_mutex_lock(&capture_lock);
+    if (capture_file) {
+        fclose(capture_file);
+        capture_file = NULL;
+    }
+    free(capture_buffer);
+    capture_buffer = NULL;
+    pthread_mutex_unlock(&capture_lock);
+}
+
+int sniffer_capture_open(const char * path) {
+
+    static int atexit_registered = 0;
+
+    if (sniffer_capture_is_open()) {
+        return -1;
+    }
+
+    FILE * file = fopen(path, "a+b");
+    if (file == NULL) {
+        return -1;
+    }
+
+    char magic[8];
+    fseek(file, 0, SEEK_END);
+    if (ftell(file) == 0) {
+        fwrite(CAPTURE_MAGIC, 1, sizeof(magic), file);
+    } else {
+        fseek(file, 0, SEEK_SET);
+        if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) != 0) {
+            printf("%s is not a sniffer capture\n", path);
+            fclose(file);
+            return -1;
+        }
+    }
+
+    pthread_mutex_lock(&capture_lock);
+    capture_buffer = malloc(CAPTURE_BUFFER_SIZE);
+    if (capture_buffer) {
+        setvbuf(file, capture_buffer, _IOFBF, CAPTURE_BUFFER_SIZE);
+    }
+    capture_file = file;
+    pthread_mutex_unlock(&capture_lock);
+
+    if (!atexit_registered) {
+        atexit(sniffer_capture_close);
+        atexit_registered = 1;
+    }
+
+    return 0;
+}
+
+long sniffer_capture_replay(const char * path) {
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t) strlen(CAPTURE_MAGIC)) {
+        close(fd);
+        return -1;
+    }
+
+    const uint8_t * map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    if (memcmp(map, CAPTURE_MAGIC, strlen(CAPTURE_MAGIC)) != 0) {
+        munmap((void *) map, st.st_size);
+        return -1;
+    }
+    madvise((void *) map, st.st_size, MADV_SEQUENTIAL);
+
+    /* Not a CSP buffer, the sniffer never frees the packets it processes */
+    csp_packet_t * packet = malloc(sizeof(csp_packet_t));
+    if (packet == NULL) {
+        munmap((void *) map, st.st_size);
+        return -1;
+    }
+
+    long count = 0;
+    size_t offset = strlen(CAPTURE_MAGIC);
+    while (offset + sizeof(capture_record_t) <= (size_t) st.st_size) {
+        capture_record_t record;
+        memcpy(&record, map + offset, sizeof(record));
+        offset += sizeof(record);
+        if (offset + record.length > (size_t) st.st_size) {
+            break;  // Truncated by a capture still being written
+        }
+        if (record.length > sizeof(packet->data)) {
+            offset += record.length;
+            continue;
+        }
+
+        memset(&packet->id, 0, sizeof(packet->id));
+        packet->timestamp_rx = record.timestamp_rx;
+        packet->length = record.length;
+        packet->id.pri = record.pri;
+        packet->id.flags = record.flags;
+        packet->id.src = record.src;
+        packet->id.dst = record.dst;
+        packet->id.dport = record.dport;
+        packet->id.sport = record.sport;
+        memcpy(packet->data, map + offset, record.length);
+        offset += record.length;
+
+        if (sniffer_filter_packet(packet) && param_sniffer_classify(packet) != SNIFFER_PACKET_OTHER) {
+            /* Parameters without a timestamp get the time they were captured, not the time of the replay */
+            csp_timestamp_t captured = {
+                .tv_sec = record.capture_us / 1000000,
+                .tv_nsec = (record.capture_us % 1000000) * 1000,
+            };
+            param_sniffer_process(packet, &captured);
+        }
+        count++;
+    }
+
+    free(packet);
+    munmap((void *) map, st.st_size);
+
+    return count;
+}
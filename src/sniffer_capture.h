@@ -0,0 +1,29 @@
+/*
+ * sniffer_capture.h
+ *
+ * Raw capture of promiscuously read CSP packets, and offline replay of captures through the sniffer.
+ */
+
+#pragma once
+
+#include <csp/csp.h>
+
+/**
+ * @brief Start recording every packet read by the sniffer to path. Existing captures are appended to.
+ * @return 0 on success, -1 if the file could not be opened or is not a capture.
+ */
+int sniffer_capture_open(const char * path);
+
+void sniffer_capture_close(void);
+
+int sniffer_capture_is_open(void);
+
+/* Record id, flags, timestamp_rx and data of a packet */
+void sniffer_capture_write(const csp_packet_t * packet);
+
+/**
+ * @brief Feed a capture through hk_param_sniffer()/param_sniffer_log() as fast as possible, in the calling thread.
+ * No CSP interface or running sniffer is needed. Parameters without a timestamp are stamped with the time they were captured.
+ * @return Number of packets replayed, or -1 if the file could not be read.
+ */
+long sniffer_capture_replay(const char * path);
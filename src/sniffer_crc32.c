@@ -0,0 +1,163 @@
+/*
+ * sniffer_crc32.c
+ *
+ * See sniffer_crc32.h
+ *
+ * All implementations work on the raw CRC register, sniffer_crc32c() applies the initial value and final xor.
+ * The hardware paths consume 8 bytes per instruction, with unaligned loads, and finish the tail bytewise.
+ */
+
+#include "sniffer_crc32.h"
+
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_X86 1
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define CRC32C_ARM 1
+#endif
+
+#define CRC32C_POLY 0x82F63B78  // Reflected Castagnoli polynomial
+
+typedef uint32_t (*crc32c_fn)(uint32_t crc, const uint8_t * p, size_t len);
+
+static uint32_t crc32c_table[8][256];
+static crc32c_fn crc32c_update;
+static const char * crc32c_name;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static uint32_t crc32c_slice8(uint32_t crc, const uint8_t * p, size_t len) {
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (len >= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF] ^
+              crc32c_table[5][(lo >> 16) & 0xFF] ^ crc32c_table[4][lo >> 24] ^
+              crc32c_table[3][hi & 0xFF] ^ crc32c_table[2][(hi >> 8) & 0xFF] ^
+              crc32c_table[1][(hi >> 16) & 0xFF] ^ crc32c_table[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+#endif
+    while (len--) {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if CRC32C_X86
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t * p, size_t len) {
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc64 = _mm_crc32_u64(crc64, v);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t) crc64;
+#endif
+    while (len >= 4) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        crc = _mm_crc32_u32(crc, v);
+        p += 4;
+        len -= 4;
+    }
+    while (len--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+#if CRC32C_ARM
+__attribute__((target("+crc")))
+static uint32_t crc32c_armv8(uint32_t crc, const uint8_t * p, size_t len) {
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+static void crc32c_init(void) {
+
+    for (unsigned int i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[0][i] = crc;
+    }
+    for (unsigned int i = 0; i < 256; i++) {
+        for (int k = 1; k < 8; k++) {
+            uint32_t prev = crc32c_table[k - 1][i];
+            crc32c_table[k][i] = (prev >> 8) ^ crc32c_table[0][prev & 0xFF];
+        }
+    }
+
+    crc32c_update = crc32c_slice8;
+    crc32c_name = "slice-by-8";
+#if CRC32C_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc32c_update = crc32c_sse42;
+        crc32c_name = "sse4.2";
+    }
+#elif CRC32C_ARM
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        crc32c_update = crc32c_armv8;
+        crc32c_name = "armv8";
+    }
+#endif
+}
+
+uint32_t sniffer_crc32c(const void * data, size_t len) {
+    pthread_once(&crc32c_once, crc32c_init);
+    return crc32c_update(0xFFFFFFFF, data, len) ^ 0xFFFFFFFF;
+}
+
+uint32_t sniffer_crc32c_sw(const void * data, size_t len) {
+    pthread_once(&crc32c_once, crc32c_init);
+    return crc32c_slice8(0xFFFFFFFF, data, len) ^ 0xFFFFFFFF;
+}
+
+const char * sniffer_crc32c_impl(void) {
+    pthread_once(&crc32c_once, crc32c_init);
+    return crc32c_name;
+}
+
+int sniffer_crc32_verify(csp_packet_t * packet) {
+
+    if (packet->length < 4) {
+        return -1;
+    }
+
+    uint32_t crc = sniffer_crc32c(packet->data, packet->length - 4);
+    const uint8_t * stored = &packet->data[packet->length - 4];
+    if (stored[0] != (uint8_t) (crc >> 24) || stored[1] != (uint8_t) (crc >> 16) ||
+        stored[2] != (uint8_t) (crc >> 8) || stored[3] != (uint8_t) crc) {
+        return -1;
+    }
+
+    packet->length -= 4;
+    return 0;
+}
@@ -0,0 +1,29 @@
+/*
+ * sniffer_crc32.h
+ *
+ * CRC32C (Castagnoli) as used by CSP_FCRC32, computed with the CPU's crc32 instruction where available
+ * (SSE4.2 on x86, the CRC extension on ARMv8), and with slice-by-8 tables otherwise.
+ * The implementation is selected once, on first use. Results are identical to csp_crc32_memory().
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <csp/csp.h>
+
+/* CRC32C of len bytes, with the same initial value and final xor as csp_crc32_memory() */
+uint32_t sniffer_crc32c(const void * data, size_t len);
+
+/* CRC32C using the slice-by-8 tables, regardless of the CPU. For testing and benchmarking */
+uint32_t sniffer_crc32c_sw(const void * data, size_t len);
+
+/* Name of the implementation used by sniffer_crc32c(): "sse4.2", "armv8" or "slice-by-8" */
+const char * sniffer_crc32c_impl(void);
+
+/**
+ * @brief Drop-in for csp_crc32_verify().
+ * The CRC covers the data only (not the header, for compatibility with csp1.x), and is stored big endian in the last 4 bytes.
+ * @return 0 and strips the CRC from packet->length if it matches, -1 otherwise.
+ */
+int sniffer_crc32_verify(csp_packet_t * packet);
@@ -0,0 +1,214 @@
+/*
+ * sniffer_dedup.c
+ *
+ * See sniffer_dedup.h
+ *
+ * The sets are split into shards by key hash, each with its own lock, so decoding threads rarely contend.
+ */
+
+#include "sniffer_dedup.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <slash/slash.h>
+#include <slash/optparse.h>
+
+#define DEDUP_SHARDS      16
+#define DEDUP_SHARD_MIN   64
+
+typedef struct {
+    uint64_t key;      // node << 48 | id << 32 | idx
+    uint64_t time_ms;  // 0 if the slot is free
+    uint64_t value;    // Bits of the value
+} dedup_entry_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    dedup_entry_t * sets[2];  // Current and previous generation
+    size_t size;              // Slots of each generation, a power of two
+    size_t used;              // Entries in the current generation
+    uint32_t window_ms;
+    uint64_t rotated_ms;      // Monotonic time the current generation was started
+} dedup_shard_t;
+
+static dedup_shard_t shards[DEDUP_SHARDS] = {
+    [0 ... DEDUP_SHARDS - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER },
+};
+static pthread_mutex_t config_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_int dedup_enabled = 0;
+
+static uint64_t dedup_clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t dedup_hash(uint64_t key, uint64_t time_ms) {
+    uint64_t h = (key ^ (time_ms * 0x9E3779B97F4A7C15ULL)) * 0xBF58476D1CE4E5B9ULL;
+    return h ^ (h >> 31);
+}
+
+/* Free the sets of every shard. Called with config_lock held */
+static void dedup_free(void) {
+    for (int i = 0; i < DEDUP_SHARDS; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        free(shards[i].sets[0]);
+        free(shards[i].sets[1]);
+        shards[i].sets[0] = NULL;
+        shards[i].sets[1] = NULL;
+        shards[i].used = 0;
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+}
+
+int sniffer_dedup_enable(uint32_t window_ms, size_t capacity) {
+
+    if (window_ms == 0 || capacity == 0) {
+        return -1;
+    }
+
+    size_t size = DEDUP_SHARD_MIN;
+    while (size * DEDUP_SHARDS < capacity) {
+        size *= 2;
+    }
+
+    pthread_mutex_lock(&config_lock);
+    atomic_store(&dedup_enabled, 0);
+    dedup_free();
+
+    uint64_t now = dedup_clock_ms();
+    for (int i = 0; i < DEDUP_SHARDS; i++) {
+        dedup_entry_t * current = calloc(size, sizeof(dedup_entry_t));
+        dedup_entry_t * previous = calloc(size, sizeof(dedup_entry_t));
+        if (current == NULL || previous == NULL) {
+            free(current);
+            free(previous);
+            dedup_free();
+            pthread_mutex_unlock(&config_lock);
+            return -1;
+        }
+        pthread_mutex_lock(&shards[i].lock);
+        shards[i].sets[0] = current;
+        shards[i].sets[1] = previous;
+        shards[i].size = size;
+        shards[i].window_ms = window_ms;
+        shards[i].rotated_ms = now;
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+    atomic_store(&dedup_enabled, 1);
+    pthread_mutex_unlock(&config_lock);
+
+    return 0;
+}
+
+void sniffer_dedup_disable(void) {
+    pthread_mutex_lock(&config_lock);
+    atomic_store(&dedup_enabled, 0);
+    dedup_free();
+    pthread_mutex_unlock(&config_lock);
+}
+
+int sniffer_dedup_is_enabled(void) {
+    return atomic_load_explicit(&dedup_enabled, memory_order_relaxed);
+}
+
+/* Slot of key in set, either holding it or the free slot where it belongs */
+static dedup_entry_t * dedup_probe(dedup_entry_t * set, size_t size, uint64_t hash, uint64_t key, uint64_t time_ms, uint64_t value, int * found) {
+    size_t slot = (hash >> 4) & (size - 1);
+    while (set[slot].time_ms != 0) {
+        if (set[slot].key == key && set[slot].time_ms == time_ms && set[slot].value == value) {
+            *found = 1;
+            return &set[slot];
+        }
+        slot = (slot + 1) & (size - 1);
+    }
+    *found = 0;
+    return &set[slot];
+}
+
+int sniffer_dedup_seen(uint16_t node, uint16_t id, uint32_t idx, uint64_t time_ms, const sniffer_value_t * value) {
+
+    if (!atomic_load_explicit(&dedup_enabled, memory_order_relaxed) || time_ms == 0) {
+        return 0;
+    }
+
+    uint64_t key = ((uint64_t) node << 48) | ((uint64_t) id << 32) | idx;
+    uint64_t bits = value->u;
+    uint64_t hash = dedup_hash(key, time_ms);
+    dedup_shard_t * shard = &shards[hash & (DEDUP_SHARDS - 1)];
+
+    pthread_mutex_lock(&shard->lock);
+    if (shard->sets[0] == NULL) {
+        pthread_mutex_unlock(&shard->lock);
+        return 0;
+    }
+
+    size_t size = shard->size;
+    int found;
+    dedup_entry_t * slot = dedup_probe(shard->sets[0], size, hash, key, time_ms, bits, &found);
+    if (!found) {
+        dedup_probe(shard->sets[1], size, hash, key, time_ms, bits, &found);
+    }
+    if (found) {
+        pthread_mutex_unlock(&shard->lock);
+        return 1;
+    }
+
+    /* Start a new generation once the window has passed, or before probing gets slow */
+    uint64_t now = dedup_clock_ms();
+    if (now - shard->rotated_ms >= shard->window_ms || (shard->used + 1) * 4 > size * 3) {
+        dedup_entry_t * previous = shard->sets[1];
+        memset(previous, 0, size * sizeof(dedup_entry_t));
+        shard->sets[1] = shard->sets[0];
+        shard->sets[0] = previous;
+        shard->used = 0;
+        shard->rotated_ms = now;
+        slot = dedup_probe(shard->sets[0], size, hash, key, time_ms, bits, &found);
+    }
+
+    slot->key = key;
+    slot->time_ms = time_ms;
+    slot->value = bits;
+    shard->used++;
+    pthread_mutex_unlock(&shard->lock);
+
+    return 0;
+}
+
+static int sniffer_dedup_cmd(struct slash * slash) {
+
+    unsigned int window_ms = SNIFFER_DEDUP_WINDOW_MS_DEFAULT;
+    unsigned int capacity = SNIFFER_DEDUP_CAPACITY_DEFAULT;
+    int disable = 0;
+
+    optparse_t * parser = optparse_new("sniffer_dedup", "");
+    optparse_add_help(parser);
+    optparse_add_unsigned(parser, 'w', "window", "NUM", 0, &window_ms, "remember samples for at least this many ms (default 600000)");
+    optparse_add_unsigned(parser, 's', "size", "NUM", 0, &capacity, "samples remembered per generation (default 262144)");
+    optparse_add_set(parser, 'd', "disable", 1, &disable, "stop suppressing duplicates");
+
+    int argi = optparse_parse(parser, slash->argc - 1, (const char **) slash->argv + 1);
+    optparse_del(parser);
+    if (argi < 0) {
+        return SLASH_EINVAL;
+    }
+
+    if (disable) {
+        sniffer_dedup_disable();
+        printf("Duplicate suppression disabled\n");
+        return SLASH_SUCCESS;
+    }
+
+    if (sniffer_dedup_enable(window_ms, capacity) < 0) {
+        printf("Failed to enable duplicate suppression\n");
+        return SLASH_EINVAL;
+    }
+    printf("Suppressing duplicate samples seen within %u ms\n", window_ms);
+    return SLASH_SUCCESS;
+}
+slash_command(sniffer_dedup, sniffer_dedup_cmd, "", "Suppress duplicate sniffed samples");
@@ -0,0 +1,41 @@
+/*
+ * sniffer_dedup.h
+ *
+ * Suppression of samples seen before, as when the same pull response is sniffed through several relays,
+ * retransmitted by RDP, or the same HK window is downloaded twice.
+ * A sample is a duplicate if a sample with the same node, id, index, timestamp and value was seen within the window.
+ * Comparing the value too keeps distinct samples that share a coarse timestamp.
+ * Only samples with a timestamp from the packet are checked, those stamped on reception never repeat.
+ *
+ * Seen samples are kept in two generations of bounded hash sets. The current generation becomes the previous one
+ * when the window has passed or it is 3/4 full, so samples are remembered for between one and two windows, less under heavy load.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "param_sniffer.h"
+
+#define SNIFFER_DEDUP_WINDOW_MS_DEFAULT (10 * 60 * 1000)
+#define SNIFFER_DEDUP_CAPACITY_DEFAULT  (256 * 1024)
+
+/**
+ * @brief Start suppressing duplicates, or change the settings, which forgets the samples seen so far.
+ * @param window_ms How long a sample is remembered, at least.
+ * @param capacity Samples remembered per generation, rounded up to a power of two. Each takes 48 bytes, over both generations.
+ * @return 0 on success, -1 if an argument is 0 or the sets could not be allocated.
+ */
+int sniffer_dedup_enable(uint32_t window_ms, size_t capacity);
+
+/* Stop suppressing duplicates, and free the sets */
+void sniffer_dedup_disable(void);
+
+int sniffer_dedup_is_enabled(void);
+
+/**
+ * @brief Check a decoded sample against those seen, and remember it.
+ * @return 1 if it is a duplicate and should be dropped, 0 otherwise (also when disabled).
+ */
+int sniffer_dedup_seen(uint16_t node, uint16_t id, uint32_t idx, uint64_t time_ms, const sniffer_value_t * value);
@@ -0,0 +1,327 @@
+/*
+ * sniffer_filter.c
+ *
+ * See sniffer_filter.h
+ */
+
+#include "sniffer_filter.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <slash/slash.h>
+#include <slash/optparse.h>
+
+#define FILTER_BITMAP_SIZE (65536 / 8)
+
+typedef struct {
+    int node_filter;    // Nonzero if only the nodes set in nodes are accepted, and likewise below
+    int port_filter;
+    int id_filter;
+    uint8_t ports[256 / 8];
+    uint8_t nodes[FILTER_BITMAP_SIZE];
+    uint8_t ids[FILTER_BITMAP_SIZE];
+} filter_table_t;
+
+/* The master table is only touched with filter_lock held. Threads copy it when filter_generation changes */
+static pthread_mutex_t filter_lock = PTHREAD_MUTEX_INITIALIZER;
+static filter_table_t master;
+static sniffer_filter_settings_t settings;
+static atomic_uint filter_generation = 0;
+static atomic_int filter_active = 0;
+
+static __thread filter_table_t * local = NULL;
+static __thread unsigned int local_generation = 0;
+static pthread_key_t local_key;
+static pthread_once_t local_key_once = PTHREAD_ONCE_INIT;
+
+static void filter_key_init(void) {
+    pthread_key_create(&local_key, free);
+}
+
+static inline int filter_bit(const uint8_t * bits, unsigned int n) {
+    return (bits[n >> 3] >> (n & 7)) & 1;
+}
+
+/**
+ * Set the bits of the comma separated decimal numbers and ranges in text, which must all be <= max.
+ * Empty elements, including a trailing comma, are malformed. @return number of ranges, -1 if malformed
+ */
+static int filter_parse(const char * text, uint8_t * bits, size_t size, unsigned long max) {
+
+    memset(bits, 0, size);
+
+    const char * p = text;
+    while (isspace((unsigned char) *p)) {
+        p++;
+    }
+    if (*p == '\0') {
+        return 0;
+    }
+
+    int ranges = 0;
+    while (1) {
+        while (isspace((unsigned char) *p)) {
+            p++;
+        }
+        if (!isdigit((unsigned char) *p)) {
+            return -1;
+        }
+
+        char * end;
+        unsigned long first = strtoul(p, &end, 10);
+        unsigned long last = first;
+        p = end;
+        while (isspace((unsigned char) *p)) {
+            p++;
+        }
+        if (*p == '-') {
+            p++;
+            while (isspace((unsigned char) *p)) {
+                p++;
+            }
+            if (!isdigit((unsigned char) *p)) {
+                return -1;
+            }
+            last = strtoul(p, &end, 10);
+            p = end;
+        }
+        if (first > last || last > max) {
+            return -1;
+        }
+        for (unsigned long n = first; n <= last; n++) {
+            bits[n >> 3] |= 1 << (n & 7);
+        }
+        ranges++;
+
+        while (isspace((unsigned char) *p)) {
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        if (*p != ',') {
+            return -1;
+        }
+        p++;
+    }
+
+    return ranges;
+}
+
+static int filter_text_valid(const char * text) {
+    return text == NULL || strlen(text) < SNIFFER_FILTER_TEXT_MAX;
+}
+
+static void filter_text_set(char * out, const char * text) {
+    strcpy(out, text ? text : "");
+}
+
+/* Publish the master table to the sniffer threads. Called with filter_lock held */
+static void filter_publish(void) {
+    atomic_store(&filter_active, master.node_filter || master.port_filter || master.id_filter);
+    atomic_fetch_add(&filter_generation, 1);
+}
+
+/* Compile the settings into a table. @return 0 on success, -1 if any part is malformed */
+static int filter_build(filter_table_t * table, const sniffer_filter_settings_t * text) {
+
+    int nodes = filter_parse(text->nodes, table->nodes, sizeof(table->nodes), 0xFFFF);
+    int ports = filter_parse(text->ports, table->ports, sizeof(table->ports), SNIFFER_FILTER_PORT_MAX);
+    int allow = filter_parse(text->allow, table->ids, sizeof(table->ids), 0xFFFF);
+
+    uint8_t * denied = malloc(FILTER_BITMAP_SIZE);
+    int deny = denied ? filter_parse(text->deny, denied, FILTER_BITMAP_SIZE, 0xFFFF) : -1;
+    if (nodes < 0 || ports < 0 || allow < 0 || deny < 0) {
+        free(denied);
+        return -1;
+    }
+
+    /* Without an allow list everything is allowed, except what is denied */
+    for (size_t i = 0; i < FILTER_BITMAP_SIZE; i++) {
+        table->ids[i] = (allow > 0 ? table->ids[i] : 0xFF) & ~denied[i];
+    }
+    free(denied);
+
+    table->node_filter = (nodes > 0);
+    table->port_filter = (ports > 0);
+    table->id_filter = (allow > 0 || deny > 0);
+    return 0;
+}
+
+int sniffer_filter_set(const char * nodes, const char * ports, const char * allow, const char * deny) {
+
+    if (!filter_text_valid(nodes) || !filter_text_valid(ports) || !filter_text_valid(allow) || !filter_text_valid(deny)) {
+        return -1;
+    }
+    filter_table_t * table = malloc(sizeof(filter_table_t));
+    if (table == NULL) {
+        return -1;
+    }
+
+    /* The threads only take the lock once the change is published, so they are not held up by the parsing */
+    pthread_mutex_lock(&filter_lock);
+    sniffer_filter_settings_t text = settings;
+    if (nodes) {
+        filter_text_set(text.nodes, nodes);
+    }
+    if (ports) {
+        filter_text_set(text.ports, ports);
+    }
+    if (allow) {
+        filter_text_set(text.allow, allow);
+    }
+    if (deny) {
+        filter_text_set(text.deny, deny);
+    }
+    int res = filter_build(table, &text);
+    if (res == 0) {
+        master = *table;
+        settings = text;
+        filter_publish();
+    }
+    pthread_mutex_unlock(&filter_lock);
+
+    free(table);
+    return res;
+}
+
+int sniffer_filter_nodes(const char * ranges) {
+    return sniffer_filter_set(ranges ? ranges : "", NULL, NULL, NULL);
+}
+
+int sniffer_filter_ports(const char * ranges) {
+    return sniffer_filter_set(NULL, ranges ? ranges : "", NULL, NULL);
+}
+
+int sniffer_filter_params(const char * allow, const char * deny) {
+    return sniffer_filter_set(NULL, NULL, allow ? allow : "", deny ? deny : "");
+}
+
+void sniffer_filter_clear(void) {
+    pthread_mutex_lock(&filter_lock);
+    master.node_filter = master.port_filter = master.id_filter = 0;
+    memset(&settings, 0, sizeof(settings));
+    filter_publish();
+    pthread_mutex_unlock(&filter_lock);
+}
+
+void sniffer_filter_get(sniffer_filter_settings_t * out) {
+    pthread_mutex_lock(&filter_lock);
+    *out = settings;
+    pthread_mutex_unlock(&filter_lock);
+}
+
+/* The calling thread's copy of the master table, refreshed if it has changed */
+static const filter_table_t * filter_local(void) {
+
+    unsigned int generation = atomic_load_explicit(&filter_generation, memory_order_acquire);
+    if (local != NULL && local_generation == generation) {
+        return local;
+    }
+
+    if (local == NULL) {
+        pthread_once(&local_key_once, filter_key_init);
+        local = malloc(sizeof(filter_table_t));
+        if (local == NULL) {
+            return NULL;
+        }
+        pthread_setspecific(local_key, local);
+    }
+
+    pthread_mutex_lock(&filter_lock);
+    memcpy(local, &master, sizeof(filter_table_t));
+    local_generation = atomic_load(&filter_generation);
+    pthread_mutex_unlock(&filter_lock);
+
+    return local;
+}
+
+int sniffer_filter_packet(const csp_packet_t * packet) {
+
+    if (!atomic_load_explicit(&filter_active, memory_order_relaxed)) {
+        return 1;
+    }
+
+    const filter_table_t * table = filter_local();
+    if (table == NULL) {
+        return 1;
+    }
+
+    if (table->node_filter && !filter_bit(table->nodes, packet->id.src)) {
+        return 0;
+    }
+    if (table->port_filter && !filter_bit(table->ports, packet->id.sport) && !filter_bit(table->ports, packet->id.dport)) {
+        return 0;
+    }
+    return 1;
+}
+
+int sniffer_filter_param(uint16_t node, uint16_t id) {
+
+    if (!atomic_load_explicit(&filter_active, memory_order_relaxed)) {
+        return 1;
+    }
+
+    const filter_table_t * table = filter_local();
+    if (table == NULL) {
+        return 1;
+    }
+
+    if (table->node_filter && !filter_bit(table->nodes, node)) {
+        return 0;
+    }
+    if (table->id_filter && !filter_bit(table->ids, id)) {
+        return 0;
+    }
+    return 1;
+}
+
+static int sniffer_filter_cmd(struct slash * slash) {
+
+    char * nodes = NULL;
+    char * ports = NULL;
+    char * allow = NULL;
+    char * deny = NULL;
+    int clear = 0;
+
+    optparse_t * parser = optparse_new("sniffer_filter", "");
+    optparse_add_help(parser);
+    optparse_add_string(parser, 'n', "nodes", "RANGES", &nodes, "only accept packets from these nodes, like 1-10,20 (\"\" for all)");
+    optparse_add_string(parser, 'p', "ports", "RANGES", &ports, "only accept packets to or from these ports (\"\" for all)");
+    optparse_add_string(parser, 'a', "allow", "RANGES", &allow, "only decode these parameter ids (\"\" for all)");
+    optparse_add_string(parser, 'd', "deny", "RANGES", &deny, "never decode these parameter ids (\"\" for none)");
+    optparse_add_set(parser, 'c', "clear", 1, &clear, "accept all traffic");
+
+    int argi = optparse_parse(parser, slash->argc - 1, (const char **) slash->argv + 1);
+    if (argi < 0) {
+        optparse_del(parser);
+        return SLASH_EINVAL;
+    }
+
+    if (clear) {
+        sniffer_filter_clear();
+    }
+
+    int res = sniffer_filter_set(nodes, ports, allow, deny);
+    optparse_del(parser);
+
+    if (res < 0) {
+        printf("Malformed ranges, expected numbers and ranges like 1-10,20\n");
+        return SLASH_EINVAL;
+    }
+
+    sniffer_filter_settings_t current;
+    sniffer_filter_get(&current);
+    printf("nodes: %s\n", current.nodes[0] ? current.nodes : "all");
+    printf("ports: %s\n", current.ports[0] ? current.ports : "all");
+    printf("allow: %s\n", current.allow[0] ? current.allow : "all");
+    printf("deny:  %s\n", current.deny[0] ? current.deny : "none");
+
+    return SLASH_SUCCESS;
+}
+slash_command(sniffer_filter, sniffer_filter_cmd, "[OPTIONS...]", "Drop sniffed traffic early, by node, port and parameter id");
@@ -0,0 +1,62 @@
+/*
+ * sniffer_filter.h
+ *
+ * Early filter for sniffed traffic, by source node, port and parameter id.
+ * The settings are compiled into bitmaps, copied by each sniffer thread when they change,
+ * so checking a packet or parameter takes no locks. Without any filter set, every check passes at once.
+ *
+ * Ranges are written as comma separated numbers and inclusive ranges, like "1-10,20".
+ * An empty string or NULL removes that part of the filter.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <csp/csp.h>
+
+/* CSP ports are 6 bit */
+#define SNIFFER_FILTER_PORT_MAX 63
+
+/* Only accept packets from these source nodes. @return 0 on success, -1 if ranges is malformed */
+int sniffer_filter_nodes(const char * ranges);
+
+/* Only accept packets to or from these ports. @return 0 on success, -1 if ranges is malformed */
+int sniffer_filter_ports(const char * ranges);
+
+/**
+ * @brief Select the parameter ids decoded from accepted packets.
+ * @param allow Only decode these ids, NULL or empty for all.
+ * @param deny Never decode these ids, takes precedence over allow.
+ * @return 0 on success, -1 if either is malformed, in which case nothing is changed.
+ */
+int sniffer_filter_params(const char * allow, const char * deny);
+
+/**
+ * @brief Change several parts of the filter at once. Every part is parsed before any is applied.
+ * @param nodes, ports, allow, deny As for the functions above. NULL leaves that part unchanged, "" removes it.
+ * @return 0 on success, -1 if any part is malformed, in which case nothing is changed.
+ */
+int sniffer_filter_set(const char * nodes, const char * ports, const char * allow, const char * deny);
+
+/* Accept all traffic again */
+void sniffer_filter_clear(void);
+
+/* Longest setting accepted, as text */
+#define SNIFFER_FILTER_TEXT_MAX 1024
+
+/* The settings as given, empty where unset */
+typedef struct {
+    char nodes[SNIFFER_FILTER_TEXT_MAX];
+    char ports[SNIFFER_FILTER_TEXT_MAX];
+    char allow[SNIFFER_FILTER_TEXT_MAX];
+    char deny[SNIFFER_FILTER_TEXT_MAX];
+} sniffer_filter_settings_t;
+
+void sniffer_filter_get(sniffer_filter_settings_t * settings);
+
+/* Run first on every sniffed packet. @return 1 to process the packet, 0 to drop it */
+int sniffer_filter_packet(const csp_packet_t * packet);
+
+/* Run for every parameter in an accepted packet, before looking it up. @return 1 to decode it, 0 to skip it */
+int sniffer_filter_param(uint16_t node, uint16_t id);
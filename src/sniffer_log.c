@@ -0,0 +1,370 @@
+/*
+ * sniffer_log.c
+ *
+ * Group commit writer for param_sniffer.log, see sniffer_log.h
+ */
+
+#include "sniffer_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include <slash/slash.h>
+#include <slash/optparse.h>
+
+/* Current log file, only touched with file_lock held */
+FILE *logfile;
+
+static char * log_path = NULL;
+static size_t file_size = 0;
+static time_t file_opened = 0;
+
+/* Producers append to queue_active, the writer swaps it for queue_flush and writes that without buf_lock */
+typedef struct {
+    char * data;
+    size_t size;
+    size_t capacity;
+} log_queue_t;
+
+static log_queue_t queues[2];
+static log_queue_t * queue_active = NULL;
+static log_queue_t * queue_flush = NULL;
+static uint64_t first_ms = 0;  // When the first line in queue_active was queued
+static uint64_t dropped = 0;
+static size_t queue_size = SNIFFER_LOG_QUEUE_SIZE_DEFAULT;
+
+static size_t commit_bytes = SNIFFER_LOG_COMMIT_BYTES_DEFAULT;
+static unsigned int commit_ms = SNIFFER_LOG_COMMIT_MS_DEFAULT;
+static size_t rotate_bytes = 0;
+static unsigned int rotate_seconds = 0;
+static unsigned int rotate_keep = SNIFFER_LOG_KEEP_DEFAULT;
+
+static pthread_mutex_t buf_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t buf_cond;
+static pthread_t writer_thread;
+
+static uint64_t log_clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int sniffer_log_set_queue_size(size_t bytes) {
+
+    if (bytes == 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&buf_lock);
+    /* Capacity is fixed while the queues are allocated */
+    int busy = (queue_active != NULL && bytes != queue_size);
+    if (!busy) {
+        queue_size = bytes;
+    }
+    pthread_mutex_unlock(&buf_lock);
+
+    return busy ? -1 : 0;
+}
+
+size_t sniffer_log_get_queue_size(void) {
+    pthread_mutex_lock(&buf_lock);
+    size_t bytes = queue_size;
+    pthread_mutex_unlock(&buf_lock);
+    return bytes;
+}
+
+void sniffer_log_set_commit(size_t bytes, unsigned int ms) {
+    pthread_mutex_lock(&buf_lock);
+    commit_bytes = bytes;
+    commit_ms = ms;
+    pthread_mutex_unlock(&buf_lock);
+}
+
+void sniffer_log_get_commit(size_t * bytes, unsigned int * ms) {
+    pthread_mutex_lock(&buf_lock);
+    *bytes = commit_bytes;
+    *ms = commit_ms;
+    pthread_mutex_unlock(&buf_lock);
+}
+
+void sniffer_log_set_rotation(size_t max_bytes, unsigned int max_seconds, unsigned int keep) {
+    pthread_mutex_lock(&file_lock);
+    rotate_bytes = max_bytes;
+    rotate_seconds = max_seconds;
+    rotate_keep = keep;
+    pthread_mutex_unlock(&file_lock);
+}
+
+void sniffer_log_get_rotation(size_t * max_bytes, unsigned int * max_seconds, unsigned int * keep) {
+    pthread_mutex_lock(&file_lock);
+    *max_bytes = rotate_bytes;
+    *max_seconds = rotate_seconds;
+    *keep = rotate_keep;
+    pthread_mutex_unlock(&file_lock);
+}
+
+uint64_t sniffer_log_dropped(void) {
+    pthread_mutex_lock(&buf_lock);
+    uint64_t count = dropped;
+    pthread_mutex_unlock(&buf_lock);
+    return count;
+}
+
+int sniffer_log_is_open(void) {
+    return queue_active != NULL;
+}
+
+void sniffer_log_write(const char * data, size_t len) {
+
+    pthread_mutex_lock(&buf_lock);
+    if (queue_active == NULL) {
+        pthread_mutex_unlock(&buf_lock);
+        return;
+    }
+    if (queue_active->size + len > queue_active->capacity) {
+        dropped += len;
+        pthread_mutex_unlock(&buf_lock);
+        return;
+    }
+    if (queue_active->size == 0) {
+        first_ms = log_clock_ms();
+        pthread_cond_signal(&buf_cond);
+    }
+    memcpy(queue_active->data + queue_active->size, data, len);
+    queue_active->size += len;
+    if (queue_active->size >= commit_bytes && queue_active->size - len < commit_bytes) {
+        pthread_cond_signal(&buf_cond);
+    }
+    pthread_mutex_unlock(&buf_lock);
+}
+
+/* Shift <path>.N to <path>.N+1, dropping the oldest, and reopen a fresh <path>. Called with file_lock held */
+static void log_rotate(void) {
+
+    char from[PATH_MAX];
+    char to[PATH_MAX];
+
+    fclose(logfile);
+    logfile = NULL;
+
+    if (rotate_keep == 0) {
+        remove(log_path);
+    } else {
+        snprintf(to, sizeof(to), "%s.%u", log_path, rotate_keep);
+        remove(to);
+        for (unsigned int i = rotate_keep - 1; i >= 1; i--) {
+            snprintf(from, sizeof(from), "%s.%u", log_path, i);
+            snprintf(to, sizeof(to), "%s.%u", log_path, i + 1);
+            rename(from, to);
+        }
+        snprintf(to, sizeof(to), "%s.1", log_path);
+        rename(log_path, to);
+    }
+
+    logfile = fopen(log_path, "a");
+    if (logfile == NULL) {
+        printf("Couldn't reopen %s after rotation\n", log_path);
+    }
+    file_size = 0;
+    file_opened = time(NULL);
+}
+
+void sniffer_log_flush(void) {
+
+    pthread_mutex_lock(&file_lock);
+
+    pthread_mutex_lock(&buf_lock);
+    if (queue_active == NULL) {
+        pthread_mutex_unlock(&buf_lock);
+        pthread_mutex_unlock(&file_lock);
+        return;
+    }
+    log_queue_t * batch = queue_active;
+    queue_active = queue_flush;
+    queue_flush = batch;
+    pthread_mutex_unlock(&buf_lock);
+
+    if (batch->size > 0 && logfile) {
+        fwrite(batch->data, 1, batch->size, logfile);
+        fflush(logfile);
+        file_size += batch->size;
+
+        if ((rotate_bytes && file_size >= rotate_bytes)
+                || (rotate_seconds && time(NULL) - file_opened >= (time_t) rotate_seconds)) {
+            log_rotate();
+        }
+    }
+    batch->size = 0;
+
+    pthread_mutex_unlock(&file_lock);
+}
+
+static void * sniffer_log_writer(void * arg) {
+
+    while (1) {
+        pthread_mutex_lock(&buf_lock);
+        while (1) {
+            uint64_t now = log_clock_ms();
+            if (queue_active->size > 0 && (queue_active->size >= commit_bytes || now >= first_ms + commit_ms)) {
+                break;
+            }
+            /* Also wake periodically, so time based rotation happens on an idle log */
+            uint64_t wake_ms = now + 1000;
+            if (queue_active->size > 0 && first_ms + commit_ms < wake_ms) {
+                wake_ms = first_ms + commit_ms;
+            }
+            struct timespec wake = { .tv_sec = wake_ms / 1000, .tv_nsec = (wake_ms % 1000) * 1000000 };
+            if (pthread_cond_timedwait(&buf_cond, &buf_lock, &wake) != 0 && queue_active->size == 0) {
+                break;
+            }
+        }
+        pthread_mutex_unlock(&buf_lock);
+
+        pthread_mutex_lock(&file_lock);
+        if (logfile && rotate_seconds && time(NULL) - file_opened >= (time_t) rotate_seconds && file_size > 0) {
+            log_rotate();
+        }
+        pthread_mutex_unlock(&file_lock);
+
+        sniffer_log_flush();
+    }
+
+    return NULL;
+}
+
+/* Undo a partial sniffer_log_open() */
+static void sniffer_log_open_abort(void) {
+
+    pthread_mutex_lock(&file_lock);
+    if (logfile) {
+        fclose(logfile);
+        logfile = NULL;
+    }
+    free(log_path);
+    log_path = NULL;
+    pthread_mutex_unlock(&file_lock);
+
+    free(queues[0].data);
+    free(queues[1].data);
+    queues[0].data = queues[1].data = NULL;
+}
+
+int sniffer_log_open(const char * path) {
+
+    if (queue_active != NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&file_lock);
+    logfile = fopen(path, "a");
+    if (logfile == NULL) {
+        pthread_mutex_unlock(&file_lock);
+        return -1;
+    }
+    fseek(logfile, 0, SEEK_END);
+    file_size = ftell(logfile);
+    file_opened = time(NULL);
+    log_path = strdup(path);
+    pthread_mutex_unlock(&file_lock);
+
+    size_t size = sniffer_log_get_queue_size();
+    queues[0].data = malloc(size);
+    queues[1].data = malloc(size);
+    queues[0].capacity = queues[1].capacity = size;
+    if (queues[0].data == NULL || queues[1].data == NULL || log_path == NULL) {
+        sniffer_log_open_abort();
+        return -1;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&buf_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_mutex_lock(&buf_lock);
+    queue_active = &queues[0];
+    queue_flush = &queues[1];
+    pthread_mutex_unlock(&buf_lock);
+
+    if (pthread_create(&writer_thread, NULL, &sniffer_log_writer, NULL) != 0) {
+        pthread_mutex_lock(&buf_lock);
+        queue_active = queue_flush = NULL;
+        pthread_mutex_unlock(&buf_lock);
+        sniffer_log_open_abort();
+        return -1;
+    }
+
+    /* Don't lose the last commit interval when the interpreter exits */
+    atexit(sniffer_log_flush);
+
+    return 0;
+}
+
+static int sniffer_log_cmd(struct slash * slash) {
+
+    int commit_kb = -1;
+    int commit_ms_arg = -1;
+    int rotate_mb = -1;
+    int rotate_s = -1;
+    int keep = -1;
+    int queue_kb = -1;
+
+    optparse_t * parser = optparse_new("sniffer_log", "");
+    optparse_add_help(parser);
+    optparse_add_int(parser, 'c', "commit-size", "KB", 0, &commit_kb, "write once this much is queued (default 64)");
+    optparse_add_int(parser, 't', "commit-age", "MS", 0, &commit_ms_arg, "write once the oldest line is this old (default 200)");
+    optparse_add_int(parser, 'r', "rotate-size", "MB", 0, &rotate_mb, "rotate when the file exceeds this size, 0 to disable (default 0)");
+    optparse_add_int(parser, 'a', "rotate-age", "SECONDS", 0, &rotate_s, "rotate when the file has been written this long, 0 to disable (default 0)");
+    optparse_add_int(parser, 'k', "keep", "NUM", 0, &keep, "rotated files kept (default 5)");
+    optparse_add_int(parser, 'q', "queue-size", "KB", 0, &queue_kb, "capacity of the in-memory queue, before the log is opened (default 4096)");
+
+    int argi = optparse_parse(parser, slash->argc - 1, (const char **) slash->argv + 1);
+    optparse_del(parser);
+    if (argi < 0) {
+        return SLASH_EINVAL;
+    }
+
+    /* -1 leaves a setting unchanged */
+    if (commit_kb < -1 || commit_ms_arg < -1 || rotate_mb < -1 || rotate_s < -1 || keep < -1 || queue_kb < -1) {
+        printf("Settings must not be negative\n");
+        return SLASH_EINVAL;
+    }
+    if (queue_kb == 0 || (queue_kb > 0 && sniffer_log_set_queue_size((size_t) queue_kb * 1024) < 0)) {
+        printf("Queue size must be above 0, and can only be changed before the log is opened\n");
+        return SLASH_EINVAL;
+    }
+
+    size_t bytes;
+    unsigned int ms;
+    sniffer_log_get_commit(&bytes, &ms);
+    if (commit_kb >= 0 || commit_ms_arg >= 0) {
+        bytes = (commit_kb >= 0) ? (size_t) commit_kb * 1024 : bytes;
+        ms = (commit_ms_arg >= 0) ? (unsigned int) commit_ms_arg : ms;
+        sniffer_log_set_commit(bytes, ms);
+    }
+
+    size_t max_bytes;
+    unsigned int max_seconds, max_keep;
+    sniffer_log_get_rotation(&max_bytes, &max_seconds, &max_keep);
+    if (rotate_mb >= 0 || rotate_s >= 0 || keep >= 0) {
+        max_bytes = (rotate_mb >= 0) ? (size_t) rotate_mb * 1024 * 1024 : max_bytes;
+        max_seconds = (rotate_s >= 0) ? (unsigned int) rotate_s : max_seconds;
+        max_keep = (keep >= 0) ? (unsigned int) keep : max_keep;
+        sniffer_log_set_rotation(max_bytes, max_seconds, max_keep);
+    }
+
+    printf("Queue of %zu KB, commit at %zu KB or %u ms\n", sniffer_log_get_queue_size() / 1024, bytes / 1024, ms);
+    if (max_bytes || max_seconds) {
+        printf("Rotate at %zu MB or %u s, keeping %u files\n", max_bytes / (1024 * 1024), max_seconds, max_keep);
+    } else {
+        printf("No rotation\n");
+    }
+    return SLASH_SUCCESS;
+}
+slash_command(sniffer_log, sniffer_log_cmd, "[OPTIONS...]", "Show or set when param_sniffer.log is written and rotated");
@@ -0,0 +1,63 @@
+/*
+ * sniffer_log.h
+ *
+ * Asynchronous writer for param_sniffer.log.
+ * Lines are queued in memory and written by a background thread in groups,
+ * so the sniffer workers never issue a write syscall per sample.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SNIFFER_LOG_QUEUE_SIZE_DEFAULT  (4 * 1024 * 1024)
+#define SNIFFER_LOG_COMMIT_BYTES_DEFAULT (64 * 1024)
+#define SNIFFER_LOG_COMMIT_MS_DEFAULT    200
+#define SNIFFER_LOG_KEEP_DEFAULT         5
+
+/**
+ * @brief Open the log file for append and start the writer thread.
+ * @return 0 on success, -1 if the file could not be opened or the writer not started.
+ */
+int sniffer_log_open(const char * path);
+
+/* Returns true once sniffer_log_open() has succeeded */
+int sniffer_log_is_open(void);
+
+/**
+ * @brief Queue lines for writing. Never blocks on I/O. Lines that do not fit in the queue are dropped and counted.
+ */
+void sniffer_log_write(const char * data, size_t len);
+
+/* Write everything queued so far, from the calling thread */
+void sniffer_log_flush(void);
+
+/**
+ * @brief Set the capacity of the in-memory queue. Lines queued beyond it are dropped and counted.
+ * The queue is allocated twice, as the writer writes one while producers fill the other.
+ * @return 0 on success, -1 if bytes is 0, or the log is open and bytes differs from the current capacity.
+ */
+int sniffer_log_set_queue_size(size_t bytes);
+size_t sniffer_log_get_queue_size(void);
+
+/**
+ * @brief Set when queued lines are committed to the file.
+ * @param bytes Commit once this many bytes are queued.
+ * @param ms Commit once the oldest queued line is this old.
+ */
+void sniffer_log_set_commit(size_t bytes, unsigned int ms);
+void sniffer_log_get_commit(size_t * bytes, unsigned int * ms);
+
+/**
+ * @brief Rotate the log when it grows too large or too old.
+ * The current file is renamed to <path>.1, older ones shifted up to <path>.<keep>, and the oldest removed.
+ * @param max_bytes Rotate when the file exceeds this size, 0 to disable.
+ * @param max_seconds Rotate when the file has been written for this long, 0 to disable.
+ * @param keep Number of rotated files to keep.
+ */
+void sniffer_log_set_rotation(size_t max_bytes, unsigned int max_seconds, unsigned int keep);
+void sniffer_log_get_rotation(size_t * max_bytes, unsigned int * max_seconds, unsigned int * keep);
+
+/* Number of bytes dropped because the queue was full */
+uint64_t sniffer_log_dropped(void);
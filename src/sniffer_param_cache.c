@@ -0,0 +1,241 @@
+/*
+ * sniffer_param_cache.c
+ *
+ * See sniffer_param_cache.h
+ */
+
+#include "sniffer_param_cache.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <param/param_list.h>
+
+typedef struct {
+    uint32_t key;  // 0 for empty, otherwise param_cache_key()
+    param_t * param;
+} param_cache_entry_t;
+
+typedef struct {
+    param_cache_entry_t * entries;
+    unsigned int size;
+    unsigned int used;
+    unsigned int generation;
+} param_cache_t;
+
+/* Bumped to invalidate every thread's table. Tables are cleared lazily, by their own thread */
+static atomic_uint cache_generation = 1;
+
+/* Prefers writers, so the resolver is not starved by workers decoding back to back */
+static pthread_rwlock_t list_lock;
+static pthread_once_t list_lock_once = PTHREAD_ONCE_INIT;
+
+/* Node whose list is being downloaded, -1 if none. Set under the write lock, read under the read lock */
+static atomic_int list_changing_node = -1;
+
+static __thread param_cache_t * cache = NULL;
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+static void param_cache_free(void * arg) {
+    param_cache_t * table = arg;
+    free(table->entries);
+    free(table);
+}
+
+static void param_cache_key_init(void) {
+    pthread_key_create(&cache_key, param_cache_free);
+}
+
+static inline uint32_t param_cache_key(int node, int id) {
+    /* Node and id are both 16 bit. Offset by one, so node 0 id 0 does not look empty */
+    return (((uint32_t) node << 16) | (uint16_t) id) + 1;
+}
+
+static inline unsigned int param_cache_slot(const param_cache_t * table, uint32_t key) {
+    return (key * 2654435761u) & (table->size - 1);
+}
+
+void sniffer_param_cache_invalidate(void) {
+    atomic_fetch_add(&cache_generation, 1);
+}
+
+unsigned int sniffer_param_cache_generation(void) {
+    return atomic_load_explicit(&cache_generation, memory_order_acquire);
+}
+
+/*
+ * Every change of the parameter list goes through these, linked in place of the libparam functions with
+ * -Wl,--wrap (see meson.build). The tables are invalidated before the change, so cached pointers to parameters
+ * about to be removed are no longer handed out, and again after it, for lookups cached while it was made.
+ * A download only adds parameters or updates them in place, so it invalidates the tables when done only.
+ */
+int __real_param_list_add(param_t * item);
+int __real_param_list_remove(int node, uint8_t verbose);
+void __real_param_list_remove_specific(param_t * param, uint8_t verbose, int destroy);
+int __real_param_list_download(int node, int timeout, int version, int include_remotes);
+
+int __wrap_param_list_add(param_t * item) {
+    sniffer_param_cache_invalidate();
+    int res = __real_param_list_add(item);
+    sniffer_param_cache_invalidate();
+    return res;
+}
+
+int __wrap_param_list_remove(int node, uint8_t verbose) {
+    sniffer_param_cache_invalidate();
+    int res = __real_param_list_remove(node, verbose);
+    sniffer_param_cache_invalidate();
+    return res;
+}
+
+void __wrap_param_list_remove_specific(param_t * param, uint8_t verbose, int destroy) {
+    sniffer_param_cache_invalidate();
+    __real_param_list_remove_specific(param, verbose, destroy);
+    sniffer_param_cache_invalidate();
+}
+
+int __wrap_param_list_download(int node, int timeout, int version, int include_remotes) {
+    int res = __real_param_list_download(node, timeout, version, include_remotes);
+    sniffer_param_cache_invalidate();
+    return res;
+}
+
+static void param_list_lock_init(void) {
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&list_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+}
+
+void sniffer_param_list_read_lock(void) {
+    pthread_once(&list_lock_once, param_list_lock_init);
+    pthread_rwlock_rdlock(&list_lock);
+}
+
+void sniffer_param_list_unlock(void) {
+    pthread_rwlock_unlock(&list_lock);
+}
+
+void sniffer_param_list_change_begin(uint16_t node) {
+    /* Waits for the workers to finish the packets they are decoding, later ones see the change */
+    pthread_once(&list_lock_once, param_list_lock_init);
+    pthread_rwlock_wrlock(&list_lock);
+    atomic_store(&list_changing_node, node);
+    pthread_rwlock_unlock(&list_lock);
+}
+
+void sniffer_param_list_change_end(void) {
+    atomic_store(&list_changing_node, -1);
+}
+
+static void param_cache_clear(param_cache_t * table) {
+    memset(table->entries, 0, table->size * sizeof(param_cache_entry_t));
+    table->used = 0;
+}
+
+static void param_cache_insert(param_cache_t * table, uint32_t key, param_t * param) {
+
+    unsigned int slot = param_cache_slot(table, key);
+    while (table->entries[slot].key != 0) {
+        slot = (slot + 1) & (table->size - 1);
+    }
+    table->entries[slot].key = key;
+    table->entries[slot].param = param;
+    table->used++;
+}
+
+/* Double the table, or clear it if it is already at the maximum size or memory is short */
+static void param_cache_grow(param_cache_t * table) {
+
+    param_cache_entry_t * entries = NULL;
+    if (table->size < SNIFFER_PARAM_CACHE_SIZE_MAX) {
+        entries = calloc(table->size * 2, sizeof(param_cache_entry_t));
+    }
+    if (entries == NULL) {
+        param_cache_clear(table);
+        return;
+    }
+
+    param_cache_entry_t * old = table->entries;
+    unsigned int old_size = table->size;
+    table->entries = entries;
+    table->size *= 2;
+    table->used = 0;
+    for (unsigned int i = 0; i < old_size; i++) {
+        if (old[i].key != 0) {
+            param_cache_insert(table, old[i].key, old[i].param);
+        }
+    }
+    free(old);
+}
+
+static param_cache_t * param_cache_get(void) {
+
+    if (cache == NULL) {
+        pthread_once(&cache_key_once, param_cache_key_init);
+        param_cache_t * table = calloc(1, sizeof(param_cache_t));
+        if (table == NULL) {
+            return NULL;
+        }
+        table->entries = calloc(SNIFFER_PARAM_CACHE_SIZE, sizeof(param_cache_entry_t));
+        if (table->entries == NULL) {
+            free(table);
+            return NULL;
+        }
+        table->size = SNIFFER_PARAM_CACHE_SIZE;
+        table->generation = atomic_load(&cache_generation);
+        /* Freed when the thread exits */
+        pthread_setspecific(cache_key, table);
+        cache = table;
+    }
+
+    unsigned int generation = atomic_load_explicit(&cache_generation, memory_order_acquire);
+    if (cache->generation != generation) {
+        param_cache_clear(cache);
+        cache->generation = generation;
+    }
+
+    return cache;
+}
+
+param_t * sniffer_param_find(int node, int id) {
+
+    /* While a list is downloaded, its node is not decoded and the list is not walked, only cached lookups are used */
+    int changing = atomic_load(&list_changing_node);
+    if (changing == node) {
+        return NULL;
+    }
+
+    param_cache_t * table = param_cache_get();
+    if (table == NULL) {
+        return changing < 0 ? param_list_find_id(node, id) : NULL;
+    }
+
+    uint32_t key = param_cache_key(node, id);
+    unsigned int slot = param_cache_slot(table, key);
+    while (table->entries[slot].key != 0) {
+        if (table->entries[slot].key == key) {
+            return table->entries[slot].param;
+        }
+        slot = (slot + 1) & (table->size - 1);
+    }
+
+    if (changing >= 0) {
+        return NULL;
+    }
+
+    /* Misses are cached as well, so unknown parameters cost no list walk until the list changes */
+    param_t * param = param_list_find_id(node, id);
+
+    if (table->used >= table->size / 4 * 3) {
+        param_cache_grow(table);
+    }
+    param_cache_insert(table, key, param);
+
+    return param;
+}
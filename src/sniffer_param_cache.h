@@ -0,0 +1,44 @@
+/*
+ * sniffer_param_cache.h
+ *
+ * (node, id) -> param lookup cache for the sniffer decode loop.
+ * Each decoding thread has its own open addressing table in front of param_list_find_id(),
+ * so lookups take no locks. Parameters not found are cached too. All tables are invalidated together whenever
+ * the parameter list changes, by wrappers around the libparam list functions linked in with -Wl,--wrap.
+ */
+
+#pragma once
+
+#include <param/param.h>
+
+/* Entries per thread, powers of two. A table grows when it becomes 3/4 full, and is cleared when it cannot grow further */
+#define SNIFFER_PARAM_CACHE_SIZE     4096
+#define SNIFFER_PARAM_CACHE_SIZE_MAX (128 * 1024)
+
+/* Cached param_list_find_id() */
+param_t * sniffer_param_find(int node, int id);
+
+/* Forget all cached lookups. Done automatically when param_list_add(), param_list_remove(), param_list_remove_specific()
+ * or param_list_download() is called */
+void sniffer_param_cache_invalidate(void);
+
+/* Changes whenever the cache is invalidated, for callers caching their own results per parameter */
+unsigned int sniffer_param_cache_generation(void);
+
+/**
+ * @brief Lock the parameter list against changes by the sniffer resolver, held shared by the decode workers for
+ * each packet. Changes made from the CLI or Python do not take the lock, since a Python sink may hold a worker
+ * in the lock while it waits for the GIL.
+ */
+void sniffer_param_list_read_lock(void);
+
+void sniffer_param_list_unlock(void);
+
+/**
+ * @brief Mark the list of a node as being downloaded, once the workers are done with the packets they hold.
+ * Until sniffer_param_list_change_end(), sniffer_param_find() returns NULL for that node, and for other
+ * parameters not already cached, so the download runs without pausing the workers.
+ */
+void sniffer_param_list_change_begin(uint16_t node);
+
+void sniffer_param_list_change_end(void);
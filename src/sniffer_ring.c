@@ -0,0 +1,252 @@
+/*
+ * sniffer_ring.c
+ *
+ * See sniffer_ring.h
+ *
+ * Positions are counted from the start and never wrap, the slot of a position is position % capacity.
+ * Samples from tail to read are leased to the consumer, and from read to head are waiting to be taken.
+ */
+
+#include "sniffer_ring.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+typedef struct {
+    uint64_t end;
+    unsigned int refs;
+} ring_lease_t;
+
+struct sniffer_ring_s {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int fd;
+    int closed;
+    size_t capacity;
+    uint64_t head;
+    uint64_t read;
+    uint64_t tail;
+    uint64_t dropped;
+
+    /* Spans handed out, oldest first. tail moves past a span once it and all older ones are released */
+    ring_lease_t * leases;
+    size_t lease_count;
+    size_t lease_size;
+    uint64_t lease_first;
+
+    uint64_t * times;
+    uint16_t * nodes;
+    uint16_t * ids;
+    uint32_t * idxs;
+    double * values;
+};
+
+sniffer_ring_t * sniffer_ring_create(size_t capacity) {
+
+    if (capacity == 0) {
+        return NULL;
+    }
+
+    sniffer_ring_t * ring = calloc(1, sizeof(sniffer_ring_t));
+    if (ring == NULL) {
+        return NULL;
+    }
+
+    ring->capacity = capacity;
+    ring->times = malloc(capacity * sizeof(uint64_t));
+    ring->nodes = malloc(capacity * sizeof(uint16_t));
+    ring->ids = malloc(capacity * sizeof(uint16_t));
+    ring->idxs = malloc(capacity * sizeof(uint32_t));
+    ring->values = malloc(capacity * sizeof(double));
+    ring->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!ring->times || !ring->nodes || !ring->ids || !ring->idxs || !ring->values || ring->fd < 0) {
+        if (ring->fd >= 0) {
+            close(ring->fd);
+        }
+        ring->fd = -1;
+        sniffer_ring_destroy(ring);
+        return NULL;
+    }
+
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&ring->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    return ring;
+}
+
+void sniffer_ring_destroy(sniffer_ring_t * ring) {
+
+    if (ring == NULL) {
+        return;
+    }
+
+    if (ring->fd >= 0) {
+        close(ring->fd);
+        pthread_mutex_destroy(&ring->lock);
+        pthread_cond_destroy(&ring->cond);
+    }
+    free(ring->leases);
+    free(ring->times);
+    free(ring->nodes);
+    free(ring->ids);
+    free(ring->idxs);
+    free(ring->values);
+    free(ring);
+}
+
+static void ring_notify(sniffer_ring_t * ring) {
+    uint64_t one = 1;
+    if (write(ring->fd, &one, sizeof(one)) < 0) {
+        /* The counter is already set, which is all the reader needs */
+    }
+}
+
+void sniffer_ring_push(void * ctx, const sniffer_sample_t * samples, size_t count) {
+
+    sniffer_ring_t * ring = ctx;
+
+    pthread_mutex_lock(&ring->lock);
+    if (ring->closed) {
+        pthread_mutex_unlock(&ring->lock);
+        return;
+    }
+
+    uint64_t head = ring->head;
+    for (size_t i = 0; i < count; i++) {
+        if (head - ring->tail >= ring->capacity) {
+            ring->dropped += count - i;
+            break;
+        }
+        size_t slot = head % ring->capacity;
+        ring->times[slot] = samples[i].time_ms;
+        ring->nodes[slot] = samples[i].node;
+        ring->ids[slot] = samples[i].id;
+        ring->idxs[slot] = samples[i].idx;
+        ring->values[slot] = sniffer_value_double(&samples[i].value);
+        head++;
+    }
+
+    if (head != ring->head) {
+        /* Only an empty ring needs the event loop woken, otherwise the consumer has yet to take what is there */
+        if (ring->read == ring->head) {
+            ring_notify(ring);
+        }
+        ring->head = head;
+        pthread_cond_broadcast(&ring->cond);
+    }
+    pthread_mutex_unlock(&ring->lock);
+}
+
+int sniffer_ring_take(sniffer_ring_t * ring, sniffer_ring_span_t * span, unsigned int refs, unsigned int timeout_ms) {
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&ring->lock);
+    while (ring->read == ring->head) {
+        if (ring->closed) {
+            pthread_mutex_unlock(&ring->lock);
+            return -1;
+        }
+        if (timeout_ms == 0 || pthread_cond_timedwait(&ring->cond, &ring->lock, &deadline) != 0) {
+            if (ring->read == ring->head) {
+                pthread_mutex_unlock(&ring->lock);
+                return 0;
+            }
+        }
+    }
+
+    if (ring->lease_count == ring->lease_size) {
+        size_t size = ring->lease_size ? ring->lease_size * 2 : 16;
+        ring_lease_t * leases = realloc(ring->leases, size * sizeof(ring_lease_t));
+        if (leases == NULL) {
+            pthread_mutex_unlock(&ring->lock);
+            return 0;
+        }
+        ring->leases = leases;
+        ring->lease_size = size;
+    }
+
+    size_t slot = ring->read % ring->capacity;
+    size_t count = ring->head - ring->read;
+    if (count > ring->capacity - slot) {
+        count = ring->capacity - slot;
+    }
+
+    span->lease = ring->lease_first + ring->lease_count;
+    span->count = count;
+    span->times = &ring->times[slot];
+    span->nodes = &ring->nodes[slot];
+    span->ids = &ring->ids[slot];
+    span->idxs = &ring->idxs[slot];
+    span->values = &ring->values[slot];
+
+    ring->read += count;
+    ring->leases[ring->lease_count].end = ring->read;
+    ring->leases[ring->lease_count].refs = refs ? refs : 1;
+    ring->lease_count++;
+    pthread_mutex_unlock(&ring->lock);
+
+    return 1;
+}
+
+void sniffer_ring_release(sniffer_ring_t * ring, uint64_t lease) {
+
+    pthread_mutex_lock(&ring->lock);
+    uint64_t index = lease - ring->lease_first;
+    if (lease >= ring->lease_first && index < ring->lease_count && ring->leases[index].refs > 0) {
+        ring->leases[index].refs--;
+    }
+
+    size_t done = 0;
+    while (done < ring->lease_count && ring->leases[done].refs == 0) {
+        ring->tail = ring->leases[done].end;
+        done++;
+    }
+    if (done > 0) {
+        ring->lease_count -= done;
+        ring->lease_first += done;
+        memmove(ring->leases, ring->leases + done, ring->lease_count * sizeof(ring_lease_t));
+    }
+    pthread_mutex_unlock(&ring->lock);
+}
+
+void sniffer_ring_close(sniffer_ring_t * ring) {
+    pthread_mutex_lock(&ring->lock);
+    ring->closed = 1;
+    ring_notify(ring);
+    pthread_cond_broadcast(&ring->cond);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+int sniffer_ring_fd(sniffer_ring_t * ring) {
+    return ring->fd;
+}
+
+void sniffer_ring_fd_clear(sniffer_ring_t * ring) {
+    uint64_t count;
+    if (read(ring->fd, &count, sizeof(count)) < 0) {
+        /* Nothing was signalled */
+    }
+}
+
+uint64_t sniffer_ring_dropped(sniffer_ring_t * ring) {
+    pthread_mutex_lock(&ring->lock);
+    uint64_t dropped = ring->dropped;
+    pthread_mutex_unlock(&ring->lock);
+    return dropped;
+}
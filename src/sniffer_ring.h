@@ -0,0 +1,62 @@
+/*
+ * sniffer_ring.h
+ *
+ * Ring buffer of sniffed samples, for consumers that read them in batches without copying.
+ * Samples are stored as columns, and handed out as contiguous spans that stay valid until released.
+ * The ring is filled by registering sniffer_ring_push() as a sink (sniffer_sink.h). When it is full, new samples are dropped.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sniffer_sink.h"
+
+typedef struct sniffer_ring_s sniffer_ring_t;
+
+/* Columns of consecutive samples. Values are converted to double */
+typedef struct {
+    uint64_t lease;
+    size_t count;
+    const uint64_t * times;
+    const uint16_t * nodes;
+    const uint16_t * ids;
+    const uint32_t * idxs;
+    const double * values;
+} sniffer_ring_span_t;
+
+/**
+ * @brief Allocate a ring holding up to capacity samples.
+ * @return The ring, or NULL if out of memory.
+ */
+sniffer_ring_t * sniffer_ring_create(size_t capacity);
+
+/* Free a closed ring. Must not be registered as a sink anymore */
+void sniffer_ring_destroy(sniffer_ring_t * ring);
+
+/* Sink function, with the ring as ctx */
+void sniffer_ring_push(void * ctx, const sniffer_sample_t * samples, size_t count);
+
+/**
+ * @brief Take the oldest unread samples that are contiguous in the ring.
+ * @param refs The span stays valid until sniffer_ring_release() has been called this many times.
+ * @param timeout_ms Time to wait for samples, 0 to return at once.
+ * @return 1 with span set, 0 if no samples arrived in time, -1 if the ring is closed and drained.
+ */
+int sniffer_ring_take(sniffer_ring_t * ring, sniffer_ring_span_t * span, unsigned int refs, unsigned int timeout_ms);
+
+/* Release a span, so the ring can reuse its samples once all older spans are released too */
+void sniffer_ring_release(sniffer_ring_t * ring, uint64_t lease);
+
+/* Wake up waiting consumers, and make sniffer_ring_take() return -1 once the ring is drained */
+void sniffer_ring_close(sniffer_ring_t * ring);
+
+/* File descriptor that becomes readable when samples arrive in an empty ring, or it is closed. For event loops */
+int sniffer_ring_fd(sniffer_ring_t * ring);
+
+/* Drain the file descriptor, before checking the ring with sniffer_ring_take() */
+void sniffer_ring_fd_clear(sniffer_ring_t * ring);
+
+/* Samples dropped because the ring was full */
+uint64_t sniffer_ring_dropped(sniffer_ring_t * ring);
@@ -0,0 +1,140 @@
+/*
+ * sniffer_sink.c
+ *
+ * See sniffer_sink.h
+ */
+
+#include "sniffer_sink.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+typedef struct {
+    char name[SNIFFER_SINK_NAME_MAX];
+    sniffer_sink_fn fn;
+    void * ctx;
+} sniffer_sink_t;
+
+typedef struct {
+    size_t count;
+    sniffer_sample_t samples[SNIFFER_SINK_BATCH];
+} sink_batch_t;
+
+/* Held for reading while a batch is handed to the sinks, and for writing while they are changed */
+static pthread_rwlock_t sinks_lock = PTHREAD_RWLOCK_INITIALIZER;
+static sniffer_sink_t sinks[SNIFFER_SINKS_MAX];
+static atomic_int sink_count = 0;
+
+static __thread sink_batch_t * batch = NULL;
+static pthread_key_t batch_key;
+static pthread_once_t batch_key_once = PTHREAD_ONCE_INIT;
+
+static void sink_batch_key_init(void) {
+    pthread_key_create(&batch_key, free);
+}
+
+int sniffer_sink_add(const char * name, sniffer_sink_fn fn, void * ctx) {
+
+    if (fn == NULL || strlen(name) >= SNIFFER_SINK_NAME_MAX) {
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&sinks_lock);
+    int count = atomic_load(&sink_count);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(sinks[i].name, name) == 0) {
+            pthread_rwlock_unlock(&sinks_lock);
+            return -1;
+        }
+    }
+    if (count >= SNIFFER_SINKS_MAX) {
+        pthread_rwlock_unlock(&sinks_lock);
+        return -1;
+    }
+    strcpy(sinks[count].name, name);
+    sinks[count].fn = fn;
+    sinks[count].ctx = ctx;
+    atomic_store(&sink_count, count + 1);
+    pthread_rwlock_unlock(&sinks_lock);
+
+    return 0;
+}
+
+int sniffer_sink_remove(const char * name, void ** ctx) {
+
+    pthread_rwlock_wrlock(&sinks_lock);
+    int count = atomic_load(&sink_count);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(sinks[i].name, name) != 0) {
+            continue;
+        }
+        if (ctx) {
+            *ctx = sinks[i].ctx;
+        }
+        memmove(&sinks[i], &sinks[i + 1], (count - i - 1) * sizeof(sniffer_sink_t));
+        atomic_store(&sink_count, count - 1);
+        pthread_rwlock_unlock(&sinks_lock);
+        return 0;
+    }
+    pthread_rwlock_unlock(&sinks_lock);
+
+    return -1;
+}
+
+int sniffer_sink_count(void) {
+    return atomic_load_explicit(&sink_count, memory_order_relaxed);
+}
+
+void sniffer_sink_sample(uint16_t node, uint16_t id, uint32_t idx, uint64_t time_ms, const sniffer_value_t * value) {
+
+    if (batch == NULL) {
+        pthread_once(&batch_key_once, sink_batch_key_init);
+        batch = malloc(sizeof(sink_batch_t));
+        if (batch == NULL) {
+            return;
+        }
+        batch->count = 0;
+        pthread_setspecific(batch_key, batch);
+    }
+
+    sniffer_sample_t * sample = &batch->samples[batch->count++];
+    sample->node = node;
+    sample->id = id;
+    sample->idx = idx;
+    sample->time_ms = time_ms;
+    sample->value = *value;
+
+    if (batch->count == SNIFFER_SINK_BATCH) {
+        sniffer_sink_flush();
+    }
+}
+
+void sniffer_sink_flush(void) {
+
+    if (batch == NULL || batch->count == 0) {
+        return;
+    }
+
+    pthread_rwlock_rdlock(&sinks_lock);
+    int count = atomic_load(&sink_count);
+    for (int i = 0; i < count; i++) {
+        sinks[i].fn(sinks[i].ctx, batch->samples, batch->count);
+    }
+    pthread_rwlock_unlock(&sinks_lock);
+
+    batch->count = 0;
+}
+
+double sniffer_value_double(const sniffer_value_t * value) {
+    switch (value->kind) {
+        case SNIFFER_VALUE_UINT:
+            return (double) value->u;
+        case SNIFFER_VALUE_INT:
+            return (double) value->i;
+        case SNIFFER_VALUE_DOUBLE:
+        default:
+            return value->d;
+    }
+}
@@ -0,0 +1,54 @@
+/*
+ * sniffer_sink.h
+ *
+ * Registry of sinks receiving the decoded samples of the sniffer, in batches.
+ * Each decoding thread collects samples in a batch of its own, which is handed to every registered sink
+ * when it is full, and at the end of each packet. Sinks are therefore called from several threads at once,
+ * and must not add or remove sinks themselves.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "param_sniffer.h"
+
+#define SNIFFER_SINK_BATCH    256
+#define SNIFFER_SINKS_MAX     16
+#define SNIFFER_SINK_NAME_MAX 32
+
+typedef struct {
+    uint16_t node;
+    uint16_t id;
+    uint32_t idx;
+    uint64_t time_ms;
+    sniffer_value_t value;
+} sniffer_sample_t;
+
+typedef void (*sniffer_sink_fn)(void * ctx, const sniffer_sample_t * samples, size_t count);
+
+/**
+ * @brief Register fn to be called with each batch of samples.
+ * @return 0 on success, -1 if name is taken or too long, or SNIFFER_SINKS_MAX sinks are registered.
+ */
+int sniffer_sink_add(const char * name, sniffer_sink_fn fn, void * ctx);
+
+/**
+ * @brief Remove the sink registered under name. Returns once no thread is calling it, so its ctx can be freed.
+ * @param ctx Set to the ctx given to sniffer_sink_add(), unless NULL.
+ * @return 0 on success, -1 if no sink is registered under name.
+ */
+int sniffer_sink_remove(const char * name, void ** ctx);
+
+/* Number of registered sinks, so samples are only collected when someone listens */
+int sniffer_sink_count(void);
+
+/* Add a sample to the batch of the calling thread, handing the batch to the sinks when full */
+void sniffer_sink_sample(uint16_t node, uint16_t id, uint32_t idx, uint64_t time_ms, const sniffer_value_t * value);
+
+/* Hand the batch of the calling thread to the sinks */
+void sniffer_sink_flush(void);
+
+/* Convert a sample value to double, for sinks that handle all types alike */
+double sniffer_value_double(const sniffer_value_t * value);
@@ -0,0 +1,44 @@
+/*
+ * sniffer_stats.c
+ *
+ * See sniffer_stats.h
+ */
+
+#include "sniffer_stats.h"
+
+#include <stddef.h>
+
+const uint32_t sniffer_stats_bounds[SNIFFER_STATS_BUCKETS - 1] = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000};
+
+sniffer_stats_t sniffer_stats = {0};
+
+void sniffer_stats_observe(uint64_t hist[SNIFFER_STATS_BUCKETS], uint64_t * sum, uint64_t value) {
+
+    unsigned int bucket = 0;
+    while (bucket < SNIFFER_STATS_BUCKETS - 1 && value > sniffer_stats_bounds[bucket]) {
+        bucket++;
+    }
+    __atomic_fetch_add(&hist[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(sum, value, __ATOMIC_RELAXED);
+}
+
+void sniffer_stats_snapshot(sniffer_stats_t * out) {
+
+    const uint64_t * src = (const uint64_t *) &sniffer_stats;
+    uint64_t * dst = (uint64_t *) out;
+    for (size_t i = 0; i < sizeof(sniffer_stats_t) / sizeof(uint64_t); i++) {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+}
+
+void sniffer_stats_reset(void) {
+
+    uint64_t buffer_used = __atomic_load_n(&sniffer_stats.vm_buffer_used, __ATOMIC_RELAXED);
+    uint64_t spool_pending = __atomic_load_n(&sniffer_stats.vm_spool_pending, __ATOMIC_RELAXED);
+    uint64_t * counters = (uint64_t *) &sniffer_stats;
+    for (size_t i = 0; i < sizeof(sniffer_stats_t) / sizeof(uint64_t); i++) {
+        __atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&sniffer_stats.vm_buffer_used, buffer_used, __ATOMIC_RELAXED);
+    __atomic_store_n(&sniffer_stats.vm_spool_pending, spool_pending, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,61 @@
+/*
+ * sniffer_stats.h
+ *
+ * Counters and histograms of the telemetry ingest path: sniffer, VictoriaMetrics push and VTS.
+ * Exposed as local parameters (python_host.c) and as a Python snapshot (python_sniffer.c).
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Histogram buckets follow a 1-2-5 series, the last bucket counts everything above the largest bound */
+#define SNIFFER_STATS_BUCKETS 12
+extern const uint32_t sniffer_stats_bounds[SNIFFER_STATS_BUCKETS - 1];
+
+typedef struct {
+    uint64_t packets_read;      // Packets read from the promiscuous queue
+    uint64_t packets_hk;
+    uint64_t packets_param;
+    uint64_t packets_other;
+    uint64_t packets_dropped;   // Classified packets dropped because a worker was behind
+    uint64_t packets_filtered;  // Packets rejected by the filter (sniffer_filter.h)
+    uint64_t params_filtered;   // Parameters skipped by the filter while decoding
+    uint64_t crc_errors;
+    uint64_t decode_errors;     // Packets with malformed parameter data
+    uint64_t samples;           // Samples decoded and handed to the outputs
+    uint64_t duplicates;        // Samples dropped as seen before (sniffer_dedup.h)
+    uint64_t agg_samples;       // Samples taken into downsampling windows (sniffer_agg.h)
+    uint64_t agg_lines;         // Lines sent for closed downsampling windows
+    uint64_t agg_overflow;      // Samples sent at full rate because the downsampling series table was full
+    uint64_t vm_dropped;        // Lines dropped because the VictoriaMetrics buffer was full
+    uint64_t vm_unchanged;      // Samples not sent because their value did not change (vm_change.h)
+    uint64_t vm_buffer_used;    // Bytes waiting in the active VictoriaMetrics buffer
+    uint64_t vm_pushes;
+    uint64_t vm_push_errors;
+    uint64_t vm_push_ms;        // Duration of the last push
+    uint64_t vm_spooled;        // Bytes written to the disk spool
+    uint64_t vm_spool_dropped;  // Spooled bytes deleted to keep the spool within its bound
+    uint64_t vm_spool_pending;  // Bytes in the disk spool
+    uint64_t vts_errors;        // Failed sends to VTS
+    uint64_t decode_us_hist[SNIFFER_STATS_BUCKETS];  // Time to decode and log a packet, in microseconds
+    uint64_t vm_push_ms_hist[SNIFFER_STATS_BUCKETS]; // Push duration, in milliseconds
+    uint64_t decode_us_sum;     // Sum of the values counted in decode_us_hist
+    uint64_t vm_push_ms_sum;
+} sniffer_stats_t;
+
+/* Updated concurrently by the sniffer workers, so only modify through the macros below */
+extern sniffer_stats_t sniffer_stats;
+
+#define SNIFFER_STATS_ADD(counter, n) __atomic_fetch_add(&sniffer_stats.counter, (n), __ATOMIC_RELAXED)
+#define SNIFFER_STATS_INC(counter) SNIFFER_STATS_ADD(counter, 1)
+#define SNIFFER_STATS_SET(gauge, value) __atomic_store_n(&sniffer_stats.gauge, (value), __ATOMIC_RELAXED)
+
+/* Count value in the histogram hist, and add it to sum */
+void sniffer_stats_observe(uint64_t hist[SNIFFER_STATS_BUCKETS], uint64_t * sum, uint64_t value);
+
+/* Copy all counters, each read atomically */
+void sniffer_stats_snapshot(sniffer_stats_t * out);
+
+/* Zero all counters, except gauges */
+void sniffer_stats_reset(void);
@@ -0,0 +1,662 @@
+/*
+ * sniffer_store.c
+ *
+ * Compressed columnar store for sniffed parameter samples, see sniffer_store.h
+ *
+ * File layout (little endian):
+ *   file header: "PYCSHTS1"
+ *   chunks:      store_chunk_header_t, followed by payload_bytes of bit packed samples
+ *
+ * Payload, MSB first per byte. First sample: 64 bit timestamp, 64 bit raw value. Following samples:
+ *   timestamp delta-of-delta: '0' | '10' 7 bits | '110' 9 bits | '1110' 12 bits | '1111' 64 bits
+ *   double: '0' (same as previous) | '10' meaningful bits in previous window | '11' 5 bit leading zeros, 6 bit length - 1, meaningful bits
+ *   integer: zigzag encoded delta to previous value, as a varint of 8 bit groups
+ */
+
+#include "sniffer_store.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#define STORE_FILE_MAGIC   "PYCSHTS1"
+#define STORE_CHUNK_MAGIC  0x43535450u  // "PTSC"
+#define STORE_SAMPLE_MAX_BITS 160      // Worst case: 68 bits of timestamp + 80 bits of varint
+#define STORE_CHUNK_MAX_SAMPLES 65535
+#define STORE_STRIPES 16
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t node;
+    uint16_t id;
+    uint32_t idx;
+    uint8_t kind;
+    uint8_t reserved[3];
+    uint32_t count;
+    uint64_t t_first;
+    uint64_t t_last;
+    uint32_t payload_bytes;
+    uint32_t crc;  // crc32 of the payload
+} store_chunk_header_t;
+
+/* Bit packing */
+
+static void bits_write(uint8_t * buf, size_t * pos, uint64_t value, int nbits) {
+    while (nbits > 0) {
+        size_t byte = *pos >> 3;
+        int used = *pos & 7;
+        int room = 8 - used;
+        int take = (nbits < room) ? nbits : room;
+        uint8_t part = (value >> (nbits - take)) & ((1u << take) - 1);
+        if (used == 0) {
+            buf[byte] = 0;
+        }
+        buf[byte] |= part << (room - take);
+        *pos += take;
+        nbits -= take;
+    }
+}
+
+/* Returns 0 past end, in which case *pos is set beyond end so callers can detect truncation */
+static uint64_t bits_read(const uint8_t * buf, size_t * pos, size_t end, int nbits) {
+    uint64_t value = 0;
+    if (*pos + nbits > end) {
+        *pos = end + 1;
+        return 0;
+    }
+    while (nbits > 0) {
+        size_t byte = *pos >> 3;
+        int used = *pos & 7;
+        int room = 8 - used;
+        int take = (nbits < room) ? nbits : room;
+        value = (value << take) | ((buf[byte] >> (room - take)) & ((1u << take) - 1));
+        *pos += take;
+        nbits -= take;
+    }
+    return value;
+}
+
+static int64_t sign_extend(uint64_t value, int nbits) {
+    return (int64_t) (value << (64 - nbits)) >> (64 - nbits);
+}
+
+/* Writer */
+
+typedef struct store_series_s {
+    sniffer_series_key_t key;
+    sniffer_value_kind_e kind;
+    uint32_t count;
+    uint64_t t_first;
+    uint64_t t_last;
+    int64_t prev_delta;
+    uint64_t prev_value;
+    uint8_t prev_leading;
+    uint8_t prev_trailing;
+    size_t bits;
+    uint8_t data[SNIFFER_STORE_CHUNK_BYTES];
+    struct store_series_s * next;
+} store_series_t;
+
+/* Series are spread over stripes, so workers appending to different series rarely share a lock */
+typedef struct {
+    pthread_mutex_t lock;
+    int active;
+    store_series_t ** buckets;
+    size_t bucket_count;
+    size_t series_count;
+} store_stripe_t;
+
+static store_stripe_t stripes[STORE_STRIPES];
+static pthread_once_t stripes_once = PTHREAD_ONCE_INIT;
+static volatile int store_open = 0;
+static FILE * store_file = NULL;
+static char * store_path = NULL;
+static pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void stripes_init(void) {
+    for (int i = 0; i < STORE_STRIPES; i++) {
+        pthread_mutex_init(&stripes[i].lock, NULL);
+    }
+}
+
+static uint32_t series_hash(sniffer_series_key_t key) {
+    uint64_t h = ((uint64_t) key.node << 48) ^ ((uint64_t) key.id << 32) ^ key.idx;
+    h *= 0x9E3779B97F4A7C15ull;
+    return h >> 32;
+}
+
+static void store_write_chunk(store_series_t * s) {
+
+    if (s->count == 0) {
+        return;
+    }
+
+    store_chunk_header_t header = {
+        .magic = STORE_CHUNK_MAGIC,
+        .node = s->key.node,
+        .id = s->key.id,
+        .idx = s->key.idx,
+        .kind = s->kind,
+        .count = s->count,
+        .t_first = s->t_first,
+        .t_last = s->t_last,
+        .payload_bytes = (s->bits + 7) / 8,
+    };
+    header.crc = crc32(0, s->data, header.payload_bytes);
+
+    pthread_mutex_lock(&file_lock);
+    if (store_file) {
+        fwrite(&header, sizeof(header), 1, store_file);
+        fwrite(s->data, 1, header.payload_bytes, store_file);
+        fflush(store_file);
+    }
+    pthread_mutex_unlock(&file_lock);
+
+    s->count = 0;
+    s->bits = 0;
+}
+
+static void store_encode(store_series_t * s, uint64_t t, uint64_t v) {
+
+    if (s->count == 0) {
+        bits_write(s->data, &s->bits, t, 64);
+        bits_write(s->data, &s->bits, v, 64);
+        s->t_first = t;
+        s->prev_delta = 0;
+        s->prev_leading = 0xFF;
+        s->prev_trailing = 0;
+    } else {
+        int64_t delta = (int64_t) (t - s->t_last);
+        int64_t dod = delta - s->prev_delta;
+        if (dod == 0) {
+            bits_write(s->data, &s->bits, 0, 1);
+        } else if (dod >= -64 && dod <= 63) {
+            bits_write(s->data, &s->bits, 0x2, 2);
+            bits_write(s->data, &s->bits, dod, 7);
+        } else if (dod >= -256 && dod <= 255) {
+            bits_write(s->data, &s->bits, 0x6, 3);
+            bits_write(s->data, &s->bits, dod, 9);
+        } else if (dod >= -2048 && dod <= 2047) {
+            bits_write(s->data, &s->bits, 0xE, 4);
+            bits_write(s->data, &s->bits, dod, 12);
+        } else {
+            bits_write(s->data, &s->bits, 0xF, 4);
+            bits_write(s->data, &s->bits, dod, 64);
+        }
+        s->prev_delta = delta;
+
+        if (s->kind == SNIFFER_VALUE_DOUBLE) {
+            uint64_t xor = v ^ s->prev_value;
+            if (xor == 0) {
+                bits_write(s->data, &s->bits, 0, 1);
+            } else {
+                int leading = __builtin_clzll(xor);
+                int trailing = __builtin_ctzll(xor);
+                if (leading > 31) {
+                    leading = 31;
+                }
+                if (s->prev_leading != 0xFF && leading >= s->prev_leading && trailing >= s->prev_trailing) {
+                    /* Fits in the window of the previous value */
+                    int meaningful = 64 - s->prev_leading - s->prev_trailing;
+                    bits_write(s->data, &s->bits, 0x2, 2);
+                    bits_write(s->data, &s->bits, xor >> s->prev_trailing, meaningful);
+                } else {
+                    int meaningful = 64 - leading - trailing;
+                    bits_write(s->data, &s->bits, 0x3, 2);
+                    bits_write(s->data, &s->bits, leading, 5);
+                    bits_write(s->data, &s->bits, meaningful - 1, 6);
+                    bits_write(s->data, &s->bits, xor >> trailing, meaningful);
+                    s->prev_leading = leading;
+                    s->prev_trailing = trailing;
+                }
+            }
+        } else {
+            int64_t diff = (int64_t) (v - s->prev_value);
+            uint64_t zigzag = ((uint64_t) diff << 1) ^ (uint64_t) (diff >> 63);
+            do {
+                uint8_t group = zigzag & 0x7F;
+                zigzag >>= 7;
+                bits_write(s->data, &s->bits, group | (zigzag ? 0x80 : 0), 8);
+            } while (zigzag);
+        }
+    }
+
+    s->t_last = t;
+    s->prev_value = v;
+    s->count++;
+}
+
+static store_series_t * stripe_find_or_add(store_stripe_t * stripe, sniffer_series_key_t key, uint32_t hash) {
+
+    if (stripe->bucket_count > 0) {
+        for (store_series_t * s = stripe->buckets[hash % stripe->bucket_count]; s != NULL; s = s->next) {
+            if (s->key.node == key.node && s->key.id == key.id && s->key.idx == key.idx) {
+                return s;
+            }
+        }
+    }
+
+    /* Keep chains short by growing at load factor 1 */
+    if (stripe->series_count >= stripe->bucket_count) {
+        size_t new_count = stripe->bucket_count ? stripe->bucket_count * 2 : 64;
+        store_series_t ** new_buckets = calloc(new_count, sizeof(store_series_t *));
+        if (new_buckets == NULL) {
+            return NULL;
+        }
+        for (size_t b = 0; b < stripe->bucket_count; b++) {
+            store_series_t * s = stripe->buckets[b];
+            while (s) {
+                store_series_t * next = s->next;
+                size_t nb = (series_hash(s->key) >> 4) % new_count;
+                s->next = new_buckets[nb];
+                new_buckets[nb] = s;
+                s = next;
+            }
+        }
+        free(stripe->buckets);
+        stripe->buckets = new_buckets;
+        stripe->bucket_count = new_count;
+    }
+
+    store_series_t * s = malloc(sizeof(store_series_t));
+    if (s == NULL) {
+        return NULL;
+    }
+    s->key = key;
+    s->count = 0;
+    s->bits = 0;
+    size_t b = hash % stripe->bucket_count;
+    s->next = stripe->buckets[b];
+    stripe->buckets[b] = s;
+    stripe->series_count++;
+
+    return s;
+}
+
+void sniffer_store_append(uint16_t node, uint16_t id, uint32_t idx, uint64_t time_ms, const sniffer_value_t * value) {
+
+    sniffer_series_key_t key = { .node = node, .id = id, .idx = idx };
+    uint32_t hash = series_hash(key);
+    store_stripe_t * stripe = &stripes[hash % STORE_STRIPES];
+
+    uint64_t raw;
+    memcpy(&raw, &value->u, sizeof(raw));
+
+    pthread_mutex_lock(&stripe->lock);
+    if (stripe->active) {
+        store_series_t * s = stripe_find_or_add(stripe, key, hash >> 4);
+        if (s != NULL) {
+            if (s->count > 0 && (s->kind != value->kind
+                    || s->bits + STORE_SAMPLE_MAX_BITS > SNIFFER_STORE_CHUNK_BYTES * 8
+                    || s->count >= STORE_CHUNK_MAX_SAMPLES)) {
+                store_write_chunk(s);
+            }
+            s->kind = value->kind;
+            store_encode(s, time_ms, raw);
+        }
+    }
+    pthread_mutex_unlock(&stripe->lock);
+}
+
+static void store_flush_stripes(int free_series) {
+
+    for (int i = 0; i < STORE_STRIPES; i++) {
+        store_stripe_t * stripe = &stripes[i];
+        pthread_mutex_lock(&stripe->lock);
+        for (size_t b = 0; b < stripe->bucket_count; b++) {
+            store_series_t * s = stripe->buckets[b];
+            while (s) {
+                store_series_t * next = s->next;
+                store_write_chunk(s);
+                if (free_series) {
+                    free(s);
+                }
+                s = next;
+            }
+        }
+        if (free_series) {
+            stripe->active = 0;
+            free(stripe->buckets);
+            stripe->buckets = NULL;
+            stripe->bucket_count = 0;
+            stripe->series_count = 0;
+        }
+        pthread_mutex_unlock(&stripe->lock);
+    }
+}
+
+void sniffer_store_flush(void) {
+    if (store_open) {
+        store_flush_stripes(0);
+    }
+}
+
+int sniffer_store_is_open(void) {
+    return store_open;
+}
+
+const char * sniffer_store_path(void) {
+    return store_open ? store_path : NULL;
+}
+
+void sniffer_store_close(void) {
+
+    if (!store_open) {
+        return;
+    }
+    store_open = 0;
+    store_flush_stripes(1);
+
+    pthread_mutex_lock(&file_lock);
+    fclose(store_file);
+    store_file = NULL;
+    free(store_path);
+    store_path = NULL;
+    pthread_mutex_unlock(&file_lock);
+}
+
+int sniffer_store_open(const char * path) {
+
+    static int atexit_registered = 0;
+
+    pthread_once(&stripes_once, stripes_init);
+
+    if (store_open) {
+        return -1;
+    }
+
+    FILE * file = fopen(path, "a+b");
+    if (file == NULL) {
+        return -1;
+    }
+
+    /* Append mode writes always go to the end, but reads can check the header of an existing store */
+    char magic[8];
+    fseek(file, 0, SEEK_END);
+    if (ftell(file) == 0) {
+        fwrite(STORE_FILE_MAGIC, 1, sizeof(magic), file);
+        fflush(file);
+    } else {
+        fseek(file, 0, SEEK_SET);
+        if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, STORE_FILE_MAGIC, sizeof(magic)) != 0) {
+            printf("%s is not a sniffer store\n", path);
+            fclose(file);
+            return -1;
+        }
+    }
+
+    pthread_mutex_lock(&file_lock);
+    store_file = file;
+    store_path = strdup(path);
+    pthread_mutex_unlock(&file_lock);
+
+    for (int i = 0; i < STORE_STRIPES; i++) {
+        pthread_mutex_lock(&stripes[i].lock);
+        stripes[i].active = 1;
+        pthread_mutex_unlock(&stripes[i].lock);
+    }
+    store_open = 1;
+
+    if (!atexit_registered) {
+        atexit(sniffer_store_close);
+        atexit_registered = 1;
+    }
+
+    return 0;
+}
+
+/* Reader */
+
+typedef struct {
+    size_t offset;  // Of the header
+    store_chunk_header_t header;
+} store_chunk_ref_t;
+
+struct sniffer_store_reader_s {
+    const uint8_t * map;
+    size_t size;
+    store_chunk_ref_t * chunks;
+    size_t chunk_count;
+};
+
+sniffer_store_reader_t * sniffer_store_reader_open(const char * path) {
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t) strlen(STORE_FILE_MAGIC)) {
+        close(fd);
+        return NULL;
+    }
+
+    const uint8_t * map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    sniffer_store_reader_t * reader = calloc(1, sizeof(sniffer_store_reader_t));
+    if (reader == NULL || memcmp(map, STORE_FILE_MAGIC, strlen(STORE_FILE_MAGIC)) != 0) {
+        munmap((void *) map, st.st_size);
+        free(reader);
+        return NULL;
+    }
+    reader->map = map;
+    reader->size = st.st_size;
+
+    /* Index the chunk headers. A store being recorded may end in a partially written chunk, which is ignored */
+    size_t capacity = 0;
+    size_t offset = strlen(STORE_FILE_MAGIC);
+    while (offset + sizeof(store_chunk_header_t) <= reader->size) {
+        store_chunk_header_t header;
+        memcpy(&header, map + offset, sizeof(header));
+        if (header.magic != STORE_CHUNK_MAGIC || offset + sizeof(header) + header.payload_bytes > reader->size) {
+            break;
+        }
+        if (crc32(0, map + offset + sizeof(header), header.payload_bytes) != header.crc) {
+            break;
+        }
+        if (reader->chunk_count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            store_chunk_ref_t * tmp = realloc(reader->chunks, capacity * sizeof(store_chunk_ref_t));
+            if (tmp == NULL) {
+                break;
+            }
+            reader->chunks = tmp;
+        }
+        reader->chunks[reader->chunk_count].offset = offset;
+        reader->chunks[reader->chunk_count].header = header;
+        reader->chunk_count++;
+        offset += sizeof(header) + header.payload_bytes;
+    }
+
+    return reader;
+}
+
+void sniffer_store_reader_close(sniffer_store_reader_t * reader) {
+    if (reader == NULL) {
+        return;
+    }
+    munmap((void *) reader->map, reader->size);
+    free(reader->chunks);
+    free(reader);
+}
+
+static int key_compare(const void * a, const void * b) {
+    const sniffer_series_key_t * ka = a;
+    const sniffer_series_key_t * kb = b;
+    if (ka->node != kb->node) {
+        return ka->node - kb->node;
+    }
+    if (ka->id != kb->id) {
+        return ka->id - kb->id;
+    }
+    return (ka->idx > kb->idx) - (ka->idx < kb->idx);
+}
+
+size_t sniffer_store_reader_series(sniffer_store_reader_t * reader, sniffer_series_key_t * keys, size_t max) {
+
+    sniffer_series_key_t * all = malloc(reader->chunk_count * sizeof(sniffer_series_key_t) + 1);
+    if (all == NULL) {
+        return 0;
+    }
+    for (size_t i = 0; i < reader->chunk_count; i++) {
+        all[i].node = reader->chunks[i].header.node;
+        all[i].id = reader->chunks[i].header.id;
+        all[i].idx = reader->chunks[i].header.idx;
+    }
+    qsort(all, reader->chunk_count, sizeof(sniffer_series_key_t), key_compare);
+
+    size_t unique = 0;
+    for (size_t i = 0; i < reader->chunk_count; i++) {
+        if (i > 0 && key_compare(&all[i], &all[i - 1]) == 0) {
+            continue;
+        }
+        if (keys && unique < max) {
+            keys[unique] = all[i];
+        }
+        unique++;
+    }
+    free(all);
+
+    return unique;
+}
+
+static int chunk_matches(const store_chunk_header_t * header, sniffer_series_key_t key) {
+    return header->node == key.node && header->id == key.id && header->idx == key.idx;
+}
+
+size_t sniffer_store_reader_count(sniffer_store_reader_t * reader, sniffer_series_key_t key, sniffer_value_kind_e * kind) {
+
+    size_t count = 0;
+    int kind_set = 0;
+    for (size_t i = 0; i < reader->chunk_count; i++) {
+        if (chunk_matches(&reader->chunks[i].header, key)) {
+            if (!kind_set && kind) {
+                *kind = reader->chunks[i].header.kind;
+            }
+            kind_set = 1;
+            count += reader->chunks[i].header.count;
+        }
+    }
+    return count;
+}
+
+/* Store a raw value of kind from in the representation of kind to */
+static void convert_value(uint64_t raw, sniffer_value_kind_e from, sniffer_value_kind_e to, void * out) {
+
+    sniffer_value_t v = { .kind = from, .u = raw };
+    if (from == to) {
+        memcpy(out, &raw, sizeof(raw));
+        return;
+    }
+
+    double d;
+    memcpy(&d, &raw, sizeof(d));
+    switch (to) {
+        case SNIFFER_VALUE_DOUBLE: {
+            double res = (from == SNIFFER_VALUE_UINT) ? (double) v.u : (double) v.i;
+            memcpy(out, &res, sizeof(res));
+            break;
+        }
+        case SNIFFER_VALUE_INT: {
+            int64_t res = (from == SNIFFER_VALUE_DOUBLE) ? (int64_t) d : v.i;
+            memcpy(out, &res, sizeof(res));
+            break;
+        }
+        case SNIFFER_VALUE_UINT: {
+            uint64_t res = (from == SNIFFER_VALUE_DOUBLE) ? (uint64_t) d : v.u;
+            memcpy(out, &res, sizeof(res));
+            break;
+        }
+    }
+}
+
+/* Decode one chunk, returns the number of samples written */
+static size_t decode_chunk(const store_chunk_header_t * header, const uint8_t * payload, sniffer_value_kind_e kind,
+                           uint64_t * times_ms, uint8_t * values, size_t max) {
+
+    size_t pos = 0;
+    size_t end = (size_t) header->payload_bytes * 8;
+    uint64_t t = 0, v = 0;
+    int64_t delta = 0;
+    int leading = 0, trailing = 0;
+    size_t n;
+
+    for (n = 0; n < header->count && n < max; n++) {
+        if (n == 0) {
+            t = bits_read(payload, &pos, end, 64);
+            v = bits_read(payload, &pos, end, 64);
+        } else {
+            int64_t dod;
+            if (bits_read(payload, &pos, end, 1) == 0) {
+                dod = 0;
+            } else if (bits_read(payload, &pos, end, 1) == 0) {
+                dod = sign_extend(bits_read(payload, &pos, end, 7), 7);
+            } else if (bits_read(payload, &pos, end, 1) == 0) {
+                dod = sign_extend(bits_read(payload, &pos, end, 9), 9);
+            } else if (bits_read(payload, &pos, end, 1) == 0) {
+                dod = sign_extend(bits_read(payload, &pos, end, 12), 12);
+            } else {
+                dod = (int64_t) bits_read(payload, &pos, end, 64);
+            }
+            delta += dod;
+            t += delta;
+
+            if (header->kind == SNIFFER_VALUE_DOUBLE) {
+                if (bits_read(payload, &pos, end, 1) != 0) {
+                    if (bits_read(payload, &pos, end, 1) != 0) {
+                        leading = bits_read(payload, &pos, end, 5);
+                        int meaningful = bits_read(payload, &pos, end, 6) + 1;
+                        trailing = 64 - leading - meaningful;
+                    }
+                    int meaningful = 64 - leading - trailing;
+                    v ^= bits_read(payload, &pos, end, meaningful) << trailing;
+                }
+            } else {
+                uint64_t zigzag = 0;
+                for (int shift = 0; shift < 64; shift += 7) {
+                    uint64_t group = bits_read(payload, &pos, end, 8);
+                    zigzag |= (group & 0x7F) << shift;
+                    if (!(group & 0x80)) {
+                        break;
+                    }
+                }
+                int64_t diff = (int64_t) (zigzag >> 1) ^ -(int64_t) (zigzag & 1);
+                v += (uint64_t) diff;
+            }
+        }
+
+        if (pos > end) {
+            break;  // Corrupt payload
+        }
+        times_ms[n] = t;
+        convert_value(v, header->kind, kind, values + n * 8);
+    }
+
+    return n;
+}
+
+size_t sniffer_store_reader_read(sniffer_store_reader_t * reader, sniffer_series_key_t key, sniffer_value_kind_e kind,
+                                 uint64_t * times_ms, void * values, size_t max) {
+
+    size_t n = 0;
+    for (size_t i = 0; i < reader->chunk_count && n < max; i++) {
+        const store_chunk_ref_t * chunk = &reader->chunks[i];
+        if (!chunk_matches(&chunk->header, key)) {
+            continue;
+        }
+        const uint8_t * payload = reader->map + chunk->offset + sizeof(store_chunk_header_t);
+        n += decode_chunk(&chunk->header, payload, kind, times_ms + n, (uint8_t *) values + n * 8, max - n);
+    }
+    return n;
+}
@@ -0,0 +1,71 @@
+/*
+ * sniffer_store.h
+ *
+ * Compressed columnar store for sniffed parameter samples.
+ *
+ * Samples are grouped per series (node, id, idx) into chunks. Within a chunk timestamps are
+ * delta-of-delta encoded, doubles are XOR (Gorilla) encoded and integers are zigzag varint deltas.
+ * Completed chunks are appended to a single file, which is read back through a memory map.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "param_sniffer.h"
+
+/* Bytes of encoded samples in a chunk before it is written out */
+#define SNIFFER_STORE_CHUNK_BYTES 2048
+
+/**
+ * @brief Start recording sniffed samples to path. Existing stores are appended to.
+ * @return 0 on success, -1 if the file could not be opened or is not a store.
+ */
+int sniffer_store_open(const char * path);
+
+/* Write all partial chunks and stop recording */
+void sniffer_store_close(void);
+
+int sniffer_store_is_open(void);
+
+/* Path of the store being recorded, or NULL */
+const char * sniffer_store_path(void);
+
+void sniffer_store_append(uint16_t node, uint16_t id, uint32_t idx, uint64_t time_ms, const sniffer_value_t * value);
+
+/* Write all partial chunks, so they become visible to readers */
+void sniffer_store_flush(void);
+
+typedef struct sniffer_store_reader_s sniffer_store_reader_t;
+
+typedef struct {
+    uint16_t node;
+    uint16_t id;
+    uint32_t idx;
+} sniffer_series_key_t;
+
+sniffer_store_reader_t * sniffer_store_reader_open(const char * path);
+void sniffer_store_reader_close(sniffer_store_reader_t * reader);
+
+/**
+ * @brief List the distinct series in the store.
+ * @param keys Output array, may be NULL to only count.
+ * @return Number of distinct series.
+ */
+size_t sniffer_store_reader_series(sniffer_store_reader_t * reader, sniffer_series_key_t * keys, size_t max);
+
+/**
+ * @brief Count the samples of a series, and get its value kind.
+ * @param kind Set to the kind of the first chunk of the series, may be NULL.
+ */
+size_t sniffer_store_reader_count(sniffer_store_reader_t * reader, sniffer_series_key_t key, sniffer_value_kind_e * kind);
+
+/**
+ * @brief Decode the samples of a series in file order.
+ * @param times_ms Output timestamps in milliseconds.
+ * @param values Output values, 8 bytes each, stored as uint64_t/int64_t/double according to kind.
+ * @return Number of samples decoded, at most max.
+ */
+size_t sniffer_store_reader_read(sniffer_store_reader_t * reader, sniffer_series_key_t key, sniffer_value_kind_e kind,
+                                 uint64_t * times_ms, void * values, size_t max);
@@ -0,0 +1,287 @@
+/*
+ * sniffer_unknown.c
+ *
+ * See sniffer_unknown.h
+ */
+
+#include "sniffer_unknown.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <param/param_list.h>
+
+#include "sniffer_param_cache.h"
+
+#define UNKNOWN_TABLE_SIZE_MIN 256
+#define RESOLVER_QUEUE_LEN 64
+
+typedef struct {
+    uint32_t key;  // 0 for empty, otherwise unknown_key()
+    uint64_t count;
+    uint64_t unreported;
+    uint64_t reported_ms;
+} unknown_entry_t;
+
+typedef struct {
+    unknown_entry_t * entries;
+    unsigned int size;
+    unsigned int used;
+} unknown_table_t;
+
+static unknown_table_t unknowns = {0};
+static uint64_t unknown_total = 0;
+static pthread_mutex_t unknown_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Resolver state, also guarded by unknown_lock. Attempts are tracked per node in a table keyed node + 1 */
+static int resolver_enabled = 0;
+static int resolver_started = 0;
+static unsigned int resolver_timeout_ms = SNIFFER_RESOLVER_TIMEOUT_MS_DEFAULT;
+static int resolver_version = SNIFFER_RESOLVER_VERSION_DEFAULT;
+static unknown_table_t resolver_attempts = {0};  // reported_ms: time of last attempt
+static uint16_t resolver_queue[RESOLVER_QUEUE_LEN];
+static unsigned int resolver_queued = 0;
+static pthread_cond_t resolver_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t resolver_thread;
+
+static uint64_t unknown_clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static inline uint32_t unknown_key(uint16_t node, uint16_t id) {
+    return (((uint32_t) node << 16) | id) + 1;
+}
+
+static inline unsigned int unknown_slot(uint32_t key, unsigned int size) {
+    return (key * 2654435761u) & (size - 1);
+}
+
+static unknown_entry_t * unknown_find(unknown_table_t * table, uint32_t key) {
+
+    if (table->size == 0) {
+        return NULL;
+    }
+
+    unsigned int slot = unknown_slot(key, table->size);
+    while (table->entries[slot].key != 0) {
+        if (table->entries[slot].key == key) {
+            return &table->entries[slot];
+        }
+        slot = (slot + 1) & (table->size - 1);
+    }
+    return NULL;
+}
+
+/* Returns the entry for key, inserting a zeroed one if it is new. NULL if full or out of memory */
+static unknown_entry_t * unknown_insert(unknown_table_t * table, uint32_t key) {
+
+    unknown_entry_t * entry = unknown_find(table, key);
+    if (entry) {
+        return entry;
+    }
+
+    if (table->used >= SNIFFER_UNKNOWN_MAX) {
+        return NULL;
+    }
+
+    if (table->used + 1 > table->size / 4 * 3) {
+        unsigned int size = table->size ? table->size * 2 : UNKNOWN_TABLE_SIZE_MIN;
+        unknown_entry_t * entries = calloc(size, sizeof(unknown_entry_t));
+        if (entries == NULL) {
+            return NULL;
+        }
+        for (unsigned int i = 0; i < table->size; i++) {
+            if (table->entries[i].key == 0) {
+                continue;
+            }
+            unsigned int slot = unknown_slot(table->entries[i].key, size);
+            while (entries[slot].key != 0) {
+                slot = (slot + 1) & (size - 1);
+            }
+            entries[slot] = table->entries[i];
+        }
+        free(table->entries);
+        table->entries = entries;
+        table->size = size;
+    }
+
+    unsigned int slot = unknown_slot(key, table->size);
+    while (table->entries[slot].key != 0) {
+        slot = (slot + 1) & (table->size - 1);
+    }
+    memset(&table->entries[slot], 0, sizeof(unknown_entry_t));
+    table->entries[slot].key = key;
+    table->used++;
+
+    return &table->entries[slot];
+}
+
+static void unknown_table_clear(unknown_table_t * table) {
+    free(table->entries);
+    table->entries = NULL;
+    table->size = 0;
+    table->used = 0;
+}
+
+/* Drop the entries of node, so they are reported again if still unknown after its list was downloaded */
+static void unknown_forget_node(uint16_t node) {
+
+    unknown_table_t old = unknowns;
+    unknowns = (unknown_table_t) {0};
+    for (unsigned int i = 0; i < old.size; i++) {
+        if (old.entries[i].key != 0 && ((old.entries[i].key - 1) >> 16) != node) {
+            unknown_entry_t * entry = unknown_insert(&unknowns, old.entries[i].key);
+            if (entry) {
+                *entry = old.entries[i];
+            }
+        }
+    }
+    free(old.entries);
+}
+
+/* Queue node for download, unless it was attempted recently. Called with unknown_lock held */
+static void resolver_queue_node(uint16_t node, uint64_t now) {
+
+    unknown_entry_t * attempt = unknown_insert(&resolver_attempts, (uint32_t) node + 1);
+    if (attempt == NULL) {
+        return;
+    }
+    if (attempt->count > 0 && now - attempt->reported_ms < SNIFFER_RESOLVER_RETRY_MS) {
+        return;
+    }
+    if (resolver_queued >= RESOLVER_QUEUE_LEN) {
+        return;
+    }
+
+    attempt->count++;
+    attempt->reported_ms = now;
+    resolver_queue[resolver_queued++] = node;
+    pthread_cond_signal(&resolver_cond);
+}
+
+unsigned int sniffer_unknown_seen(uint16_t node, uint16_t id) {
+
+    uint64_t now = unknown_clock_ms();
+    unsigned int report = 0;
+
+    pthread_mutex_lock(&unknown_lock);
+    unknown_total++;
+
+    unknown_entry_t * entry = unknown_insert(&unknowns, unknown_key(node, id));
+    if (entry) {
+        entry->count++;
+        entry->unreported++;
+        if (entry->reported_ms == 0 || now - entry->reported_ms >= SNIFFER_UNKNOWN_REPORT_MS) {
+            report = entry->unreported;
+            entry->unreported = 0;
+            entry->reported_ms = now ? now : 1;
+        }
+    }
+
+    if (resolver_enabled) {
+        resolver_queue_node(node, now);
+    }
+    pthread_mutex_unlock(&unknown_lock);
+
+    return report;
+}
+
+unsigned int sniffer_unknown_list(sniffer_unknown_t * out, unsigned int max) {
+
+    pthread_mutex_lock(&unknown_lock);
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < unknowns.size; i++) {
+        if (unknowns.entries[i].key == 0) {
+            continue;
+        }
+        if (count < max) {
+            out[count].node = (unknowns.entries[i].key - 1) >> 16;
+            out[count].id = (unknowns.entries[i].key - 1) & 0xFFFF;
+            out[count].count = unknowns.entries[i].count;
+        }
+        count++;
+    }
+    pthread_mutex_unlock(&unknown_lock);
+
+    return count;
+}
+
+uint64_t sniffer_unknown_total(void) {
+    pthread_mutex_lock(&unknown_lock);
+    uint64_t total = unknown_total;
+    pthread_mutex_unlock(&unknown_lock);
+    return total;
+}
+
+void sniffer_unknown_clear(void) {
+    pthread_mutex_lock(&unknown_lock);
+    unknown_table_clear(&unknowns);
+    unknown_table_clear(&resolver_attempts);
+    unknown_total = 0;
+    pthread_mutex_unlock(&unknown_lock);
+}
+
+/* Downloads lists off the sniffer hot path, one queued batch of nodes at a time */
+static void * resolver_task(void * arg) {
+
+    uint16_t batch[RESOLVER_QUEUE_LEN];
+
+    while (1) {
+        pthread_mutex_lock(&unknown_lock);
+        while (resolver_queued == 0) {
+            pthread_cond_wait(&resolver_cond, &unknown_lock);
+        }
+        unsigned int count = resolver_queued;
+        memcpy(batch, resolver_queue, count * sizeof(uint16_t));
+        resolver_queued = 0;
+        unsigned int timeout_ms = resolver_timeout_ms;
+        int version = resolver_version;
+        pthread_mutex_unlock(&unknown_lock);
+
+        for (unsigned int i = 0; i < count; i++) {
+            /* The workers keep decoding other nodes from their caches meanwhile. The download invalidates the
+             * parameter cache when done (see sniffer_param_cache.c) */
+            sniffer_param_list_change_begin(batch[i]);
+            int params = param_list_download(batch[i], timeout_ms, version, 0);
+            sniffer_param_list_change_end();
+            if (params <= 0) {
+                printf("Sniffer: Failed to download parameter list of node %u\n", batch[i]);
+                continue;
+            }
+            printf("Sniffer: Downloaded %d parameters of node %u\n", params, batch[i]);
+
+            pthread_mutex_lock(&unknown_lock);
+            unknown_forget_node(batch[i]);
+            pthread_mutex_unlock(&unknown_lock);
+        }
+    }
+
+    return NULL;
+}
+
+int sniffer_resolver_enable(int enable, unsigned int timeout_ms, int version) {
+
+    pthread_mutex_lock(&unknown_lock);
+    resolver_timeout_ms = timeout_ms;
+    resolver_version = version;
+    if (enable && !resolver_started) {
+        if (pthread_create(&resolver_thread, NULL, resolver_task, NULL) != 0) {
+            pthread_mutex_unlock(&unknown_lock);
+            return -1;
+        }
+        pthread_detach(resolver_thread);
+        resolver_started = 1;
+    }
+    resolver_enabled = enable;
+    if (!enable) {
+        resolver_queued = 0;
+    }
+    pthread_mutex_unlock(&unknown_lock);
+
+    return 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * sniffer_unknown.h
+ *
+ * Bookkeeping of sniffed parameters that are not in the parameter list.
+ * Occurrences are counted per (node, id) and reported at a limited rate,
+ * and an optional background resolver downloads the parameter lists of the nodes they come from.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Report each unknown (node, id) at most this often */
+#define SNIFFER_UNKNOWN_REPORT_MS 60000
+
+/* Distinct unknown (node, id) pairs tracked, further ones are only counted in the total */
+#define SNIFFER_UNKNOWN_MAX 65536
+
+/* Wait this long before downloading the list of a node again */
+#define SNIFFER_RESOLVER_RETRY_MS 60000
+#define SNIFFER_RESOLVER_TIMEOUT_MS_DEFAULT 1000
+#define SNIFFER_RESOLVER_VERSION_DEFAULT 2
+
+/**
+ * @brief Count an occurrence of an unknown parameter, and queue its node for resolution if enabled.
+ * @return Number of occurrences to report now, including this one. 0 if reporting is rate limited.
+ */
+unsigned int sniffer_unknown_seen(uint16_t node, uint16_t id);
+
+typedef struct {
+    uint16_t node;
+    uint16_t id;
+    uint64_t count;
+} sniffer_unknown_t;
+
+/**
+ * @brief Copy up to max tracked unknown parameters into out.
+ * @return Number of tracked unknown parameters, which may exceed max.
+ */
+unsigned int sniffer_unknown_list(sniffer_unknown_t * out, unsigned int max);
+
+/* Total occurrences of unknown parameters, including untracked ones */
+uint64_t sniffer_unknown_total(void);
+
+/* Forget all unknown parameters */
+void sniffer_unknown_clear(void);
+
+/**
+ * @brief Enable or disable background download of parameter lists from nodes sending unknown parameters.
+ * While a list is downloaded, parameters of that node and others not yet cached by the workers count as unknown.
+ * @param timeout_ms Timeout of each list download.
+ * @param version List version to request.
+ * @return 0 on success, -1 if the resolver thread could not be started.
+ */
+int sniffer_resolver_enable(int enable, unsigned int timeout_ms, int version);
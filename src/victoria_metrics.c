@@ -11,26 +11,281 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/time.h>
 #include <curl/curl.h>
+#include <zlib.h>
 
 #include <slash/slash.h>
 #include <slash/optparse.h>
 
 #include <csp/csp.h>
 #include <param/param_queue.h>
-#include <param/param_string.h>
 #include "param_sniffer.h"
+#include "victoria_metrics.h"
+#include "sniffer_stats.h"
+#include "vm_spool.h"
+#include "sniffer_agg.h"
+#include "vm_change.h"
+#include "metric_format.h"
 
 int vm_running = 0;
 
 #define SERVER_PORT      8428
 #define SERVER_PORT_AUTH 8427
-#define BUFFER_SIZE      10 * 1024 * 1024
 
-static char buffer[BUFFER_SIZE];
-static size_t buffer_size = 0;
+typedef struct {
+    char * data;
+    size_t size;
+    unsigned int lines;
+    uint64_t first_ms;  // When the first line of this batch was added
+} vm_buffer_t;
+
+/**
+ * Double buffered ingest: producers (vm_add) append to active_buffer,
+ * while vm_push owns flush_buffer and sends it without holding buffer_mutex.
+ * The mutex only guards the append and the pointer swap, so producers never wait on network I/O.
+ * Both buffers are allocated when the push thread starts, and freed again when it stops.
+ */
+static vm_buffer_t buffers[2];
+static vm_buffer_t * active_buffer = NULL;
+static vm_buffer_t * flush_buffer = NULL;
+static size_t buffer_capacity = VM_BUFFER_SIZE_DEFAULT;
 static pthread_mutex_t buffer_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/* Signalled by producers when a batch is started or a flush threshold is crossed */
+static pthread_cond_t buffer_cond;
+static pthread_once_t buffer_cond_once = PTHREAD_ONCE_INIT;
+
+static size_t flush_max_bytes = VM_FLUSH_BYTES_DEFAULT;
+static unsigned int flush_max_age_ms = VM_FLUSH_AGE_MS_DEFAULT;
+static unsigned int flush_max_lines = VM_FLUSH_LINES_DEFAULT;
+static int use_gzip = 1;
+static unsigned int push_concurrency = VM_CONCURRENCY_DEFAULT;
+
+static uint64_t vm_clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void vm_buffer_cond_init(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&buffer_cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+void vm_set_flush_policy(size_t max_bytes, unsigned int max_age_ms, unsigned int max_lines) {
+    pthread_mutex_lock(&buffer_mutex);
+    flush_max_bytes = max_bytes;
+    flush_max_age_ms = max_age_ms;
+    flush_max_lines = max_lines;
+    pthread_mutex_unlock(&buffer_mutex);
+}
+
+void vm_get_flush_policy(size_t * max_bytes, unsigned int * max_age_ms, unsigned int * max_lines) {
+    pthread_mutex_lock(&buffer_mutex);
+    *max_bytes = flush_max_bytes;
+    *max_age_ms = flush_max_age_ms;
+    *max_lines = flush_max_lines;
+    pthread_mutex_unlock(&buffer_mutex);
+}
+
+void vm_set_compression(int enable) {
+    use_gzip = enable;
+}
+
+int vm_get_compression(void) {
+    return use_gzip;
+}
+
+int vm_set_concurrency(unsigned int requests) {
+    if (requests == 0 || requests > VM_CONCURRENCY_MAX) {
+        return -1;
+    }
+    push_concurrency = requests;
+    return 0;
+}
+
+unsigned int vm_get_concurrency(void) {
+    return push_concurrency;
+}
+
+int vm_set_buffer_size(size_t size) {
+
+    if (size == 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&buffer_mutex);
+    /* Capacity is fixed while the buffers are allocated */
+    int busy = (active_buffer != NULL);
+    if (!busy) {
+        buffer_capacity = size;
+    }
+    pthread_mutex_unlock(&buffer_mutex);
+
+    return busy ? -1 : 0;
+}
+
+size_t vm_get_buffer_size(void) {
+    return buffer_capacity;
+}
+
+static int vm_buffers_alloc(void) {
+
+    pthread_once(&buffer_cond_once, vm_buffer_cond_init);
+
+    pthread_mutex_lock(&buffer_mutex);
+    if (active_buffer == NULL) {
+        buffers[0].data = malloc(buffer_capacity);
+        buffers[1].data = malloc(buffer_capacity);
+        if (buffers[0].data == NULL || buffers[1].data == NULL) {
+            free(buffers[0].data);
+            free(buffers[1].data);
+            buffers[0].data = buffers[1].data = NULL;
+            pthread_mutex_unlock(&buffer_mutex);
+            return -1;
+        }
+        buffers[0].size = buffers[1].size = 0;
+        buffers[0].lines = buffers[1].lines = 0;
+        active_buffer = &buffers[0];
+        flush_buffer = &buffers[1];
+    }
+    pthread_mutex_unlock(&buffer_mutex);
+
+    return 0;
+}
+
+/* With spool set, lines still buffered are written to the spool if there is one, older batch first */
+static void vm_buffers_free(int spool) {
+
+    pthread_mutex_lock(&buffer_mutex);
+    vm_buffer_t * pending[2] = {flush_buffer, active_buffer};
+    active_buffer = flush_buffer = NULL;
+    pthread_mutex_unlock(&buffer_mutex);
+
+    // Producers no longer append once the buffers are detached, so they are spooled outside buffer_mutex
+    for (int i = 0; i < 2; i++) {
+        if (spool && pending[i] && pending[i]->size > 0 && vm_spool_write(pending[i]->data, pending[i]->size) < 0) {
+            SNIFFER_STATS_ADD(vm_dropped, pending[i]->lines);
+        }
+    }
+
+    pthread_mutex_lock(&buffer_mutex);
+    free(buffers[0].data);
+    free(buffers[1].data);
+    buffers[0].data = buffers[1].data = NULL;
+    buffers[0].size = buffers[1].size = 0;
+    buffers[0].lines = buffers[1].lines = 0;
+    SNIFFER_STATS_SET(vm_buffer_used, 0);
+    pthread_mutex_unlock(&buffer_mutex);
+}
+
+int vm_ingest_start(void) {
+
+    if (vm_running || vm_buffers_alloc() < 0) {
+        return -1;
+    }
+    vm_running = 1;
+    return 0;
+}
+
+size_t vm_ingest_drain(void) {
+
+    pthread_mutex_lock(&buffer_mutex);
+    size_t size = 0;
+    if (active_buffer) {
+        size = active_buffer->size;
+        active_buffer->size = 0;
+        active_buffer->lines = 0;
+    }
+    SNIFFER_STATS_SET(vm_buffer_used, 0);
+    pthread_mutex_unlock(&buffer_mutex);
+
+    return size;
+}
+
+void vm_ingest_stop(void) {
+    vm_running = 0;
+    vm_buffers_free(0);
+}
+
+static int vm_batch_due(const vm_buffer_t * buf, uint64_t now) {
+    return buf->size >= flush_max_bytes
+        || buf->lines >= flush_max_lines
+        || now >= buf->first_ms + flush_max_age_ms;
+}
+
+/**
+ * Wait until the active batch is due (max bytes, max lines or max age), then hand it over to the push thread.
+ * The push thread trades the batch buffer for the empty one of an upload slot, so the next swap can happen while requests are in flight.
+ * Returns with an empty batch if nothing became due within max_wait_ms, so vm_running and the spool are rechecked.
+ */
+static vm_buffer_t * vm_buffers_wait_swap(unsigned int max_wait_ms) {
+
+    pthread_mutex_lock(&buffer_mutex);
+    if (flush_buffer->size == 0) {
+        uint64_t now = vm_clock_ms();
+        uint64_t idle_until = now + max_wait_ms;
+        while (vm_running) {
+            if (active_buffer->size > 0 && vm_batch_due(active_buffer, now)) {
+                vm_buffer_t * tmp = flush_buffer;
+                flush_buffer = active_buffer;
+                active_buffer = tmp;
+                SNIFFER_STATS_SET(vm_buffer_used, active_buffer->size);
+                break;
+            }
+            if (now >= idle_until) {
+                break;
+            }
+            uint64_t wake_ms = idle_until;
+            if (active_buffer->size > 0 && active_buffer->first_ms + flush_max_age_ms < wake_ms) {
+                wake_ms = active_buffer->first_ms + flush_max_age_ms;
+            }
+            struct timespec wake = { .tv_sec = wake_ms / 1000, .tv_nsec = (wake_ms % 1000) * 1000000 };
+            pthread_cond_timedwait(&buffer_cond, &buffer_mutex, &wake);
+            now = vm_clock_ms();
+        }
+    }
+    pthread_mutex_unlock(&buffer_mutex);
+
+    return flush_buffer;
+}
+
+/**
+ * gzip compress data into out, growing it as needed.
+ * Returns the compressed length, or 0 on failure.
+ */
+static size_t vm_gzip(z_stream * strm, const char * data, size_t len, char ** out, size_t * out_size) {
+
+    if (deflateReset(strm) != Z_OK) {
+        return 0;
+    }
+
+    size_t bound = deflateBound(strm, len);
+    if (bound > *out_size) {
+        char * tmp = realloc(*out, bound);
+        if (tmp == NULL) {
+            return 0;
+        }
+        *out = tmp;
+        *out_size = bound;
+    }
+
+    strm->next_in = (Bytef *) data;
+    strm->avail_in = len;
+    strm->next_out = (Bytef *) *out;
+    strm->avail_out = *out_size;
+    if (deflate(strm, Z_FINISH) != Z_STREAM_END) {
+        return 0;
+    }
+
+    return strm->total_out;
+}
+
 typedef struct {
     int use_ssl;
     int port;
@@ -46,6 +301,133 @@ static size_t write_callback(char *ptr, size_t size, size_t nmemb, void *userdat
     return size * nmemb;
 }
 
+/* How often the push thread looks for due batches while requests are in flight */
+#define VM_POLL_MS 10
+
+/* How often windows of downsampled series that went quiet are closed (sniffer_agg.h) */
+#define VM_AGG_SWEEP_MS 100
+
+/* Time between attempts while the server is not accepting pushes */
+#define VM_RETRY_MS 1000
+
+/* A request is aborted when it cannot connect, or moves less than a byte per second for this long, so a stalled
+ * connection does not hold its slot, or the spool reader, forever */
+#define VM_CONNECT_TIMEOUT_S 10
+#define VM_STALL_TIMEOUT_S   30
+
+/**
+ * One request slot of the push thread. The uncompressed lines are kept until the request completes,
+ * so a failed live batch can still be spooled, and a failed spooled chunk is simply read again.
+ */
+typedef struct {
+    CURL * curl;
+    int busy;
+    int from_spool;
+    char * lines;
+    size_t lines_len;
+    size_t lines_size;
+    char * gzip_buf;
+    size_t gzip_buf_size;
+    uint64_t order;             // Read order of a spooled chunk
+    vm_spool_pos_t spool_end;   // Spool position after a spooled chunk
+    uint64_t start_ms;
+    uint64_t retry_ms;          // Set while a live batch that could not be spooled waits to be resent
+} vm_upload_t;
+
+/**
+ * Spooled chunks may complete out of order, but are acknowledged in the order they were read,
+ * so nothing after a failed chunk is removed from the spool. Once the spooled requests in flight have completed,
+ * reading starts over from the oldest unacknowledged line, which may push some lines twice.
+ */
+typedef struct {
+    vm_spool_pos_t read_pos;
+    uint64_t next_order;
+    uint64_t ack_order;
+    unsigned int in_flight;
+    int failed;
+    unsigned int done_count;
+    struct {
+        uint64_t order;
+        vm_spool_pos_t end;
+    } done[VM_CONCURRENCY_MAX];
+} vm_spool_reader_t;
+
+static void vm_spool_reader_complete(vm_spool_reader_t * reader, const vm_upload_t * up, int ok) {
+
+    reader->in_flight--;
+    if (ok) {
+        reader->done[reader->done_count].order = up->order;
+        reader->done[reader->done_count].end = up->spool_end;
+        reader->done_count++;
+    } else {
+        reader->failed = 1;
+    }
+
+    for (unsigned int i = 0; i < reader->done_count;) {
+        if (reader->done[i].order != reader->ack_order) {
+            i++;
+            continue;
+        }
+        vm_spool_ack(reader->done[i].end);
+        reader->ack_order++;
+        reader->done[i] = reader->done[--reader->done_count];
+        i = 0;
+    }
+
+    if (reader->failed && reader->in_flight == 0) {
+        reader->done_count = 0;
+        reader->read_pos = vm_spool_start();
+        reader->ack_order = reader->next_order;
+        reader->failed = 0;
+    }
+}
+
+static vm_upload_t * vm_upload_free(vm_upload_t * uploads, unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        if (!uploads[i].busy) {
+            return &uploads[i];
+        }
+    }
+    return NULL;
+}
+
+static int vm_upload_reserve(vm_upload_t * up, size_t len) {
+    if (len > up->lines_size) {
+        char * tmp = realloc(up->lines, len);
+        if (tmp == NULL) {
+            return -1;
+        }
+        up->lines = tmp;
+        up->lines_size = len;
+    }
+    return 0;
+}
+
+/* Set up the request body, gzip compressed if enabled and strm is not NULL */
+static void vm_upload_prepare(vm_upload_t * up, z_stream * strm, struct curl_slist * headers, struct curl_slist * headers_gzip) {
+
+    size_t gzip_len = 0;
+    if (use_gzip && strm) {
+        gzip_len = vm_gzip(strm, up->lines, up->lines_len, &up->gzip_buf, &up->gzip_buf_size);
+    }
+    if (gzip_len > 0) {
+        curl_easy_setopt(up->curl, CURLOPT_HTTPHEADER, headers_gzip);
+        curl_easy_setopt(up->curl, CURLOPT_POSTFIELDSIZE, gzip_len);
+        curl_easy_setopt(up->curl, CURLOPT_POSTFIELDS, up->gzip_buf);
+    } else {
+        curl_easy_setopt(up->curl, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(up->curl, CURLOPT_POSTFIELDSIZE, up->lines_len);
+        curl_easy_setopt(up->curl, CURLOPT_POSTFIELDS, up->lines);
+    }
+    up->busy = 1;
+    up->retry_ms = 0;
+}
+
+static void vm_upload_add(CURLM * multi, vm_upload_t * up) {
+    up->start_ms = vm_clock_ms();
+    curl_multi_add_handle(multi, up->curl);
+}
+
 void * vm_push(void * arg) {
 
     vm_args * args = arg;
@@ -53,6 +435,11 @@ void * vm_push(void * arg) {
     CURL * curl;
     CURLcode res;
     struct curl_slist * headers = NULL;
+    struct curl_slist * headers_gzip = NULL;
+
+    /* windowBits 15 + 16 selects the gzip wrapper expected with Content-Encoding: gzip */
+    z_stream strm = {0};
+    int have_zlib = (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK);
 
     curl = curl_easy_init();
     const char * hostname = csp_get_conf()->hostname;
@@ -118,7 +505,17 @@ void * vm_push(void * arg) {
         }
         curl_easy_setopt(curl, CURLOPT_URL, url);
         headers = curl_slist_append(headers, "Content-Type: text/plain");
+        headers_gzip = curl_slist_append(headers_gzip, "Content-Type: text/plain");
+        headers_gzip = curl_slist_append(headers_gzip, "Content-Encoding: gzip");
         curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+        // Requests share connections, multiplexed over HTTP/2 where the server offers it over TLS
+        curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, (long) VM_CONNECT_TIMEOUT_S);
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long) VM_STALL_TIMEOUT_S);
 
         if (args->verbose) {
             printf("Full URL: %s\n", url);
@@ -129,6 +526,11 @@ void * vm_push(void * arg) {
         printf("curl_easy_init() failed\n");
     }
 
+    if (vm_running && vm_buffers_alloc() < 0) {
+        printf("Failed to allocate %zu bytes for vm buffers\n", 2 * buffer_capacity);
+        vm_running = 0;
+    }
+
     if (vm_running) {
         if(args->api_root) {
             printf("Connection established to %s", args->api_root);
@@ -137,30 +539,174 @@ void * vm_push(void * arg) {
         }
     }
 
+    // All requests are driven from this thread by one multi handle, each slot using a copy of the configured handle
+    unsigned int slots = push_concurrency;
+    vm_upload_t * uploads = calloc(slots, sizeof(vm_upload_t));
+    CURLM * multi = vm_running ? curl_multi_init() : NULL;
+    if (vm_running && (uploads == NULL || multi == NULL)) {
+        printf("Failed to set up %u vm push requests\n", slots);
+        vm_running = 0;
+    }
+    if (vm_running) {
+        curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long) slots);
+        for (unsigned int i = 0; i < slots; i++) {
+            uploads[i].curl = (i == 0) ? curl : curl_easy_duphandle(curl);
+            if (uploads[i].curl == NULL) {
+                printf("curl_easy_duphandle() failed\n");
+                vm_running = 0;
+                break;
+            }
+            curl_easy_setopt(uploads[i].curl, CURLOPT_PRIVATE, &uploads[i]);
+        }
+    }
+
+    z_stream * gzip_strm = have_zlib ? &strm : NULL;
+    vm_spool_reader_t spool_reader = {0};
+    unsigned int running = 0;
+    int server_up = 1;
+    uint64_t retry_at = 0;
+    uint64_t sweep_at = 0;
+
     while (vm_running) {
-        // Lock the buffer mutex
-        pthread_mutex_lock(&buffer_mutex);
-        if (buffer_size == 0) {
-            pthread_mutex_unlock(&buffer_mutex);
-            sleep(1);
-            continue;
+        uint64_t now = vm_clock_ms();
+
+        // Close downsampling windows of series that went quiet
+        if (now >= sweep_at) {
+            sniffer_agg_sweep();
+            sweep_at = now + VM_AGG_SWEEP_MS;
         }
 
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, buffer_size);
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, buffer);
-        curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1);
-        res = curl_easy_perform(curl);
-        if (res != CURLE_OK) {
-            printf("Failed push: %s\n", curl_easy_strerror(res));
-        } else {
-            buffer_size = 0;
+        // Resend live batches that could neither be pushed nor spooled
+        for (unsigned int i = 0; i < slots; i++) {
+            if (uploads[i].retry_ms && now >= uploads[i].retry_ms && (server_up || running == 0)) {
+                uploads[i].retry_ms = 0;
+                vm_upload_add(multi, &uploads[i]);
+                running++;
+            }
+        }
+
+        // Fill the free slots, live batches first. While the server is down, a single request probes it every VM_RETRY_MS
+        while (vm_running && (server_up || (running == 0 && now >= retry_at))) {
+            vm_upload_t * up = vm_upload_free(uploads, slots);
+            if (up == NULL) {
+                break;
+            }
+
+            // Chunks read but not acknowledged are bounded by the slots, and so is the reader's done list
+            int spool_ready = !spool_reader.failed && vm_spool_pending() > 0
+                && spool_reader.next_order - spool_reader.ack_order < slots;
+
+            // Only block waiting for live data when there is nothing else to do
+            vm_buffer_t * batch = vm_buffers_wait_swap((running == 0 && !spool_ready) ? 1000 : 0);
+
+            if (batch->size > 0) {
+                // The slot takes the batch buffer and leaves its own in place, which must hold a full batch
+                if (vm_upload_reserve(up, buffer_capacity) < 0) {
+                    break;
+                }
+                char * data = batch->data;
+                batch->data = up->lines;
+                up->lines = data;
+                up->lines_size = buffer_capacity;
+                up->lines_len = batch->size;
+                up->from_spool = 0;
+                batch->size = 0;
+                batch->lines = 0;
+            } else if (spool_ready && vm_upload_reserve(up, VM_SPOOL_CHUNK_SIZE) == 0) {
+                up->lines_len = vm_spool_read(up->lines, &spool_reader.read_pos);
+                if (up->lines_len == 0) {
+                    break;
+                }
+                up->from_spool = 1;
+                up->spool_end = spool_reader.read_pos;
+                up->order = spool_reader.next_order++;
+                spool_reader.in_flight++;
+            } else {
+                break;
+            }
+
+            vm_upload_prepare(up, gzip_strm, headers, headers_gzip);
+            vm_upload_add(multi, up);
+            running++;
+            if (!server_up) {
+                break;
+            }
+        }
+
+        int active;
+        curl_multi_perform(multi, &active);
+
+        CURLMsg * msg;
+        int queued;
+        while ((msg = curl_multi_info_read(multi, &queued)) != NULL) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            CURLcode res = msg->data.result;
+            vm_upload_t * up = NULL;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &up);
+            curl_multi_remove_handle(multi, up->curl);
+            running--;
+
+            uint64_t push_ms = vm_clock_ms() - up->start_ms;
+            SNIFFER_STATS_SET(vm_push_ms, push_ms);
+            sniffer_stats_observe(sniffer_stats.vm_push_ms_hist, &sniffer_stats.vm_push_ms_sum, push_ms);
+
+            if (res == CURLE_OK) {
+                SNIFFER_STATS_INC(vm_pushes);
+                server_up = 1;
+                up->busy = 0;
+                if (up->from_spool) {
+                    vm_spool_reader_complete(&spool_reader, up, 1);
+                }
+                continue;
+            }
+
+            SNIFFER_STATS_INC(vm_push_errors);
+            if (server_up || !up->from_spool) {
+                printf("Failed push%s: %s\n", up->from_spool ? " of spooled lines" : "", curl_easy_strerror(res));
+            }
+            server_up = 0;
+            retry_at = vm_clock_ms() + VM_RETRY_MS;
+
+            if (up->from_spool) {
+                up->busy = 0;
+                vm_spool_reader_complete(&spool_reader, up, 0);
+            } else if (vm_spool_write(up->lines, up->lines_len) == 0) {
+                // Spool the batch rather than retrying it, so the slot is free for live data
+                up->busy = 0;
+            } else {
+                up->retry_ms = retry_at;
+            }
         }
-        // Unlock the buffer mutex
-        pthread_mutex_unlock(&buffer_mutex);
 
-        sleep(1);
+        curl_multi_poll(multi, NULL, 0, VM_POLL_MS, NULL);
     }
 
+    // Live batches still in flight or waiting to be resent are spooled if possible. Spooled chunks stay in the spool
+    for (unsigned int i = 0; uploads && i < slots; i++) {
+        if (uploads[i].busy && !uploads[i].from_spool) {
+            vm_spool_write(uploads[i].lines, uploads[i].lines_len);
+        }
+        if (uploads[i].curl) {
+            if (multi) {
+                curl_multi_remove_handle(multi, uploads[i].curl);
+            }
+            if (uploads[i].curl != curl) {
+                curl_easy_cleanup(uploads[i].curl);
+            }
+        }
+        free(uploads[i].lines);
+        free(uploads[i].gzip_buf);
+    }
+    free(uploads);
+    if (multi) {
+        curl_multi_cleanup(multi);
+    }
+
+    vm_buffers_free(1);
+
     printf("vm push stopped\n");
     // Clean up
     if (curl) {
@@ -169,6 +715,12 @@ void * vm_push(void * arg) {
     if (headers) {
         curl_slist_free_all(headers);
     }
+    if (headers_gzip) {
+        curl_slist_free_all(headers_gzip);
+    }
+    if (have_zlib) {
+        deflateEnd(&strm);
+    }
     if (args->username) {
         free(args->username);
         args->username = NULL;
@@ -188,41 +740,219 @@ void * vm_push(void * arg) {
     return NULL;
 }
 
-void vm_add(char * metric_line) {
+void vm_add_lines(const char * lines, size_t len, unsigned int count) {
 
     // Lock the buffer mutex
     pthread_mutex_lock(&buffer_mutex);
 
-    // Check if there's enough space in the buffer
-    size_t line_len = strlen(metric_line);
-    if (buffer_size + line_len < BUFFER_SIZE) {
-        // Add the new metric line to the buffer
-        strcpy(buffer + buffer_size, metric_line);
-        buffer_size += line_len;
+    int overflow = 0;
+
+    // Check that the buffers are allocated, and that there's enough space
+    if (active_buffer && active_buffer->size + len < buffer_capacity) {
+        if (active_buffer->size == 0) {
+            // Start the age timer of a new batch
+            active_buffer->first_ms = vm_clock_ms();
+            pthread_cond_signal(&buffer_cond);
+        }
+        // Add the new metric lines to the buffer
+        memcpy(active_buffer->data + active_buffer->size, lines, len);
+        active_buffer->size += len;
+        unsigned int lines_before = active_buffer->lines;
+        active_buffer->lines += count;
+        if (active_buffer->size >= flush_max_bytes || (lines_before < flush_max_lines && active_buffer->lines >= flush_max_lines)) {
+            pthread_cond_signal(&buffer_cond);
+        }
+        SNIFFER_STATS_SET(vm_buffer_used, active_buffer->size);
+    } else if (active_buffer) {
+        overflow = 1;
     }
 
     // Unlock the buffer mutex
     pthread_mutex_unlock(&buffer_mutex);
+
+    // Lines that do not fit go to the disk spool if there is one, outside buffer_mutex since it may block on I/O
+    if (overflow && vm_spool_write(lines, len) < 0) {
+        SNIFFER_STATS_ADD(vm_dropped, count);
+    }
+}
+
+void vm_add(char * metric_line) {
+    vm_add_lines(metric_line, strlen(metric_line), 1);
 }
 
+/* Read element i of a numeric param. @return 0 on success, -1 for other types */
+static int vm_param_value(param_t * param, unsigned int i, sniffer_value_t * value) {
+
+    switch (param->type) {
+        case PARAM_TYPE_UINT8:
+        case PARAM_TYPE_XINT8:
+            value->kind = SNIFFER_VALUE_UINT;
+            value->u = param_get_uint8_array(param, i);
+            return 0;
+        case PARAM_TYPE_UINT16:
+        case PARAM_TYPE_XINT16:
+            value->kind = SNIFFER_VALUE_UINT;
+            value->u = param_get_uint16_array(param, i);
+            return 0;
+        case PARAM_TYPE_UINT32:
+        case PARAM_TYPE_XINT32:
+            value->kind = SNIFFER_VALUE_UINT;
+            value->u = param_get_uint32_array(param, i);
+            return 0;
+        case PARAM_TYPE_UINT64:
+        case PARAM_TYPE_XINT64:
+            value->kind = SNIFFER_VALUE_UINT;
+            value->u = param_get_uint64_array(param, i);
+            return 0;
+        case PARAM_TYPE_INT8:
+            value->kind = SNIFFER_VALUE_INT;
+            value->i = param_get_int8_array(param, i);
+            return 0;
+        case PARAM_TYPE_INT16:
+            value->kind = SNIFFER_VALUE_INT;
+            value->i = param_get_int16_array(param, i);
+            return 0;
+        case PARAM_TYPE_INT32:
+            value->kind = SNIFFER_VALUE_INT;
+            value->i = param_get_int32_array(param, i);
+            return 0;
+        case PARAM_TYPE_INT64:
+            value->kind = SNIFFER_VALUE_INT;
+            value->i = param_get_int64_array(param, i);
+            return 0;
+        case PARAM_TYPE_FLOAT:
+            value->kind = SNIFFER_VALUE_DOUBLE;
+            value->d = param_get_float_array(param, i);
+            return 0;
+        case PARAM_TYPE_DOUBLE:
+            value->kind = SNIFFER_VALUE_DOUBLE;
+            value->d = param_get_double_array(param, i);
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+/* Lines are rendered into a local buffer, so several threads may add params at once */
+#define VM_PARAM_LINE_MAX  512
+#define VM_PARAM_BATCH     4096
+
 void vm_add_param(param_t * param) {
 
     if(param->type == PARAM_TYPE_STRING || param->type == PARAM_TYPE_DATA){
         return;
     }
-    static char outstr[1000] = {};
-    static char valstr[100] = {};
     int arr_cnt = param->array_size;
-    if (arr_cnt < 0)
+    if (arr_cnt < 1)
         arr_cnt = 1;
 
     struct timeval tv;
-	gettimeofday(&tv, NULL);
-	uint64_t time_ms = ((uint64_t) tv.tv_sec * 1000000 + tv.tv_usec) / 1000;
+    gettimeofday(&tv, NULL);
+    uint64_t time_ms = ((uint64_t) tv.tv_sec * 1000000 + tv.tv_usec) / 1000;
+
+    char prefix[VM_PARAM_LINE_MAX - 3 * METRIC_FORMAT_NUM_MAX - 8];
+    size_t prefix_len = metric_format_prefix(prefix, sizeof(prefix), param->name, *(param->node));
+
+    char batch[VM_PARAM_BATCH];
+    size_t batch_len = 0;
+    unsigned int batch_lines = 0;
 
     for (int j = 0; j < arr_cnt; j++) {
-        param_value_str(param, j, valstr, 100);
-        snprintf(outstr, 1000, "%s{node=\"%u\", idx=\"%u\"} %s %"PRIu64"\n", param->name, *(param->node), j, valstr, time_ms);
-        vm_add(outstr);
+
+        sniffer_value_t value;
+        if (vm_param_value(param, j, &value) < 0) {
+            return;
+        }
+        if (!vm_change_check(*(param->node), param->id, j, time_ms, &value)) {
+            continue;
+        }
+
+        if (VM_PARAM_BATCH - batch_len < VM_PARAM_LINE_MAX) {
+            vm_add_lines(batch, batch_len, batch_lines);
+            batch_len = 0;
+            batch_lines = 0;
+        }
+
+        char * p = batch + batch_len;
+        memcpy(p, prefix, prefix_len);
+        p += prefix_len;
+        p = metric_format_u64(p, j);
+        memcpy(p, "\"} ", 3);
+        p += 3;
+        switch (value.kind) {
+            case SNIFFER_VALUE_UINT:
+                p = metric_format_u64(p, value.u);
+                break;
+            case SNIFFER_VALUE_INT:
+                p = metric_format_i64(p, value.i);
+                break;
+            case SNIFFER_VALUE_DOUBLE:
+                p = metric_format_double(p, value.d, (param->type == PARAM_TYPE_FLOAT) ? 6 : 12);
+                break;
+        }
+        *p++ = ' ';
+        p = metric_format_u64(p, time_ms);
+        *p++ = '\n';
+        batch_len = p - batch;
+        batch_lines++;
+    }
+
+    if (batch_len > 0) {
+        vm_add_lines(batch, batch_len, batch_lines);
     }
 }
+
+static int vm_config_cmd(struct slash * slash) {
+
+    unsigned int buffer_kb = 0;
+    unsigned int flush_kb = 0;
+    unsigned int flush_ms = 0;
+    unsigned int flush_lines = 0;
+    unsigned int concurrency = 0;
+    int gzip = -1;
+
+    optparse_t * parser = optparse_new("vm_config", "");
+    optparse_add_help(parser);
+    optparse_add_unsigned(parser, 'b', "buffer", "KB", 0, &buffer_kb, "capacity of each ingest buffer, while vm_push is stopped (default 10240)");
+    optparse_add_unsigned(parser, 's', "flush-size", "KB", 0, &flush_kb, "push once a batch holds this much (default 1024)");
+    optparse_add_unsigned(parser, 'a', "flush-age", "MS", 0, &flush_ms, "push once the oldest line is this old (default 50)");
+    optparse_add_unsigned(parser, 'l', "flush-lines", "NUM", 0, &flush_lines, "push once a batch holds this many lines (default 10000)");
+    optparse_add_set(parser, 'z', "gzip", 1, &gzip, "gzip compress pushed batches (default)");
+    optparse_add_set(parser, 'Z', "no-gzip", 0, &gzip, "push batches uncompressed");
+    optparse_add_unsigned(parser, 'c', "concurrency", "NUM", 0, &concurrency, "push requests in flight, from the next vm_push start (default 4, max 32)");
+
+    int argi = optparse_parse(parser, slash->argc - 1, (const char **) slash->argv + 1);
+    optparse_del(parser);
+    if (argi < 0) {
+        return SLASH_EINVAL;
+    }
+
+    if (buffer_kb && vm_set_buffer_size((size_t) buffer_kb * 1024) < 0) {
+        printf("Buffer size can only be changed while vm_push is stopped\n");
+        return SLASH_EINVAL;
+    }
+
+    size_t max_bytes;
+    unsigned int max_age_ms, max_lines;
+    vm_get_flush_policy(&max_bytes, &max_age_ms, &max_lines);
+    if (flush_kb || flush_ms || flush_lines) {
+        max_bytes = flush_kb ? (size_t) flush_kb * 1024 : max_bytes;
+        max_age_ms = flush_ms ? flush_ms : max_age_ms;
+        max_lines = flush_lines ? flush_lines : max_lines;
+        vm_set_flush_policy(max_bytes, max_age_ms, max_lines);
+    }
+    if (gzip >= 0) {
+        vm_set_compression(gzip);
+    }
+    if (concurrency && vm_set_concurrency(concurrency) < 0) {
+        printf("Concurrency must be 1 to %u\n", VM_CONCURRENCY_MAX);
+        return SLASH_EINVAL;
+    }
+
+    printf("Buffer size %zu KB\n", vm_get_buffer_size() / 1024);
+    printf("Push at %zu KB, %u ms or %u lines, %s\n", max_bytes / 1024, max_age_ms, max_lines,
+           vm_get_compression() ? "gzip compressed" : "uncompressed");
+    printf("Up to %u push requests in flight\n", vm_get_concurrency());
+    return SLASH_SUCCESS;
+}
+slash_command(vm_config, vm_config_cmd, "[OPTIONS...]", "Show or set how lines are sent to VictoriaMetrics");
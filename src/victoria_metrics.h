@@ -6,7 +6,71 @@
  */
 #pragma once
 
+#include <stddef.h>
 #include <param/param.h>
 
+/* Capacity of each of the two ingest buffers, allocated when vm_push() starts */
+#define VM_BUFFER_SIZE_DEFAULT (10 * 1024 * 1024)
+
+/* A batch is pushed when it reaches any of these limits */
+#define VM_FLUSH_BYTES_DEFAULT  (1024 * 1024)
+#define VM_FLUSH_AGE_MS_DEFAULT 50
+#define VM_FLUSH_LINES_DEFAULT  10000
+
+/* Push requests in flight at once */
+#define VM_CONCURRENCY_DEFAULT  4
+#define VM_CONCURRENCY_MAX      32
+
 void vm_add(char * metric_line);
+
+/**
+ * @brief Append several newline terminated lines to the ingest buffer under a single lock.
+ * Lines that do not fit are written to the disk spool if one is open (vm_spool.h), and dropped otherwise.
+ * @param lines Rendered lines, need not be NULL terminated.
+ * @param len Total length of lines.
+ * @param count Number of lines, used for the line count flush threshold.
+ */
+void vm_add_lines(const char * lines, size_t len, unsigned int count);
 void vm_add_param(param_t * param);
+
+/**
+ * @brief Set the capacity of the VictoriaMetrics ingest buffers.
+ * @param size Capacity in bytes of each buffer.
+ * @return 0 on success, -1 if size is invalid or the push thread is running.
+ */
+int vm_set_buffer_size(size_t size);
+size_t vm_get_buffer_size(void);
+
+/**
+ * @brief Set when vm_push() sends the collected lines.
+ * @param max_bytes Push once a batch holds this many bytes.
+ * @param max_age_ms Push once the oldest line in a batch is this old.
+ * @param max_lines Push once a batch holds this many lines.
+ */
+void vm_set_flush_policy(size_t max_bytes, unsigned int max_age_ms, unsigned int max_lines);
+void vm_get_flush_policy(size_t * max_bytes, unsigned int * max_age_ms, unsigned int * max_lines);
+
+/**
+ * @brief Enable or disable gzip compression (Content-Encoding: gzip) of pushed batches. Enabled by default.
+ */
+void vm_set_compression(int enable);
+int vm_get_compression(void);
+
+/**
+ * @brief Set how many push requests may be in flight at once, sharing keep-alive connections (multiplexed over HTTP/2 when available).
+ * Spooled lines are still removed from the spool in order. Takes effect the next time vm_push() starts.
+ * @return 0 on success, -1 if requests is 0 or above VM_CONCURRENCY_MAX.
+ */
+int vm_set_concurrency(unsigned int requests);
+unsigned int vm_get_concurrency(void);
+
+/**
+ * @brief Collect lines without a push thread, for benchmarks and offline use.
+ * Lines are only buffered until vm_ingest_drain() discards them.
+ * @return 0 on success, -1 if vm_push() is running or the buffers could not be allocated.
+ */
+int vm_ingest_start(void);
+
+/* Discard the lines collected since the last drain, and return their size in bytes */
+size_t vm_ingest_drain(void);
+void vm_ingest_stop(void);
@@ -0,0 +1,186 @@
+/*
+ * vm_change.c
+ *
+ * See vm_change.h
+ *
+ * The cache is split into shards by series, each an open addressing table with its own lock.
+ * Series are never removed, a full shard lets samples of new series through.
+ */
+
+#include "vm_change.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <slash/slash.h>
+#include <slash/optparse.h>
+
+#include "sniffer_stats.h"
+
+#define CHANGE_SHARDS    16
+#define CHANGE_SHARD_MIN 64
+
+typedef struct {
+    uint64_t key;      // node << 48 | id << 32 | idx
+    uint64_t value;    // Bits of the last sample
+    uint64_t seen_ms;  // Time of the last sample, 0 if the slot is free
+    uint64_t sent_ms;  // Time of the last sample sent
+} change_entry_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    change_entry_t * entries;
+    size_t size;       // A power of two
+    size_t used;
+    uint32_t heartbeat_ms;
+} change_shard_t;
+
+static change_shard_t shards[CHANGE_SHARDS] = {
+    [0 ... CHANGE_SHARDS - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER },
+};
+static pthread_mutex_t config_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_int change_enabled = 0;
+
+/* Free the tables of every shard. Called with config_lock held */
+static void change_free(void) {
+    for (int i = 0; i < CHANGE_SHARDS; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        free(shards[i].entries);
+        shards[i].entries = NULL;
+        shards[i].used = 0;
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+}
+
+int vm_change_enable(uint32_t heartbeat_ms, size_t capacity) {
+
+    if (heartbeat_ms == 0 || capacity == 0) {
+        return -1;
+    }
+
+    size_t size = CHANGE_SHARD_MIN;
+    while (size * CHANGE_SHARDS < capacity) {
+        size *= 2;
+    }
+
+    pthread_mutex_lock(&config_lock);
+    atomic_store(&change_enabled, 0);
+    change_free();
+
+    for (int i = 0; i < CHANGE_SHARDS; i++) {
+        change_entry_t * entries = calloc(size, sizeof(change_entry_t));
+        if (entries == NULL) {
+            change_free();
+            pthread_mutex_unlock(&config_lock);
+            return -1;
+        }
+        pthread_mutex_lock(&shards[i].lock);
+        shards[i].entries = entries;
+        shards[i].size = size;
+        shards[i].heartbeat_ms = heartbeat_ms;
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+    atomic_store(&change_enabled, 1);
+    pthread_mutex_unlock(&config_lock);
+
+    return 0;
+}
+
+void vm_change_disable(void) {
+    pthread_mutex_lock(&config_lock);
+    atomic_store(&change_enabled, 0);
+    change_free();
+    pthread_mutex_unlock(&config_lock);
+}
+
+int vm_change_is_enabled(void) {
+    return atomic_load_explicit(&change_enabled, memory_order_relaxed);
+}
+
+int vm_change_check(uint16_t node, uint16_t id, uint32_t idx, uint64_t time_ms, const sniffer_value_t * value) {
+
+    if (!atomic_load_explicit(&change_enabled, memory_order_relaxed) || time_ms == 0) {
+        return 1;
+    }
+
+    uint64_t key = ((uint64_t) node << 48) | ((uint64_t) id << 32) | idx;
+    uint64_t hash = key * 0x9E3779B97F4A7C15ULL;
+    hash ^= hash >> 29;
+    change_shard_t * shard = &shards[hash & (CHANGE_SHARDS - 1)];
+
+    pthread_mutex_lock(&shard->lock);
+    if (shard->entries == NULL) {
+        pthread_mutex_unlock(&shard->lock);
+        return 1;
+    }
+
+    size_t slot = (hash >> 4) & (shard->size - 1);
+    change_entry_t * entry = &shard->entries[slot];
+    while (entry->seen_ms != 0 && entry->key != key) {
+        slot = (slot + 1) & (shard->size - 1);
+        entry = &shard->entries[slot];
+    }
+
+    int send = 1;
+    if (entry->seen_ms != 0) {
+        /* Older samples, as from a HK download, are history of their own and always sent */
+        send = entry->value != value->u || time_ms < entry->seen_ms || time_ms - entry->sent_ms >= shard->heartbeat_ms;
+    } else if ((shard->used + 1) * 4 > shard->size * 3) {
+        /* Full, keep probing short */
+        pthread_mutex_unlock(&shard->lock);
+        return 1;
+    } else {
+        entry->key = key;
+        shard->used++;
+    }
+
+    if (time_ms >= entry->seen_ms) {
+        entry->value = value->u;
+        entry->seen_ms = time_ms;
+    }
+    if (send && time_ms > entry->sent_ms) {
+        entry->sent_ms = time_ms;
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    if (!send) {
+        SNIFFER_STATS_INC(vm_unchanged);
+    }
+    return send;
+}
+
+static int vm_change_cmd(struct slash * slash) {
+
+    unsigned int heartbeat_ms = VM_CHANGE_HEARTBEAT_MS_DEFAULT;
+    unsigned int capacity = VM_CHANGE_CAPACITY_DEFAULT;
+    int disable = 0;
+
+    optparse_t * parser = optparse_new("vm_change_only", "");
+    optparse_add_help(parser);
+    optparse_add_unsigned(parser, 'b', "heartbeat", "NUM", 0, &heartbeat_ms, "send unchanged values every this many ms (default 60000)");
+    optparse_add_unsigned(parser, 's', "size", "NUM", 0, &capacity, "series tracked (default 262144)");
+    optparse_add_set(parser, 'd', "disable", 1, &disable, "send every sample");
+
+    int argi = optparse_parse(parser, slash->argc - 1, (const char **) slash->argv + 1);
+    optparse_del(parser);
+    if (argi < 0) {
+        return SLASH_EINVAL;
+    }
+
+    if (disable) {
+        vm_change_disable();
+        printf("Sending every sample to VictoriaMetrics\n");
+        return SLASH_SUCCESS;
+    }
+
+    if (vm_change_enable(heartbeat_ms, capacity) < 0) {
+        printf("Failed to enable change-only export\n");
+        return SLASH_EINVAL;
+    }
+    printf("Sending changed values, and unchanged ones every %u ms\n", heartbeat_ms);
+    return SLASH_SUCCESS;
+}
+slash_command(vm_change_only, vm_change_cmd, "", "Only send changed values to VictoriaMetrics");
@@ -0,0 +1,38 @@
+/*
+ * vm_change.h
+ *
+ * Change-only export to VictoriaMetrics. When enabled, a sample of a (node, id, idx) series is only sent
+ * if its value differs from the previous sample, or the last sent sample is older than the heartbeat.
+ * The heartbeat keeps series of constant values from going stale in VictoriaMetrics, so it should stay
+ * below its staleness interval (5 minutes by default). Applies to the sniffer and to vm_add_param(),
+ * which share the cache. The local log still receives every sample.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "param_sniffer.h"
+
+#define VM_CHANGE_HEARTBEAT_MS_DEFAULT (60 * 1000)
+#define VM_CHANGE_CAPACITY_DEFAULT     (256 * 1024)
+
+/**
+ * @brief Only send changed values, or change the settings, which forgets the values seen so far.
+ * @param heartbeat_ms Send unchanged values again once the last sent one is this old, by sample time.
+ * @param capacity Series tracked, rounded up to a power of two, 32 bytes each. Samples of further series are always sent.
+ * @return 0 on success, -1 if an argument is 0 or the cache could not be allocated.
+ */
+int vm_change_enable(uint32_t heartbeat_ms, size_t capacity);
+
+/* Send every sample again, and free the cache */
+void vm_change_disable(void);
+
+int vm_change_is_enabled(void);
+
+/**
+ * @brief Decide whether a sample is sent, and remember it.
+ * @return 1 if the sample should be sent (also when disabled), 0 if it is unchanged.
+ */
+int vm_change_check(uint16_t node, uint16_t id, uint32_t idx, uint64_t time_ms, const sniffer_value_t * value);
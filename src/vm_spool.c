@@ -0,0 +1,296 @@
+/*
+ * vm_spool.c
+ *
+ * See vm_spool.h
+ *
+ * Segments are named <seq>.vmspool, and only ever appended to while they are the newest.
+ * Older segments are read from, and deleted once fully pushed or when the spool exceeds its bound.
+ * The read offset into the oldest segment is not persisted, so after a restart part of it may be pushed twice.
+ */
+
+#include "vm_spool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "sniffer_stats.h"
+
+#define SPOOL_SUFFIX ".vmspool"
+#define SPOOL_WRITE_BUFFER (256 * 1024)
+
+static pthread_mutex_t spool_lock = PTHREAD_MUTEX_INITIALIZER;
+static char * spool_dir = NULL;
+static uint64_t spool_max = VM_SPOOL_MAX_DEFAULT;
+static uint64_t segment_size = VM_SPOOL_SEGMENT_SIZE;
+static uint64_t spool_bytes = 0;    // Bytes not yet consumed, over all segments
+static uint64_t first_seq = 1;      // Oldest segment, being drained
+static uint64_t read_offset = 0;    // Consumed bytes of the oldest segment
+static uint64_t write_seq = 1;      // Newest segment, being appended to
+static uint64_t write_size = 0;
+static FILE * write_file = NULL;
+
+static void spool_path(char * out, size_t size, uint64_t seq) {
+    snprintf(out, size, "%s/%020" PRIu64 SPOOL_SUFFIX, spool_dir, seq);
+}
+
+static uint64_t spool_file_size(uint64_t seq) {
+    char path[512];
+    spool_path(path, sizeof(path), seq);
+    struct stat st;
+    return (stat(path, &st) == 0) ? (uint64_t) st.st_size : 0;
+}
+
+/* Close the newest segment, so it can be drained. Called with spool_lock held */
+static void spool_rotate(void) {
+    if (write_file) {
+        fclose(write_file);
+        write_file = NULL;
+    }
+    write_seq++;
+    write_size = 0;
+}
+
+/* Delete the oldest segment, returning its unconsumed bytes. Called with spool_lock held */
+static uint64_t spool_delete_first(void) {
+
+    uint64_t remaining = spool_file_size(first_seq);
+    remaining = (remaining > read_offset) ? remaining - read_offset : 0;
+
+    char path[512];
+    spool_path(path, sizeof(path), first_seq);
+    unlink(path);
+
+    spool_bytes = (spool_bytes > remaining) ? spool_bytes - remaining : 0;
+    first_seq++;
+    read_offset = 0;
+    SNIFFER_STATS_SET(vm_spool_pending, spool_bytes);
+
+    return remaining;
+}
+
+void vm_spool_close(void) {
+
+    pthread_mutex_lock(&spool_lock);
+    if (write_file) {
+        fclose(write_file);
+        write_file = NULL;
+    }
+    free(spool_dir);
+    spool_dir = NULL;
+    pthread_mutex_unlock(&spool_lock);
+}
+
+int vm_spool_is_open(void) {
+    return spool_dir != NULL;
+}
+
+int vm_spool_open(const char * dir, uint64_t max_bytes) {
+
+    static int atexit_registered = 0;
+
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        return -1;
+    }
+
+    DIR * d = opendir(dir);
+    if (d == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&spool_lock);
+    if (spool_dir) {
+        pthread_mutex_unlock(&spool_lock);
+        closedir(d);
+        return -1;
+    }
+    spool_dir = strdup(dir);
+    if (spool_dir == NULL) {
+        pthread_mutex_unlock(&spool_lock);
+        closedir(d);
+        return -1;
+    }
+
+    /* Pick up segments left by a previous run */
+    uint64_t min_seq = UINT64_MAX, max_seq = 0;
+    spool_bytes = 0;
+    struct dirent * entry;
+    while ((entry = readdir(d)) != NULL) {
+        uint64_t seq;
+        int end = 0;
+        if (sscanf(entry->d_name, "%" SCNu64 SPOOL_SUFFIX "%n", &seq, &end) != 1 || entry->d_name[end] != '\0' || end == 0) {
+            continue;
+        }
+        if (seq < min_seq) {
+            min_seq = seq;
+        }
+        if (seq > max_seq) {
+            max_seq = seq;
+        }
+        spool_bytes += spool_file_size(seq);
+    }
+    closedir(d);
+
+    first_seq = (max_seq > 0) ? min_seq : 1;
+    write_seq = max_seq + 1;
+    write_size = 0;
+    read_offset = 0;
+    spool_max = max_bytes;
+    /* Several segments must fit within the bound, so the oldest can be deleted to make room */
+    segment_size = max_bytes / 8;
+    if (segment_size > VM_SPOOL_SEGMENT_SIZE) {
+        segment_size = VM_SPOOL_SEGMENT_SIZE;
+    }
+    if (segment_size < VM_SPOOL_CHUNK_SIZE) {
+        segment_size = VM_SPOOL_CHUNK_SIZE;
+    }
+    SNIFFER_STATS_SET(vm_spool_pending, spool_bytes);
+    pthread_mutex_unlock(&spool_lock);
+
+    if (!atexit_registered) {
+        atexit(vm_spool_close);
+        atexit_registered = 1;
+    }
+
+    return 0;
+}
+
+int vm_spool_write(const char * data, size_t len) {
+
+    pthread_mutex_lock(&spool_lock);
+    if (spool_dir == NULL) {
+        pthread_mutex_unlock(&spool_lock);
+        return -1;
+    }
+
+    if (write_size > 0 && write_size + len > segment_size) {
+        spool_rotate();
+    }
+
+    /* Make room by deleting the oldest segments, newer data is worth more */
+    while (spool_bytes + len > spool_max && first_seq < write_seq) {
+        SNIFFER_STATS_ADD(vm_spool_dropped, spool_delete_first());
+    }
+    if (spool_bytes + len > spool_max) {
+        pthread_mutex_unlock(&spool_lock);
+        return -1;
+    }
+
+    if (write_file == NULL) {
+        char path[512];
+        spool_path(path, sizeof(path), write_seq);
+        write_file = fopen(path, "ab");
+        if (write_file == NULL) {
+            pthread_mutex_unlock(&spool_lock);
+            return -1;
+        }
+        setvbuf(write_file, NULL, _IOFBF, SPOOL_WRITE_BUFFER);
+    }
+
+    if (fwrite(data, 1, len, write_file) != len) {
+        pthread_mutex_unlock(&spool_lock);
+        return -1;
+    }
+    write_size += len;
+    spool_bytes += len;
+    SNIFFER_STATS_ADD(vm_spooled, len);
+    SNIFFER_STATS_SET(vm_spool_pending, spool_bytes);
+    pthread_mutex_unlock(&spool_lock);
+
+    return 0;
+}
+
+vm_spool_pos_t vm_spool_start(void) {
+    pthread_mutex_lock(&spool_lock);
+    vm_spool_pos_t pos = { .seq = first_seq, .offset = read_offset };
+    pthread_mutex_unlock(&spool_lock);
+    return pos;
+}
+
+size_t vm_spool_read(char * buf, vm_spool_pos_t * pos) {
+
+    while (1) {
+        pthread_mutex_lock(&spool_lock);
+        if (spool_dir == NULL) {
+            pthread_mutex_unlock(&spool_lock);
+            return 0;
+        }
+        /* Already acknowledged, or deleted to honour the bound */
+        if (pos->seq < first_seq || (pos->seq == first_seq && pos->offset < read_offset)) {
+            pos->seq = first_seq;
+            pos->offset = read_offset;
+        }
+        /* The newest segment is only read once it is closed */
+        if (pos->seq >= write_seq) {
+            if (pos->seq > write_seq || write_size == 0) {
+                pthread_mutex_unlock(&spool_lock);
+                return 0;
+            }
+            spool_rotate();
+        }
+        char path[512];
+        spool_path(path, sizeof(path), pos->seq);
+        pthread_mutex_unlock(&spool_lock);
+
+        /* Closed segments are not written to, so they can be read without holding the lock */
+        ssize_t len = -1;
+        int fd = open(path, O_RDONLY);
+        if (fd >= 0) {
+            len = pread(fd, buf, VM_SPOOL_CHUNK_SIZE, pos->offset);
+            close(fd);
+        }
+
+        size_t lines = (len > 0) ? len : 0;
+        while (lines > 0 && buf[lines - 1] != '\n') {
+            lines--;
+        }
+
+        if (lines > 0) {
+            pos->offset += lines;
+            return lines;
+        }
+
+        /* Missing, exhausted, or ending in a partial line left by a crash. The segment is deleted once acknowledged past */
+        pos->seq++;
+        pos->offset = 0;
+    }
+}
+
+void vm_spool_ack(vm_spool_pos_t pos) {
+
+    pthread_mutex_lock(&spool_lock);
+    if (spool_dir) {
+        /* Whatever is left of fully read segments is a partial line */
+        while (first_seq < pos.seq && first_seq < write_seq) {
+            SNIFFER_STATS_ADD(vm_spool_dropped, spool_delete_first());
+        }
+        if (first_seq == pos.seq && pos.offset > read_offset) {
+            uint64_t len = pos.offset - read_offset;
+            read_offset = pos.offset;
+            spool_bytes = (spool_bytes > len) ? spool_bytes - len : 0;
+            if (first_seq < write_seq && read_offset >= spool_file_size(first_seq)) {
+                spool_delete_first();
+            }
+        }
+        if (first_seq == write_seq && write_size == 0) {
+            /* Everything on disk is gone, whatever the count says */
+            spool_bytes = 0;
+        }
+        SNIFFER_STATS_SET(vm_spool_pending, spool_bytes);
+    }
+    pthread_mutex_unlock(&spool_lock);
+}
+
+uint64_t vm_spool_pending(void) {
+    pthread_mutex_lock(&spool_lock);
+    uint64_t pending = spool_bytes;
+    pthread_mutex_unlock(&spool_lock);
+    return pending;
+}
@@ -0,0 +1,61 @@
+/*
+ * vm_spool.h
+ *
+ * Bounded on-disk spool for VictoriaMetrics lines that could not be buffered or pushed.
+ * Lines are appended to numbered segment files in a directory, and drained oldest first by vm_push().
+ * Segments left over from a previous run are picked up again when the spool is opened.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Segments are 1/8 of the spool bound, between VM_SPOOL_CHUNK_SIZE and this */
+#define VM_SPOOL_SEGMENT_SIZE   (16 * 1024 * 1024)
+#define VM_SPOOL_MAX_DEFAULT    (1024ULL * 1024 * 1024)
+
+/* Largest chunk handed out by vm_spool_read(), a spooled line must be shorter than this */
+#define VM_SPOOL_CHUNK_SIZE     (1024 * 1024)
+
+/**
+ * @brief Start spooling to dir, which is created if missing.
+ * @param max_bytes Bound on the total size of the spool. When exceeded, the oldest segments are deleted.
+ * @return 0 on success, -1 if the directory could not be used or a spool is already open.
+ */
+int vm_spool_open(const char * dir, uint64_t max_bytes);
+
+/* Stop spooling. Spooled data is kept on disk for the next vm_spool_open() */
+void vm_spool_close(void);
+
+int vm_spool_is_open(void);
+
+/**
+ * @brief Append whole lines to the spool.
+ * @return 0 on success, -1 if the spool is not open or the write failed.
+ */
+int vm_spool_write(const char * data, size_t len);
+
+/* Position in the spool, as a segment and a byte offset into it */
+typedef struct {
+    uint64_t seq;
+    uint64_t offset;
+} vm_spool_pos_t;
+
+/* Position of the oldest spooled line that has not been acknowledged */
+vm_spool_pos_t vm_spool_start(void);
+
+/**
+ * @brief Copy spooled lines from *pos into buf, without removing them, and advance *pos past them.
+ * Several chunks can be read ahead this way, and acknowledged in order once pushed.
+ * A position whose segment has been deleted to honour the bound is moved to vm_spool_start().
+ * @param buf At least VM_SPOOL_CHUNK_SIZE bytes.
+ * @return Length of the whole lines copied, 0 if nothing is spooled beyond *pos.
+ */
+size_t vm_spool_read(char * buf, vm_spool_pos_t * pos);
+
+/* Remove everything before pos, as returned by vm_spool_read(), once it has been pushed */
+void vm_spool_ack(vm_spool_pos_t pos);
+
+/* Bytes in the spool */
+uint64_t vm_spool_pending(void);
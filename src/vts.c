@@ -11,6 +11,7 @@
 #include <slash/slash.h>
 #include <slash/optparse.h>
 #include "param_sniffer.h"
+#include "sniffer_stats.h"
 
 static int adcs_node = 0;
 
@@ -46,6 +47,7 @@ void vts_add(double arr[4], uint16_t id, int count, uint64_t time_ms){
     sprintf(buf, "TIME %f 1\n", jd_cnes);
     //printf("%s", buf);
     if(send(sockfd, buf, strlen(buf), MSG_NOSIGNAL) == -1){
+        SNIFFER_STATS_INC(vts_errors);
         printf("VTS send failed!\n");
     }
 
@@ -53,6 +55,7 @@ void vts_add(double arr[4], uint16_t id, int count, uint64_t time_ms){
         sprintf(buf, "DATA %f orbit_sim_quat \"%f %f %f %f\"\n", jd_cnes, arr[3], arr[0], arr[1], arr[2]);
         //printf("%s", buf);
         if(send(sockfd, buf, strlen(buf), MSG_NOSIGNAL) == -1){
+            SNIFFER_STATS_INC(vts_errors);
             printf("VTS send failed!\n");
         }
         last_q_hat_time = timestamp;
@@ -62,6 +65,7 @@ void vts_add(double arr[4], uint16_t id, int count, uint64_t time_ms){
         sprintf(buf, "DATA %f orbit_prop_pos \"%f %f %f\"\n", jd_cnes, arr[0]/1000, arr[1]/1000, arr[2]/1000); // convert to km
         //printf("%s", buf);
         if(send(sockfd, buf, strlen(buf), MSG_NOSIGNAL) == -1){
+            SNIFFER_STATS_INC(vts_errors);
             printf("VTS send failed!\n");
         }
         last_pos_time = timestamp;
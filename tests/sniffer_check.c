@@ -0,0 +1,488 @@
+/*
+ * sniffer_check.c
+ *
+ * Behaviour checks of the sniffer ingest path. Each check feeds samples through the code under test
+ * and compares what comes out with what went in.
+ *
+ * Run with `meson test`, or directly: sniffer_check
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+
+#include <csp/csp.h>
+#include <param/param.h>
+#include <param/param_list.h>
+#include <param/param_queue.h>
+#include <param/param_server.h>
+
+#include "param_sniffer.h"
+#include "sniffer_store.h"
+#include "sniffer_capture.h"
+#include "sniffer_sink.h"
+#include "sniffer_param_cache.h"
+#include "sniffer_dedup.h"
+#include "sniffer_cache.h"
+#include "sniffer_stats.h"
+#include "victoria_metrics.h"
+#include "vm_change.h"
+#include "vts.h"
+
+/* Only the first failures are printed, one broken check tends to fail thousands of times */
+#define CHECK_PRINT_MAX 20
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+        if (!(cond) && failures++ < CHECK_PRINT_MAX) { \
+            printf("%s:%d: %s: ", __FILE__, __LINE__, __func__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+        } \
+    } while (0)
+
+/* Path of a new temporary file, removed again so it can be created by the code under test */
+static void check_temp_path(char * path, size_t size, const char * suffix) {
+    snprintf(path, size, "/tmp/sniffer_check_XXXXXX%s", suffix);
+    int fd = mkstemps(path, strlen(suffix));
+    if (fd < 0) {
+        perror("mkstemps");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    remove(path);
+}
+
+static uint64_t check_wall_ms(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+#define CHECK_NODE 120
+
+static param_t * check_param_create(int id, param_type_e type, int array_size, char * name) {
+    param_t * param = param_list_create_remote(id, CHECK_NODE, type, PM_TELEM, array_size, name, NULL, NULL, -1);
+    if (param == NULL || param_list_add(param) < 0) {
+        fprintf(stderr, "Failed to create param %s\n", name);
+        exit(EXIT_FAILURE);
+    }
+    return param;
+}
+
+/* Encode the current values and timestamps of params into packet, as a version 2 pull response */
+static void check_packet_build(csp_packet_t * packet, param_t ** params, int count) {
+
+    memset(packet, 0, sizeof(*packet));
+    param_queue_t queue;
+    param_queue_init(&queue, &packet->data[2], sizeof(packet->data) - 2, 0, PARAM_QUEUE_TYPE_SET, 2);
+    queue.last_node = CHECK_NODE;
+    for (int i = 0; i < count; i++) {
+        if (param_queue_add(&queue, params[i], -1, NULL) < 0) {
+            fprintf(stderr, "Packet full\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    packet->data[0] = PARAM_PULL_RESPONSE_V2;
+    packet->id.src = CHECK_NODE;
+    packet->id.dst = 1;
+    packet->id.sport = PARAM_PORT_SERVER;
+    packet->id.dport = 20;
+    packet->length = 2 + queue.used;
+}
+
+/* Sink collecting every sample it is given */
+#define CHECK_SAMPLES_MAX 256
+typedef struct {
+    sniffer_sample_t samples[CHECK_SAMPLES_MAX];
+    size_t count;
+} check_samples_t;
+
+static void check_sink(void * ctx, const sniffer_sample_t * samples, size_t count) {
+    check_samples_t * collected = ctx;
+    for (size_t i = 0; i < count && collected->count < CHECK_SAMPLES_MAX; i++) {
+        collected->samples[collected->count++] = samples[i];
+    }
+}
+
+static void check_sink_add(check_samples_t * collected) {
+    collected->count = 0;
+    if (sniffer_sink_add("check", check_sink, collected) < 0) {
+        fprintf(stderr, "Failed to add sink\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static param_t * check_counter;   // uint32 scalar
+static param_t * check_vector;    // double[4]
+
+static void check_params_create(void) {
+    check_counter = check_param_create(300, PARAM_TYPE_UINT32, 1, "check_counter");
+    check_vector = check_param_create(301, PARAM_TYPE_DOUBLE, 4, "check_vector");
+}
+
+/* Set both params to values derived from n, without timestamps */
+static void check_params_set(uint32_t n) {
+    param_set(check_counter, 0, &n);
+    for (int i = 0; i < 4; i++) {
+        double d = n + i / 4.0;
+        param_set(check_vector, i, &d);
+    }
+    check_counter->timestamp->tv_sec = check_vector->timestamp->tv_sec = 0;
+    check_counter->timestamp->tv_nsec = check_vector->timestamp->tv_nsec = 0;
+}
+
+/* Stamp both params with a time from the packet, as sent by a node with a clock */
+static void check_params_stamp(uint32_t sec) {
+    check_counter->timestamp->tv_sec = check_vector->timestamp->tv_sec = sec;
+    check_counter->timestamp->tv_nsec = check_vector->timestamp->tv_nsec = 0;
+}
+
+/* Decode a pull response of both params with their current values and timestamps, @return samples delivered to sinks */
+static size_t check_process(check_samples_t * collected) {
+    param_t * params[] = { check_counter, check_vector };
+    csp_packet_t packet;
+    check_packet_build(&packet, params, 2);
+    size_t before = collected->count;
+    param_sniffer_process(&packet, NULL);
+    return collected->count - before;
+}
+
+/* A packet sniffed twice is delivered once, while a changed value or timestamp gets through */
+static void check_dedup(void) {
+
+    CHECK(sniffer_dedup_enable(60 * 1000, 1024) == 0, "enable");
+    static check_samples_t collected;
+    check_sink_add(&collected);
+
+    check_params_set(7);
+    check_params_stamp(1700000000);
+    size_t first = check_process(&collected);
+    CHECK(first == 5, "first packet: %zu samples", first);
+    size_t repeated = check_process(&collected);
+    CHECK(repeated == 0, "repeated packet: %zu samples", repeated);
+
+    /* Same timestamp, only the counter changed */
+    uint32_t changed = 8;
+    param_set(check_counter, 0, &changed);
+    size_t counter = check_process(&collected);
+    CHECK(counter == 1, "changed counter: %zu samples", counter);
+    if (counter == 1) {
+        const sniffer_sample_t * sample = &collected.samples[collected.count - 1];
+        CHECK(sample->id == 300 && sample->value.u == 8, "changed counter: %u = %" PRIu64, sample->id, sample->value.u);
+    }
+
+    /* Same values, later timestamp */
+    check_params_stamp(1700000001);
+    size_t later = check_process(&collected);
+    CHECK(later == 5, "later packet: %zu samples", later);
+
+    /* Without a timestamp in the packet, samples are stamped on reception and never suppressed */
+    check_params_stamp(0);
+    check_process(&collected);
+    size_t unstamped = check_process(&collected);
+    CHECK(unstamped == 5, "unstamped packet: %zu samples", unstamped);
+
+    sniffer_dedup_disable();
+    check_params_stamp(1700000000);
+    size_t disabled = check_process(&collected);
+    CHECK(disabled == 5, "disabled: %zu samples", disabled);
+
+    sniffer_sink_remove("check", NULL);
+}
+
+/* VTS connection, set up by the vts command */
+extern int vts_running;
+extern int sockfd;
+
+/* Send the orbit position to VTS from a packet of node 0, the ADCS node by default. @return bytes sent */
+static ssize_t check_vts_send(param_t * pos, int peer) {
+    csp_packet_t packet;
+    check_packet_build(&packet, &pos, 1);
+    packet.id.src = 0;
+    param_sniffer_process(&packet, NULL);
+    char buf[1000];
+    return recv(peer, buf, sizeof(buf), MSG_DONTWAIT);
+}
+
+/* VTS gets whole vectors only, so nothing once an element is suppressed as a duplicate */
+static void check_vts_dedup(void) {
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        perror("socketpair");
+        exit(EXIT_FAILURE);
+    }
+    param_t * pos = param_list_create_remote(357, 0, PARAM_TYPE_DOUBLE, PM_TELEM, 3, "orbit_pos", NULL, NULL, -1);
+    if (pos == NULL || param_list_add(pos) < 0) {
+        fprintf(stderr, "Failed to create param orbit_pos\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < 3; i++) {
+        double d = 7000000 + i;
+        param_set(pos, i, &d);
+    }
+    pos->timestamp->tv_sec = 1700000000;
+    pos->timestamp->tv_nsec = 0;
+
+    CHECK(sniffer_dedup_enable(60 * 1000, 1024) == 0, "enable");
+    sockfd = sv[0];
+    vts_running = 1;
+
+    CHECK(check_vts_send(pos, sv[1]) > 0, "first packet not sent to VTS");
+    CHECK(check_vts_send(pos, sv[1]) < 0, "repeated packet sent to VTS");
+
+    /* Same timestamp, only the middle element changed */
+    double changed = 1;
+    param_set(pos, 1, &changed);
+    CHECK(check_vts_send(pos, sv[1]) < 0, "packet with duplicate elements sent to VTS");
+
+    vts_running = 0;
+    sniffer_dedup_disable();
+    close(sv[0]);
+    close(sv[1]);
+}
+
+/* Decode a packet of both params, @return samples held back as unchanged, and in sent the bytes rendered for VictoriaMetrics */
+static uint64_t check_process_vm(size_t * sent) {
+    sniffer_stats_t before, after;
+    sniffer_stats_snapshot(&before);
+    param_t * params[] = { check_counter, check_vector };
+    csp_packet_t packet;
+    check_packet_build(&packet, params, 2);
+    param_sniffer_process(&packet, NULL);
+    sniffer_stats_snapshot(&after);
+    *sent = vm_ingest_drain();
+    return after.vm_unchanged - before.vm_unchanged;
+}
+
+/* Unchanged values are held back until the heartbeat, by sample time, while changed ones are sent right away */
+static void check_change_only(void) {
+
+    CHECK(vm_ingest_start() == 0, "ingest start");
+    CHECK(vm_change_enable(1000, 1024) == 0, "enable");
+
+    size_t sent;
+    check_params_set(3);
+    check_params_stamp(1800000000);
+    uint64_t unchanged = check_process_vm(&sent);
+    CHECK(unchanged == 0 && sent > 0, "first packet: %" PRIu64 " unchanged, %zu bytes", unchanged, sent);
+
+    for (int n = 1; n <= 3; n++) {
+        check_counter->timestamp->tv_nsec = check_vector->timestamp->tv_nsec = n * 200 * 1000000;
+        unchanged = check_process_vm(&sent);
+        CHECK(unchanged == 5 && sent == 0, "repeat %d: %" PRIu64 " unchanged, %zu bytes", n, unchanged, sent);
+    }
+
+    /* Only the counter changed */
+    uint32_t changed = 4;
+    param_set(check_counter, 0, &changed);
+    check_counter->timestamp->tv_nsec = check_vector->timestamp->tv_nsec = 800 * 1000000;
+    unchanged = check_process_vm(&sent);
+    CHECK(unchanged == 4 && sent > 0, "changed counter: %" PRIu64 " unchanged, %zu bytes", unchanged, sent);
+
+    /* The vector was last sent a heartbeat ago, the counter only 200 ms ago */
+    check_params_stamp(1800000001);
+    unchanged = check_process_vm(&sent);
+    CHECK(unchanged == 1 && sent > 0, "heartbeat: %" PRIu64 " unchanged, %zu bytes", unchanged, sent);
+
+    vm_change_disable();
+    unchanged = check_process_vm(&sent);
+    CHECK(unchanged == 0 && sent > 0, "disabled: %" PRIu64 " unchanged, %zu bytes", unchanged, sent);
+
+    vm_ingest_stop();
+}
+
+/* More samples than the initial ring of a series, and than the history kept, so the ring grows and then wraps */
+#define CHECK_CACHE_HISTORY 16
+#define CHECK_CACHE_SAMPLES 20
+
+/* The latest sample and the history of each series come back in the order they were decoded */
+static void check_cache(void) {
+
+    CHECK(sniffer_cache_enable(CHECK_CACHE_HISTORY, 1024) == 0, "enable");
+
+    static check_samples_t collected;
+    check_sink_add(&collected);
+    for (uint32_t n = 0; n < CHECK_CACHE_SAMPLES; n++) {
+        check_params_set(100 + n);
+        check_params_stamp(1900000000 + n);
+        check_process(&collected);
+    }
+    sniffer_sink_remove("check", NULL);
+    CHECK(collected.count == CHECK_CACHE_SAMPLES * 5, "%zu samples", collected.count);
+
+    uint64_t last_ms = (uint64_t) (1900000000 + CHECK_CACHE_SAMPLES - 1) * 1000;
+    uint64_t time_ms = 0;
+    sniffer_value_t value = {0};
+    CHECK(sniffer_cache_latest(CHECK_NODE, 300, 0, &time_ms, &value) == 0, "counter not cached");
+    CHECK(time_ms == last_ms && value.kind == SNIFFER_VALUE_UINT && value.u == 100 + CHECK_CACHE_SAMPLES - 1,
+          "latest counter %" PRIu64 " at %" PRIu64, value.u, time_ms);
+    CHECK(sniffer_cache_latest(CHECK_NODE, 301, 4, &time_ms, &value) < 0, "vector[4] cached");
+
+    uint64_t times[CHECK_CACHE_SAMPLES];
+    sniffer_value_t values[CHECK_CACHE_SAMPLES];
+    for (uint32_t idx = 0; idx < 4; idx++) {
+        size_t count = sniffer_cache_history(CHECK_NODE, 301, idx, times, values, CHECK_CACHE_SAMPLES);
+        CHECK(count == CHECK_CACHE_HISTORY, "vector[%u]: %zu samples", idx, count);
+        for (size_t i = 0; i < count; i++) {
+            uint32_t n = CHECK_CACHE_SAMPLES - count + i;
+            CHECK(times[i] == (uint64_t) (1900000000 + n) * 1000 && values[i].d == 100 + n + idx / 4.0,
+                  "vector[%u] sample %zu: %f at %" PRIu64, idx, i, values[i].d, times[i]);
+        }
+    }
+
+    /* Fewer than kept: the newest ones */
+    size_t count = sniffer_cache_history(CHECK_NODE, 300, 0, times, values, 5);
+    CHECK(count == 5, "counter: %zu samples", count);
+    for (size_t i = 0; i < count; i++) {
+        CHECK(values[i].u == 100 + CHECK_CACHE_SAMPLES - 5 + i, "counter sample %zu: %" PRIu64, i, values[i].u);
+    }
+
+    sniffer_cache_disable();
+    CHECK(sniffer_cache_latest(CHECK_NODE, 300, 0, &time_ms, &value) < 0, "counter cached after disable");
+}
+
+#define CHECK_REPLAY_PACKETS 3
+
+/* Replayed samples carry the values captured, stamped with the time of capture rather than of the replay */
+static void check_capture_replay(void) {
+
+    char path[64];
+    check_temp_path(path, sizeof(path), ".cap");
+    CHECK(sniffer_capture_open(path) == 0, "open %s", path);
+
+    param_t * params[] = { check_counter, check_vector };
+    uint64_t captured_from = check_wall_ms();
+    for (uint32_t p = 0; p < CHECK_REPLAY_PACKETS; p++) {
+        csp_packet_t packet;
+        check_params_set(10 + p);
+        check_packet_build(&packet, params, 2);
+        sniffer_capture_write(&packet);
+    }
+    uint64_t captured_to = check_wall_ms();
+    sniffer_capture_close();
+
+    /* Replay measurably later than the capture */
+    usleep(50 * 1000);
+
+    static check_samples_t collected;
+    check_sink_add(&collected);
+    long replayed = sniffer_capture_replay(path);
+    sniffer_sink_remove("check", NULL);
+    remove(path);
+
+    CHECK(replayed == CHECK_REPLAY_PACKETS, "replayed %ld packets", replayed);
+    CHECK(collected.count == CHECK_REPLAY_PACKETS * 5, "%zu samples", collected.count);
+    if (collected.count != CHECK_REPLAY_PACKETS * 5) {
+        return;
+    }
+
+    for (uint32_t p = 0; p < CHECK_REPLAY_PACKETS; p++) {
+        const sniffer_sample_t * counter = &collected.samples[p * 5];
+        CHECK(counter->node == CHECK_NODE && counter->id == 300 && counter->idx == 0, "packet %u: counter series %u:%u[%u]",
+              p, counter->node, counter->id, counter->idx);
+        CHECK(counter->value.kind == SNIFFER_VALUE_UINT && counter->value.u == 10 + p, "packet %u: counter %" PRIu64, p, counter->value.u);
+
+        for (uint32_t i = 0; i < 4; i++) {
+            const sniffer_sample_t * element = &collected.samples[p * 5 + 1 + i];
+            CHECK(element->id == 301 && element->idx == i, "packet %u: vector series %u[%u]", p, element->id, element->idx);
+            CHECK(element->value.kind == SNIFFER_VALUE_DOUBLE && element->value.d == 10 + p + i / 4.0,
+                  "packet %u: vector[%u] %f", p, i, element->value.d);
+        }
+        for (uint32_t i = 0; i < 5; i++) {
+            uint64_t t = collected.samples[p * 5 + i].time_ms;
+            CHECK(t >= captured_from && t <= captured_to, "packet %u: stamped %" PRIu64 ", captured %" PRIu64 "..%" PRIu64,
+                  p, t, captured_from, captured_to);
+        }
+    }
+}
+
+/* Parameters added to the list are found right away, also when their absence was cached */
+static void check_param_cache(void) {
+
+    CHECK(sniffer_param_find(CHECK_NODE, 302) == NULL, "param 302 found before it was added");
+    param_t * param = check_param_create(302, PARAM_TYPE_INT16, 1, "check_added");
+    CHECK(sniffer_param_find(CHECK_NODE, 302) == param, "param 302 not found after it was added");
+    CHECK(sniffer_param_find(CHECK_NODE, 300) == check_counter, "param 300 not found");
+
+    /* Cached lookups of other nodes keep working while a list is downloaded, the node downloaded is not decoded */
+    sniffer_param_list_change_begin(CHECK_NODE + 1);
+    CHECK(sniffer_param_find(CHECK_NODE, 300) == check_counter, "param 300 not found during a download of another node");
+    sniffer_param_list_change_end();
+    sniffer_param_list_change_begin(CHECK_NODE);
+    CHECK(sniffer_param_find(CHECK_NODE, 300) == NULL, "param 300 found during a download of its node");
+    sniffer_param_list_change_end();
+    CHECK(sniffer_param_find(CHECK_NODE, 300) == check_counter, "param 300 not found after the download");
+}
+
+/* Enough series to grow the store hash tables several times, with samples interleaved between series */
+#define CHECK_STORE_SERIES  3000
+#define CHECK_STORE_SAMPLES 5
+
+static void check_store_many_series(void) {
+
+    char path[64];
+    check_temp_path(path, sizeof(path), ".tsdb");
+    CHECK(sniffer_store_open(path) == 0, "open %s", path);
+
+    for (int s = 0; s < CHECK_STORE_SAMPLES; s++) {
+        for (int i = 0; i < CHECK_STORE_SERIES; i++) {
+            sniffer_value_t value = { .kind = SNIFFER_VALUE_INT, .i = (int64_t) i * 100 + s };
+            sniffer_store_append(1 + i % 3, i / 3, i % 7, 1000 + s * 10, &value);
+        }
+    }
+    sniffer_store_close();
+
+    sniffer_store_reader_t * reader = sniffer_store_reader_open(path);
+    CHECK(reader != NULL, "reader open");
+    if (reader == NULL) {
+        return;
+    }
+
+    size_t series = sniffer_store_reader_series(reader, NULL, 0);
+    CHECK(series == CHECK_STORE_SERIES, "%zu series", series);
+
+    for (int i = 0; i < CHECK_STORE_SERIES; i++) {
+        sniffer_series_key_t key = { .node = 1 + i % 3, .id = i / 3, .idx = i % 7 };
+        sniffer_value_kind_e kind;
+        size_t count = sniffer_store_reader_count(reader, key, &kind);
+        CHECK(count == CHECK_STORE_SAMPLES && kind == SNIFFER_VALUE_INT, "series %d: %zu samples", i, count);
+
+        uint64_t times[CHECK_STORE_SAMPLES];
+        int64_t values[CHECK_STORE_SAMPLES];
+        size_t read = sniffer_store_reader_read(reader, key, SNIFFER_VALUE_INT, times, values, CHECK_STORE_SAMPLES);
+        CHECK(read == CHECK_STORE_SAMPLES, "series %d: read %zu samples", i, read);
+        for (size_t s = 0; s < read; s++) {
+            CHECK(times[s] == 1000 + s * 10 && values[s] == (int64_t) i * 100 + (int64_t) s,
+                  "series %d sample %zu: %" PRIu64 " %" PRId64, i, s, times[s], values[s]);
+        }
+    }
+
+    sniffer_store_reader_close(reader);
+    remove(path);
+}
+
+int main(void) {
+
+    check_params_create();
+
+    check_param_cache();
+    check_store_many_series();
+    check_capture_replay();
+    check_dedup();
+    check_vts_dedup();
+    check_change_only();
+    check_cache();
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("All checks passed\n");
+    return EXIT_SUCCESS;
+}
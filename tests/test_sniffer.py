@@ -0,0 +1,368 @@
+import os
+import pycsh
+import asyncio
+import unittest
+import tempfile
+import urllib.error
+import urllib.request
+
+
+class TestSnifferStore(unittest.TestCase):
+
+    def setUp(self):
+        fd, self.path = tempfile.mkstemp(suffix='.tsdb')
+        os.close(fd)
+        os.remove(self.path)
+
+    def tearDown(self):
+        pycsh.sniffer_store_close()
+        if os.path.exists(self.path):
+            os.remove(self.path)
+
+    def test_empty_store(self):
+        pycsh.sniffer_store_open(self.path)
+        pycsh.sniffer_store_close()
+
+        self.assertEqual(pycsh.sniffer_store_series(self.path), [])
+
+        timestamps, values = pycsh.sniffer_store_read(self.path, 1, 2)
+        self.assertEqual(len(timestamps), 0)
+        self.assertEqual(len(values), 0)
+        self.assertEqual(timestamps.format, 'Q')
+
+    def test_not_a_store(self):
+        with open(self.path, 'w') as f:
+            f.write('not a store')
+
+        with self.assertRaises(OSError):
+            pycsh.sniffer_store_open(self.path)
+        with self.assertRaises(OSError):
+            pycsh.sniffer_store_series(self.path)
+
+
+class TestSnifferCapture(unittest.TestCase):
+
+    def setUp(self):
+        fd, self.path = tempfile.mkstemp(suffix='.cap')
+        os.close(fd)
+        os.remove(self.path)
+
+    def tearDown(self):
+        pycsh.sniffer_capture_close()
+        if os.path.exists(self.path):
+            os.remove(self.path)
+
+    def test_replay_empty_capture(self):
+        pycsh.sniffer_capture_open(self.path)
+        pycsh.sniffer_capture_close()
+
+        self.assertEqual(pycsh.sniffer_replay(self.path), 0)
+
+    def test_replay_missing_capture(self):
+        with self.assertRaises(OSError):
+            pycsh.sniffer_replay(self.path)
+
+
+class TestSnifferStats(unittest.TestCase):
+
+    def test_snapshot(self):
+        stats = pycsh.sniffer_stats()
+
+        for key in ('packets_read', 'samples', 'crc_errors', 'vm_dropped', 'vm_push_errors', 'vts_errors'):
+            self.assertIsInstance(stats[key], int)
+
+        histogram = stats['vm_push_ms_histogram']
+        self.assertEqual(histogram[-1][0], float('inf'))
+        self.assertEqual([bound for bound, _ in histogram], sorted(bound for bound, _ in histogram))
+
+    def test_reset(self):
+        pycsh.sniffer_stats_reset()
+        self.assertEqual(pycsh.sniffer_stats()['samples'], 0)
+
+
+class TestSnifferLogConfig(unittest.TestCase):
+
+    def setUp(self):
+        self.defaults = pycsh.sniffer_log_config()
+
+    def tearDown(self):
+        pycsh.sniffer_log_config(**self.defaults)
+
+    def test_set(self):
+        config = pycsh.sniffer_log_config(commit_ms=10, rotate_bytes=1 << 20, keep=2)
+        self.assertEqual(config['commit_ms'], 10)
+        self.assertEqual(config['commit_bytes'], self.defaults['commit_bytes'])
+        self.assertEqual(config['rotate_bytes'], 1 << 20)
+        self.assertEqual(config['keep'], 2)
+        self.assertEqual(pycsh.sniffer_log_config(rotate_bytes=0)['rotate_bytes'], 0)
+
+    def test_queue_size(self):
+        self.assertEqual(pycsh.sniffer_log_config(queue_bytes=self.defaults['queue_bytes'])['queue_bytes'],
+                         self.defaults['queue_bytes'])
+
+    def test_invalid(self):
+        with self.assertRaises(ValueError):
+            pycsh.sniffer_log_config(commit_ms=-1)
+        with self.assertRaises(ValueError):
+            pycsh.sniffer_log_config(queue_bytes=0)
+
+
+class TestSnifferWorkers(unittest.TestCase):
+
+    def test_invalid(self):
+        with self.assertRaises(ValueError):
+            pycsh.sniffer_workers(-1)
+        with self.assertRaises(ValueError):
+            pycsh.sniffer_workers(9)
+
+
+class TestVmSpool(unittest.TestCase):
+
+    def setUp(self):
+        self.dir = tempfile.TemporaryDirectory()
+
+    def tearDown(self):
+        pycsh.vm_spool_close()
+        self.dir.cleanup()
+
+    def test_open_empty(self):
+        pycsh.vm_spool_open(self.dir.name, max_mb=16)
+        self.assertEqual(pycsh.sniffer_stats()['vm_spool_pending'], 0)
+
+    def test_open_twice(self):
+        pycsh.vm_spool_open(self.dir.name)
+        with self.assertRaises(OSError):
+            pycsh.vm_spool_open(self.dir.name)
+
+
+class TestVmConfig(unittest.TestCase):
+
+    def setUp(self):
+        self.defaults = pycsh.vm_config()
+
+    def tearDown(self):
+        pycsh.vm_config(**self.defaults)
+
+    def test_buffer_size(self):
+        self.assertEqual(pycsh.vm_config(buffer_size=1 << 20)['buffer_size'], 1 << 20)
+        self.assertEqual(pycsh.vm_config()['buffer_size'], 1 << 20)
+        self.assertEqual(pycsh.sniffer_stats()['vm_buffer_size'], 1 << 20)
+
+    def test_flush_policy(self):
+        config = pycsh.vm_config(flush_bytes=65536, flush_lines=100, gzip=False)
+        self.assertEqual(config['flush_bytes'], 65536)
+        self.assertEqual(config['flush_lines'], 100)
+        self.assertEqual(config['flush_age_ms'], self.defaults['flush_age_ms'])
+        self.assertFalse(config['gzip'])
+        self.assertFalse(pycsh.vm_config(gzip=None)['gzip'])
+        self.assertTrue(pycsh.vm_config(gzip=True)['gzip'])
+
+    def test_concurrency(self):
+        self.assertEqual(pycsh.vm_config(concurrency=8)['concurrency'], 8)
+        self.assertEqual(pycsh.vm_config()['concurrency'], 8)
+
+    def test_invalid(self):
+        with self.assertRaises(ValueError):
+            pycsh.vm_config(buffer_size=-1)
+        with self.assertRaises(ValueError):
+            pycsh.vm_config(flush_age_ms=-1)
+        with self.assertRaises(ValueError):
+            pycsh.vm_config(concurrency=33)
+
+
+class TestSnifferSink(unittest.TestCase):
+
+    def tearDown(self):
+        try:
+            pycsh.sniffer_sink_remove('test')
+        except KeyError:
+            pass
+
+    def test_add_remove(self):
+        pycsh.sniffer_sink_add('test', lambda nodes, ids, idxs, timestamps, values: None)
+        with self.assertRaises(ValueError):
+            pycsh.sniffer_sink_add('test', print)
+        pycsh.sniffer_sink_remove('test')
+        with self.assertRaises(KeyError):
+            pycsh.sniffer_sink_remove('test')
+
+    def test_not_callable(self):
+        with self.assertRaises(TypeError):
+            pycsh.sniffer_sink_add('test', 42)
+
+
+class TestSnifferSubscription(unittest.TestCase):
+
+    def test_closed_iteration_ends(self):
+        with pycsh.sniffer_subscribe(capacity=1024) as subscription:
+            self.assertEqual(subscription.dropped, 0)
+        self.assertEqual(list(subscription), [])
+
+    def test_closed_async_iteration_ends(self):
+        subscription = pycsh.sniffer_subscribe()
+
+        async def consume():
+            asyncio.get_running_loop().call_soon(subscription.close)
+            return [batch async for batch in subscription]
+
+        self.assertEqual(asyncio.run(consume()), [])
+
+    def test_concurrent_anext(self):
+        subscription = pycsh.sniffer_subscribe()
+
+        async def consume():
+            first = subscription.__anext__()
+            with self.assertRaises(RuntimeError):
+                subscription.__anext__()
+            subscription.close()
+            with self.assertRaises(StopAsyncIteration):
+                await first
+
+        asyncio.run(consume())
+
+    def test_invalid_capacity(self):
+        with self.assertRaises(ValueError):
+            pycsh.sniffer_subscribe(capacity=0)
+
+
+class TestSnifferFilter(unittest.TestCase):
+
+    def tearDown(self):
+        pycsh.sniffer_filter_clear()
+
+    def test_set_and_clear(self):
+        settings = pycsh.sniffer_filter(nodes='1-10, 20', deny='5')
+        self.assertEqual(settings['nodes'], '1-10, 20')
+        self.assertEqual(settings['deny'], '5')
+        self.assertEqual(settings['ports'], '')
+
+        settings = pycsh.sniffer_filter(allow='100-200')
+        self.assertEqual(settings['allow'], '100-200')
+        self.assertEqual(settings['deny'], '5')
+
+        pycsh.sniffer_filter_clear()
+        self.assertEqual(set(pycsh.sniffer_filter().values()), {''})
+
+    def test_malformed(self):
+        for ranges in ('10-1', '1,,2', '1,', ',1', '0x10', 'a', '65536'):
+            with self.assertRaises(ValueError):
+                pycsh.sniffer_filter(nodes=ranges)
+        with self.assertRaises(ValueError):
+            pycsh.sniffer_filter(ports='64')
+        self.assertEqual(pycsh.sniffer_filter()['nodes'], '')
+
+    def test_malformed_part_changes_nothing(self):
+        pycsh.sniffer_filter(nodes='1', allow='2')
+        with self.assertRaises(ValueError):
+            pycsh.sniffer_filter(nodes='3', ports='4', allow='5', deny='x')
+        self.assertEqual(pycsh.sniffer_filter(), {'nodes': '1', 'ports': '', 'allow': '2', 'deny': ''})
+
+
+class TestSnifferAgg(unittest.TestCase):
+
+    def tearDown(self):
+        pycsh.sniffer_agg_clear()
+
+    def test_rules(self):
+        pycsh.sniffer_agg('adcs_*', 1000)
+        pycsh.sniffer_agg('pwr_?', 500, stats='mean, last', node=5)
+        pycsh.sniffer_agg('adcs_*', 2000, stats='max,min')
+        self.assertEqual(pycsh.sniffer_agg_rules(), [('adcs_*', 2000, 'min,max', -1), ('pwr_?', 500, 'last,mean', 5)])
+
+        pycsh.sniffer_agg_remove('pwr_?', node=5)
+        self.assertEqual(len(pycsh.sniffer_agg_rules()), 1)
+        with self.assertRaises(KeyError):
+            pycsh.sniffer_agg_remove('pwr_?')
+
+        pycsh.sniffer_agg_flush()
+        pycsh.sniffer_agg_clear()
+        self.assertEqual(pycsh.sniffer_agg_rules(), [])
+
+    def test_invalid(self):
+        with self.assertRaises(ValueError):
+            pycsh.sniffer_agg('x', 1000, stats='median')
+        with self.assertRaises(ValueError):
+            pycsh.sniffer_agg('x', 0)
+        with self.assertRaises(ValueError):
+            pycsh.sniffer_agg('', 1000)
+        self.assertEqual(pycsh.sniffer_agg_rules(), [])
+
+
+class TestSnifferDedup(unittest.TestCase):
+
+    def tearDown(self):
+        pycsh.sniffer_dedup(False)
+
+    def test_invalid(self):
+        with self.assertRaises(ValueError):
+            pycsh.sniffer_dedup(window_ms=0)
+        with self.assertRaises(ValueError):
+            pycsh.sniffer_dedup(capacity=0)
+
+
+class TestVmChangeOnly(unittest.TestCase):
+
+    def tearDown(self):
+        pycsh.vm_change_only(False)
+
+    def test_invalid(self):
+        with self.assertRaises(ValueError):
+            pycsh.vm_change_only(heartbeat_ms=0)
+        with self.assertRaises(ValueError):
+            pycsh.vm_change_only(capacity=-1)
+
+
+class TestSnifferCache(unittest.TestCase):
+
+    def tearDown(self):
+        pycsh.sniffer_cache(False)
+
+    def test_unknown_series(self):
+        pycsh.sniffer_cache()
+        self.assertIsNone(pycsh.sniffer_latest(4095, 65535, 7))
+        times, values = pycsh.sniffer_history(4095, 65535, 7)
+        self.assertEqual(len(times), 0)
+        self.assertEqual(len(values), 0)
+        self.assertEqual(times.format, 'Q')
+        self.assertNotIn((4095, 65535, 7), pycsh.sniffer_cache_series())
+
+    def test_invalid(self):
+        with self.assertRaises(ValueError):
+            pycsh.sniffer_cache(history=0)
+        with self.assertRaises(ValueError):
+            pycsh.sniffer_cache(max_series=-1)
+        with self.assertRaises(ValueError):
+            pycsh.sniffer_history(1, 1, count=-1)
+
+
+class TestPrometheus(unittest.TestCase):
+
+    def setUp(self):
+        self.port = pycsh.prometheus_start(port=0, address='127.0.0.1')
+
+    def tearDown(self):
+        pycsh.prometheus_stop()
+
+    def get(self, path):
+        return urllib.request.urlopen(f'http://127.0.0.1:{self.port}{path}', timeout=5)
+
+    def test_metrics(self):
+        with self.get('/metrics') as response:
+            self.assertTrue(response.headers['Content-Type'].startswith('text/plain; version=0.0.4'))
+            body = response.read().decode()
+        self.assertIn('# TYPE pycsh_samples_total counter', body)
+        self.assertIn('pycsh_decode_us_bucket{le="+Inf"}', body)
+        self.assertIn('pycsh_decode_us_sum ', body)
+
+    def test_not_found(self):
+        with self.assertRaises(urllib.error.HTTPError) as cm:
+            self.get('/')
+        self.assertEqual(cm.exception.code, 404)
+
+    def test_started_twice(self):
+        with self.assertRaises(RuntimeError):
+            pycsh.prometheus_start(port=0)
+
+
+if __name__ == "__main__":
+    unittest.main()